@@ -19,16 +19,77 @@
 #include<stdio.h>
 #include<stdlib.h>
 #include<string.h>
+#include<inttypes.h>
 #include<unistd.h>
+#include<pthread.h>
+#include<coroutine>
+#include<atomic>
+#include<sched.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<fnmatch.h>
+#include<dirent.h>
+#include<limits.h>
+#include<time.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<sys/epoll.h>
+#if defined(__AVX2__)
+#include<immintrin.h>
+#elif defined(__SSE2__)
+#include<emmintrin.h>
+#endif
+#include<sys/syscall.h>
+#include<linux/mempolicy.h>
 #include<iostream>
-#include<io.h>
 
+#include "CVFSClient.h"
+
+#ifndef MAXINODE
 #define MAXINODE 50
+#endif
 
 #define READ 1
 #define WRITE 2
+#define APPEND 4
+
+// Default total size of an instance's data area (CVFS --data-size)
+#ifndef DATAAREASIZE
+#define DATAAREASIZE (64LL * 1024 * 1024 * 1024)
+#endif
+
+// Every inode owns an equal slot of the data area (see SizeDataArea)
+#define MAXFILESIZE (CurrentVFS->FileSpan)
+
+#define BLOCKSIZE 4096
+#define MAXBLOCKS (MAXFILESIZE / BLOCKSIZE)
+#define DIRTYMAPSIZE ((MAXBLOCKS + 7) / 8)
+
+#define NAMEARENASIZE ((size_t)MAXINODE * 1024 + 16 * 1024 * 1024)
+
+#define HUGEPAGESIZE (2 * 1024 * 1024)
+
+#define ARENA_SMALL 0
+#define ARENA_TRANSPARENT 1
+#define ARENA_EXPLICIT 2
+
+#define RAMINWINDOW (4 * BLOCKSIZE)
+#define RAMAXWINDOW (256 * BLOCKSIZE)
+#define WBUFMAX (16 * 1024 * 1024)
 
-#define MAXFILESIZE 2048
+#define TIERHOTHITS 2
+#define TIERIOSIZE (64 * 1024 * 1024)
+#define TIERCOMPACTMIN (64LL * 1024 * 1024)
+
+#define TX_CREATE 1
+#define TX_WRITE 2
+#define TX_TRUNCATE 3
+#define TX_RM 4
+#define TXMAXFILES 64
+#define TXSPINS 1000
+#define TXJOURNALSIZE (64 * 1024 * 1024)
+
+#define CHANGELOGSIZE 65536
 
 #define REGULAR 1
 #define SPECIAL 2
@@ -36,16 +97,39 @@
 #define START 0
 #define CURRENT 1
 #define END 2
+#define DATA 3
+#define HOLE 4
+
+#define OP_NOP 0
+#define OP_CREATE 1
+#define OP_OPEN 2
+#define OP_READ 3
+#define OP_WRITE 4
+#define OP_LSEEK 5
+#define OP_CLOSE 6
+#define OP_STAT 7
+#define OP_RM 8
+#define OP_COUNT 9
 
 
 /*
  * Structure: superblock
  * ---------------------
- * This structure holds basic information about the file system's inode usage.
+ * This structure holds basic information about the file system's inode and data usage.
  *
  * Fields:
  *  - TotalInodes : Total number of inodes available in the file system.
  *  - FreeInodes  : Number of inodes currently free (not allocated).
+ *  - FreeHint    : Every inode before this index of the inode table is in
+ *                  use; AllocateInode() starts looking here.
+ *  - TotalBytes  : Size of the data area in bytes.
+ *  - FreeBytes   : Bytes of the data area not used by any file. Files use
+ *                  whole blocks and holes use none, see AllocateBlocks().
+ *  - Generation  : Number of changes made so far; the latest change has this
+ *                  generation (see LogChange).
+ *  - DeltaId     : Random identity of the file system, carried by its deltas.
+ *  - SourceId, SourceGen : File system and generation the last delta applied
+ *                  here came from (see ApplyDelta).
  *
  * Typedefs:
  *  - SUPERBLOCK     : Alias for the struct superblock.
@@ -55,6 +139,13 @@ typedef struct superblock
 {
     int TotalInodes;
     int FreeInodes;
+    int FreeHint;
+    long TotalBytes;
+    long FreeBytes;
+    uint64_t Generation;
+    uint64_t DeltaId;
+    uint64_t SourceId;
+    uint64_t SourceGen;
 }SUPERBLOCK, *PSUPERBLOCK;
 
 
@@ -64,19 +155,25 @@ typedef struct superblock
  * Structure: inode
  * ----------------
  * This structure represents a file in the virtual file system.
- * It stores metadata and a pointer to the file's data buffer.
+ * It stores metadata and the location of the file's data buffer.
+ * Inodes hold no pointers: the name is an offset into the name arena, and
+ * the inode number, the next inode and the data slot follow from the
+ * inode's position in the inode table (see InodeNumber), so the table can
+ * be shared between processes that map it at different addresses. Fields
+ * are ordered by size so the structure packs into 32 bytes.
  *
  * Fields:
- *  - FileName       : Name of the file (max 50 characters).
- *  - InodeNumber    : Unique number assigned to each inode.
- *  - FileSize       : Maximum allowed size of the file.
  *  - FileActualSize : Actual size of the data written in the file.
- *  - FileType       : Type of file (e.g., REGULAR or SPECIAL).
- *  - Buffer         : Pointer to the memory where file data is stored.
+ *  - NameOffset     : Offset of the file name in the name arena (see InodeName).
+ *  - NameHash       : Hash of the file name (see NameHash), checked before comparing names.
+ *  - AllocatedBlocks: Blocks that hold data; holes take none (see InodeAllocMap).
+ *  - LeaseCount     : Number of outstanding read views and mappings pinning the buffer,
+ *                     changed atomically (see TakeLease);
+ *                     a deleted file keeps one until it is reclaimed (see RetireObject).
  *  - LinkCount      : Number of references (links) to this inode.
- *  - ReferenceCount : Number of file descriptors currently using this inode.
+ *  - ReferenceCount : Number of open files (file table entries) using this inode.
+ *  - FileType       : Type of file (e.g., REGULAR or SPECIAL), 0 for a free inode.
  *  - Permission     : Permissions assigned to the file (read, write, etc.).
- *  - next           : Pointer to the next inode in the linked list.
  *
  * Typedefs:
  *  - INODE   : Alias for the struct inode.
@@ -85,16 +182,15 @@ typedef struct superblock
  */
 typedef struct inode
 {
-    char FileName[50];
-    int InodeNumber;
-    int FileSize;
-    int FileActualSize;
-    int FileType;
-    char *Buffer;
-    int LinkCount;
-    int ReferenceCount;
-    int Permission;                     
-    struct inode *next;
+    uint64_t FileActualSize;
+    uint32_t NameOffset;
+    uint32_t NameHash;
+    int32_t AllocatedBlocks;
+    int32_t LeaseCount;
+    uint16_t LinkCount;
+    uint16_t ReferenceCount;
+    uint8_t FileType;
+    uint8_t Permission;
 }INODE,*PINODE,**PPINODE;
 
 
@@ -108,8 +204,18 @@ typedef struct inode
  *  - readoffset   : Current position for reading from the file.
  *  - writeoffset  : Current position for writing into the file.
  *  - count        : Number of references to this file table (used for tracking open instances).
- *  - mode         : Access mode (READ, WRITE, or READ + WRITE).
+ *  - mode         : Access mode (READ, WRITE, or READ + WRITE), optionally with APPEND.
  *  - ptrinode     : Pointer to the inode representing the actual file.
+ *  - RaNext       : Offset at which the next read is sequential.
+ *  - RaStart      : Start of the prefetched, not yet read window.
+ *  - RaEnd        : End of the prefetched window.
+ *  - RaWindow     : Current readahead window in bytes.
+ *  - WBuf         : Write-behind buffer, or NULL when writes go straight to the file (see SetWriteBuffer).
+ *  - WBufSize     : Capacity of WBuf in bytes.
+ *  - WBufLen      : Bytes in WBuf that still have to be written at writeoffset.
+ *  - ReadLock     : Held while readoffset and the readahead state change, so
+ *                   threads reading the descriptor without the instance lock
+ *                   (see DoReadFileNoLock) take turns (see LockReads).
  *
  * Typedefs:
  *  - FILETABLE   : Alias for the struct filetable.
@@ -117,11 +223,19 @@ typedef struct inode
  */
 typedef struct filetable
 {
-    int readoffset;
-    int writeoffset;
+    int64_t readoffset;
+    int64_t writeoffset;
     int count;
     int mode;                            
     PINODE ptrinode;
+    int64_t RaNext;
+    int64_t RaStart;
+    int64_t RaEnd;
+    int64_t RaWindow;
+    char *WBuf;
+    uint64_t WBufSize;
+    uint64_t WBufLen;
+    int ReadLock;
 }FILETABLE, *PFILETABLE;
 
 
@@ -145,21 +259,484 @@ typedef struct ufdt
 
 
 
+/*
+ * Structure: nameentry
+ * --------------------
+ * One file of the name index: its inode table index and the offset of its
+ * name in the name arena.
+ */
+typedef struct nameentry
+{
+    int Inode;
+    uint32_t NameOffset;
+}NAMEENTRY;
+
+
+/*
+ * Structure: nameindex
+ * --------------------
+ * The names of all files in lexical order, and the use of the name arena
+ * that stores them (see StoreName). Entries hold indices into the inode
+ * table and the name arena rather than pointers, so the index can live in
+ * a shared memory segment next to the inodes it refers to. Keeping the
+ * name offset in the entry lets a search go straight to the arena without
+ * touching the inodes on its way.
+ *
+ * Fields:
+ *  - Count        : Number of files in the index.
+ *  - Seq          : Odd while the index or the arena is being changed (see IndexBegin).
+ *  - ArenaUsed    : Bytes of the name arena handed out so far.
+ *  - ArenaGarbage : Bytes of ArenaUsed that belong to deleted files.
+ *  - Entries      : Inode table indices and name offsets, sorted by name.
+ *
+ * Typedefs:
+ *  - NAMEINDEX  : Alias for the struct nameindex.
+ *  - PNAMEINDEX : Pointer to a NAMEINDEX structure.
+ */
+typedef struct nameindex
+{
+    int Count;
+    uint64_t Seq;
+    uint64_t ArenaUsed;
+    uint64_t ArenaGarbage;
+    NAMEENTRY Entries[MAXINODE];
+}NAMEINDEX, *PNAMEINDEX;
+
+
+/*
+ * Structure: tierentry
+ * --------------------
+ * Tiering state of one inode (see EnableTiering).
+ *
+ * Fields:
+ *  - Spilled     : Non-zero while the data lives in the spill file instead of RAM.
+ *  - SpillOffset : Offset of the data in the spill file.
+ *  - SpillSize   : Bytes of data stored at SpillOffset.
+ *  - LastAccess  : Value of the tier clock at the last access (recency).
+ *  - Hits        : Accesses since the data was last brought into RAM (frequency).
+ */
+typedef struct tierentry
+{
+    int Spilled;
+    uint64_t SpillOffset;
+    uint64_t SpillSize;
+    uint64_t LastAccess;
+    unsigned Hits;
+}TIERENTRY, *PTIERENTRY;
+
+
+/*
+ * Structure: tierstate
+ * --------------------
+ * Spill file and memory budget of a tiered instance.
+ *
+ * Fields:
+ *  - SpillFd       : Host file holding the data of cold files.
+ *  - Budget        : Bytes of file data allowed to stay in RAM.
+ *  - SpillEnd      : End of the used part of the spill file.
+ *  - SpillLive     : Bytes of the spill file that still hold data.
+ *  - Clock         : Advances by one on every access.
+ *  - Promotions    : Files brought back into RAM.
+ *  - Demotions     : Files moved out to the spill file.
+ *  - ReloadSeconds : Total time spent bringing files back.
+ *  - ReloadMax     : Longest single reload.
+ *  - Entries       : Per-inode state, indexed by InodeNumber - 1.
+ */
+typedef struct tierstate
+{
+    int SpillFd;
+    uint64_t Budget;
+    uint64_t SpillEnd;
+    uint64_t SpillLive;
+    uint64_t Clock;
+    long Promotions;
+    long Demotions;
+    double ReloadSeconds;
+    double ReloadMax;
+    TIERENTRY Entries[MAXINODE];
+}TIERSTATE, *PTIERSTATE;
+
+
+/*
+ * Structure: retired
+ * ------------------
+ * A deleted file or closed file table whose memory may still be reached by
+ * a read in flight (see RetireObject).
+ *
+ * Fields:
+ *  - Epoch        : Global epoch when the object was unlinked.
+ *  - ptrinode     : Inode to free together with its data, or NULL.
+ *  - ptrfiletable : File table to free together with its write buffer, or NULL.
+ *  - next         : Next retired object of the instance.
+ */
+typedef struct retired
+{
+    uint64_t Epoch;
+    PINODE ptrinode;
+    PFILETABLE ptrfiletable;
+    struct retired *next;
+}RETIRED, *PRETIRED;
+
+
+/*
+ * Structure: changerecord
+ * -----------------------
+ * One change in the change log of an instance (see LogChange). The log
+ * keeps the last CHANGELOGSIZE changes, the change of generation g in slot
+ * g % CHANGELOGSIZE.
+ *
+ * Fields:
+ *  - Gen     : Generation of the change; written last, once the rest is in place.
+ *  - Inode   : Inode table index of the changed file.
+ *  - Created : Non-zero if the change made the file.
+ *  - First, Last : Blocks [First, Last) whose data changed, none if equal.
+ */
+typedef struct changerecord
+{
+    uint64_t Gen;
+    int32_t Inode;
+    int32_t Created;
+    int64_t First;
+    int64_t Last;
+}CHANGERECORD, *PCHANGERECORD;
+
+
+/*
+ * Structure: mapping
+ * ------------------
+ * One entry of an instance's mapping table, filled by MapFile().
+ *
+ * Fields:
+ *  - ptrinode : Inode whose buffer is mapped (NULL for a free entry).
+ *  - addr     : Address returned to the caller.
+ *  - offset   : File offset of the first mapped byte.
+ *  - length   : Length of the mapping in bytes.
+ *  - prot     : READ, WRITE or READ + WRITE.
+ */
+typedef struct mapping
+{
+    PINODE ptrinode;
+    char *addr;
+    int64_t offset;
+    uint64_t length;
+    int prot;
+}MAPPING, *PMAPPING;
+
+
+/*
+ * Structure: vfsinstance
+ * ----------------------
+ * The complete state of one file system.
+ *
+ * Fields:
+ *  - UFDTArr       : Array of 50 User File Descriptor Table entries. Each entry stores 
+ *                    a pointer to the filetable of an open file, simulating file descriptors.
+ *
+ *  - Super         : The SUPERBLOCK that maintains metadata about total and available
+ *                    inodes; points at SuperStore, or into a shared memory segment.
+ *
+ *  - head          : Pointer to the head of the linked list of inodes (Disk Inode List Block),
+ *                    used to manage metadata for all files in the system.
+ *
+ *  - InodeTable    : Array of MAXINODE inodes, in list order.
+ *
+ *  - Names         : Ordered index of the file names (see ListFiles); points at
+ *                    NamesStore, or into a shared memory segment.
+ *
+ *  - FileSpan      : Size of every inode's slot of the data area, and so the maximum
+ *                    file size (MAXFILESIZE); 0 until SizeDataArea() runs.
+ *
+ *  - DataBase      : Data area holding MAXFILESIZE bytes for every inode.
+ *
+ *  - DirtyBase     : Dirty block bitmaps, DIRTYMAPSIZE bytes for every inode (see InodeDirtyMap).
+ *
+ *  - AllocBase     : Allocated block bitmaps, DIRTYMAPSIZE bytes for every inode (see InodeAllocMap).
+ *
+ *  - NameBase      : Name arena of NAMEARENASIZE bytes holding the file names (see StoreName).
+ *
+ *  - Versions      : Version of every inode, MAXINODE counters (see VersionBegin).
+ *
+ *  - GenBase       : Block generations, MAXBLOCKS counters for every inode (see InodeBlockGens).
+ *
+ *  - ChangeLog     : The last CHANGELOGSIZE changes (see LogChange).
+ *
+ *  - Journal       : Commit journal of a shared instance (see TxCommit), NULL otherwise.
+ *
+ *  - Lock          : Serialises concurrent users of the instance (see LockVFS); points at
+ *                    LockStore, or at a process-shared mutex in a shared memory segment.
+ *
+ *  - Shared        : Address of the shared memory segment, NULL for a private instance.
+ *
+ *  - Backed        : Non-zero when the data area is a mapping of a host file (see OpenBackingStore).
+ *
+ *  - ArenaPages    : Page size backing a private data area (ARENA_SMALL, ARENA_TRANSPARENT
+ *                    or ARENA_EXPLICIT, see AllocateArena).
+ *
+ *  - ReadaheadHits, ReadaheadWaste : Prefetched bytes that were later read / dropped unread.
+ *
+ *  - Tier          : Spill file and per-file access history, NULL unless tiering is enabled.
+ *
+ *  - Retired       : Unlinked objects waiting for the reads that may use them (see ReclaimRetired).
+ *
+ *  - MapTab        : Mappings made by MapFile(). Kept per process even for a shared instance,
+ *                    since the addresses are only valid in the process that mapped.
+ */
+typedef struct vfsinstance
+{
+    UFDT UFDTArr[50];
+    PSUPERBLOCK Super;
+    SUPERBLOCK SuperStore;
+    PINODE head;
+    PINODE InodeTable;
+    PNAMEINDEX Names;
+    NAMEINDEX NamesStore;
+    int64_t FileSpan;
+    char *DataBase;
+    unsigned char *DirtyBase;
+    unsigned char *AllocBase;
+    char *NameBase;
+    uint64_t *Versions;
+    uint64_t *GenBase;
+    PCHANGERECORD ChangeLog;
+    char *Journal;
+    pthread_mutex_t *Lock;
+    pthread_mutex_t LockStore;
+    void *Shared;
+    size_t SharedSize;
+    int Backed;
+    int ArenaPages;
+    long ReadaheadHits;
+    long ReadaheadWaste;
+    PTIERSTATE Tier;
+    PRETIRED Retired;
+    MAPPING MapTab[50];
+}VFSINSTANCE, *PVFSINSTANCE;
+
+
 /*
  * Global Variables:
  * -----------------
- * UFDTArr         : Array of 50 User File Descriptor Table entries. Each entry stores 
- *                   a pointer to the filetable of an open file, simulating file descriptors.
+ * DefaultVFS      : The file system used by the shell, the ring and the coroutine front-end.
+ *
+ * CurrentVFS      : Per-thread pointer to the instance the VFS functions operate on.
+ *                   Shard threads point it at their own instance (see InitialiseShards).
+ *
+ * UseHugePages    : Non-zero to back private data areas with 2 MB pages (CVFS --hugepages).
+ *
+ * UseReadahead    : Zero to turn off readahead on backed instances (CVFS --no-readahead).
+ *
+ * DataAreaSize    : Total data area of a new instance, shared equally by the MAXINODE
+ *                   files (CVFS --data-size). Sharded mode divides it over the shards.
+ *
+ * UFDTArr, SUPERBLOCKobj, head and MapTab name the state of the current instance.
+ */
+VFSINSTANCE DefaultVFS;
+thread_local PVFSINSTANCE CurrentVFS = &DefaultVFS;
+int UseHugePages = 0;
+int UseReadahead = 1;
+int64_t DataAreaSize = DATAAREASIZE;
+
+#define UFDTArr (CurrentVFS->UFDTArr)
+#define SUPERBLOCKobj (*CurrentVFS->Super)
+#define head (CurrentVFS->head)
+#define MapTab (CurrentVFS->MapTab)
+
+
+/*
+ * Function: InodeNumber
+ * ---------------------
+ * @return The number of an inode, its position in the inode table plus one.
+ */
+int InodeNumber(PINODE inode)
+{
+    return (int)(inode - CurrentVFS->InodeTable) + 1;
+}
+
+
+/*
+ * Function: NextInode
+ * -------------------
+ * @return The inode following `inode` in the inode list, or NULL.
+ */
+PINODE NextInode(PINODE inode)
+{
+    if (InodeNumber(inode) >= MAXINODE)
+        return NULL;
+    return inode + 1;
+}
+
+
+/*
+ * Function: InodeData
+ * -------------------
+ * @return Address of the first byte of the inode's data buffer, its fixed
+ *         MAXFILESIZE slot in the data area (committed lazily).
+ */
+char *InodeData(PINODE inode)
+{
+    return CurrentVFS->DataBase + (size_t)(InodeNumber(inode) - 1) * MAXFILESIZE;
+}
+
+
+/*
+ * Function: InodeName
+ * -------------------
+ * @return The NUL-terminated name of a file, in the name arena.
+ */
+const char *InodeName(PINODE inode)
+{
+    return CurrentVFS->NameBase + inode->NameOffset + sizeof(uint32_t);
+}
+
+
+/*
+ * Function: NameHash
+ * ------------------
+ * @return The 32-bit FNV-1a hash of a name.
+ */
+uint32_t NameHash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*name != '\0')
+    {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+
+/*
+ * Function: NameEntrySize
+ * -----------------------
+ * @return Bytes an arena entry for a name of `length` bytes takes: the
+ *         32-bit length prefix, the name and its NUL, rounded up to 4 so
+ *         every prefix is aligned.
+ */
+uint64_t NameEntrySize(uint64_t length)
+{
+    return (sizeof(uint32_t) + length + 1 + 3) & ~(uint64_t)3;
+}
+
+
+/*
+ * Function: InodeDirtyMap
+ * -----------------------
+ * The dirty bitmap of an inode: one bit per BLOCKSIZE block modified since
+ * it was last cleaned. It lives outside the inode because it is large for
+ * big files; like the data, its pages are only committed when first used.
+ *
+ * @return Address of the first byte of the inode's bitmap.
+ */
+unsigned char *InodeDirtyMap(PINODE inode)
+{
+    return CurrentVFS->DirtyBase + (size_t)(InodeNumber(inode) - 1) * DIRTYMAPSIZE;
+}
+
+
+/*
+ * Function: InodeAllocMap
+ * -----------------------
+ * The allocation bitmap of an inode: one bit per BLOCKSIZE block that holds
+ * data. Blocks without their bit are holes; they read as zero and take no
+ * memory. Laid out like the dirty bitmap.
+ *
+ * @return Address of the first byte of the inode's bitmap.
+ */
+unsigned char *InodeAllocMap(PINODE inode)
+{
+    return CurrentVFS->AllocBase + (size_t)(InodeNumber(inode) - 1) * DIRTYMAPSIZE;
+}
+
+
+/*
+ * Function: InodeVersion
+ * ----------------------
+ * The version of an inode. It is even while the file is stable and odd
+ * while it is being changed, and grows with every change of the file's
+ * data, size or existence, so a reader that finds the same even version
+ * before and after copying data saw no change (a sequence lock). Versions
+ * are never reset: a slot reused for a new file keeps counting.
  *
- * SUPERBLOCKobj   : An instance of the SUPERBLOCK structure that maintains metadata about 
- *                   total and available inodes in the virtual file system.
+ * @return Address of the inode's version counter.
+ */
+uint64_t *InodeVersion(PINODE inode)
+{
+    return &CurrentVFS->Versions[InodeNumber(inode) - 1];
+}
+
+
+/*
+ * Function: InodeBlockGens
+ * ------------------------
+ * The generations of an inode's blocks: for every block, the generation of
+ * the latest change of its data (see LogChange), 0 if it never changed.
  *
- * head            : Pointer to the head of the linked list of inodes (Disk Inode List Block),
- *                   used to manage metadata for all files in the system.
+ * @return The first of the inode's MAXBLOCKS block generations.
+ */
+uint64_t *InodeBlockGens(PINODE inode)
+{
+    return CurrentVFS->GenBase + (size_t)(InodeNumber(inode) - 1) * MAXBLOCKS;
+}
+
+
+/*
+ * Function: VersionBegin
+ * ----------------------
+ * Makes an inode's version odd before it is changed. Nothing happens if it
+ * is odd already, so a change may be made of smaller ones. Writers hold
+ * the instance lock.
+ */
+void VersionBegin(PINODE inode)
+{
+    uint64_t *version = InodeVersion(inode);
+    uint64_t v = __atomic_load_n(version, __ATOMIC_RELAXED);
+
+    if ((v & 1) == 0)
+        __atomic_store_n(version, v + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);  // Odd before any change is seen
+}
+
+
+/*
+ * Function: VersionEnd
+ * --------------------
+ * Moves an inode's version to the next even value once it has been changed.
+ */
+void VersionEnd(PINODE inode)
+{
+    uint64_t *version = InodeVersion(inode);
+
+    __atomic_store_n(version, (__atomic_load_n(version, __ATOMIC_RELAXED) | 1) + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Leases
+ * ------
+ * LeaseCount is only changed atomically, with TakeLease() and DropLease().
+ * Leases are taken under the instance lock, but a read view is released
+ * whenever its holder is done with it, lock or not (see ReleaseView), and
+ * a plain ++ or -- racing with it would lose a count: the file would stay
+ * pinned for good, or its data would be freed under a live view.
  */
-UFDT UFDTArr[50];
-SUPERBLOCK SUPERBLOCKobj;
-PINODE head = NULL;
+void TakeLease(PINODE inode)
+{
+    __atomic_add_fetch(&inode->LeaseCount, 1, __ATOMIC_ACQ_REL);
+}
+
+void DropLease(PINODE inode)
+{
+    __atomic_sub_fetch(&inode->LeaseCount, 1, __ATOMIC_ACQ_REL);
+}
+
+// Non-zero while a view, a mapping or a pending reclamation pins the inode
+int Leased(PINODE inode)
+{
+    return __atomic_load_n(&inode->LeaseCount, __ATOMIC_ACQUIRE) > 0;
+}
 
 
 
@@ -198,8 +775,10 @@ void man(char *name)
     }
     else if(strcmp(name, "ls") == 0) 
     {
-        printf("Description : Used to list all information of file\n");
-        printf("Usage : ls\n"); 
+        printf("Description : Used to list all information of file in name order\n");
+        printf("Usage : ls [Pattern] [--limit Count] [--after File_name]\n");
+        printf(" Pattern : glob with * ? [...], or a name prefix\n");
+        printf(" --after : continue listing after the last name of a previous page\n");
     }
     else if(strcmp(name, "stat") == 0)
     {
@@ -213,13 +792,13 @@ void man(char *name)
     }
     else if(strcmp(name, "truncate") == 0)
     {
-        printf("Description : Used to remove data from file\n");
-        printf("Usage : truncate File_name\n");
+        printf("Description : Used to change the size of a file, removing or adding zeroed data\n");
+        printf("Usage : truncate File_name [Size]\n Without Size all data is removed\n");
     }
     else if(strcmp(name, "open") == 0)
     {
         printf("Description : Used to open an existing file\n");
-        printf("Usage : open File_name\n");
+        printf("Usage : open File_name Mode\n Mode : 1 = Read, 2 = Write, 3 = Read & Write, add 4 to append\n");
     }
     else if(strcmp(name, "close") == 0)
     {
@@ -235,6 +814,72 @@ void man(char *name)
     {
         printf("Description : Used to change file offset\n");
         printf("Usage : lseek File_Name ChangeInOffset StartPoint\n");
+        printf(" StartPoint : 0 = Start, 1 = Current, 2 = End, 3 = Next data, 4 = Next hole\n");
+    }
+    else if(strcmp(name, "dup") == 0)
+    {
+        printf("Description : Used to give an open file another file descriptor sharing its offsets\n");
+        printf("Usage : dup File_Descriptor [New_File_Descriptor]\n An open New_File_Descriptor is closed first\n");
+    }
+    else if(strcmp(name, "wbuf") == 0)
+    {
+        printf("Description : Used to collect small writes of an open file in a buffer\n");
+        printf("Usage : wbuf File_Name Size\n Size 0 writes straight to the file again\n");
+    }
+    else if(strcmp(name, "flush") == 0)
+    {
+        printf("Description : Used to write the buffered writes of an open file\n");
+        printf("Usage : flush File_Name\n");
+    }
+    else if(strcmp(name, "punch") == 0)
+    {
+        printf("Description : Used to deallocate a range of an open file, which then reads as zeros\n");
+        printf("Usage : punch File_Name Offset Length\n The file size does not change\n");
+    }
+    else if(strcmp(name, "grep") == 0)
+    {
+        printf("Description : Used to search the data of all files for a string\n");
+        printf("Usage : grep Pattern [Threads]\n Prints each matching file with its match count and first offsets\n");
+    }
+    else if(strcmp(name, "import") == 0)
+    {
+        printf("Description : Used to copy all files of a host directory into the file system\n");
+        printf("Usage : import Host_Directory [Threads]\n Existing files are left as they are\n");
+    }
+    else if(strcmp(name, "export") == 0)
+    {
+        printf("Description : Used to copy all files of the file system into a host directory\n");
+        printf("Usage : export Host_Directory [Threads]\n The directory is created if needed\n");
+    }
+    else if(strcmp(name, "export-delta") == 0)
+    {
+        printf("Description : Used to write the changes since a generation to a host file or pipe for a standby\n");
+        printf("Usage : export-delta Since_Generation Host_File\n Since_Generation is the To of the last delta applied, 0 for all files\n");
+    }
+    else if(strcmp(name, "apply-delta") == 0)
+    {
+        printf("Description : Used to make the changes of a delta written by export-delta on this file system\n");
+        printf("Usage : apply-delta Host_File\n Deltas are applied in order, starting with a full one\n");
+    }
+    else if(strcmp(name, "df") == 0)
+    {
+        printf("Description : Used to display inode and data usage of the file system\n");
+        printf("Usage : df\n");
+    }
+    else if(strcmp(name, "rastat") == 0)
+    {
+        printf("Description : Used to display readahead counters of a backed file system\n");
+        printf("Usage : rastat\n");
+    }
+    else if(strcmp(name, "tierstat") == 0)
+    {
+        printf("Description : Used to display memory budget, spill file and promotion counters\n");
+        printf("Usage : tierstat\n Tiering is enabled with CVFS --spill Spill_File Budget_MB\n");
+    }
+    else if(strcmp(name, "trace") == 0)
+    {
+        printf("Description : Used to record every file operation into a host file\n");
+        printf("Usage : trace start Trace_File\n        trace stop\n Replay with CVFS --replay Trace_File [--timed]\n");
     }
     else if(strcmp(name, "rm") == 0)
     {
@@ -260,7 +905,7 @@ void man(char *name)
 
 void DisplayHelp()
 {
-    printf("ls : To List out all files\n");
+    printf("ls : To List out files in name order, with filters and paging\n");
     printf("clear : To clear console\n");
     printf("open : To open the file\n");
     printf("close : To close the file\n");
@@ -270,8 +915,21 @@ void DisplayHelp()
     printf("exit : To terminate file system\n");
     printf("stat : To display information of file using name\n");
     printf("fstat : To display information of file using file descriptor\n");
-    printf("truncate : To remove all data from file\n");
+    printf("truncate : To change the size of a file\n");
+    printf("punch : To turn a range of a file into a hole\n");
+    printf("dup : To duplicate a file descriptor\n");
+    printf("wbuf : To buffer small writes of a file\n");
+    printf("flush : To write buffered data of a file\n");
+    printf("df : To display inode and data usage\n");
+    printf("grep : To search the data of all files for a string\n");
+    printf("import : To copy files from a host directory\n");
+    printf("export : To copy files to a host directory\n");
+    printf("export-delta : To write the changes since a generation for a standby\n");
+    printf("apply-delta : To apply changes written by export-delta\n");
     printf("rm : To delete the file\n");
+    printf("rastat : To display readahead hit and waste counters\n");
+    printf("tierstat : To display tiered storage counters\n");
+    printf("trace : To record file operations for replay\n");
 }
 
 
@@ -288,12 +946,13 @@ void DisplayHelp()
  */
 int GetFDFromName(char *name)
 {
+    uint32_t hash = NameHash(name);
     int i = 0;
 
     while(i < 50)
     {
-        if(UFDTArr[i].ptrfiletable != NULL)
-            if(strcmp((UFDTArr[i].ptrfiletable->ptrinode->FileName), name) == 0)
+        if(UFDTArr[i].ptrfiletable != NULL && UFDTArr[i].ptrfiletable->ptrinode->NameHash == hash)
+            if(strcmp(InodeName(UFDTArr[i].ptrfiletable->ptrinode), name) == 0)
                 break;
         i++;
     }
@@ -305,803 +964,8371 @@ int GetFDFromName(char *name)
 
 
 /*
- * Function: Get_Inode
- * -------------------
- * Searches the linked list of inodes to find a file with the given name.
- *
- * @param name - The name of the file to look for.
- *
- * @return - Pointer to the inode (PINODE) if the file is found,
- *           or NULL if the file does not exist or if the input name is NULL.
+ * Function: IndexedInode
+ * ----------------------
+ * @return The inode at position `pos` of the name index.
  */
-PINODE Get_Inode(char *name)
+PINODE IndexedInode(int pos)
 {
-    PINODE temp = head;
-    int i = 0;
-
-    if (name == NULL)
-        return NULL;  // Return NULL if the name is NULL
-
-    while(temp != NULL)
-    {
-        if(strcmp(name, temp->FileName) == 0)  // Fix incorrect arrow usage
-            break;
-        temp = temp->next;
-    }
-
-    return temp;  // Return the found inode or NULL if not found
+    return &CurrentVFS->InodeTable[CurrentVFS->Names->Entries[pos].Inode];
 }
 
+
+/*
+ * Function: IndexedName
+ * ---------------------
+ * @return The name at position `pos` of the name index.
+ */
+const char *IndexedName(int pos)
+{
+    return CurrentVFS->NameBase + CurrentVFS->Names->Entries[pos].NameOffset + sizeof(uint32_t);
+}
+
+
+/*
+ * Function: NameLowerBound
+ * ------------------------
+ * Binary search over the name index.
+ *
+ * @return Position of the first name that is not less than `name`.
+ */
+int NameLowerBound(const char *name)
+{
+    int low = 0, high = CurrentVFS->Names->Count, mid = 0;
+
+    while (low < high)
+    {
+        mid = (low + high) / 2;
+        if (strcmp(IndexedName(mid), name) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+
+/*
+ * Function: PrefixLowerBound
+ * --------------------------
+ * Binary search over the name index for the first `length` bytes of
+ * `prefix`, which need not be terminated there.
+ *
+ * @return Position of the first name that is not less than the prefix.
+ */
+int PrefixLowerBound(const char *prefix, size_t length)
+{
+    int low = 0, high = CurrentVFS->Names->Count, mid = 0;
+
+    while (low < high)
+    {
+        mid = (low + high) / 2;
+        if (strncmp(IndexedName(mid), prefix, length) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+
+/*
+ * Function: IndexBegin
+ * --------------------
+ * Makes the index sequence odd before the name index or the name arena is
+ * changed, so lookups without the lock (see LookupNoLock) retry. Changes
+ * may nest; only the outermost one moves the sequence.
+ *
+ * @return Value to pass to IndexEnd().
+ */
+int IndexBegin()
+{
+    PNAMEINDEX names = CurrentVFS->Names;
+    uint64_t seq = __atomic_load_n(&names->Seq, __ATOMIC_RELAXED);
+
+    if (seq & 1)
+        return 0;  // Inside a larger change
+
+    __atomic_store_n(&names->Seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return 1;
+}
+
+
+/*
+ * Function: IndexEnd
+ * ------------------
+ * Ends a change started with IndexBegin().
+ */
+void IndexEnd(int began)
+{
+    PNAMEINDEX names = CurrentVFS->Names;
+
+    if (began)
+        __atomic_store_n(&names->Seq, __atomic_load_n(&names->Seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Function: IndexInsert
+ * ---------------------
+ * Adds a newly named inode to the name index.
+ */
+void IndexInsert(PINODE inode)
+{
+    PNAMEINDEX names = CurrentVFS->Names;
+    int pos = NameLowerBound(InodeName(inode));
+    int began = IndexBegin();
+
+    memmove(&names->Entries[pos + 1], &names->Entries[pos], (names->Count - pos) * sizeof(NAMEENTRY));
+    names->Entries[pos].Inode = (int)(inode - CurrentVFS->InodeTable);
+    names->Entries[pos].NameOffset = inode->NameOffset;
+    names->Count++;
+    IndexEnd(began);
+}
+
+
+/*
+ * Function: IndexRemove
+ * ---------------------
+ * Removes a deleted inode from the name index.
+ */
+void IndexRemove(PINODE inode)
+{
+    PNAMEINDEX names = CurrentVFS->Names;
+    int pos = NameLowerBound(InodeName(inode));
+    int began = 0;
+
+    if (pos == names->Count || IndexedInode(pos) != inode)
+        return;
+
+    began = IndexBegin();
+    memmove(&names->Entries[pos], &names->Entries[pos + 1], (names->Count - pos - 1) * sizeof(NAMEENTRY));
+    names->Count--;
+    IndexEnd(began);
+}
+
+
+/*
+ * Function: RebuildNameIndex
+ * --------------------------
+ * Recreates the name index from the inode table.
+ */
+void RebuildNameIndex()
+{
+    PINODE temp = head;
+    int began = IndexBegin();
+
+    CurrentVFS->Names->Count = 0;
+    while (temp != NULL)
+    {
+        if (temp->FileType != 0)
+            IndexInsert(temp);
+        temp = NextInode(temp);
+    }
+    IndexEnd(began);
+}
+
+
+/*
+ * Function: Get_Inode
+ * -------------------
+ * Looks up a file by name in the name index.
+ *
+ * @param name - The name of the file to look for.
+ *
+ * @return - Pointer to the inode (PINODE) if the file is found,
+ *           or NULL if the file does not exist or if the input name is NULL.
+ */
+PINODE Get_Inode(char *name)
+{
+    int pos = 0;
+
+    if (name == NULL)
+        return NULL;  // Return NULL if the name is NULL
+
+    pos = NameLowerBound(name);
+    if (pos == CurrentVFS->Names->Count || strcmp(IndexedName(pos), name) != 0)
+        return NULL;  // Not found
+
+    return IndexedInode(pos);
+}
+
+/*
+ * Function: LogChange
+ * -------------------
+ * Gives a change of a file the next generation, stamps blocks [first, last)
+ * of the file with it and records it in the change log, so ExportDelta()
+ * finds the changes since a generation without scanning the file system.
+ * Safe without the lock: a block keeps the highest generation stamped on it.
+ *
+ * @param inode   - The changed file.
+ * @param created - Non-zero if the change made the file.
+ * @param first   - First block whose data changed.
+ * @param last    - Block past the last one whose data changed, `first` if none did.
+ */
+void LogChange(PINODE inode, int created, int64_t first, int64_t last)
+{
+    uint64_t gen = __atomic_add_fetch(&SUPERBLOCKobj.Generation, 1, __ATOMIC_RELAXED);
+    PCHANGERECORD rec = &CurrentVFS->ChangeLog[gen % CHANGELOGSIZE];
+    uint64_t *gens = InodeBlockGens(inode);
+    uint64_t old = 0;
+    int64_t block = first;
+
+    while (block < last && block < MAXBLOCKS)
+    {
+        old = __atomic_load_n(&gens[block], __ATOMIC_RELAXED);
+        while (old < gen &&
+               !__atomic_compare_exchange_n(&gens[block], &old, gen, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+        block++;
+    }
+
+    rec->Inode = InodeNumber(inode) - 1;
+    rec->Created = created;
+    rec->First = first;
+    rec->Last = last;
+    __atomic_store_n(&rec->Gen, gen, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Function: MarkBlocksDirty
+ * -------------------------
+ * Sets the dirty bit of every block overlapping [offset, offset + length).
+ * Persistence or checksum layers consume the bits with TestAndCleanBlock().
+ * The change is logged with a new generation (see LogChange).
+ */
+void MarkBlocksDirty(PINODE inode, int64_t offset, uint64_t length)
+{
+    unsigned char *map = NULL;
+    int64_t block = 0, last = 0;
+
+    if (inode == NULL || length == 0)
+        return;
+
+    map = InodeDirtyMap(inode);
+    block = offset / BLOCKSIZE;
+    last = (int64_t)((offset + length - 1) / BLOCKSIZE);
+
+    while (block <= last && block < MAXBLOCKS)
+    {
+        __atomic_fetch_or(&map[block / 8], (unsigned char)(1 << (block % 8)), __ATOMIC_RELAXED);
+        block++;
+    }
+
+    LogChange(inode, 0, offset / BLOCKSIZE, last + 1);
+}
+
+
+/*
+ * Function: TestAndCleanBlock
+ * ---------------------------
+ * Clears the dirty bit of one block.
+ *
+ * @return 1 if the block was dirty, 0 otherwise.
+ */
+int TestAndCleanBlock(PINODE inode, int64_t block)
+{
+    unsigned char *map = NULL;
+    unsigned char bit = 0;
+
+    if (inode == NULL || block < 0 || block >= MAXBLOCKS)
+        return 0;
+
+    map = InodeDirtyMap(inode);
+    bit = (unsigned char)(1 << (block % 8));
+    if ((map[block / 8] & bit) == 0)
+        return 0;
+
+    map[block / 8] &= (unsigned char)~bit;
+    return 1;
+}
+
+
+/*
+ * Function: BlocksOf
+ * ------------------
+ * @return Number of blocks needed to hold `size` bytes.
+ */
+int64_t BlocksOf(uint64_t size)
+{
+    return (size + BLOCKSIZE - 1) / BLOCKSIZE;
+}
+
+
+/*
+ * Function: SetBlocks
+ * -------------------
+ * Sets the bits of every block overlapping [offset, offset + length) in an
+ * allocation bitmap. Bits are set atomically, so writers of the same file
+ * that do not hold the lock never lose each other's blocks.
+ *
+ * @return Number of bits that were clear.
+ */
+int64_t SetBlocks(unsigned char *map, int64_t offset, uint64_t length)
+{
+    unsigned char bit = 0;
+    int64_t block = 0, last = 0, added = 0;
+
+    if (length == 0)
+        return 0;
+
+    block = offset / BLOCKSIZE;
+    last = (int64_t)((offset + length - 1) / BLOCKSIZE);
+
+    while (block <= last && block < MAXBLOCKS)
+    {
+        bit = (unsigned char)(1 << (block % 8));
+        // Rewrites of existing data only read the bitmap
+        if ((map[block / 8] & bit) == 0 && (__atomic_fetch_or(&map[block / 8], bit, __ATOMIC_RELAXED) & bit) == 0)
+            added++;
+        block++;
+    }
+
+    return added;
+}
+
+
+/*
+ * Function: AllocateBlocks
+ * ------------------------
+ * Records that every block overlapping [offset, offset + length) holds data
+ * and charges the superblock for the blocks that were holes. May be called
+ * without the lock by appenders that reserved their range with a
+ * compare-and-swap, so the counters are updated atomically too.
+ */
+void AllocateBlocks(PINODE inode, int64_t offset, uint64_t length)
+{
+    int64_t added = 0;
+
+    if (inode == NULL)
+        return;
+
+    added = SetBlocks(InodeAllocMap(inode), offset, length);
+    if (added > 0)
+    {
+        __atomic_fetch_add(&inode->AllocatedBlocks, added, __ATOMIC_RELAXED);
+        __atomic_fetch_sub(&SUPERBLOCKobj.FreeBytes, (long)added * BLOCKSIZE, __ATOMIC_RELAXED);
+    }
+}
+
+
+/*
+ * Function: DiscardRange
+ * ----------------------
+ * Returns the memory behind [addr, addr + length) to the host; the range
+ * reads back as zero afterwards. Private memory is simply dropped, memory
+ * that is `shared` with a file or segment is punched out of its object.
+ */
+void DiscardRange(void *addr, size_t length, int shared)
+{
+    if (madvise(addr, length, shared ? MADV_REMOVE : MADV_DONTNEED) != 0)
+        memset(addr, 0, length);  // Not page aligned, or no hole support
+}
+
+
+/*
+ * Function: CompactNames
+ * ----------------------
+ * Moves the names of all live files to the front of the name arena, in
+ * inode order, dropping the entries of deleted files.
+ *
+ * @return 0 on success, -1 if no memory was available to do it.
+ */
+int CompactNames()
+{
+    PNAMEINDEX names = CurrentVFS->Names;
+    PINODE temp = head;
+    char *copy = NULL;
+    uint64_t used = 0, size = 0, page = 0;
+    int i = 0, began = 0;
+
+    copy = (char *)malloc(names->ArenaUsed - names->ArenaGarbage + 1);
+    if (copy == NULL)
+        return -1;
+
+    began = IndexBegin();
+
+    while (temp != NULL)
+    {
+        if (temp->FileType != 0)
+        {
+            size = NameEntrySize(*(uint32_t *)(CurrentVFS->NameBase + temp->NameOffset));
+            memcpy(copy + used, CurrentVFS->NameBase + temp->NameOffset, size);
+            temp->NameOffset = (uint32_t)used;
+            used += size;
+        }
+        temp = NextInode(temp);
+    }
+
+    memcpy(CurrentVFS->NameBase, copy, used);
+    free(copy);
+
+    while (i < names->Count)
+    {
+        names->Entries[i].NameOffset = CurrentVFS->InodeTable[names->Entries[i].Inode].NameOffset;
+        i++;
+    }
+
+    // The whole pages past the live names are free again
+    page = (used + 4095) & ~(uint64_t)4095;
+    if (page < names->ArenaUsed)
+        DiscardRange(CurrentVFS->NameBase + page, names->ArenaUsed - page, CurrentVFS->Shared != NULL);
+    names->ArenaUsed = used;
+    names->ArenaGarbage = 0;
+    IndexEnd(began);
+
+    return 0;
+}
+
+
+/*
+ * Function: StoreName
+ * -------------------
+ * Appends a name to the name arena as a length-prefixed, NUL-terminated
+ * entry and points the inode at it. The arena is append-only: names of
+ * deleted files are garbage (see DropName) until the arena fills up and is
+ * compacted.
+ *
+ * @return 0 on success, -1 if the arena has no room for the name.
+ */
+int StoreName(PINODE inode, const char *name)
+{
+    PNAMEINDEX names = CurrentVFS->Names;
+    uint64_t length = strlen(name), size = NameEntrySize(length);
+    char *entry = NULL;
+
+    if (size > NAMEARENASIZE - names->ArenaUsed)
+    {
+        if (size > NAMEARENASIZE - (names->ArenaUsed - names->ArenaGarbage) || CompactNames() != 0)
+            return -1;
+    }
+
+    entry = CurrentVFS->NameBase + names->ArenaUsed;
+    *(uint32_t *)entry = (uint32_t)length;
+    memcpy(entry + sizeof(uint32_t), name, length + 1);
+
+    inode->NameOffset = (uint32_t)names->ArenaUsed;
+    inode->NameHash = NameHash(name);
+    names->ArenaUsed += size;
+
+    return 0;
+}
+
+
+/*
+ * Function: DropName
+ * ------------------
+ * Marks the arena entry of a deleted file's name as garbage.
+ */
+void DropName(PINODE inode)
+{
+    CurrentVFS->Names->ArenaGarbage += NameEntrySize(*(uint32_t *)(CurrentVFS->NameBase + inode->NameOffset));
+}
+
+
+/*
+ * Function: ReleaseBlocks
+ * -----------------------
+ * Returns the memory behind blocks [first, last) of an inode to the host.
+ * The blocks read back as zero afterwards. The cost is one system call and
+ * the pages actually released; the rest of the file is not touched.
+ */
+void ReleaseBlocks(PINODE inode, int64_t first, int64_t last)
+{
+    if (first >= last)
+        return;
+
+    DiscardRange(InodeData(inode) + first * BLOCKSIZE, (size_t)(last - first) * BLOCKSIZE,
+                 CurrentVFS->Shared != NULL || CurrentVFS->Backed);
+}
+
+
+/*
+ * Function: FreeBlocks
+ * --------------------
+ * Turns blocks [first, last) of an inode into holes: their memory goes back
+ * to the host (see ReleaseBlocks) and the superblock is credited for every
+ * block that held data.
+ */
+void FreeBlocks(PINODE inode, int64_t first, int64_t last)
+{
+    unsigned char *map = NULL;
+    unsigned char bit = 0;
+    int64_t block = first, removed = 0;
+
+    if (first >= last)
+        return;
+
+    map = InodeAllocMap(inode);
+    while (block < last)
+    {
+        if (block % 8 == 0 && block + 8 <= last && map[block / 8] == 0)
+        {
+            block += 8;  // Eight holes at once
+            continue;
+        }
+
+        bit = (unsigned char)(1 << (block % 8));
+        if (map[block / 8] & bit)
+        {
+            map[block / 8] &= (unsigned char)~bit;
+            removed++;
+        }
+        block++;
+    }
+
+    ReleaseBlocks(inode, first, last);
+
+    inode->AllocatedBlocks -= removed;
+    SUPERBLOCKobj.FreeBytes += (long)removed * BLOCKSIZE;
+}
+
+
+/*
+ * Function: FindBlock
+ * -------------------
+ * Looks for the first block in [first, last) whose bit in `map` is `set`
+ * (1: a block with data, 0: a hole).
+ *
+ * @return The block number, or `last` if there is none.
+ */
+int64_t FindBlock(const unsigned char *map, int64_t first, int64_t last, int set)
+{
+    int64_t block = first;
+    unsigned char skip = set ? 0x00 : 0xFF;
+
+    while (block < last)
+    {
+        if (block % 8 == 0 && block + 8 <= last && map[block / 8] == skip)
+        {
+            block += 8;
+            continue;
+        }
+        if (((map[block / 8] >> (block % 8)) & 1) == (set ? 1 : 0))
+            return block;
+        block++;
+    }
+
+    return last;
+}
+
+
+
+/*
+ * Tiered Storage
+ * --------------
+ * With tiering enabled (EnableTiering) only a budget of file data stays in
+ * RAM. When an access pushes the resident data over the budget, the data of
+ * the coldest files is written to a host spill file and released from the
+ * data area. The next ReadFile, WriteFile, ReadView or MapFile on such a file
+ * reads it back first. Inodes never leave the inode table, so stat and ls do
+ * not touch the spill file.
+ *
+ * Files that were accessed fewer than TIERHOTHITS times since they were last
+ * brought in are evicted first, least recently used first; hot files only go
+ * when no cold file is left. Pinned files (views, mappings) are never evicted.
+ * Freed spill space is punched out of the spill file, and the file is
+ * compacted once less than half of it holds data.
+ *
+ * Tiering moves file data around, so all accesses must hold the instance lock.
+ */
+
+/*
+ * Function: TierEntry
+ * -------------------
+ * @return The tiering state of an inode.
+ */
+PTIERENTRY TierEntry(PINODE inode)
+{
+    return &CurrentVFS->Tier->Entries[InodeNumber(inode) - 1];
+}
+
+
+/*
+ * Function: SpillIO
+ * -----------------
+ * Moves `length` bytes between `buf` and the spill file at `offset`.
+ *
+ * @return 0 on success, -1 on an I/O error.
+ */
+int SpillIO(int write, char *buf, uint64_t length, uint64_t offset)
+{
+    uint64_t done = 0, want = 0;
+    ssize_t n = 0;
+
+    while (done < length)
+    {
+        want = length - done;
+        if (want > TIERIOSIZE)
+            want = TIERIOSIZE;
+
+        if (write)
+            n = pwrite(CurrentVFS->Tier->SpillFd, buf + done, want, (off_t)(offset + done));
+        else
+            n = pread(CurrentVFS->Tier->SpillFd, buf + done, want, (off_t)(offset + done));
+
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        done += (uint64_t)n;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Function: SpillRuns
+ * -------------------
+ * Moves the blocks of a file that hold data (see InodeAllocMap) between the
+ * data area and the spill region starting at `offset`, in the direction of
+ * SpillIO(). Only the first `size` bytes of the file are considered.
+ *
+ * @return 0 on success, -1 on an I/O error.
+ */
+int SpillRuns(PINODE inode, int write, uint64_t size, uint64_t offset)
+{
+    unsigned char *map = InodeAllocMap(inode);
+    int64_t blocks = BlocksOf(size), first = 0, last = 0;
+    uint64_t start = 0, end = 0;
+
+    while (first < blocks)
+    {
+        first = FindBlock(map, first, blocks, 1);
+        if (first >= blocks)
+            break;
+        last = FindBlock(map, first, blocks, 0);
+
+        start = (uint64_t)first * BLOCKSIZE;
+        end = (uint64_t)last * BLOCKSIZE;
+        if (end > size)
+            end = size;
+        if (SpillIO(write, InodeData(inode) + start, end - start, offset + start) != 0)
+            return -1;
+
+        first = last;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Function: CompactSpill
+ * ----------------------
+ * Moves the spilled data to the front of the spill file, in offset order,
+ * and cuts the file after it.
+ */
+void CompactSpill()
+{
+    PTIERSTATE tier = CurrentVFS->Tier;
+    PTIERENTRY entry = NULL, next = NULL;
+    char *buf = NULL;
+    uint64_t end = 0, done = 0, want = 0;
+    int i = 0;
+
+    buf = (char *)malloc(TIERIOSIZE);
+    if (buf == NULL)
+        return;
+
+    while (1)
+    {
+        // Lowest spilled region that has not been moved yet
+        next = NULL;
+        for (i = 0; i < MAXINODE; i++)
+        {
+            entry = &tier->Entries[i];
+            if (entry->Spilled && entry->SpillOffset >= end && (next == NULL || entry->SpillOffset < next->SpillOffset))
+                next = entry;
+        }
+        if (next == NULL)
+            break;
+
+        // Regions never overlap, so copying front to back is safe
+        for (done = 0; done < next->SpillSize && next->SpillOffset != end; done += want)
+        {
+            want = next->SpillSize - done;
+            if (want > TIERIOSIZE)
+                want = TIERIOSIZE;
+            if (SpillIO(0, buf, want, next->SpillOffset + done) != 0 || SpillIO(1, buf, want, end + done) != 0)
+            {
+                free(buf);
+                return;  // Leave the rest where it is
+            }
+        }
+
+        next->SpillOffset = end;
+        end += next->SpillSize;
+    }
+
+    free(buf);
+    if (ftruncate(tier->SpillFd, (off_t)end) == 0)
+        tier->SpillEnd = end;
+}
+
+
+/*
+ * Function: TierForget
+ * --------------------
+ * Drops the spilled copy of an inode's data, if any.
+ */
+void TierForget(PINODE inode)
+{
+    PTIERSTATE tier = CurrentVFS->Tier;
+    PTIERENTRY entry = NULL;
+
+    if (tier == NULL)
+        return;
+
+    entry = TierEntry(inode);
+    if (entry->Spilled)
+    {
+#ifdef FALLOC_FL_PUNCH_HOLE
+        if (entry->SpillSize > 0)
+            fallocate(tier->SpillFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      (off_t)entry->SpillOffset, (off_t)entry->SpillSize);
+#endif
+        tier->SpillLive -= entry->SpillSize;
+    }
+
+    entry->Spilled = 0;
+    entry->SpillOffset = 0;
+    entry->SpillSize = 0;
+    entry->Hits = 0;
+    entry->LastAccess = tier->Clock;
+
+    if (tier->SpillLive == 0)
+    {
+        if (tier->SpillEnd > 0 && ftruncate(tier->SpillFd, 0) == 0)
+            tier->SpillEnd = 0;
+    }
+    else if (tier->SpillEnd > TIERCOMPACTMIN && tier->SpillEnd > 2 * tier->SpillLive)
+    {
+        CompactSpill();
+    }
+}
+
+
+/*
+ * Function: DemoteInode
+ * ---------------------
+ * Writes the data of a file to the end of the spill file and releases it
+ * from the data area.
+ *
+ * @return 0 on success, -1 if the spill file could not be written.
+ */
+int DemoteInode(PINODE inode)
+{
+    PTIERSTATE tier = CurrentVFS->Tier;
+    PTIERENTRY entry = TierEntry(inode);
+    uint64_t size = inode->FileActualSize;
+
+    // Holes are skipped and stay holes in the spill file
+    if (SpillRuns(inode, 1, size, tier->SpillEnd) != 0)
+        return -1;
+
+    ReleaseBlocks(inode, 0, BlocksOf(size));
+
+    entry->Spilled = 1;
+    entry->SpillOffset = tier->SpillEnd;
+    entry->SpillSize = size;
+    entry->Hits = 0;
+    tier->SpillEnd += size;
+    tier->SpillLive += size;
+    tier->Demotions++;
+
+    return 0;
+}
+
+
+/*
+ * Function: EnsureResident
+ * ------------------------
+ * Brings the data of a spilled file back into the data area.
+ *
+ * @return 0 if the data is in RAM, -1 if it could not be read back.
+ */
+int EnsureResident(PINODE inode)
+{
+    PTIERENTRY entry = NULL;
+    struct timespec start, end;
+    uint64_t size = 0;
+    double seconds = 0;
+
+    if (CurrentVFS->Tier == NULL)
+        return 0;
+
+    entry = TierEntry(inode);
+    if (!entry->Spilled)
+        return 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    size = entry->SpillSize;
+    if (SpillRuns(inode, 0, size, entry->SpillOffset) != 0)
+    {
+        ReleaseBlocks(inode, 0, BlocksOf(size));
+        return -1;
+    }
+
+    TierForget(inode);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    CurrentVFS->Tier->Promotions++;
+    CurrentVFS->Tier->ReloadSeconds += seconds;
+    if (seconds > CurrentVFS->Tier->ReloadMax)
+        CurrentVFS->Tier->ReloadMax = seconds;
+
+    return 0;
+}
+
+
+/*
+ * Function: TierTruncate
+ * ----------------------
+ * Cuts the spilled copy of a file's data to `size` bytes.
+ *
+ * @return 1 if the file is spilled (its data area holds nothing to trim), 0 otherwise.
+ */
+int TierTruncate(PINODE inode, uint64_t size)
+{
+    PTIERENTRY entry = NULL;
+
+    if (CurrentVFS->Tier == NULL)
+        return 0;
+
+    entry = TierEntry(inode);
+    if (!entry->Spilled)
+        return 0;
+
+    if (size < entry->SpillSize)
+    {
+#ifdef FALLOC_FL_PUNCH_HOLE
+        fallocate(CurrentVFS->Tier->SpillFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  (off_t)(entry->SpillOffset + size), (off_t)(entry->SpillSize - size));
+#endif
+        CurrentVFS->Tier->SpillLive -= entry->SpillSize - size;
+        entry->SpillSize = size;
+    }
+
+    return 1;
+}
+
+
+/*
+ * Function: ResidentBytes
+ * -----------------------
+ * @return Bytes of file data currently held in RAM, in whole blocks.
+ */
+uint64_t ResidentBytes()
+{
+    uint64_t total = 0;
+    int i = 0;
+
+    for (i = 0; i < MAXINODE; i++)
+    {
+        if (CurrentVFS->InodeTable[i].FileType == REGULAR && !CurrentVFS->Tier->Entries[i].Spilled)
+            total += (uint64_t)CurrentVFS->InodeTable[i].AllocatedBlocks * BLOCKSIZE;
+    }
+
+    return total;
+}
+
+
+/*
+ * Function: EnforceBudget
+ * -----------------------
+ * Demotes the coldest files until the resident data fits the budget.
+ * `keep` (may be NULL) is the file being accessed and is never demoted.
+ */
+void EnforceBudget(PINODE keep)
+{
+    PTIERSTATE tier = CurrentVFS->Tier;
+    PINODE inode = NULL, victim = NULL;
+    PTIERENTRY entry = NULL, best = NULL;
+    uint64_t resident = 0;
+    int i = 0;
+
+    if (tier == NULL)
+        return;
+
+    resident = ResidentBytes();
+    while (resident > tier->Budget)
+    {
+        victim = NULL;
+        best = NULL;
+        for (i = 0; i < MAXINODE; i++)
+        {
+            inode = &CurrentVFS->InodeTable[i];
+            entry = &tier->Entries[i];
+            if (inode == keep || inode->FileType != REGULAR || entry->Spilled ||
+                Leased(inode) || inode->FileActualSize == 0)
+                continue;
+
+            // Cold before hot, then least recently used
+            if (best == NULL ||
+                (entry->Hits < TIERHOTHITS) > (best->Hits < TIERHOTHITS) ||
+                ((entry->Hits < TIERHOTHITS) == (best->Hits < TIERHOTHITS) && entry->LastAccess < best->LastAccess))
+            {
+                victim = inode;
+                best = entry;
+            }
+        }
+
+        if (victim == NULL)
+            break;  // Everything left is pinned or in use
+
+        resident -= (uint64_t)victim->AllocatedBlocks * BLOCKSIZE;
+        if (DemoteInode(victim) != 0)
+            break;  // Spill file full or failing, keep the data in RAM
+    }
+}
+
+
+/*
+ * Function: TierTouch
+ * -------------------
+ * Records an access to a file, brings its data into RAM and keeps the
+ * resident data within the budget.
+ *
+ * @return 0 on success, -1 if the data could not be read back.
+ */
+int TierTouch(PINODE inode)
+{
+    PTIERENTRY entry = NULL;
+
+    if (CurrentVFS->Tier == NULL)
+        return 0;
+
+    if (EnsureResident(inode) != 0)
+        return -1;
+
+    entry = TierEntry(inode);
+    entry->LastAccess = ++CurrentVFS->Tier->Clock;
+    if (entry->Hits < TIERHOTHITS)
+        entry->Hits++;
+
+    EnforceBudget(inode);
+    return 0;
+}
+
+
+/*
+ * Function: EnableTiering
+ * -----------------------
+ * Limits the file data kept in RAM to `budget` bytes; colder data goes to
+ * the host file `path`, which is created or emptied. Only private instances
+ * can be tiered: a shared or backed data area already lives in a host object.
+ *
+ * @return
+ *   0 : Success.
+ *  -1 : The instance is shared or backed, or tiering is already enabled.
+ *  -2 : The spill file cannot be opened.
+ *  -3 : Memory allocation failed.
+ */
+int EnableTiering(const char *path, uint64_t budget)
+{
+    PTIERSTATE tier = NULL;
+
+    if (path == NULL || CurrentVFS->Shared != NULL || CurrentVFS->Backed || CurrentVFS->Tier != NULL)
+        return -1;
+
+    tier = (PTIERSTATE)calloc(1, sizeof(TIERSTATE));
+    if (tier == NULL)
+        return -3;
+
+    tier->SpillFd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (tier->SpillFd == -1)
+    {
+        free(tier);
+        return -2;
+    }
+
+    tier->Budget = budget;
+    CurrentVFS->Tier = tier;
+    EnforceBudget(NULL);
+
+    return 0;
+}
+
+
+/*
+ * Operation Trace
+ * ---------------
+ * StartTrace() records every CreateFile, OpenFile, ReadFile, ReadView,
+ * WriteFile, LseekFile, CloseFileByName and rm_File call with its arguments,
+ * result, start time and duration. Each thread appends to a ring of its own
+ * without locks or system calls; a flusher thread drains all rings into the
+ * trace file every TRACEFLUSHMS milliseconds, or every TRACEBUSYMS while
+ * records keep coming. A record that finds its ring
+ * full is counted as dropped instead of waiting. ReplayTrace() runs a trace
+ * file against the current instance.
+ *
+ * Trace file: TRACEHEADER followed by TRACERECORDs, in per-thread batches.
+ * Rings stay allocated after their thread exits and are reused by no one;
+ * there is one per thread that ever traced an operation.
+ */
+#define TRACEMAGIC "CVFSTRC1"
+#define TRACERINGSIZE 16384
+#define TRACEFLUSHMS 10
+#define TRACEBUSYMS 1
+
+
+/*
+ * Structure: tracerecord
+ * ----------------------
+ * One traced call.
+ *
+ * Fields:
+ *  - Time   : Start of the call in nanoseconds since StartTrace().
+ *  - Arg    : Permission (create), mode (open), byte count (read, write) or offset (lseek).
+ *  - Result : Return value of the call.
+ *  - Nanos  : Duration of the call.
+ *  - Op     : One of the OP_* codes.
+ *  - From   : Whence of an lseek.
+ *  - Fd     : File descriptor of read, write, lseek and close.
+ *  - Thread : Number of the recording thread.
+ *  - Name   : File name of create, open and rm.
+ */
+typedef struct tracerecord
+{
+    uint64_t Time;
+    int64_t Arg;
+    int64_t Result;
+    uint32_t Nanos;
+    int16_t Op;
+    int16_t From;
+    int32_t Fd;
+    int32_t Thread;
+    char Name[56];
+}TRACERECORD, *PTRACERECORD;
+
+
+typedef struct traceheader
+{
+    char Magic[8];
+    uint32_t RecordSize;
+    uint32_t Reserved;
+}TRACEHEADER;
+
+
+/*
+ * Structure: tracering
+ * --------------------
+ * Records of one thread. Only the owner advances Head and only the flusher
+ * advances Tail.
+ */
+typedef struct tracering
+{
+    std::atomic<uint64_t> Head;
+    std::atomic<uint64_t> Tail;
+    int Thread;
+    struct tracering *Next;
+    TRACERECORD Records[TRACERINGSIZE];
+}TRACERING, *PTRACERING;
+
+
+/*
+ * Structure: tracestate
+ * ---------------------
+ * The process-wide recorder.
+ */
+typedef struct tracestate
+{
+    std::atomic<int> Active;
+    std::atomic<int> Stop;
+    int Fd;
+    uint64_t StartNs;
+    pthread_t Flusher;
+    std::atomic<PTRACERING> Rings;
+    std::atomic<int> Threads;
+    std::atomic<long> Written;
+    std::atomic<long> Dropped;
+}TRACESTATE;
+
+TRACESTATE Trace;
+thread_local PTRACERING TraceRing = NULL;
+
+
+/*
+ * Function: TraceNow
+ * ------------------
+ * @return CLOCK_MONOTONIC time in nanoseconds.
+ */
+uint64_t TraceNow()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+/*
+ * Function: TraceBegin
+ * --------------------
+ * @return The start time of a call to trace, or 0 when tracing is off.
+ */
+uint64_t TraceBegin()
+{
+    if (Trace.Active.load(std::memory_order_relaxed) == 0)
+        return 0;
+    return TraceNow();
+}
+
+
+/*
+ * Function: TraceEnd
+ * ------------------
+ * Appends a record for a call that started at `start` (see TraceBegin)
+ * to the calling thread's ring.
+ */
+void TraceEnd(uint64_t start, int op, int fd, const char *name, int64_t arg, int from, int64_t result)
+{
+    PTRACERING ring = TraceRing;
+    PTRACERECORD rec = NULL;
+    uint64_t end = 0, pos = 0;
+
+    if (start == 0)
+        return;
+    end = TraceNow();
+
+    if (ring == NULL)
+    {
+        ring = (PTRACERING)calloc(1, sizeof(TRACERING));
+        if (ring == NULL)
+        {
+            Trace.Dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        ring->Thread = Trace.Threads.fetch_add(1) + 1;
+        ring->Next = Trace.Rings.load();
+        while (!Trace.Rings.compare_exchange_weak(ring->Next, ring))
+            ;
+        TraceRing = ring;
+    }
+
+    pos = ring->Head.load(std::memory_order_relaxed);
+    if (pos - ring->Tail.load(std::memory_order_acquire) >= TRACERINGSIZE)
+    {
+        Trace.Dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    rec = &ring->Records[pos % TRACERINGSIZE];
+    rec->Time = start - Trace.StartNs;
+    rec->Arg = arg;
+    rec->Result = result;
+    rec->Nanos = end - start > UINT32_MAX ? UINT32_MAX : (uint32_t)(end - start);
+    rec->Op = (int16_t)op;
+    rec->From = (int16_t)from;
+    rec->Fd = fd;
+    rec->Thread = ring->Thread;
+    rec->Name[0] = '\0';
+    if (name != NULL)
+        snprintf(rec->Name, sizeof(rec->Name), "%s", name);
+
+    ring->Head.store(pos + 1, std::memory_order_release);
+}
+
+
+/*
+ * Function: WriteAll
+ * ------------------
+ * @return 0 if all `length` bytes were written to `fd`, -1 otherwise.
+ */
+int WriteAll(int fd, const void *buf, size_t length)
+{
+    size_t done = 0;
+    ssize_t n = 0;
+
+    while (done < length)
+    {
+        n = write(fd, (const char *)buf + done, length - done);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        done += (size_t)n;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Function: DrainTraceRings
+ * -------------------------
+ * Writes the pending records of every ring to the trace file.
+ *
+ * @return Number of records taken from the rings.
+ */
+long DrainTraceRings()
+{
+    PTRACERING ring = Trace.Rings.load();
+    uint64_t tail = 0, end = 0, n = 0;
+    long total = 0;
+
+    while (ring != NULL)
+    {
+        tail = ring->Tail.load(std::memory_order_relaxed);
+        end = ring->Head.load(std::memory_order_acquire);
+
+        // At most two pieces: up to the end of the array, then from its start
+        while (tail < end)
+        {
+            n = TRACERINGSIZE - tail % TRACERINGSIZE;
+            if (n > end - tail)
+                n = end - tail;
+            if (WriteAll(Trace.Fd, &ring->Records[tail % TRACERINGSIZE], n * sizeof(TRACERECORD)) == 0)
+                Trace.Written.fetch_add((long)n, std::memory_order_relaxed);
+            else
+                Trace.Dropped.fetch_add((long)n, std::memory_order_relaxed);
+            tail += n;
+            total += (long)n;
+        }
+
+        ring->Tail.store(tail, std::memory_order_release);
+        ring = ring->Next;
+    }
+
+    return total;
+}
+
+
+/*
+ * Function: TraceFlusher
+ * ----------------------
+ * Flusher thread body.
+ */
+void *TraceFlusher(void *)
+{
+    struct timespec pause = { 0, TRACEFLUSHMS * 1000000L };
+
+    while (Trace.Stop.load() == 0)
+    {
+        nanosleep(&pause, NULL);
+        pause.tv_nsec = (DrainTraceRings() > 0 ? TRACEBUSYMS : TRACEFLUSHMS) * 1000000L;
+    }
+    DrainTraceRings();
+
+    return NULL;
+}
+
+
+/*
+ * Function: StartTrace
+ * --------------------
+ * Starts recording into the host file `path`, which is created or emptied.
+ *
+ * @return
+ *   0 : Recording.
+ *  -1 : A trace is already being recorded.
+ *  -2 : The trace file cannot be written.
+ *  -3 : The flusher thread cannot be started.
+ */
+int StartTrace(const char *path)
+{
+    TRACEHEADER hdr;
+    PTRACERING ring = NULL;
+
+    if (path == NULL || Trace.Active.load() != 0)
+        return -1;
+
+    Trace.Fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (Trace.Fd == -1)
+        return -2;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.Magic, TRACEMAGIC, sizeof(hdr.Magic));
+    hdr.RecordSize = sizeof(TRACERECORD);
+    if (WriteAll(Trace.Fd, &hdr, sizeof(hdr)) != 0)
+    {
+        close(Trace.Fd);
+        return -2;
+    }
+
+    // Forget records left over from an earlier trace
+    for (ring = Trace.Rings.load(); ring != NULL; ring = ring->Next)
+        ring->Tail.store(ring->Head.load());
+
+    Trace.Written.store(0);
+    Trace.Dropped.store(0);
+    Trace.Stop.store(0);
+    Trace.StartNs = TraceNow();
+
+    if (pthread_create(&Trace.Flusher, NULL, TraceFlusher, NULL) != 0)
+    {
+        close(Trace.Fd);
+        return -3;
+    }
+
+    Trace.Active.store(1);
+    return 0;
+}
+
+
+/*
+ * Function: StopTrace
+ * -------------------
+ * Stops recording and writes out every pending record.
+ *
+ * @return 0 on success, -1 if no trace is being recorded.
+ */
+int StopTrace()
+{
+    if (Trace.Active.load() == 0)
+        return -1;
+
+    Trace.Active.store(0);
+    Trace.Stop.store(1);
+    pthread_join(Trace.Flusher, NULL);
+    close(Trace.Fd);
+
+    return 0;
+}
+
+
+/*
+ * Function: LockReads
+ * -------------------
+ * Takes the read lock of a file table (see FILETABLE::ReadLock). It is only
+ * held for one read or seek, so waiters yield instead of sleeping.
+ */
+void LockReads(PFILETABLE ft)
+{
+    while (__atomic_exchange_n(&ft->ReadLock, 1, __ATOMIC_ACQUIRE) != 0)
+        sched_yield();
+}
+
+
+/*
+ * Function: UnlockReads
+ * ---------------------
+ * Releases the lock taken by LockReads().
+ */
+void UnlockReads(PFILETABLE ft)
+{
+    __atomic_store_n(&ft->ReadLock, 0, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Function: ResetReadahead
+ * ------------------------
+ * Puts a file table into its initial readahead state: a read at offset 0
+ * counts as sequential and nothing has been prefetched yet.
+ */
+void ResetReadahead(PFILETABLE ft)
+{
+    ft->RaNext = 0;
+    ft->RaStart = 0;
+    ft->RaEnd = 0;
+    ft->RaWindow = 0;
+}
+
+
+/*
+ * Function: EndReadahead
+ * ----------------------
+ * Drops the prefetched window of a file table; whatever part of it was not
+ * read is counted as readahead waste.
+ */
+void EndReadahead(PFILETABLE ft)
+{
+    if (ft->RaEnd > ft->RaStart)
+        __atomic_fetch_add(&CurrentVFS->ReadaheadWaste, (long)(ft->RaEnd - ft->RaStart), __ATOMIC_RELAXED);
+
+    ft->RaStart = ft->RaEnd = 0;
+}
+
+
+/*
+ * Function: Readahead
+ * -------------------
+ * Called after every read of `length` bytes at `offset` on a backed instance.
+ * A read that starts where the previous one ended (no LseekFile in between)
+ * doubles the readahead window up to RAMAXWINDOW; any other read is random
+ * access, which drops the prefetched window and shrinks the window.
+ * The kernel is then asked to fetch the window past the read asynchronously
+ * from the backing file. Called with the file table's read lock held.
+ */
+void Readahead(PFILETABLE ft, int64_t offset, uint64_t length)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    int64_t end = offset + (int64_t)length, from = 0, to = 0;
+    uintptr_t first = 0, last = 0;
+
+    if (!CurrentVFS->Backed || !UseReadahead || length == 0)
+        return;
+
+    // Bytes of this read that an earlier prefetch already brought in
+    from = offset > ft->RaStart ? offset : ft->RaStart;
+    to = end < ft->RaEnd ? end : ft->RaEnd;
+    if (to > from)
+    {
+        __atomic_fetch_add(&CurrentVFS->ReadaheadHits, (long)(to - from), __ATOMIC_RELAXED);
+        ft->RaStart = to;
+    }
+
+    if (offset != ft->RaNext)
+    {
+        EndReadahead(ft);
+        ft->RaWindow /= 4;
+        ft->RaNext = end;
+        return;
+    }
+
+    ft->RaNext = end;
+    if (ft->RaWindow == 0)
+        ft->RaWindow = RAMINWINDOW;
+    else if (ft->RaWindow < RAMAXWINDOW)
+        ft->RaWindow *= 2;
+
+    from = end > ft->RaEnd ? end : ft->RaEnd;
+    to = end + ft->RaWindow;
+    if (to > (int64_t)ft->ptrinode->FileActualSize)
+        to = (int64_t)ft->ptrinode->FileActualSize;
+    if (to <= from)
+        return;
+
+    if (ft->RaEnd <= ft->RaStart)
+        ft->RaStart = from;
+    ft->RaEnd = to;
+
+    first = (uintptr_t)(InodeData(ft->ptrinode) + from) & ~(uintptr_t)(page - 1);
+    last = (uintptr_t)(InodeData(ft->ptrinode) + to);
+    madvise((void *)first, last - first, MADV_WILLNEED);
+}
+
+
+/*
+ * Function: GetReadaheadStats
+ * ---------------------------
+ * Reports how many prefetched bytes were later read (hits) and how many
+ * were dropped unread (waste) since the instance was created.
+ */
+void GetReadaheadStats(long *hits, long *waste)
+{
+    *hits = __atomic_load_n(&CurrentVFS->ReadaheadHits, __ATOMIC_RELAXED);
+    *waste = __atomic_load_n(&CurrentVFS->ReadaheadWaste, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Function: SpanOf
+ * ----------------
+ * @return The per-inode slot size for a data area of `total` bytes: an
+ *         equal share, rounded down to whole huge pages so every slot can
+ *         be backed by them, but at least one huge page.
+ */
+constexpr int64_t SpanOf(int64_t total)
+{
+    int64_t span = (total / MAXINODE) & ~(int64_t)(HUGEPAGESIZE - 1);
+
+    return span < HUGEPAGESIZE ? HUGEPAGESIZE : span;
+}
+
+
+/*
+ * Function: SizeDataArea
+ * ----------------------
+ * Fixes the slot size of the current instance from DataAreaSize unless it
+ * was already set (shards and attached segments get theirs elsewhere). Runs
+ * before anything is sized from MAXFILESIZE, so only DataAreaSize bytes of
+ * address space are reserved for file data, not a fixed amount per file.
+ */
+void SizeDataArea()
+{
+    if (CurrentVFS->FileSpan == 0)
+        CurrentVFS->FileSpan = SpanOf(DataAreaSize);
+}
+
+
+/*
+ * Function: OpenBackingStore
+ * --------------------------
+ * Keeps the file data of the current instance in the host file `path`
+ * instead of in memory. The data area is a shared mapping of the file, so
+ * data is paged in from the host file on first access and sequential
+ * readers are served by Readahead(). Must be called before CreateDILB().
+ *
+ * @return
+ *   0  : Success.
+ *  -1  : The host file could not be opened or sized.
+ *  -2  : The host file could not be mapped.
+ */
+int OpenBackingStore(const char *path)
+{
+    size_t size = 0;
+    void *base = NULL;
+    int fd = 0;
+
+    SizeDataArea();
+    size = (size_t)MAXINODE * MAXFILESIZE;
+    fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd == -1)
+        return -1;
+
+    // Data of an earlier run has no inodes, and free blocks must read as zero
+    if (ftruncate(fd, 0) == -1 || ftruncate(fd, size) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -2;
+
+    CurrentVFS->DataBase = (char *)base;
+    CurrentVFS->Backed = 1;
+
+    return 0;
+}
+
+
+/*
+ * Function: AllocateArena
+ * -----------------------
+ * Reserves the private data area of the current instance. Memory is only
+ * committed when a block is first written, and the area is bound to the
+ * MPOL_LOCAL policy, so on a NUMA host every block is placed on the node of
+ * the thread that writes it, even under a process-wide interleave policy.
+ *
+ * With UseHugePages the area is backed by 2 MB pages where possible, to cut
+ * TLB misses on large data sets: explicit huge pages if the hugetlbfs pool
+ * can hold the whole area (they are reserved up front), otherwise
+ * transparent huge pages, otherwise normal pages. ArenaPages records which.
+ *
+ * @return The data area, or NULL if it could not be mapped.
+ */
+char *AllocateArena(size_t size)
+{
+    char *base = NULL, *aligned = NULL;
+    size_t slack = UseHugePages ? HUGEPAGESIZE : 0;
+
+    CurrentVFS->ArenaPages = ARENA_SMALL;
+
+    if (UseHugePages)
+    {
+        base = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base != (char *)MAP_FAILED)
+            CurrentVFS->ArenaPages = ARENA_EXPLICIT;
+    }
+
+    if (CurrentVFS->ArenaPages == ARENA_SMALL)
+    {
+        // Over-allocate so the area can start on a huge page boundary
+        base = (char *)mmap(NULL, size + slack, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == (char *)MAP_FAILED)
+            return NULL;
+
+        if (UseHugePages)
+        {
+            aligned = (char *)(((uintptr_t)base + HUGEPAGESIZE - 1) & ~(uintptr_t)(HUGEPAGESIZE - 1));
+            if (aligned > base)
+                munmap(base, aligned - base);
+            if (aligned < base + slack)
+                munmap(aligned + size, base + slack - aligned);
+            base = aligned;
+
+            if (madvise(base, size, MADV_HUGEPAGE) == 0)
+                CurrentVFS->ArenaPages = ARENA_TRANSPARENT;
+        }
+    }
+
+#ifdef __linux__
+    // Fails harmlessly on kernels without NUMA support
+    syscall(SYS_mbind, base, size, MPOL_LOCAL, NULL, 0, 0);
+#endif
+
+    return base;
+}
+
+
+/*
+ * Function: CreateDILB
+ * --------------------
+ * Creates the Disk Inode List Block (DILB), which is a list of inodes.
+ * Initializes all inodes with default values. The inodes live in one table,
+ * in list order, and their numbers follow from their position; each owns a
+ * fixed MAXFILESIZE slot of the data area. The table, the data area, the
+ * bitmaps, the name arena, the inode versions, the block generations and
+ * the change log are allocated here unless the instance is shared.
+ *
+ * This function sets up the file system’s basic structure for managing files.
+ *
+ * Prints a success message once all inodes are created.
+ */
+void CreateDILB()
+{
+    int i = 1;
+    PINODE newn = NULL;
+
+    // A shared or backed instance already points at its inode table or data area
+    if (CurrentVFS->InodeTable == NULL)
+        CurrentVFS->InodeTable = (PINODE)malloc(MAXINODE * sizeof(INODE));
+    if (CurrentVFS->DataBase == NULL)
+        CurrentVFS->DataBase = AllocateArena((size_t)MAXINODE * MAXFILESIZE);
+    if (CurrentVFS->DirtyBase == NULL)
+    {
+        CurrentVFS->DirtyBase = (unsigned char *)mmap(NULL, (size_t)MAXINODE * DIRTYMAPSIZE, PROT_READ | PROT_WRITE,
+                                                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (CurrentVFS->DirtyBase == (unsigned char *)MAP_FAILED)
+            CurrentVFS->DirtyBase = NULL;
+    }
+    if (CurrentVFS->AllocBase == NULL)
+    {
+        CurrentVFS->AllocBase = (unsigned char *)mmap(NULL, (size_t)MAXINODE * DIRTYMAPSIZE, PROT_READ | PROT_WRITE,
+                                                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (CurrentVFS->AllocBase == (unsigned char *)MAP_FAILED)
+            CurrentVFS->AllocBase = NULL;
+    }
+    if (CurrentVFS->NameBase == NULL)
+    {
+        CurrentVFS->NameBase = (char *)mmap(NULL, NAMEARENASIZE, PROT_READ | PROT_WRITE,
+                                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (CurrentVFS->NameBase == (char *)MAP_FAILED)
+            CurrentVFS->NameBase = NULL;
+    }
+    if (CurrentVFS->Versions == NULL)
+        CurrentVFS->Versions = (uint64_t *)calloc(MAXINODE, sizeof(uint64_t));
+    if (CurrentVFS->GenBase == NULL)
+    {
+        CurrentVFS->GenBase = (uint64_t *)mmap(NULL, (size_t)MAXINODE * MAXBLOCKS * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (CurrentVFS->GenBase == (uint64_t *)MAP_FAILED)
+            CurrentVFS->GenBase = NULL;
+    }
+    if (CurrentVFS->ChangeLog == NULL)
+        CurrentVFS->ChangeLog = (PCHANGERECORD)calloc(CHANGELOGSIZE, sizeof(CHANGERECORD));
+
+    // Check if memory allocation was successful
+    if (CurrentVFS->InodeTable == NULL || CurrentVFS->DataBase == NULL || CurrentVFS->DirtyBase == NULL ||
+        CurrentVFS->AllocBase == NULL || CurrentVFS->NameBase == NULL || CurrentVFS->Versions == NULL ||
+        CurrentVFS->GenBase == NULL || CurrentVFS->ChangeLog == NULL)
+    {
+        printf("Memory allocation failed for inode table\n");
+        return;
+    }
+
+    // The list order is the table order (see NextInode)
+    head = &CurrentVFS->InodeTable[0];
+    while(i <= MAXINODE)
+    {
+        newn = &CurrentVFS->InodeTable[i - 1];
+
+        // Initialize inode fields
+        newn->LinkCount = 0;
+        newn->ReferenceCount = 0;
+        newn->LeaseCount = 0;
+        newn->FileType = 0;
+        newn->Permission = 0;
+        newn->FileActualSize = 0;
+        newn->AllocatedBlocks = 0;
+        newn->NameOffset = 0;
+        newn->NameHash = 0;
+        i++;
+    }
+    printf("DILB created successfully\n");
+}
+
+/*
+ * Function: InitialiseSuperBlock
+ * ------------------------------
+ * Initializes the SuperBlock and User File Descriptor Table (UFDT).
+ *
+ * - Sets all entries in the UFDT array to NULL (no files are open initially).
+ * - Sets the total and free inode count in the superblock to MAXINODE.
+ *
+ * This function prepares the file system for use by resetting its metadata.
+ */
+void InitialiseSuperBlock()
+{
+    int i = 0;
+
+    SizeDataArea();
+    if (CurrentVFS->Super == NULL)
+        CurrentVFS->Super = &CurrentVFS->SuperStore;
+    if (CurrentVFS->Names == NULL)
+        CurrentVFS->Names = &CurrentVFS->NamesStore;
+    if (CurrentVFS->Lock == NULL)
+    {
+        pthread_mutex_init(&CurrentVFS->LockStore, NULL);
+        CurrentVFS->Lock = &CurrentVFS->LockStore;
+    }
+
+    while(i < 50)
+    {
+        UFDTArr[i].ptrfiletable = NULL;
+        i++;
+    }
+
+    SUPERBLOCKobj.TotalInodes = MAXINODE;
+    SUPERBLOCKobj.FreeInodes = MAXINODE;
+    SUPERBLOCKobj.FreeHint = 0;
+    SUPERBLOCKobj.TotalBytes = (long)MAXINODE * MAXFILESIZE;
+    SUPERBLOCKobj.FreeBytes = SUPERBLOCKobj.TotalBytes;
+    SUPERBLOCKobj.Generation = 0;
+    SUPERBLOCKobj.DeltaId = ((uint64_t)time(NULL) << 32) ^ ((uint64_t)getpid() << 16) ^ TraceNow();
+    SUPERBLOCKobj.SourceId = 0;
+    SUPERBLOCKobj.SourceGen = 0;
+    CurrentVFS->Names->Count = 0;
+    CurrentVFS->Names->ArenaUsed = 0;
+    CurrentVFS->Names->ArenaGarbage = 0;
+    CurrentVFS->Names->Seq = 0;
+    CurrentVFS->Retired = NULL;
+}
+
+
+/*
+ * Deferred Reclamation
+ * --------------------
+ * ReadFileNoLock() reads without the instance lock, so a file can be
+ * deleted, or its descriptor closed, while a read is still copying from it.
+ * What such a read can reach, the file table and the inode with its data
+ * slot, is therefore not freed at once: rm_File() and close unlink it and
+ * retire it, and it is reclaimed once every read that was already running
+ * has finished (epoch-based reclamation).
+ *
+ * A reader announces itself in a slot of EpochObj with the global epoch it
+ * saw on entry. Retiring stamps the object with the global epoch and
+ * advances it; the object is freed when no announced reader entered at or
+ * before its stamp. Retire and reclaim run under the instance lock, readers
+ * never take it inside an epoch, so neither side waits for the other.
+ */
+#define EPOCHSLOTS 128
+
+
+/*
+ * Structure: epochslot
+ * --------------------
+ * Announcement of one reader thread, on a cache line of its own.
+ *
+ * Fields:
+ *  - Epoch   : Global epoch seen on entry plus one, 0 outside a read.
+ *  - Claimed : Non-zero while a thread owns the slot.
+ */
+typedef struct epochslot
+{
+    alignas(64) std::atomic<uint64_t> Epoch;
+    std::atomic<int> Claimed;
+}EPOCHSLOT;
+
+
+/*
+ * Structure: epochstate
+ * ---------------------
+ * Epochs of all instances of the process.
+ *
+ * Fields:
+ *  - Global : Advances by one for every retired object.
+ *  - Used   : Number of slots ever claimed; only these are scanned.
+ *  - Slots  : Reader announcements.
+ */
+typedef struct epochstate
+{
+    std::atomic<uint64_t> Global;
+    std::atomic<int> Used;
+    EPOCHSLOT Slots[EPOCHSLOTS];
+}EPOCHSTATE;
+
+EPOCHSTATE EpochObj;
+
+
+/*
+ * Class: EpochSlot
+ * ----------------
+ * The slot of the calling thread, given back when the thread exits.
+ */
+class EpochSlot
+{
+public:
+    int Index = -1;
+
+    ~EpochSlot()
+    {
+        if (Index >= 0)
+        {
+            EpochObj.Slots[Index].Epoch.store(0);
+            EpochObj.Slots[Index].Claimed.store(0);
+        }
+    }
+};
+
+thread_local EpochSlot ThreadEpoch;
+
+
+/*
+ * Function: EpochEnter
+ * --------------------
+ * Starts a read. Until EpochExit() no file table or inode reached from here
+ * on is freed, even if the file is deleted or closed meanwhile. Reads do not
+ * nest, and the instance lock must not be taken before EpochExit().
+ *
+ * @return 0 on success, -1 if all EPOCHSLOTS slots are owned by other threads.
+ */
+int EpochEnter()
+{
+    int i = ThreadEpoch.Index, expected = 0;
+
+    if (i < 0)
+    {
+        i = 0;
+        while (i < EPOCHSLOTS)
+        {
+            expected = 0;
+            if (EpochObj.Slots[i].Claimed.compare_exchange_strong(expected, 1))
+                break;
+            i++;
+        }
+        if (i == EPOCHSLOTS)
+            return -1;  // No free slot
+
+        ThreadEpoch.Index = i;
+        expected = EpochObj.Used.load();
+        while (expected < i + 1 && !EpochObj.Used.compare_exchange_weak(expected, i + 1))
+            ;
+    }
+
+    // Published before any pointer is loaded (sequentially consistent)
+    EpochObj.Slots[i].Epoch.store(EpochObj.Global.load() + 1);
+    return 0;
+}
+
+
+/*
+ * Function: EpochExit
+ * -------------------
+ * Ends the read started by EpochEnter().
+ */
+void EpochExit()
+{
+    EpochObj.Slots[ThreadEpoch.Index].Epoch.store(0, std::memory_order_release);
+}
+
+
+/*
+ * Function: OldestEpoch
+ * ---------------------
+ * @return The smallest announcement of a running read, UINT64_MAX if none.
+ */
+uint64_t OldestEpoch()
+{
+    uint64_t oldest = UINT64_MAX, epoch = 0;
+    int i = 0, used = EpochObj.Used.load();
+
+    while (i < used)
+    {
+        epoch = EpochObj.Slots[i].Epoch.load();
+        if (epoch != 0 && epoch < oldest)
+            oldest = epoch;
+        i++;
+    }
+
+    return oldest;
+}
+
+
+/*
+ * Function: ReleaseInodeSlot
+ * --------------------------
+ * Lets AllocateInode() find an inode that became free again.
+ */
+void ReleaseInodeSlot(PINODE inode)
+{
+    if (InodeNumber(inode) - 1 < SUPERBLOCKobj.FreeHint)
+        SUPERBLOCKobj.FreeHint = InodeNumber(inode) - 1;
+}
+
+
+/*
+ * Function: ReleaseObject
+ * -----------------------
+ * Frees a retired file table, and gives a retired inode's data and slot back.
+ */
+void ReleaseObject(PINODE inode, PFILETABLE ft)
+{
+    if (ft != NULL)
+    {
+        free(ft->WBuf);
+        free(ft);
+    }
+
+    if (inode != NULL)
+    {
+        // Give the data back so the slot is all zero for its next file
+        TierForget(inode);
+        FreeBlocks(inode, 0, BlocksOf(inode->FileActualSize));
+        DropLease(inode);
+        ReleaseInodeSlot(inode);
+        (SUPERBLOCKobj.FreeInodes)++;
+    }
+}
+
+
+/*
+ * Function: RetireObject
+ * ----------------------
+ * Frees an inode or file table that has just been unlinked (removed from
+ * the name index and the UFDT), or queues it until the reads running now
+ * have finished. A retired inode keeps a lease so AllocateInode() does not
+ * hand its slot out early. Must be called with the instance locked.
+ */
+void RetireObject(PINODE inode, PFILETABLE ft)
+{
+    PRETIRED item = NULL;
+    uint64_t epoch = 0;
+
+    if (inode != NULL)
+        TakeLease(inode);
+
+    // Reads of a shared instance always hold the lock (see ReadFileNoLock)
+    if (CurrentVFS->Shared != NULL || EpochObj.Used.load() == 0)
+    {
+        ReleaseObject(inode, ft);
+        return;
+    }
+
+    epoch = EpochObj.Global.fetch_add(1);
+    if (OldestEpoch() > epoch + 1)
+    {
+        ReleaseObject(inode, ft);
+        return;
+    }
+
+    item = (PRETIRED)malloc(sizeof(RETIRED));
+    if (item == NULL)
+    {
+        while (OldestEpoch() <= epoch + 1)
+            sched_yield();
+        ReleaseObject(inode, ft);
+        return;
+    }
+
+    item->Epoch = epoch;
+    item->ptrinode = inode;
+    item->ptrfiletable = ft;
+    item->next = CurrentVFS->Retired;
+    CurrentVFS->Retired = item;
+}
+
+
+/*
+ * Function: ReclaimRetired
+ * ------------------------
+ * Frees every retired object that no running read can reach any more.
+ * Must be called with the instance locked.
+ */
+void ReclaimRetired()
+{
+    PRETIRED *link = &CurrentVFS->Retired, item = NULL;
+    uint64_t oldest = 0;
+
+    if (*link == NULL)
+        return;
+
+    oldest = OldestEpoch();
+    while (*link != NULL)
+    {
+        item = *link;
+        if (item->Epoch + 1 < oldest)
+        {
+            *link = item->next;
+            ReleaseObject(item->ptrinode, item->ptrfiletable);
+            free(item);
+        }
+        else
+        {
+            link = &item->next;
+        }
+    }
+}
+
+
+/*
+ * Function: AwaitFreeInode
+ * ------------------------
+ * Reclaims retired objects, and if no inode is free but some are retired,
+ * waits for the reads that still hold them. A reader preempted inside its
+ * epoch would otherwise make creates fail while deleted files are only
+ * waiting to be reclaimed. Readers never take the lock inside an epoch, so
+ * this may wait with it held. Must be called with the instance locked.
+ */
+void AwaitFreeInode()
+{
+    PRETIRED item = NULL;
+
+    ReclaimRetired();
+    while (SUPERBLOCKobj.FreeInodes == 0)
+    {
+        for (item = CurrentVFS->Retired; item != NULL && item->ptrinode == NULL; item = item->next)
+            ;
+        if (item == NULL)
+            return;  // Nothing to wait for
+
+        sched_yield();
+        ReclaimRetired();
+    }
+}
+
+
+
+/*
+ * Function: ClaimInode
+ * --------------------
+ * Turns a free inode into a new, empty regular file: names it and enters it
+ * into the name index. No descriptor is opened. The caller has checked that
+ * the inode is free and not awaiting reclamation, and that the name is
+ * valid and not in use. The inode's version is left odd, the caller ends
+ * it (VersionEnd) once the new file is complete.
+ *
+ * @param temp       - The free inode.
+ * @param name       - The name of the new file.
+ * @param permission - Access permission (1 = Read, 2 = Write, 3 = Read + Write).
+ *
+ * @return 0 on success, -1 if the name arena is full.
+ */
+int ClaimInode(PINODE temp, char *name, int permission)
+{
+    // Assign the file name and initialize inode attributes
+    if (StoreName(temp, name) != 0)
+        return -1;  // No room for the name
+    VersionBegin(temp);
+    temp->FileType = REGULAR;
+    temp->ReferenceCount = 0;
+    temp->LinkCount = 1;
+    temp->FileActualSize = 0;
+    temp->AllocatedBlocks = 0;
+    temp->Permission = permission;
+    DiscardRange(InodeDirtyMap(temp), DIRTYMAPSIZE, CurrentVFS->Shared != NULL);
+    DiscardRange(InodeAllocMap(temp), DIRTYMAPSIZE, CurrentVFS->Shared != NULL);
+    TierForget(temp);
+    IndexInsert(temp);
+    LogChange(temp, 1, 0, 0);
+
+    SUPERBLOCKobj.FreeInodes--;
+
+    return 0;
+}
+
+
+/*
+ * Function: AllocateInode
+ * -----------------------
+ * Takes a free inode for a new regular file (see ClaimInode).
+ *
+ * @param name       - The name of the new file.
+ * @param permission - Access permission (1 = Read, 2 = Write, 3 = Read + Write).
+ *
+ * @return The new inode, or NULL if no inode is free or the name arena is full.
+ */
+PINODE AllocateInode(char *name, int permission)
+{
+    PINODE temp = SUPERBLOCKobj.FreeHint < MAXINODE ? &head[SUPERBLOCKobj.FreeHint] : NULL;
+
+    // Find an available inode with FileType 0 (empty slot), past those known to be in use
+    while (temp != NULL)
+    {
+        if (temp->FileType == 0 && !Leased(temp))  // Found an empty inode slot, not awaiting reclamation
+            break;
+        temp = NextInode(temp);
+    }
+
+    if (temp == NULL)
+        return NULL;  // No available inode for new file
+
+    if (ClaimInode(temp, name, permission) != 0)
+        return NULL;  // No room for the name
+
+    // Slots skipped while awaiting reclamation lower the hint again when released
+    SUPERBLOCKobj.FreeHint = InodeNumber(temp);
+    return temp;
+}
+
+
+
+/*
+ * Function: SetFileTable
+ * ----------------------
+ * Points a UFDT slot at a file table, or clears it with NULL. Reads without
+ * the lock load the slot (see DoReadFileNoLock), so a table is complete
+ * before a slot points at it.
+ */
+void SetFileTable(int fd, PFILETABLE ft)
+{
+    __atomic_store_n(&UFDTArr[fd].ptrfiletable, ft, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Function: DoCreateFile
+ * ----------------------
+ * Creates a new regular file in the virtual file system with the given name and permission.
+ * Allocates an inode, initializes metadata, and assigns a file descriptor entry.
+ *
+ * @param name       - The name of the file to be created.
+ * @param permission - Access permission (1 = Read, 2 = Write, 3 = Read + Write).
+ *
+ * @return 
+ *  >= 0  : File descriptor index if the file is successfully created.
+ *   -1   : Invalid parameters (null name, or incorrect permission).
+ *   -2   : No free inodes available.
+ *   -3   : File with the same name already exists.
+ *   -4   : No available inode slot found, or no room left for the name.
+ *   -5   : No available file descriptor slot in UFDT.
+ *   -6   : Memory allocation failed for file table.
+ */
+
+int DoCreateFile(char *name, int permission)
+{
+    int i = 0;
+    PINODE temp = NULL;
+    PFILETABLE ft = NULL;
+
+    // Check if name is valid, permission is in the range 1 to 3
+    if ((name == NULL) || (permission == 0) || (permission > 3))
+        return -1;  // Invalid input
+
+    // Check if there are free inodes
+    if (SUPERBLOCKobj.FreeInodes == 0)
+        AwaitFreeInode();
+    if (SUPERBLOCKobj.FreeInodes == 0)
+        return -2;  // No free inodes available
+
+    // Check if file with the same name already exists
+    if (Get_Inode(name) != NULL)
+        return -3;  // File already exists
+
+    // Find an available slot in the UFDT array
+    while (i < 50)
+    {
+        if (UFDTArr[i].ptrfiletable == NULL)  // Found an empty slot in UFDT
+            break;
+        i++;
+    }
+
+    // If no available file descriptor slot was found
+    if (i == 50)
+        return -5;  // No available file descriptor slot
+
+    // Allocate memory for the file table entry
+    ft = (PFILETABLE)malloc(sizeof(FILETABLE));
+    if (ft == NULL)  // Check malloc success
+    {
+        printf("Memory allocation failed for file table entry.\n");
+        return -6;  // Memory allocation failed
+    }
+
+    temp = AllocateInode(name, permission);
+    if (temp == NULL)
+    {
+        free(ft);
+        return -4;  // No available inode for new file
+    }
+
+    // Initialize the file table entry
+    ft->count = 1;
+    ft->mode = permission;
+    ft->readoffset = 0;
+    ft->writeoffset = 0;
+    ResetReadahead(ft);
+    ft->WBuf = NULL;
+    ft->WBufSize = 0;
+    ft->WBufLen = 0;
+    ft->ReadLock = 0;
+
+    ft->ptrinode = temp;
+    temp->ReferenceCount = 1;
+    VersionEnd(temp);
+    SetFileTable(i, ft);
+
+    return i;  // Return the file descriptor index
+}
+
+/*
+ * Function: RemoveInode
+ * ---------------------
+ * Deletes a file whose last link is gone: its name is removed, every
+ * descriptor open on it is closed without flushing, and the inode with its
+ * data is retired (see RetireObject).
+ */
+void RemoveInode(PINODE inode)
+{
+    PFILETABLE ft = NULL;
+    int i = 0;
+
+    IndexRemove(inode);
+    __atomic_store_n(&inode->FileType, 0, __ATOMIC_RELAXED);  // Mark inode as unused, its data slot is reused once reclaimed
+    DropName(inode);
+    LogChange(inode, 0, 0, 0);
+
+    // Every descriptor of the file goes, shared file tables with the last of them
+    while(i < 50)
+    {
+        ft = UFDTArr[i].ptrfiletable;
+        if(ft != NULL && ft->ptrinode == inode)
+        {
+            SetFileTable(i, NULL);
+            if(--ft->count == 0)
+                RetireObject(NULL, ft);  // Buffered writes of a deleted file are dropped
+        }
+        i++;
+    }
+
+    // The data and the inode, and the free inode count, come back on reclamation
+    RetireObject(inode, NULL);
+}
+
+
+/*
+ * Function: DoRmFile
+ * ------------------
+ * Deletes the specified file from the virtual file system.
+ * Decreases its link count, and if it reaches zero, frees its resources
+ * (every descriptor open on it and their file tables, and marks inode and
+ * its data slot as free). The name and the descriptors go at once; the
+ * memory is retired and only freed when no read can still use it (see
+ * RetireObject).
+ *
+ * @param name - Name of the file to be deleted.
+ *
+ * @return 
+ *   0  : File successfully deleted or unlinked.
+ *  -1  : File not found (invalid name or not open).
+ *  -2  : File data is pinned by an outstanding read view.
+ */
+int DoRmFile(char *name)
+{
+    PINODE inode = NULL;
+    int fd = 0;
+
+    fd = GetFDFromName(name);
+    if(fd == -1)
+        return -1;  // File descriptor not found
+
+    if(Leased(UFDTArr[fd].ptrfiletable->ptrinode))
+        return -2;  // Buffer is still leased
+
+    // Decrease link count of the inode
+    (UFDTArr[fd].ptrfiletable->ptrinode->LinkCount)--;
+
+    // If no more links, delete the file
+    if(UFDTArr[fd].ptrfiletable->ptrinode->LinkCount == 0)
+    {
+        inode = UFDTArr[fd].ptrfiletable->ptrinode;
+        VersionBegin(inode);
+        RemoveInode(inode);
+        VersionEnd(inode);
+    }
+
+    // Set the file descriptor slot to NULL
+    SetFileTable(fd, NULL);
+
+    ReclaimRetired();
+
+    return 0;  // Success
+}
+
+
+/*
+ * Function: TruncateInode
+ * -----------------------
+ * Sets the size of a file, see truncate_File(). Descriptors positioned past
+ * the new end of file are moved back to it.
+ */
+void TruncateInode(PINODE inode, uint64_t size)
+{
+    uint64_t old = inode->FileActualSize, tail = 0;
+    int i = 0;
+
+    if (size < old && TierTruncate(inode, size) == 0)
+    {
+        // The part of the new last block past the end of file must read as zero
+        tail = BlocksOf(size) * BLOCKSIZE;
+        if (tail > old)
+            tail = old;
+        memset(InodeData(inode) + size, 0, tail - size);
+    }
+    if (size < old)
+    {
+        FreeBlocks(inode, BlocksOf(size), BlocksOf(old));
+        MarkBlocksDirty(inode, size, old - size);
+    }
+
+    inode->FileActualSize = size;
+    LogChange(inode, 0, 0, 0);
+
+    while (i < 50)
+    {
+        if (UFDTArr[i].ptrfiletable != NULL && UFDTArr[i].ptrfiletable->ptrinode == inode)
+        {
+            LockReads(UFDTArr[i].ptrfiletable);
+            if ((uint64_t)UFDTArr[i].ptrfiletable->readoffset > size)
+                UFDTArr[i].ptrfiletable->readoffset = size;
+            UnlockReads(UFDTArr[i].ptrfiletable);
+            if ((uint64_t)UFDTArr[i].ptrfiletable->writeoffset > size)
+                UFDTArr[i].ptrfiletable->writeoffset = size;
+        }
+        i++;
+    }
+}
+
+
+/*
+ * Function: WriteInodeAt
+ * ----------------------
+ * Copies `isize` bytes into a file at `offset` and grows the file if the
+ * data ends past its end. The range must fit in MAXFILESIZE and the data
+ * must be resident (see TierTouch). Nothing is demoted to make room: the
+ * caller enforces the memory budget once its changes are in (see
+ * WriteThrough, TxCommit), so a transaction's files stay resident while
+ * it is applied.
+ */
+void WriteInodeAt(PINODE inode, uint64_t offset, const char *arr, uint64_t isize)
+{
+    uint64_t end = offset + isize, size = 0;
+
+    memcpy(InodeData(inode) + offset, arr, isize);
+    AllocateBlocks(inode, offset, isize);
+    MarkBlocksDirty(inode, offset, isize);
+
+    // Grow the file only if the write ended past the current end of file
+    size = __atomic_load_n(&inode->FileActualSize, __ATOMIC_RELAXED);
+    while (end > size &&
+           !__atomic_compare_exchange_n(&inode->FileActualSize, &size, end,
+                                        true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+        ;
+}
+
+
+/*
+ * Function: WriteThrough
+ * ----------------------
+ * Writes data from the provided buffer into the file starting at the current write offset.
+ *
+ * On a descriptor opened with APPEND the data goes to the end of the file
+ * instead. The destination range is reserved by atomically advancing the
+ * inode's FileActualSize, so any number of appenders (on any descriptors)
+ * get disjoint ranges and copy their data concurrently without a lock.
+ *
+ * @param fd    - File descriptor of the file to write to.
+ * @param arr   - Data buffer to be written into the file.
+ * @param isize - Number of bytes to write.
+ *
+ * @return 
+ *  > 0  : Number of bytes successfully written.
+ *  -1   : Invalid file descriptor or write permission denied.
+ *  -2   : File has reached its maximum size.
+ *  -3   : File is not a regular file.
+ *  -4   : File data could not be read back from the spill file.
+ */
+int64_t WriteThrough(int fd, char *arr, uint64_t isize)
+{
+    PINODE inode = NULL;
+    uint64_t offset = 0, size = 0;
+
+    // Check if file is in correct mode for writing
+    if ((UFDTArr[fd].ptrfiletable->mode & WRITE) == 0)
+        return -1;  // Invalid mode for writing
+
+    // Check if user has write permission
+    if ((UFDTArr[fd].ptrfiletable->ptrinode->Permission != WRITE) && (UFDTArr[fd].ptrfiletable->ptrinode->Permission != (READ + WRITE)))
+        return -1;  // Permission denied
+
+    // Check if the file is of regular type
+    if (UFDTArr[fd].ptrfiletable->ptrinode->FileType != REGULAR)
+        return -3;  // Invalid file type
+
+    inode = UFDTArr[fd].ptrfiletable->ptrinode;
+    if (TierTouch(inode) != 0)
+        return -4;  // Spilled data unavailable
+
+    if (UFDTArr[fd].ptrfiletable->mode & APPEND)
+    {
+        // Reserve [offset, offset + isize) at the end of file
+        offset = __atomic_load_n(&inode->FileActualSize, __ATOMIC_RELAXED);
+        do
+        {
+            if (offset >= (uint64_t)MAXFILESIZE)
+                return -2;  // File is full
+            if (isize > MAXFILESIZE - offset)
+                isize = MAXFILESIZE - offset;
+        } while (!__atomic_compare_exchange_n(&inode->FileActualSize, &offset, offset + isize,
+                                              true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+        VersionBegin(inode);
+        memcpy(InodeData(inode) + offset, arr, isize);
+        AllocateBlocks(inode, offset, isize);
+        MarkBlocksDirty(inode, offset, isize);
+        VersionEnd(inode);
+        UFDTArr[fd].ptrfiletable->writeoffset = offset + isize;
+        EnforceBudget(inode);
+
+        return (int64_t)isize;
+    }
+
+    // Check if the file size exceeds the limit
+    if (UFDTArr[fd].ptrfiletable->writeoffset == MAXFILESIZE)
+        return -2;  // File is full
+
+    // Ensure we don't write past the maximum file size
+    if (isize > (uint64_t)(MAXFILESIZE - UFDTArr[fd].ptrfiletable->writeoffset))
+    {
+        isize = MAXFILESIZE - UFDTArr[fd].ptrfiletable->writeoffset;  // Adjust write size
+    }
+
+    // Write data into the buffer
+    size = inode->FileActualSize;
+    VersionBegin(inode);
+    WriteInodeAt(inode, UFDTArr[fd].ptrfiletable->writeoffset, arr, isize);
+    VersionEnd(inode);
+    if (inode->FileActualSize > size)
+        EnforceBudget(inode);  // The file grew, others may have to make room
+
+    // Update the write offset
+    UFDTArr[fd].ptrfiletable->writeoffset += isize;
+
+    return (int64_t)isize;  // Return the number of bytes written
+}
+
+
+/*
+ * Function: FlushFile
+ * -------------------
+ * Writes the data held in a descriptor's write-behind buffer to the file as
+ * one write (see WriteThrough) and empties the buffer.
+ *
+ * @param fd - File descriptor.
+ *
+ * @return
+ *  >= 0 : Number of bytes flushed.
+ *  -1   : Invalid file descriptor.
+ *  < -1 : Error of WriteThrough(); the data stays in the buffer.
+ */
+int64_t FlushFile(int fd)
+{
+    PFILETABLE ft = NULL;
+    int64_t ret = 0;
+
+    if (fd < 0 || fd >= 50 || UFDTArr[fd].ptrfiletable == NULL)
+        return -1;
+
+    ft = UFDTArr[fd].ptrfiletable;
+    if (ft->WBufLen == 0)
+        return 0;
+
+    ret = WriteThrough(fd, ft->WBuf, ft->WBufLen);
+    if (ret < 0)
+        return ret;
+
+    // Only a file that reached MAXFILESIZE takes less; the rest is dropped like a short write
+    ft->WBufLen = 0;
+    return ret;
+}
+
+
+/*
+ * Function: FlushInode
+ * --------------------
+ * Flushes the write-behind buffer of every descriptor open on an inode,
+ * before an operation that works on the file data directly.
+ */
+void FlushInode(PINODE inode)
+{
+    int i = 0;
+
+    while (i < 50)
+    {
+        if (UFDTArr[i].ptrfiletable != NULL && UFDTArr[i].ptrfiletable->ptrinode == inode)
+            FlushFile(i);
+        i++;
+    }
+}
+
+
+/*
+ * Function: SetWriteBuffer
+ * ------------------------
+ * Gives a descriptor a write-behind buffer of `size` bytes, or removes it
+ * when `size` is 0. Writes smaller than the buffer are then collected in it
+ * and reach the file as one large write when the buffer fills, on
+ * FlushFile(), on lseek and on close. Reads on the same descriptor flush
+ * first, so they see its writes; other descriptors, grep and export see
+ * them once flushed. A buffered descriptor must not be used by two threads
+ * at once. Data already buffered is flushed before the buffer changes.
+ *
+ * @param fd   - File descriptor opened for writing.
+ * @param size - Buffer size in bytes, at most WBUFMAX; 0 disables buffering.
+ *
+ * @return
+ *   0  : Buffer set.
+ *  -1  : Invalid file descriptor, not opened for writing, or no write permission.
+ *  -2  : Size is larger than WBUFMAX.
+ *  -3  : Memory allocation failure, or the buffered data could not be flushed.
+ */
+int SetWriteBuffer(int fd, uint64_t size)
+{
+    PFILETABLE ft = NULL;
+    char *buf = NULL;
+
+    if (fd < 0 || fd >= 50 || UFDTArr[fd].ptrfiletable == NULL)
+        return -1;
+
+    ft = UFDTArr[fd].ptrfiletable;
+    if ((ft->mode & WRITE) == 0 || (ft->ptrinode->Permission & WRITE) == 0 || ft->ptrinode->FileType != REGULAR)
+        return -1;
+    if (size > WBUFMAX)
+        return -2;
+
+    if (FlushFile(fd) < 0)
+        return -3;
+
+    if (size > 0)
+    {
+        buf = (char *)malloc(size);
+        if (buf == NULL)
+            return -3;
+    }
+
+    free(ft->WBuf);
+    ft->WBuf = buf;
+    ft->WBufSize = size;
+    ft->WBufLen = 0;
+
+    return 0;
+}
+
+
+/*
+ * Function: DoWriteFile
+ * ---------------------
+ * Writes data into the file at the current write offset. On a descriptor
+ * with a write-behind buffer (see SetWriteBuffer) a write that fits is only
+ * copied into the buffer, without any of the checks and updates of
+ * WriteThrough(); those run once per flush.
+ *
+ * @return Same as WriteThrough().
+ */
+int64_t DoWriteFile(int fd, char *arr, uint64_t isize)
+{
+    PFILETABLE ft = UFDTArr[fd].ptrfiletable;
+    int64_t ret = 0;
+
+    if (ft->WBuf == NULL)
+        return WriteThrough(fd, arr, isize);
+
+    // Buffered data must fit the file too, or the caller would see a late short write
+    if (isize <= ft->WBufSize - ft->WBufLen &&
+        (ft->mode & APPEND || ft->writeoffset + ft->WBufLen + isize <= (uint64_t)MAXFILESIZE))
+    {
+        memcpy(ft->WBuf + ft->WBufLen, arr, isize);
+        ft->WBufLen += isize;
+        return (int64_t)isize;
+    }
+
+    ret = FlushFile(fd);
+    if (ret < 0)
+        return ret;
+
+    if (isize < ft->WBufSize && ft->writeoffset + isize <= (uint64_t)MAXFILESIZE)
+    {
+        memcpy(ft->WBuf, arr, isize);
+        ft->WBufLen = isize;
+        return (int64_t)isize;
+    }
+
+    return WriteThrough(fd, arr, isize);
+}
+
+
+/*
+ * Function: ReadOpenFile
+ * ----------------------
+ * Copies data from an open file at its read offset, the part of DoReadFile()
+ * after the descriptor checks and the flush of its write-behind buffer. The
+ * file table is passed in, so a read without the lock (see ReadFileNoLock)
+ * keeps using the one it found even if the descriptor is closed meanwhile.
+ *
+ * @return Same as DoReadFile().
+ */
+int64_t ReadOpenFile(PFILETABLE ft, char *arr, uint64_t isize)
+{
+    PINODE inode = ft->ptrinode;
+    uint64_t read_size = 0, size = 0;
+
+    // Check if user has permission to read
+    if(inode->Permission != READ && inode->Permission != (READ + WRITE))
+        return -2;  // Permission denied
+
+    // The read offset and readahead state belong to this read until it is done
+    LockReads(ft);
+
+    // Check if read offset is at the end of the file (appenders grow it without the lock)
+    size = __atomic_load_n(&inode->FileActualSize, __ATOMIC_ACQUIRE);
+    if((uint64_t)ft->readoffset >= size)
+    {
+        UnlockReads(ft);
+        return -3;  // End of file reached
+    }
+
+    // Check if the file is of regular type (rm_File may be removing it meanwhile)
+    if(__atomic_load_n(&inode->FileType, __ATOMIC_RELAXED) != REGULAR)
+    {
+        UnlockReads(ft);
+        return -4;  // Invalid file type
+    }
+
+    if(TierTouch(inode) != 0)
+    {
+        UnlockReads(ft);
+        return -5;  // Spilled data unavailable
+    }
+
+    // Calculate the actual number of bytes to read
+    read_size = size - ft->readoffset;
+    
+    // Ensure we don't read beyond the available file data
+    if(read_size < isize)
+    {
+        // Copy the data into the provided buffer
+        memcpy(arr, InodeData(inode) + ft->readoffset, read_size);
+
+        // Update the read offset
+        ft->readoffset += read_size;
+    }
+    else
+    {
+        // Copy the exact amount requested
+        memcpy(arr, InodeData(inode) + ft->readoffset, isize);
+
+        // Update the read offset
+        ft->readoffset += isize;
+    }
+
+    read_size = read_size < isize ? read_size : isize;
+    Readahead(ft, ft->readoffset - (int64_t)read_size, read_size);
+    UnlockReads(ft);
+
+    // Return the actual number of bytes read
+    return (int64_t)read_size;
+}
+
+
+/*
+ * Function: DoReadFile
+ * --------------------
+ * Reads data from a file into the provided buffer, starting from the current read offset.
+ *
+ * @param fd    - File descriptor from which to read.
+ * @param arr   - Buffer where the read data will be stored.
+ * @param isize - Number of bytes to read.
+ *
+ * @return 
+ *  > 0  : Number of bytes actually read.
+ *  -1   : Invalid file descriptor or file not opened in readable mode.
+ *  -2   : Read permission denied.
+ *  -3   : End of file reached.
+ *  -4   : File is not a regular file.
+ *  -5   : File data could not be read back from the spill file.
+ */
+int64_t DoReadFile(int fd, char *arr, uint64_t isize)
+{
+    // Check if file descriptor is valid
+    if(UFDTArr[fd].ptrfiletable == NULL)
+        return -1;  // Invalid file descriptor
+
+    // Check if file is in read or read-write mode
+    if((UFDTArr[fd].ptrfiletable->mode & READ) == 0)
+        return -1;  // Invalid file mode
+
+    // Reads see the writes still held in this descriptor's buffer
+    if(UFDTArr[fd].ptrfiletable->WBufLen > 0 && FlushFile(fd) < 0)
+        return -5;
+
+    return ReadOpenFile(UFDTArr[fd].ptrfiletable, arr, isize);
+}
+
+
+/*
+ * Structure: viewlease
+ * --------------------
+ * A read-only view into a file's buffer returned by ReadView().
+ * While the lease is held the inode's LeaseCount keeps truncate_File()
+ * and rm_File() from discarding the data behind the view.
+ *
+ * Fields:
+ *  - ptrinode : Inode whose buffer is pinned.
+ *  - data     : First byte of the view (inside the inode's buffer).
+ *  - length   : Number of readable bytes at `data`.
+ */
+typedef struct viewlease
+{
+    PINODE ptrinode;
+    const char *data;
+    uint64_t length;
+}VIEWLEASE, *PVIEWLEASE;
+
+
+/*
+ * Function: DoReadView
+ * --------------------
+ * Zero-copy counterpart of ReadFile. Instead of copying into a caller buffer
+ * it returns a view directly into the file's data and advances the read
+ * offset. The view stays valid until ReleaseView() is called.
+ *
+ * @param fd    - File descriptor from which to read.
+ * @param isize - Maximum number of bytes to expose.
+ * @param lease - Receives the view.
+ *
+ * @return
+ *  > 0  : Number of bytes in the view.
+ *  -1   : Invalid file descriptor or file not opened in readable mode.
+ *  -2   : Read permission denied.
+ *  -3   : End of file reached.
+ *  -4   : File is not a regular file.
+ *  -5   : File data could not be read back from the spill file.
+ */
+int64_t DoReadView(int fd, uint64_t isize, PVIEWLEASE lease)
+{
+    PFILETABLE ft = NULL;
+    uint64_t read_size = 0;
+    int64_t ret = 0;
+
+    if (fd < 0 || fd >= 50 || lease == NULL || isize == 0)
+        return -1;
+
+    ft = UFDTArr[fd].ptrfiletable;
+    if (ft == NULL)
+        return -1;  // Invalid file descriptor
+
+    if ((ft->mode & READ) == 0)
+        return -1;  // Invalid file mode
+
+    if (ft->WBufLen > 0 && FlushFile(fd) < 0)
+        return -5;
+
+    if (ft->ptrinode->Permission != READ && ft->ptrinode->Permission != (READ + WRITE))
+        return -2;  // Permission denied
+
+    // Readers without the instance lock may share the descriptor
+    LockReads(ft);
+    if ((uint64_t)ft->readoffset >= ft->ptrinode->FileActualSize)
+        ret = -3;  // End of file reached
+    else if (ft->ptrinode->FileType != REGULAR)
+        ret = -4;  // Invalid file type
+    else if (TierTouch(ft->ptrinode) != 0)
+        ret = -5;  // Spilled data unavailable
+    if (ret != 0)
+    {
+        UnlockReads(ft);
+        return ret;
+    }
+
+    read_size = ft->ptrinode->FileActualSize - ft->readoffset;
+    if (read_size > isize)
+        read_size = isize;
+
+    lease->ptrinode = ft->ptrinode;
+    lease->data = InodeData(ft->ptrinode) + ft->readoffset;
+    lease->length = read_size;
+    TakeLease(ft->ptrinode);
+
+    ft->readoffset += read_size;
+    Readahead(ft, ft->readoffset - (int64_t)read_size, read_size);
+    UnlockReads(ft);
+
+    return (int64_t)read_size;
+}
+
+
+/*
+ * Function: ReleaseView
+ * ---------------------
+ * Drops a lease obtained from ReadView(). The view must not be used afterwards.
+ * Unlike ReadView() it needs no lock, so a view can outlive the locked
+ * section that took it (see TakeLease).
+ */
+void ReleaseView(PVIEWLEASE lease)
+{
+    if (lease == NULL || lease->ptrinode == NULL)
+        return;
+
+    DropLease(lease->ptrinode);
+    lease->ptrinode = NULL;
+    lease->data = NULL;
+    lease->length = 0;
+}
+
+
+/*
+ * Function: MapFile
+ * -----------------
+ * Returns a directly addressable region of a file's data so it can be parsed
+ * or patched in place. The descriptor's mode and the file's permission must
+ * allow every access in `prot`, exactly as ReadFile/WriteFile require.
+ * Read-only mappings must lie inside the file; writable mappings may extend
+ * up to MAXFILESIZE, the part past the current end of file reads as zeros.
+ * As with msync(2), stores through a writable mapping are published with
+ * MsyncFile(). The mapping pins the data like a read view until UnmapFile().
+ * Must be called with the instance locked, like MsyncFile() and UnmapFile(),
+ * which search the same mapping table.
+ *
+ * @param fd     - File descriptor of the file.
+ * @param offset - File offset of the first byte to map.
+ * @param length - Number of bytes to map.
+ * @param prot   - READ, WRITE or READ + WRITE.
+ *
+ * @return Address of the mapped region, or NULL on any error.
+ */
+char *MapFile(int fd, int64_t offset, uint64_t length, int prot)
+{
+    PFILETABLE ft = NULL;
+    PINODE inode = NULL;
+    int i = 0;
+
+    if (fd < 0 || fd >= 50 || offset < 0 || length == 0 || length > (uint64_t)MAXFILESIZE)
+        return NULL;
+    if (prot <= 0 || prot > (READ + WRITE))
+        return NULL;
+
+    ft = UFDTArr[fd].ptrfiletable;
+    if (ft == NULL)
+        return NULL;
+    inode = ft->ptrinode;
+
+    // Same mode and permission rules as ReadFile and WriteFile
+    if ((ft->mode & prot) != prot || (inode->Permission & prot) != prot)
+        return NULL;
+    if (inode->FileType != REGULAR)
+        return NULL;
+
+    if (offset > MAXFILESIZE - (int64_t)length)
+        return NULL;
+    FlushInode(inode);  // The mapping must see buffered writes
+    if ((prot & WRITE) == 0 && offset + length > inode->FileActualSize)
+        return NULL;
+
+    while (i < 50)
+    {
+        if (MapTab[i].ptrinode == NULL)
+            break;
+        i++;
+    }
+    if (i == 50)
+        return NULL;  // Mapping table full
+
+    if (TierTouch(inode) != 0)
+        return NULL;  // Spilled data unavailable
+
+    MapTab[i].ptrinode = inode;
+    MapTab[i].addr = InodeData(inode) + offset;
+    MapTab[i].offset = offset;
+    MapTab[i].length = length;
+    MapTab[i].prot = prot;
+    TakeLease(inode);
+
+    return MapTab[i].addr;
+}
+
+
+/*
+ * Function: MsyncFile
+ * -------------------
+ * Publishes the stores made to [addr, addr + length) through a writable
+ * mapping: the blocks of the range are marked dirty and allocated, and
+ * FileActualSize grows to the end of the range if that lies past the end of
+ * file. Only the range is examined, so the cost does not depend on the size
+ * of the mapping. Must be called with the instance locked.
+ *
+ * @param addr   - First byte written, inside a writable mapping from MapFile().
+ * @param length - Number of bytes written.
+ *
+ * @return
+ *   0  : Success.
+ *  -1  : The range is not inside a writable mapping returned by MapFile().
+ */
+int MsyncFile(char *addr, uint64_t length)
+{
+    PMAPPING m = NULL;
+    int64_t offset = 0;
+    int i = 0;
+
+    while (i < 50)
+    {
+        if (MapTab[i].ptrinode != NULL && (MapTab[i].prot & WRITE) && addr >= MapTab[i].addr &&
+            (uint64_t)(addr - MapTab[i].addr) <= MapTab[i].length &&
+            length <= MapTab[i].length - (uint64_t)(addr - MapTab[i].addr))
+            break;
+        i++;
+    }
+    if (i == 50)
+        return -1;
+
+    m = &MapTab[i];
+    if (length == 0)
+        return 0;
+
+    offset = m->offset + (addr - m->addr);
+
+    // Writes through the mapping count as a change from here on
+    VersionBegin(m->ptrinode);
+    MarkBlocksDirty(m->ptrinode, offset, length);
+    AllocateBlocks(m->ptrinode, offset, length);
+    if (offset + length > m->ptrinode->FileActualSize)
+        m->ptrinode->FileActualSize = offset + length;
+    VersionEnd(m->ptrinode);
+
+    return 0;
+}
+
+
+/*
+ * Function: UnmapFile
+ * -------------------
+ * Releases a mapping. Stores that were not published with MsyncFile() stay
+ * in the file's data but do not change its size or dirty bits. Must be
+ * called with the instance locked, like MapFile(), whose table it changes.
+ *
+ * @return
+ *   0  : Success.
+ *  -1  : `addr` is not a mapping returned by MapFile().
+ */
+int UnmapFile(char *addr)
+{
+    int i = 0;
+
+    while (i < 50)
+    {
+        if (MapTab[i].ptrinode != NULL && MapTab[i].addr == addr)
+            break;
+        i++;
+    }
+    if (i == 50)
+        return -1;
+
+    DropLease(MapTab[i].ptrinode);
+    MapTab[i].ptrinode = NULL;
+    MapTab[i].addr = NULL;
+
+    return 0;
+}
+
+
+
+/*
+ * Function: DoOpenFile
+ * --------------------
+ * Opens an existing file with the specified access mode and creates
+ * an entry in the User File Descriptor Table (UFDT).
+ *
+ * @param name - Name of the file to open.
+ * @param mode - Mode to open the file in (1 = Read, 2 = Write, 3 = Read + Write),
+ *               plus APPEND (4) to make every write go to the end of file.
+ *
+ * @return 
+ *  >= 0 : File descriptor index if the file is successfully opened.
+ *   -1  : Invalid parameters (null name or invalid mode).
+ *   -2  : File does not exist.
+ *   -3  : Permission denied.
+ *   -4  : No free file descriptor available.
+ *   -5  : Memory allocation failure.
+ */
+int DoOpenFile(char *name, int mode)
+{
+    int i = 0;
+    PINODE temp = NULL;
+    PFILETABLE ft = NULL;
+
+    // Check if the name is valid and mode is positive
+    if (name == NULL || mode <= 0 || mode > (READ + WRITE + APPEND))
+        return -1;  // Invalid input
+
+    // Appending only makes sense for writing
+    if ((mode & APPEND) && (mode & WRITE) == 0)
+        return -1;  // Invalid input
+
+    // Get inode based on file name
+    temp = Get_Inode(name);
+    if (temp == NULL)
+        return -2;  // File not found
+
+    // Check if the file has the required permission
+    if ((temp->Permission & mode & (READ + WRITE)) != (mode & (READ + WRITE)))
+        return -3;  // Permission denied
+
+    // Find an empty slot in UFDT array
+    while (i < 50)
+    {
+        if (UFDTArr[i].ptrfiletable == NULL)
+            break;
+        i++;
+    }
+
+    // If no free slots available in UFDT array
+    if (i == 50)
+        return -4;  // No free file descriptor
+
+    // Allocate memory for the file table entry
+    ft = (PFILETABLE)malloc(sizeof(FILETABLE));
+    if (ft == NULL)
+        return -5;  // Memory allocation failure
+
+    // Initialize the file table entry
+    ft->count = 1;
+    ft->mode = mode;
+    ResetReadahead(ft);
+    ft->WBuf = NULL;
+    ft->WBufSize = 0;
+    ft->WBufLen = 0;
+    ft->ReadLock = 0;
+
+    // Initialize read and write offsets based on the mode
+    if ((mode & (READ + WRITE)) == (READ + WRITE))
+    {
+        ft->readoffset = 0;
+        ft->writeoffset = 0;
+    }
+    else if ((mode & (READ + WRITE)) == READ)
+    {
+        ft->readoffset = 0;
+    }
+    else if ((mode & (READ + WRITE)) == WRITE)
+    {
+        ft->writeoffset = 0;
+    }
+
+    // Link the file table entry to the inode
+    ft->ptrinode = temp;
+
+    // Increment the reference count of the inode
+    ft->ptrinode->ReferenceCount++;
+    SetFileTable(i, ft);
+
+    return i;  // Return the file descriptor index
+}
+
+
+/*
+ * Function: CloseFileByName
+ * -------------------------
+ * Closes the given file descriptor. The file table entry it refers to may be
+ * shared with other descriptors (see DupFile); its `count` is decreased and
+ * only the last descriptor frees it, after flushing its write-behind buffer
+ * and dropping the inode's reference count. The memory is retired rather
+ * than freed (see RetireObject).
+ *
+ * @param fd - File descriptor of the file to close.
+ */
+void CloseFileByName(int fd)
+{
+    PFILETABLE ft = NULL;
+    uint64_t start = 0;
+
+    if (fd < 0 || fd >= 50 || UFDTArr[fd].ptrfiletable == NULL)
+        return;
+    start = TraceBegin();
+
+    ft = UFDTArr[fd].ptrfiletable;
+    if (ft->count == 1)
+    {
+        // Buffered writes reach the file before the open file goes away
+        FlushFile(fd);
+        LockReads(ft);
+        EndReadahead(ft);
+        UnlockReads(ft);
+
+        (ft->ptrinode->ReferenceCount)--;
+        SetFileTable(fd, NULL);
+        RetireObject(NULL, ft);  // A read without the lock may still be using it
+        ReclaimRetired();
+    }
+    else
+    {
+        ft->count--;  // Other descriptors keep the offsets and the buffer
+        SetFileTable(fd, NULL);
+    }
+
+    TraceEnd(start, OP_CLOSE, fd, NULL, 0, 0, 0);
+}
+
+
+
+/*
+ * Function: CloseFileByName
+ * -------------------------
+ * Closes the file with the given name by locating its file descriptor
+ * and delegating to the descriptor-based close function.
+ *
+ * @param name - Name of the file to be closed.
+ *
+ * @return 
+ *   0  : File closed successfully.
+ *  -1  : File not found (invalid or unopened).
+ */
+
+int CloseFileByName(char *name)
+{
+    int i = 0;
+    i = GetFDFromName(name);
+
+    if (i == -1)
+        return -1;  // File not found
+
+    // Close the file by its index
+    CloseFileByName(i);
+
+    return 0;
+}
+
+
+
+/*
+ * Function: CloseAllFile
+ * ----------------------
+ * Closes all currently opened files in the system by iterating through
+ * the User File Descriptor Table (UFDT) and calling the file-close function
+ * for each active entry.
+ *
+ * This helps to release resources and reset the system state.
+ */
+void CloseAllFile()
+{
+    int i = 0;
+    while (i < 50)
+    {
+        if (UFDTArr[i].ptrfiletable != NULL)
+        {
+            CloseFileByName(i);  // Close file at index i
+        }
+        i++;
+    }
+}
+
+
+
+/*
+ * Function: DupFile
+ * -----------------
+ * Makes the lowest free file descriptor refer to the same file table entry
+ * as `fd`, like dup(): both share the read and write offsets, the mode and
+ * the write-behind buffer. No lookup or allocation is done; the entry's
+ * `count` tracks the descriptors that share it.
+ *
+ * @param fd - Open file descriptor.
+ *
+ * @return
+ *  >= 0 : The new file descriptor.
+ *   -1  : Invalid file descriptor.
+ *   -2  : No free file descriptor available.
+ */
+int DupFile(int fd)
+{
+    int i = 0;
+
+    if (fd < 0 || fd >= 50 || UFDTArr[fd].ptrfiletable == NULL)
+        return -1;
+
+    while (i < 50)
+    {
+        if (UFDTArr[i].ptrfiletable == NULL)
+            break;
+        i++;
+    }
+    if (i == 50)
+        return -2;  // No free file descriptor
+
+    UFDTArr[fd].ptrfiletable->count++;
+    SetFileTable(i, UFDTArr[fd].ptrfiletable);
+
+    return i;
+}
+
+
+/*
+ * Function: Dup2File
+ * ------------------
+ * Like DupFile(), but the new descriptor is `newfd`, which is closed first
+ * if it is open, like dup2(). Nothing happens when `newfd` equals `fd`.
+ *
+ * @param fd    - Open file descriptor.
+ * @param newfd - Descriptor to make refer to the same file table entry.
+ *
+ * @return
+ *  >= 0 : `newfd`.
+ *   -1  : Invalid file descriptor.
+ */
+int Dup2File(int fd, int newfd)
+{
+    if (fd < 0 || fd >= 50 || UFDTArr[fd].ptrfiletable == NULL)
+        return -1;
+    if (newfd < 0 || newfd >= 50)
+        return -1;
+
+    if (newfd == fd)
+        return newfd;
+
+    if (UFDTArr[newfd].ptrfiletable != NULL)
+        CloseFileByName(newfd);
+
+    UFDTArr[fd].ptrfiletable->count++;
+    SetFileTable(newfd, UFDTArr[fd].ptrfiletable);
+
+    return newfd;
+}
+
+
+/*
+ * Structure: txjournal
+ * --------------------
+ * Header of the commit journal of a shared instance. TxCommit() writes the
+ * operations of a transaction after it, sets State and only then applies
+ * them; if the process dies before State is cleared, the next process to
+ * lock the instance applies them again (see RecoverVFS). Every operation
+ * can be applied twice with the same result.
+ *
+ * Fields:
+ *  - State  : 1 while a complete journal is being applied, 0 otherwise.
+ *  - Count  : Number of records.
+ *  - Length : Bytes of records after the header.
+ */
+typedef struct txjournal
+{
+    uint32_t State;
+    uint32_t Count;
+    uint64_t Length;
+}TXJOURNAL, *PTXJOURNAL;
+
+
+/*
+ * Structure: txrecord
+ * -------------------
+ * One operation in the commit journal, followed by the NUL-terminated file
+ * name and, for TX_WRITE, Length bytes of data (see TxRecordSize).
+ *
+ * Fields:
+ *  - Op         : TX_CREATE, TX_WRITE, TX_TRUNCATE or TX_RM.
+ *  - Permission : Permission of a created file.
+ *  - NameLength : Length of the name, without the NUL.
+ *  - Offset     : Offset of written data.
+ *  - Length     : Bytes written, or the new size of a truncated file.
+ */
+typedef struct txrecord
+{
+    int32_t Op;
+    int32_t Permission;
+    uint32_t NameLength;
+    uint64_t Offset;
+    uint64_t Length;
+}TXRECORD, *PTXRECORD;
+
+
+/*
+ * Function: TxRecordSize
+ * ----------------------
+ * @return Bytes a record takes in the journal, padded to 8 bytes.
+ */
+uint64_t TxRecordSize(int op, uint64_t namelength, uint64_t length)
+{
+    uint64_t size = sizeof(TXRECORD) + namelength + 1;
+
+    if (op == TX_WRITE)
+        size += length;
+
+    return (size + 7) & ~(uint64_t)7;
+}
+
+
+/*
+ * Function: ApplyTxOp
+ * -------------------
+ * Applies one operation of a committing transaction to the file `name`.
+ * The caller holds the lock and has checked that the operation fits (see
+ * TxCommit). The file's version is left odd.
+ *
+ * A create of a file that exists only happens when a journal is applied a
+ * second time; the file is emptied instead, as the create had done.
+ *
+ * @return 0 on success, -1 if the change could not be made.
+ */
+int ApplyTxOp(int op, char *name, int permission, uint64_t offset, uint64_t length, const char *data)
+{
+    PINODE inode = Get_Inode(name);
+
+    if (inode != NULL)
+        VersionBegin(inode);
+
+    switch (op)
+    {
+        case TX_CREATE:
+            if (inode != NULL)
+            {
+                TruncateInode(inode, 0);
+                inode->Permission = permission;
+                return 0;
+            }
+            if (SUPERBLOCKobj.FreeInodes == 0)
+                AwaitFreeInode();
+            return AllocateInode(name, permission) == NULL ? -1 : 0;
+
+        case TX_WRITE:
+            if (inode == NULL || EnsureResident(inode) != 0)
+                return -1;
+            WriteInodeAt(inode, offset, data, length);
+            return 0;
+
+        case TX_TRUNCATE:
+            if (inode == NULL)
+                return -1;
+            TruncateInode(inode, length);
+            return 0;
+
+        case TX_RM:
+            if (inode != NULL)
+                RemoveInode(inode);
+            return 0;
+    }
+
+    return -1;
+}
+
+
+/*
+ * Function: ApplyJournal
+ * ----------------------
+ * Applies every record of the commit journal, in order.
+ *
+ * @return 0 on success, -1 if a record could not be applied.
+ */
+int ApplyJournal()
+{
+    PTXJOURNAL journal = (PTXJOURNAL)CurrentVFS->Journal;
+    char *p = CurrentVFS->Journal + sizeof(TXJOURNAL);
+    PTXRECORD rec = NULL;
+    uint32_t i = 0;
+    int ret = 0;
+
+    while (i < journal->Count)
+    {
+        rec = (PTXRECORD)p;
+        if (ApplyTxOp(rec->Op, p + sizeof(TXRECORD), rec->Permission, rec->Offset, rec->Length,
+                      p + sizeof(TXRECORD) + rec->NameLength + 1) != 0)
+            ret = -1;
+        p += TxRecordSize(rec->Op, rec->NameLength, rec->Length);
+        i++;
+    }
+
+    return ret;
+}
+
+
+/*
+ * Function: RecoverVFS
+ * --------------------
+ * Called when the lock of a shared instance is acquired after its previous
+ * owner died. Metadata that is derived from the inode table is recomputed so
+ * that a half-finished create or rm of the dead process does not leak inodes,
+ * and a transaction whose commit had been journalled is applied in full.
+ */
+void RecoverVFS()
+{
+    PINODE temp = head;
+    PTXJOURNAL journal = (PTXJOURNAL)CurrentVFS->Journal;
+    int used = 0;
+    long bytes = 0;
+    uint64_t names = 0;
+
+    // Lookups without the lock would retry forever on a change left half-done
+    if (CurrentVFS->Names->Seq & 1)
+        CurrentVFS->Names->Seq++;
+
+    while (temp != NULL)
+    {
+        if (temp->FileType != 0)
+        {
+            used++;
+            bytes += (long)temp->AllocatedBlocks * BLOCKSIZE;
+            names += NameEntrySize(strlen(InodeName(temp)));
+        }
+        temp = NextInode(temp);
+    }
+    CurrentVFS->Names->ArenaGarbage = CurrentVFS->Names->ArenaUsed - names;
+
+    SUPERBLOCKobj.TotalInodes = MAXINODE;
+    SUPERBLOCKobj.FreeInodes = MAXINODE - used;
+    SUPERBLOCKobj.FreeHint = 0;
+    SUPERBLOCKobj.TotalBytes = (long)MAXINODE * MAXFILESIZE;
+    SUPERBLOCKobj.FreeBytes = SUPERBLOCKobj.TotalBytes - bytes;
+
+    // The dead process may have been shifting the name index
+    RebuildNameIndex();
+
+    // A transaction it was committing is finished for it
+    if (journal != NULL && journal->State == 1)
+    {
+        ApplyJournal();
+        journal->State = 0;
+    }
+
+    // So are the changes of files it had begun
+    temp = head;
+    while (temp != NULL)
+    {
+        if (*InodeVersion(temp) & 1)
+            VersionEnd(temp);
+        temp = NextInode(temp);
+    }
+}
+
+
+/*
+ * Function: LockVFS
+ * -----------------
+ * Locks the current instance. For a shared instance the mutex is robust:
+ * if its owner crashed while holding it the state is repaired and the lock
+ * is handed to the caller, so the file system never stays locked.
+ */
+void LockVFS()
+{
+    if (pthread_mutex_lock(CurrentVFS->Lock) == EOWNERDEAD)
+    {
+        RecoverVFS();
+        pthread_mutex_consistent(CurrentVFS->Lock);
+    }
+}
+
+
+/*
+ * Function: TryLockVFS
+ * --------------------
+ * @return 0 if the lock was acquired, non-zero if it is held by someone else.
+ */
+int TryLockVFS()
+{
+    int ret = pthread_mutex_trylock(CurrentVFS->Lock);
+
+    if (ret == EOWNERDEAD)
+    {
+        RecoverVFS();
+        pthread_mutex_consistent(CurrentVFS->Lock);
+        ret = 0;
+    }
+
+    return ret;
+}
+
+
+/*
+ * Function: UnlockVFS
+ * -------------------
+ * Releases the lock taken by LockVFS() or TryLockVFS().
+ */
+void UnlockVFS()
+{
+    pthread_mutex_unlock(CurrentVFS->Lock);
+}
+
+
+/*
+ * Class: VfsGuard
+ * ---------------
+ * Holds the lock of the current instance for the lifetime of the object.
+ */
+class VfsGuard
+{
+public:
+    VfsGuard()
+    {
+        LockVFS();
+    }
+
+    ~VfsGuard()
+    {
+        UnlockVFS();
+    }
+};
+
+
+/*
+ * Transactions
+ * ------------
+ * A transaction groups creates, writes, truncates and deletes of several
+ * files, by name. They are staged in the TRANSACTION, where only its own
+ * TxRead() sees them, and TxCommit() applies all of them at once under the
+ * instance lock, or none if another thread changed one of the files since
+ * the transaction first used it (optimistic concurrency control).
+ *
+ * The first use of a file records its version (see InodeVersion). TxRead()
+ * copies committed data without the lock and then checks that none of the
+ * recorded versions moved, so every read of a transaction sees the files as
+ * they were at one moment, with the transaction's own changes on top, and
+ * never waits for a writer; a read that finds a moved version fails with
+ * -5 and the transaction has to start over. TxCommit() checks the versions
+ * again under the lock and keeps them odd while it applies the changes, so
+ * no transaction reads a half-applied commit. Reads through descriptors
+ * take the lock and see a commit whole, except ReadFileNoLock() and
+ * mappings, which do not check versions.
+ *
+ * On a shared instance a commit is written to the journal in the segment
+ * before it is applied, so a commit cut short by the death of its process
+ * is completed by the next process to lock the instance (see RecoverVFS).
+ * A private instance dies with its process and needs no journal.
+ *
+ * A transaction is used by one thread. TxCommit() and TxAbort() free it.
+ */
+
+/*
+ * Structure: txop
+ * ---------------
+ * One staged operation of a transaction.
+ *
+ * Fields:
+ *  - Op         : TX_CREATE, TX_WRITE, TX_TRUNCATE or TX_RM.
+ *  - File       : Index of the file in the transaction's Files.
+ *  - Permission : Permission of a created file.
+ *  - Offset     : Offset of written data.
+ *  - Length     : Bytes written, or the new size of a truncated file.
+ *  - Data       : Copy of the written data.
+ *  - next       : Next operation, in the order they were staged.
+ */
+typedef struct txop
+{
+    int Op;
+    int File;
+    int Permission;
+    uint64_t Offset;
+    uint64_t Length;
+    char *Data;
+    struct txop *next;
+}TXOP, *PTXOP;
+
+
+/*
+ * Structure: txfile
+ * -----------------
+ * A file used by a transaction: what it was when the transaction first used
+ * it, and what it is with the staged operations applied.
+ *
+ * Fields:
+ *  - Name          : The file name.
+ *  - Inode         : Inode table index of the committed file, -1 if there was none.
+ *  - Version       : Version of that inode (see InodeVersion).
+ *  - CommittedSize : Size of the committed file.
+ *  - Exists        : Non-zero if the file exists for the transaction.
+ *  - Size          : Size of the file for the transaction.
+ *  - Permission    : Permission of the file for the transaction.
+ */
+typedef struct txfile
+{
+    char *Name;
+    int Inode;
+    uint64_t Version;
+    uint64_t CommittedSize;
+    int Exists;
+    uint64_t Size;
+    int Permission;
+}TXFILE, *PTXFILE;
+
+
+/*
+ * Structure: transaction
+ * ----------------------
+ * State of one transaction, see TxBegin().
+ *
+ * Fields:
+ *  - Files        : The files the transaction used.
+ *  - FileCount    : Number of entries in Files.
+ *  - Ops, LastOp  : The staged operations, oldest first.
+ *  - JournalBytes : Journal space the operations take (see TxRecordSize).
+ */
+typedef struct transaction
+{
+    TXFILE Files[TXMAXFILES];
+    int FileCount;
+    PTXOP Ops;
+    PTXOP LastOp;
+    uint64_t JournalBytes;
+}TRANSACTION, *PTRANSACTION;
+
+
+/*
+ * Function: LookupNoLock
+ * ----------------------
+ * Get_Inode() for a caller that does not hold the lock. The search is
+ * retried while the name index is being changed (see IndexBegin); reads of
+ * the index are bounds-checked, as they may see it half-changed before the
+ * retry. After TXSPINS tries the lock is taken.
+ *
+ * @return The inode of the file, or NULL if there is none.
+ */
+PINODE LookupNoLock(const char *name)
+{
+    PNAMEINDEX names = CurrentVFS->Names;
+    PINODE ret = NULL;
+    uint64_t seq = 0, offset = 0;
+    int tries = 0, low = 0, high = 0, mid = 0, found = 0, cmp = 0;
+
+    while (tries < TXSPINS)
+    {
+        seq = __atomic_load_n(&names->Seq, __ATOMIC_ACQUIRE);
+        if ((seq & 1) == 0)
+        {
+            low = 0;
+            high = __atomic_load_n(&names->Count, __ATOMIC_RELAXED);
+            high = high < 0 ? 0 : high > MAXINODE ? MAXINODE : high;
+            found = -1;
+            while (low < high)
+            {
+                mid = (low + high) / 2;
+                offset = __atomic_load_n(&names->Entries[mid].NameOffset, __ATOMIC_RELAXED) + sizeof(uint32_t);
+                if (offset >= NAMEARENASIZE)
+                    break;
+                cmp = strncmp(CurrentVFS->NameBase + offset, name, NAMEARENASIZE - offset);
+                if (cmp == 0)
+                {
+                    found = __atomic_load_n(&names->Entries[mid].Inode, __ATOMIC_RELAXED);
+                    break;
+                }
+                if (cmp < 0)
+                    low = mid + 1;
+                else
+                    high = mid;
+            }
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&names->Seq, __ATOMIC_RELAXED) == seq)
+                return found >= 0 && found < MAXINODE ? &CurrentVFS->InodeTable[found] : NULL;
+        }
+        tries++;
+        sched_yield();
+    }
+
+    LockVFS();
+    ret = Get_Inode((char *)name);
+    UnlockVFS();
+
+    return ret;
+}
+
+
+/*
+ * Function: TxSnapshot
+ * --------------------
+ * Records the committed state of a file the transaction uses for the first
+ * time: whether it exists and, if so, its inode, version, size and
+ * permission, all from one moment.
+ *
+ * @return 0 on success, -5 if the file kept changing.
+ */
+int TxSnapshot(PTXFILE f)
+{
+    PINODE inode = NULL;
+    uint64_t version = 0;
+    int tries = 0;
+
+    while (tries < TXSPINS)
+    {
+        inode = LookupNoLock(f->Name);
+        if (inode == NULL)
+        {
+            f->Inode = -1;
+            f->Version = 0;
+            f->CommittedSize = 0;
+            f->Exists = 0;
+            f->Size = 0;
+            f->Permission = 0;
+            return 0;
+        }
+
+        version = __atomic_load_n(InodeVersion(inode), __ATOMIC_ACQUIRE);
+        if ((version & 1) == 0)
+        {
+            f->CommittedSize = __atomic_load_n(&inode->FileActualSize, __ATOMIC_RELAXED);
+            f->Permission = __atomic_load_n(&inode->Permission, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+            // The inode may have been reused for another file since the lookup
+            if (__atomic_load_n(InodeVersion(inode), __ATOMIC_RELAXED) == version &&
+                LookupNoLock(f->Name) == inode)
+            {
+                f->Inode = InodeNumber(inode) - 1;
+                f->Version = version;
+                f->Exists = 1;
+                f->Size = f->CommittedSize;
+                return 0;
+            }
+        }
+        tries++;
+        sched_yield();
+    }
+
+    return -5;
+}
+
+
+/*
+ * Function: TxValidate
+ * --------------------
+ * Checks without the lock that no file the transaction used has changed
+ * since it was first used: the recorded versions still hold and files that
+ * did not exist still do not.
+ *
+ * @return 0 if the transaction's view is still current, -5 otherwise.
+ */
+int TxValidate(PTRANSACTION tx)
+{
+    PTXFILE f = NULL;
+    int i = 0;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);  // Copies made before are covered by the versions read below
+    while (i < tx->FileCount)
+    {
+        f = &tx->Files[i];
+        if (f->Inode >= 0)
+        {
+            if (__atomic_load_n(InodeVersion(&CurrentVFS->InodeTable[f->Inode]), __ATOMIC_RELAXED) != f->Version)
+                return -5;
+        }
+        else if (LookupNoLock(f->Name) != NULL)
+            return -5;
+        i++;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Function: TxFile
+ * ----------------
+ * Finds a file in the transaction, adding it on first use.
+ *
+ * @return
+ *  >= 0 : Index of the file in Files.
+ *   -4  : The transaction uses TXMAXFILES files already, or out of memory.
+ *   -5  : The files changed since the transaction used them; it has to be retried.
+ */
+int TxFile(PTRANSACTION tx, const char *name)
+{
+    PTXFILE f = NULL;
+    int i = 0;
+
+    while (i < tx->FileCount)
+    {
+        if (strcmp(tx->Files[i].Name, name) == 0)
+            return i;
+        i++;
+    }
+
+    if (tx->FileCount == TXMAXFILES)
+        return -4;
+
+    f = &tx->Files[tx->FileCount];
+    f->Name = strdup(name);
+    if (f->Name == NULL)
+        return -4;
+    if (TxSnapshot(f) != 0)
+    {
+        free(f->Name);
+        return -5;
+    }
+    tx->FileCount++;
+
+    // The new file has to belong to the same moment as the others
+    if (TxValidate(tx) != 0)
+        return -5;
+
+    return i;
+}
+
+
+/*
+ * Function: TxStage
+ * -----------------
+ * Appends an operation to the transaction; TX_WRITE data is copied.
+ *
+ * @return 0 on success, -4 if out of memory.
+ */
+int TxStage(PTRANSACTION tx, int op, int file, int permission, uint64_t offset, uint64_t length, const char *data)
+{
+    PTXOP newop = (PTXOP)malloc(sizeof(TXOP));
+
+    if (newop == NULL)
+        return -4;
+
+    newop->Data = NULL;
+    if (op == TX_WRITE)
+    {
+        newop->Data = (char *)malloc(length);
+        if (newop->Data == NULL)
+        {
+            free(newop);
+            return -4;
+        }
+        memcpy(newop->Data, data, length);
+    }
+
+    newop->Op = op;
+    newop->File = file;
+    newop->Permission = permission;
+    newop->Offset = offset;
+    newop->Length = length;
+    newop->next = NULL;
+
+    if (tx->LastOp == NULL)
+        tx->Ops = newop;
+    else
+        tx->LastOp->next = newop;
+    tx->LastOp = newop;
+    tx->JournalBytes += TxRecordSize(op, strlen(tx->Files[file].Name), length);
+
+    return 0;
+}
+
+
+/*
+ * Function: TxBegin
+ * -----------------
+ * Starts an empty transaction.
+ */
+void TxBegin(PTRANSACTION tx)
+{
+    tx->FileCount = 0;
+    tx->Ops = NULL;
+    tx->LastOp = NULL;
+    tx->JournalBytes = 0;
+}
+
+
+/*
+ * Function: TxAbort
+ * -----------------
+ * Drops the staged operations of a transaction and frees it.
+ */
+void TxAbort(PTRANSACTION tx)
+{
+    PTXOP op = tx->Ops, next = NULL;
+    int i = 0;
+
+    while (op != NULL)
+    {
+        next = op->next;
+        free(op->Data);
+        free(op);
+        op = next;
+    }
+
+    while (i < tx->FileCount)
+    {
+        free(tx->Files[i].Name);
+        i++;
+    }
+
+    TxBegin(tx);
+}
+
+
+/*
+ * Function: TxCreate
+ * ------------------
+ * Stages the creation of an empty regular file, like CreateFile() but
+ * without opening it.
+ *
+ * @param tx         - The transaction.
+ * @param name       - The name of the new file.
+ * @param permission - Access permission (1 = Read, 2 = Write, 3 = Read + Write).
+ *
+ * @return
+ *   0  : Staged.
+ *  -1  : Invalid parameters.
+ *  -3  : File with the same name already exists.
+ *  -4  : Transaction full, or out of memory.
+ *  -5  : Conflict; the transaction has to be aborted and retried.
+ */
+int TxCreate(PTRANSACTION tx, char *name, int permission)
+{
+    PTXFILE f = NULL;
+    int i = 0;
+
+    if (name == NULL || permission <= 0 || permission > 3)
+        return -1;
+
+    i = TxFile(tx, name);
+    if (i < 0)
+        return i;
+
+    f = &tx->Files[i];
+    if (f->Exists)
+        return -3;
+    if (TxStage(tx, TX_CREATE, i, permission, 0, 0, NULL) != 0)
+        return -4;
+
+    f->Exists = 1;
+    f->Size = 0;
+    f->Permission = permission;
+
+    return 0;
+}
+
+
+/*
+ * Function: TxWrite
+ * -----------------
+ * Stages a write of `isize` bytes at `offset` of a file, like pwrite().
+ *
+ * @return
+ *  >= 0 : Number of bytes staged.
+ *   -1  : Invalid parameters, file not found, or no write permission.
+ *   -2  : The write would end past MAXFILESIZE.
+ *   -4  : Transaction full, or out of memory.
+ *   -5  : Conflict; the transaction has to be aborted and retried.
+ */
+int64_t TxWrite(PTRANSACTION tx, char *name, uint64_t offset, char *arr, uint64_t isize)
+{
+    PTXFILE f = NULL;
+    int i = 0;
+
+    if (name == NULL || (arr == NULL && isize > 0))
+        return -1;
+
+    i = TxFile(tx, name);
+    if (i < 0)
+        return i;
+
+    f = &tx->Files[i];
+    if (!f->Exists || (f->Permission & WRITE) == 0)
+        return -1;
+    if (offset > (uint64_t)MAXFILESIZE || isize > MAXFILESIZE - offset)
+        return -2;
+    if (isize == 0)
+        return 0;
+    if (TxStage(tx, TX_WRITE, i, 0, offset, isize, arr) != 0)
+        return -4;
+
+    if (offset + isize > f->Size)
+        f->Size = offset + isize;
+
+    return (int64_t)isize;
+}
+
+
+/*
+ * Function: TxTruncate
+ * --------------------
+ * Stages setting the size of a file, like truncate_File().
+ *
+ * @return
+ *   0  : Staged.
+ *  -1  : Invalid parameters or file not found.
+ *  -3  : Size is larger than MAXFILESIZE.
+ *  -4  : Transaction full, or out of memory.
+ *  -5  : Conflict; the transaction has to be aborted and retried.
+ */
+int TxTruncate(PTRANSACTION tx, char *name, uint64_t size)
+{
+    PTXFILE f = NULL;
+    int i = 0;
+
+    if (name == NULL)
+        return -1;
+
+    i = TxFile(tx, name);
+    if (i < 0)
+        return i;
+
+    f = &tx->Files[i];
+    if (!f->Exists)
+        return -1;
+    if (size > (uint64_t)MAXFILESIZE)
+        return -3;
+    if (TxStage(tx, TX_TRUNCATE, i, 0, 0, size, NULL) != 0)
+        return -4;
+
+    f->Size = size;
+
+    return 0;
+}
+
+
+/*
+ * Function: TxRm
+ * --------------
+ * Stages deleting a file, like rm_File(); the file need not be open.
+ *
+ * @return
+ *   0  : Staged.
+ *  -1  : Invalid parameters or file not found.
+ *  -4  : Transaction full, or out of memory.
+ *  -5  : Conflict; the transaction has to be aborted and retried.
+ */
+int TxRm(PTRANSACTION tx, char *name)
+{
+    PTXFILE f = NULL;
+    int i = 0;
+
+    if (name == NULL)
+        return -1;
+
+    i = TxFile(tx, name);
+    if (i < 0)
+        return i;
+
+    f = &tx->Files[i];
+    if (!f->Exists)
+        return -1;
+    if (TxStage(tx, TX_RM, i, 0, 0, 0, NULL) != 0)
+        return -4;
+
+    f->Exists = 0;
+    f->Size = 0;
+
+    return 0;
+}
+
+
+/*
+ * Function: TxCopy
+ * ----------------
+ * Copies committed data of a file the transaction recorded. Data of a
+ * tiered instance may have to be read back from the spill file, which
+ * takes the lock.
+ *
+ * @return 0 on success, -4 if spilled data could not be read, -5 if the file changed.
+ */
+int TxCopy(PTXFILE f, uint64_t offset, char *arr, uint64_t length)
+{
+    PINODE inode = &CurrentVFS->InodeTable[f->Inode];
+    int ret = 0;
+
+    if (CurrentVFS->Tier == NULL)
+    {
+        memcpy(arr, InodeData(inode) + offset, length);
+        return 0;
+    }
+
+    LockVFS();
+    if (*InodeVersion(inode) != f->Version)
+        ret = -5;
+    else if (TierTouch(inode) != 0)
+        ret = -4;
+    else
+        memcpy(arr, InodeData(inode) + offset, length);
+    UnlockVFS();
+
+    return ret;
+}
+
+
+/*
+ * Function: TxRead
+ * ----------------
+ * Reads up to `isize` bytes at `offset` of a file as the transaction sees
+ * it: the committed data as of the transaction's snapshot, with the staged
+ * operations on the file applied in order. Does not take the lock, except
+ * for spilled data.
+ *
+ * @return
+ *  > 0  : Number of bytes read.
+ *  -1   : Invalid parameters or file not found.
+ *  -2   : Read permission denied.
+ *  -3   : Offset is at or past the end of file.
+ *  -4   : Transaction full, out of memory, or spilled data could not be read.
+ *  -5   : Conflict; the transaction has to be aborted and retried.
+ */
+int64_t TxRead(PTRANSACTION tx, char *name, uint64_t offset, char *arr, uint64_t isize)
+{
+    PTXFILE f = NULL;
+    PTXOP op = NULL;
+    uint64_t n = 0, base = 0, from = 0, to = 0;
+    int i = 0, ret = 0;
+
+    if (name == NULL || arr == NULL)
+        return -1;
+
+    i = TxFile(tx, name);
+    if (i < 0)
+        return i;
+
+    f = &tx->Files[i];
+    if (!f->Exists)
+        return -1;
+    if ((f->Permission & READ) == 0)
+        return -2;
+    if (offset >= f->Size)
+        return -3;
+    n = f->Size - offset < isize ? f->Size - offset : isize;
+
+    // Committed data first, checked against the snapshot once copied
+    if (f->Inode >= 0 && offset < f->CommittedSize)
+        base = f->CommittedSize - offset < n ? f->CommittedSize - offset : n;
+    if (base > 0)
+    {
+        ret = TxCopy(f, offset, arr, base);
+        if (ret != 0)
+            return ret;
+    }
+    memset(arr + base, 0, n - base);
+    if (TxValidate(tx) != 0)
+        return -5;
+
+    // Bytes past the size of the file at any step read as zero
+    op = tx->Ops;
+    while (op != NULL)
+    {
+        if (op->File == i)
+        {
+            if (op->Op == TX_CREATE || op->Op == TX_RM)
+                memset(arr, 0, n);
+            else if (op->Op == TX_TRUNCATE)
+            {
+                from = op->Length > offset ? op->Length : offset;
+                if (from < offset + n)
+                    memset(arr + (from - offset), 0, offset + n - from);
+            }
+            else if (op->Offset < offset + n && op->Offset + op->Length > offset)
+            {
+                from = op->Offset > offset ? op->Offset : offset;
+                to = op->Offset + op->Length < offset + n ? op->Offset + op->Length : offset + n;
+                memcpy(arr + (from - offset), op->Data + (from - op->Offset), to - from);
+            }
+        }
+        op = op->next;
+    }
+
+    return (int64_t)n;
+}
+
+
+/*
+ * Function: TxCheck
+ * -----------------
+ * The checks of TxCommit(), under the lock: every file is still what the
+ * transaction recorded, and the changes fit. It also takes what applying
+ * them needs and could fail to get halfway: room at the end of the name
+ * arena for the new names, and the spilled data of the files written.
+ *
+ * @return 0 if the transaction can be applied, or an error of TxCommit().
+ */
+int TxCheck(PTRANSACTION tx)
+{
+    PNAMEINDEX names = CurrentVFS->Names;
+    PTXFILE f = NULL;
+    PTXOP op = NULL;
+    PINODE inode = NULL;
+    uint64_t room = 0;
+    int creates = 0, i = 0;
+
+    while (i < tx->FileCount)
+    {
+        f = &tx->Files[i];
+        inode = Get_Inode(f->Name);
+        if (inode != (f->Inode >= 0 ? &CurrentVFS->InodeTable[f->Inode] : NULL))
+            return -2;
+        if (inode != NULL)
+        {
+            FlushInode(inode);  // Buffered writes of descriptors are changes too
+            if (*InodeVersion(inode) != f->Version)
+                return -2;
+        }
+        i++;
+    }
+
+    op = tx->Ops;
+    while (op != NULL)
+    {
+        f = &tx->Files[op->File];
+        if (op->Op == TX_CREATE)
+        {
+            creates++;
+            room += NameEntrySize(strlen(f->Name));
+        }
+        else if (op->Op != TX_WRITE && f->Inode >= 0 && Leased(&CurrentVFS->InodeTable[f->Inode]))
+            return -3;  // Buffer is still leased
+        op = op->next;
+    }
+
+    if (creates > SUPERBLOCKobj.FreeInodes)
+        ReclaimRetired();
+    if (creates > SUPERBLOCKobj.FreeInodes)
+        return -4;
+    if (room > NAMEARENASIZE - (names->ArenaUsed - names->ArenaGarbage))
+        return -4;
+    if (CurrentVFS->Journal != NULL && tx->JournalBytes > TXJOURNALSIZE - sizeof(TXJOURNAL))
+        return -4;
+    if (room > NAMEARENASIZE - names->ArenaUsed && CompactNames() != 0)
+        return -4;
+
+    op = tx->Ops;
+    while (op != NULL)
+    {
+        f = &tx->Files[op->File];
+        if (op->Op == TX_WRITE && f->Inode >= 0 && EnsureResident(&CurrentVFS->InodeTable[f->Inode]) != 0)
+            return -5;
+        op = op->next;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Function: TxJournal
+ * -------------------
+ * Writes the operations of a transaction to the commit journal of a shared
+ * instance and marks it complete.
+ */
+void TxJournal(PTRANSACTION tx)
+{
+    PTXJOURNAL journal = (PTXJOURNAL)CurrentVFS->Journal;
+    char *p = CurrentVFS->Journal + sizeof(TXJOURNAL);
+    PTXRECORD rec = NULL;
+    PTXOP op = tx->Ops;
+    const char *name = NULL;
+
+    journal->Count = 0;
+    while (op != NULL)
+    {
+        name = tx->Files[op->File].Name;
+        rec = (PTXRECORD)p;
+        rec->Op = op->Op;
+        rec->Permission = op->Permission;
+        rec->NameLength = (uint32_t)strlen(name);
+        rec->Offset = op->Offset;
+        rec->Length = op->Length;
+        memcpy(p + sizeof(TXRECORD), name, rec->NameLength + 1);
+        if (op->Op == TX_WRITE)
+            memcpy(p + sizeof(TXRECORD) + rec->NameLength + 1, op->Data, op->Length);
+
+        p += TxRecordSize(op->Op, rec->NameLength, op->Length);
+        journal->Count++;
+        op = op->next;
+    }
+    journal->Length = (uint64_t)(p - CurrentVFS->Journal - sizeof(TXJOURNAL));
+
+    // From here on the commit is finished even if this process dies
+    __atomic_store_n(&journal->State, 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Function: TxCommit
+ * ------------------
+ * Applies the staged operations of a transaction, in order and all at
+ * once, if none of its files changed since the transaction used them, and
+ * frees the transaction either way.
+ *
+ * @return
+ *   0  : Committed.
+ *  -2  : Conflict: a file the transaction used has changed; nothing applied.
+ *  -3  : A file to delete or truncate is pinned by a read view; nothing applied.
+ *  -4  : No free inodes, name arena or journal space for the changes, or no
+ *        memory to compact the name arena; nothing applied.
+ *  -5  : Spilled data of a file to write could not be read back; nothing applied.
+ */
+int TxCommit(PTRANSACTION tx)
+{
+    PTXFILE f = NULL;
+    PTXOP op = NULL;
+    PINODE inode = NULL;
+    int ret = 0, i = 0;
+
+    LockVFS();
+    ret = TxCheck(tx);
+
+    if (ret == 0)
+    {
+        // No transaction reads the files until all of the changes are in
+        while (i < tx->FileCount)
+        {
+            if (tx->Files[i].Inode >= 0)
+                VersionBegin(&CurrentVFS->InodeTable[tx->Files[i].Inode]);
+            i++;
+        }
+
+        if (CurrentVFS->Journal != NULL)
+        {
+            TxJournal(tx);
+            if (ApplyJournal() != 0)
+                ret = -5;
+            __atomic_store_n(&((PTXJOURNAL)CurrentVFS->Journal)->State, 0, __ATOMIC_RELEASE);
+        }
+        else
+        {
+            op = tx->Ops;
+            while (op != NULL)
+            {
+                if (ApplyTxOp(op->Op, tx->Files[op->File].Name, op->Permission, op->Offset, op->Length, op->Data) != 0)
+                    ret = -5;
+                op = op->next;
+            }
+        }
+
+        // Both the inodes the files had and the ones they have now
+        i = 0;
+        while (i < tx->FileCount)
+        {
+            f = &tx->Files[i];
+            if (f->Inode >= 0 && (*InodeVersion(&CurrentVFS->InodeTable[f->Inode]) & 1))
+                VersionEnd(&CurrentVFS->InodeTable[f->Inode]);
+            inode = Get_Inode(f->Name);
+            if (inode != NULL && (*InodeVersion(inode) & 1))
+                VersionEnd(inode);
+            i++;
+        }
+
+        // Written files were brought in by TxCheck and stay until all changes are in
+        EnforceBudget(NULL);
+    }
+
+    UnlockVFS();
+    TxAbort(tx);
+
+    return ret;
+}
+
+
+/*
+ * Structure: shmheader
+ * --------------------
+ * Start of a shared memory segment. The dirty bitmaps follow at
+ * SHMDIRTYOFFSET, the allocation bitmaps at SHMALLOCOFFSET, the name arena
+ * at SHMNAMEOFFSET, the commit journal at SHMJOURNALOFFSET, the block
+ * generations at SHMGENOFFSET, the change log at SHMCHANGEOFFSET and the
+ * data area of MAXINODE * MAXFILESIZE bytes at SHMDATAOFFSET; the segment
+ * is sparse, so only used pages take memory.
+ *
+ * Fields:
+ *  - Magic    : SHMMAGIC once the creator finished initialising the segment.
+ *  - FileSpan : The creator's MAXFILESIZE, which fixes the layout of the segment.
+ *  - Lock     : Process-shared, robust mutex protecting everything below.
+ *  - Super    : The superblock of the shared file system.
+ *  - Names    : The name index of the shared file system.
+ *  - Inodes   : The inode table; inodes link to each other by index.
+ *  - Versions : The inode versions (see InodeVersion).
+ */
+#define SHMMAGIC 0x43564653
+
+typedef struct shmheader
+{
+    unsigned Magic;
+    int64_t FileSpan;
+    pthread_mutex_t Lock;
+    SUPERBLOCK Super;
+    NAMEINDEX Names;
+    INODE Inodes[MAXINODE];
+    uint64_t Versions[MAXINODE];
+}SHMHEADER, *PSHMHEADER;
+
+#define SHMDIRTYOFFSET ((sizeof(SHMHEADER) + 4095) & ~(size_t)4095)
+#define SHMALLOCOFFSET (SHMDIRTYOFFSET + (((size_t)MAXINODE * DIRTYMAPSIZE + 4095) & ~(size_t)4095))
+#define SHMNAMEOFFSET (SHMALLOCOFFSET + (((size_t)MAXINODE * DIRTYMAPSIZE + 4095) & ~(size_t)4095))
+#define SHMJOURNALOFFSET (SHMNAMEOFFSET + ((NAMEARENASIZE + 4095) & ~(size_t)4095))
+#define SHMGENOFFSET (SHMJOURNALOFFSET + (size_t)TXJOURNALSIZE)
+#define SHMCHANGEOFFSET (SHMGENOFFSET + (((size_t)MAXINODE * MAXBLOCKS * sizeof(uint64_t) + 4095) & ~(size_t)4095))
+#define SHMDATAOFFSET (SHMCHANGEOFFSET + ((CHANGELOGSIZE * sizeof(CHANGERECORD) + 4095) & ~(size_t)4095))
+#define SHMSIZE (SHMDATAOFFSET + (size_t)MAXINODE * MAXFILESIZE)
+
+
+/*
+ * Function: DetachSharedVFS
+ * -------------------------
+ * Closes this process's descriptors and unmaps the shared segment. The
+ * segment itself persists until it is removed with shm_unlink().
+ */
+void DetachSharedVFS()
+{
+    if (CurrentVFS->Shared == NULL)
+        return;
+
+    CloseAllFile();
+    munmap(CurrentVFS->Shared, CurrentVFS->SharedSize);
+
+    CurrentVFS->Shared = NULL;
+    CurrentVFS->Super = NULL;
+    CurrentVFS->Names = NULL;
+    CurrentVFS->Lock = NULL;
+    CurrentVFS->InodeTable = NULL;
+    CurrentVFS->DirtyBase = NULL;
+    CurrentVFS->AllocBase = NULL;
+    CurrentVFS->NameBase = NULL;
+    CurrentVFS->Versions = NULL;
+    CurrentVFS->GenBase = NULL;
+    CurrentVFS->ChangeLog = NULL;
+    CurrentVFS->Journal = NULL;
+    CurrentVFS->DataBase = NULL;
+    CurrentVFS->FileSpan = 0;
+    head = NULL;
+}
+
+
+/*
+ * Function: AttachSharedVFS
+ * -------------------------
+ * Points the current instance at the file system in the POSIX shared memory
+ * object `name`, creating and formatting it if this is the first process.
+ * The superblock, inode table and file data are shared; the UFDT and file
+ * tables stay private to the process.
+ *
+ * @param name - Shared memory object name, e.g. "/cvfs".
+ *
+ * @return
+ *   0  : Attached.
+ *  -1  : Invalid name or the object could not be opened or sized.
+ *  -2  : The object could not be mapped.
+ *  -3  : Timed out waiting for the creator to initialise the segment.
+ */
+int AttachSharedVFS(const char *name)
+{
+    PSHMHEADER hdr = NULL;
+    pthread_mutexattr_t attr;
+    struct stat st;
+    void *base = NULL;
+    int fd = 0, creator = 1, tries = 0, i = 0;
+
+    if (name == NULL || name[0] != '/')
+        return -1;
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (fd == -1)
+    {
+        if (errno != EEXIST)
+            return -1;
+        creator = 0;
+        fd = shm_open(name, O_RDWR, 0666);
+        if (fd == -1)
+            return -1;
+    }
+
+    if (creator)
+    {
+        SizeDataArea();
+        if (ftruncate(fd, SHMSIZE) == -1)
+        {
+            close(fd);
+            shm_unlink(name);
+            return -1;
+        }
+    }
+    else
+    {
+        // The creator may not have sized the object yet
+        while (fstat(fd, &st) == 0 && (size_t)st.st_size < SHMDIRTYOFFSET && tries < 1000)
+        {
+            usleep(1000);
+            tries++;
+        }
+        if ((size_t)st.st_size < SHMDIRTYOFFSET)
+        {
+            close(fd);
+            return -3;
+        }
+
+        // The layout follows from the creator's file span, published with Magic
+        hdr = (PSHMHEADER)mmap(NULL, SHMDIRTYOFFSET, PROT_READ, MAP_SHARED, fd, 0);
+        if (hdr == (PSHMHEADER)MAP_FAILED)
+        {
+            close(fd);
+            return -2;
+        }
+        tries = 0;
+        while (__atomic_load_n(&hdr->Magic, __ATOMIC_ACQUIRE) != SHMMAGIC && tries < 1000)
+        {
+            usleep(1000);
+            tries++;
+        }
+        CurrentVFS->FileSpan = hdr->Magic == SHMMAGIC ? hdr->FileSpan : 0;
+        munmap(hdr, SHMDIRTYOFFSET);
+        if (CurrentVFS->FileSpan == 0)
+        {
+            close(fd);
+            return -3;
+        }
+    }
+
+    base = mmap(NULL, SHMSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -2;
+
+    hdr = (PSHMHEADER)base;
+    CurrentVFS->Shared = base;
+    CurrentVFS->SharedSize = SHMSIZE;
+    CurrentVFS->Super = &hdr->Super;
+    CurrentVFS->Names = &hdr->Names;
+    CurrentVFS->Lock = &hdr->Lock;
+    CurrentVFS->InodeTable = hdr->Inodes;
+    CurrentVFS->DirtyBase = (unsigned char *)base + SHMDIRTYOFFSET;
+    CurrentVFS->AllocBase = (unsigned char *)base + SHMALLOCOFFSET;
+    CurrentVFS->NameBase = (char *)base + SHMNAMEOFFSET;
+    CurrentVFS->Versions = hdr->Versions;
+    CurrentVFS->Journal = (char *)base + SHMJOURNALOFFSET;
+    CurrentVFS->GenBase = (uint64_t *)((char *)base + SHMGENOFFSET);
+    CurrentVFS->ChangeLog = (PCHANGERECORD)((char *)base + SHMCHANGEOFFSET);
+    CurrentVFS->DataBase = (char *)base + SHMDATAOFFSET;
+
+    if (creator)
+    {
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&hdr->Lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+
+        hdr->FileSpan = MAXFILESIZE;
+        InitialiseSuperBlock();
+        CreateDILB();
+        __atomic_store_n(&hdr->Magic, SHMMAGIC, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    // Only the per-process state is reset when joining
+    while (i < 50)
+    {
+        UFDTArr[i].ptrfiletable = NULL;
+        i++;
+    }
+    head = &CurrentVFS->InodeTable[0];
+
+    return 0;
+}
+
+
+
+/*
+ * Function: SeekDataOrHole
+ * ------------------------
+ * The DATA and HOLE cases of DoLseekFile().
+ *
+ * @return 0 if the offset was moved, -1 otherwise.
+ */
+int SeekDataOrHole(PFILETABLE ft, int64_t offset, int from)
+{
+    PINODE inode = ft->ptrinode;
+    int64_t size = (int64_t)inode->FileActualSize, blocks = BlocksOf(inode->FileActualSize);
+    int64_t block = 0, pos = 0;
+
+    if ((ft->mode & (READ | WRITE)) == 0 || offset < 0 || offset >= size)
+        return -1;
+
+    block = FindBlock(InodeAllocMap(inode), offset / BLOCKSIZE, blocks, from == DATA);
+    if (block >= blocks)
+    {
+        if (from == DATA)
+            return -1;  // Only holes up to the end of file
+        pos = size;
+    }
+    else
+    {
+        pos = block * BLOCKSIZE;
+        if (pos < offset)
+            pos = offset;  // Already inside the block that was asked for
+        if (pos > size)
+            pos = size;
+    }
+
+    if (ft->mode & READ)
+    {
+        LockReads(ft);
+        ft->readoffset = pos;
+        UnlockReads(ft);
+    }
+    else
+        ft->writeoffset = pos;
+
+    return 0;
+}
+
+
+/*
+ * Function: DoLseekFile
+ * ---------------------
+ * Changes the current read or write offset in an open file, similar to the lseek() system call.
+ * The new position is calculated relative to the start, current position, or end of the file.
+ *
+ * @param fd     - File descriptor of the file.
+ * @param offset - Number of bytes to move the offset by, may be negative.
+ * @param from   - Reference point for the offset (0 = START, 1 = CURRENT, 2 = END),
+ *                 or 3 = DATA / 4 = HOLE to move to the first byte at or after
+ *                 `offset` that holds data / lies in a hole, like SEEK_DATA
+ *                 and SEEK_HOLE. The end of file counts as a hole.
+ *
+ * @return 
+ *   0  : Offset successfully updated.
+ *  -1  : Invalid parameters, invalid file descriptor, or operation out of bounds
+ *        (for DATA and HOLE: `offset` not within the file, or no data after it).
+ *
+ * Notes:
+ * - For read mode, it updates the read offset, which must stay within the file.
+ * - For write mode, it updates the write offset, which may go up to MAXFILESIZE;
+ *   seeking past the end of file leaves a hole that reads as zeros.
+ * - The range check is done without computing a sum that could overflow.
+ * - Data and holes are tracked per BLOCKSIZE block (see InodeAllocMap).
+ */
+int DoLseekFile(int fd, int64_t offset, int from)
+{
+    PFILETABLE ft = NULL;
+    int64_t base = 0, limit = 0, pos = 0;
+
+    if (fd < 0 || fd >= 50 || from < START || from > HOLE)
+        return -1;
+
+    ft = UFDTArr[fd].ptrfiletable;
+    if (ft == NULL)
+        return -1;  // Invalid file descriptor
+
+    // Positions are relative to the file with this descriptor's writes in it
+    if (ft->WBufLen > 0 && FlushFile(fd) < 0)
+        return -1;
+
+    if (from == DATA || from == HOLE)
+        return SeekDataOrHole(ft, offset, from);
+
+    if (ft->mode & READ)
+        limit = (int64_t)ft->ptrinode->FileActualSize;  // Reading stops at the end of file
+    else if (ft->mode & WRITE)
+        limit = MAXFILESIZE;  // Writing may extend the file
+    else
+        return -1;
+
+    // Readers without the instance lock may be moving readoffset meanwhile
+    if (ft->mode & READ)
+        LockReads(ft);
+
+    if (from == START)
+        base = 0;
+    else if (from == CURRENT)
+        base = (ft->mode & READ) ? ft->readoffset : ft->writeoffset;
+    else
+        base = (int64_t)ft->ptrinode->FileActualSize;
+
+    // base + offset must lie in [0, limit], and both base and limit are in [0, MAXFILESIZE]
+    if (offset > limit - base || offset < -base)
+        pos = -1;
+    else
+        pos = base + offset;
+
+    if (ft->mode & READ)
+    {
+        if (pos >= 0)
+            ft->readoffset = pos;
+        UnlockReads(ft);
+        return pos >= 0 ? 0 : -1;
+    }
+
+    if (pos < 0)
+        return -1;
+
+    if ((uint64_t)pos > ft->ptrinode->FileActualSize)
+    {
+        // Adjust file size if necessary, the gap is a hole
+        VersionBegin(ft->ptrinode);
+        ft->ptrinode->FileActualSize = pos;
+        LogChange(ft->ptrinode, 0, 0, 0);  // No block changed, but deltas carry the new size
+        VersionEnd(ft->ptrinode);
+    }
+    ft->writeoffset = pos;
+
+    return 0;
+}
+
+
+
+/*
+ * Function: ListFiles
+ * -------------------
+ * Collects files in lexical order of their names. Only the part of the name
+ * index that can match is visited: the literal prefix of `pattern` (the text
+ * before its first wildcard) and the `after` cursor give the starting point
+ * by binary search, and the walk stops once the prefix no longer matches or
+ * `limit` files were found.
+ *
+ * @param pattern - Glob pattern (*, ? and [...]); without wildcards it is a
+ *                  name prefix. NULL lists every file.
+ * @param after   - Only names greater than this one are listed, NULL for all.
+ *                  Pass the last name of a page to get the next page.
+ * @param limit   - Maximum number of files to collect, at most MAXINODE.
+ * @param out     - Receives the matching inodes.
+ *
+ * @return
+ *  >= 0 : Number of files stored in `out`.
+ *   -1  : Invalid parameters.
+ */
+int ListFiles(const char *pattern, const char *after, int limit, PINODE *out)
+{
+    const char *prefix = (pattern != NULL) ? pattern : "";
+    size_t plen = strcspn(prefix, "*?[");  // The prefix is read in place, so its length is not limited
+    int glob = (prefix[plen] != '\0'), pos = 0, found = 0, start = 0;
+    PINODE temp = NULL;
+
+    if (out == NULL || limit <= 0)
+        return -1;
+
+    pos = PrefixLowerBound(prefix, plen);
+    if (after != NULL && strncmp(after, prefix, plen) >= 0)
+    {
+        start = NameLowerBound(after);
+        if (start < CurrentVFS->Names->Count && strcmp(IndexedName(start), after) == 0)
+            start++;
+        pos = start;
+    }
+
+    while (pos < CurrentVFS->Names->Count && found < limit)
+    {
+        temp = IndexedInode(pos);
+        if (strncmp(InodeName(temp), prefix, plen) != 0)
+            break;  // Past the names that share the prefix
+        if (!glob || fnmatch(pattern, InodeName(temp), 0) == 0)
+            out[found++] = temp;
+        pos++;
+    }
+
+    return found;
+}
+
+
+/*
+ * Function: ls_file
+ * -----------------
+ * Lists files in lexical order, optionally filtered and paged (see ListFiles).
+ * It prints each file's name, inode number, actual size, and link count.
+ *
+ * @param pattern - Glob pattern or name prefix, NULL for every file.
+ * @param after   - Name to continue after, NULL to start at the beginning.
+ * @param limit   - Maximum number of files to print.
+ *
+ * If no files are present, it displays an appropriate message.
+ */
+
+void ls_file(const char *pattern, const char *after, int limit)
+{
+    PINODE *found = NULL;
+    int count = 0, i = 0;
+
+    if (SUPERBLOCKobj.FreeInodes == MAXINODE)
+    {
+        printf("Error: There are no files\n");
+        return;
+    }
+
+    if (limit > MAXINODE)
+        limit = MAXINODE;
+
+    found = (PINODE *)malloc(limit * sizeof(PINODE));
+    if (found == NULL)
+    {
+        printf("Error: Memory allocation failure\n");
+        return;
+    }
+
+    count = ListFiles(pattern, after, limit, found);
+    if (count < 0)
+    {
+        printf("Error: Incorrect parameters\n");
+        free(found);
+        return;
+    }
+    if (count == 0)
+    {
+        printf("Error: No matching files\n");
+        free(found);
+        return;
+    }
+
+    printf("\nFile Name\tInode number\tFile size\tLink count\n");
+    printf("--------------------------------------------------------\n");
+
+    while (i < count)
+    {
+        printf("%s\t\t%d\t\t%" PRIu64 "\t\t%d\n", InodeName(found[i]), InodeNumber(found[i]), found[i]->FileActualSize, found[i]->LinkCount);
+        i++;
+    }
+    printf("-------------------------------------\n");
+
+    if (count == limit && limit < MAXINODE)
+        printf("Next page : --after %s\n", InodeName(found[count - 1]));
+    free(found);
+}
+
+
+
+/*
+ * Function: fstat_file
+ * --------------------
+ * Displays metadata about an open file using its file descriptor.
+ * Prints details such as file name, inode number, file size, link count,
+ * reference count, and permissions.
+ *
+ * @param fd - File descriptor of the file to be inspected.
+ *
+ * @return 
+ *   0  : Success.
+ *  -1  : Invalid file descriptor (negative value).
+ *  -2  : File not currently open (null filetable entry).
+ */
+int fstat_file(int fd)
+{
+    PINODE temp = head;
+
+    if (fd < 0) return -1;
+    if (UFDTArr[fd].ptrfiletable == NULL) return -2;
+
+    temp = UFDTArr[fd].ptrfiletable->ptrinode;
+
+    printf("\n---------------------- Statistical Information about file------------------\n");
+    printf("File name: %s\n", InodeName(temp));
+    printf("Inode Number: %d\n", InodeNumber(temp));
+    printf("File size: %" PRIu64 "\n", temp->FileActualSize);  
+    printf("Actual File size: %" PRIu64 "\n", temp->FileActualSize);
+    printf("Allocated size: %" PRIu64 "\n", (uint64_t)temp->AllocatedBlocks * BLOCKSIZE);
+    printf("Link count: %d\n", temp->LinkCount);
+    printf("Reference count: %d\n", temp->ReferenceCount);
+
+   
+    if (temp->Permission == 1)
+        printf("File Permission: Read only\n");
+    else if (temp->Permission == 2)
+        printf("File Permission: Write\n");
+    else if (temp->Permission == 3)
+        printf("File Permission: Read & Write\n");
+
+    printf("------------------\n\n");
+
+    return 0;
+}
+
+
+/*
+ * Function: stat_file
+ * -------------------
+ * Displays metadata about a file using its name.
+ * Looks the file up in the name index and prints information such as
+ * name, inode number, size, link count, reference count, and permissions.
+ *
+ * @param name - Name of the file to inspect.
+ *
+ * @return 
+ *   0  : Success.
+ *  -1  : Invalid input (null file name).
+ *  -2  : File not found in the inode list.
+ */
+int stat_file(char *name)
+{
+    PINODE temp = NULL;
+
+    if (name == NULL) return -1;
+
+    temp = Get_Inode(name);
+    if (temp == NULL) return -2;
+
+    printf("\nStatistical Information about file-------\n");
+    printf("File name: %s\n", InodeName(temp));
+    printf("Inode Number: %d\n", InodeNumber(temp));
+    printf("File size: %" PRIu64 "\n", temp->FileActualSize);
+    printf("Actual File size: %" PRIu64 "\n", temp->FileActualSize);
+    printf("Allocated size: %" PRIu64 "\n", (uint64_t)temp->AllocatedBlocks * BLOCKSIZE);
+    printf("Link count: %d\n", temp->LinkCount);
+    printf("Reference count: %d\n", temp->ReferenceCount);
+
+    
+    if (temp->Permission == 1)
+        printf("File Permission: Read only\n");
+    else if (temp->Permission == 2)
+        printf("File Permission: Write\n");
+    else if (temp->Permission == 3)
+        printf("File Permission: Read & Write\n");
+
+    printf("-------------\n\n");
+
+    return 0;
+}
+
+
+
+/*
+ * Function: truncate_File
+ * -----------------------
+ * Sets the size of the specified file, like ftruncate().
+ *
+ * Shrinking zeroes the rest of the new last block and frees every whole
+ * block past it (see FreeBlocks), without touching the data that is kept.
+ * Growing only moves the end of file: the new range is a hole and reads as
+ * zeros without taking any memory. Descriptors positioned past
+ * the new end of file are moved back to it.
+ *
+ * @param name - Name of the file to truncate.
+ * @param size - New size in bytes, 0 removes all data.
+ *
+ * @return 
+ *   0  : File successfully truncated.
+ *  -1  : File not found or not open.
+ *  -2  : File data is pinned by an outstanding read view.
+ *  -3  : Size is larger than MAXFILESIZE.
+ */
+int truncate_File(char *name, uint64_t size)
+{
+    PINODE inode = NULL;
+    int fd = 0;
+
+    fd = GetFDFromName(name);
+    if (fd == -1)
+        return -1;
+
+    if (size > (uint64_t)MAXFILESIZE)
+        return -3;  // Invalid size
+
+    inode = UFDTArr[fd].ptrfiletable->ptrinode;
+    if (Leased(inode))
+        return -2;  // Buffer is still leased
+
+    FlushInode(inode);  // Buffered writes land before the new size applies
+    VersionBegin(inode);
+    TruncateInode(inode, size);
+    VersionEnd(inode);
+
+    return 0;  
+}
+
+
+/*
+ * Function: PunchHole
+ * -------------------
+ * Deallocates a range of an open file, like fallocate() with
+ * FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE: the range reads as zeros
+ * afterwards and the file size does not change. Whole blocks in the range
+ * are freed (see FreeBlocks); the parts of the blocks at either end that
+ * are only partly covered are zeroed. The last block of the file counts as
+ * whole when the range reaches the end of file.
+ *
+ * @param fd     - File descriptor opened for writing.
+ * @param offset - First byte of the range.
+ * @param length - Length of the range; the part past the end of file is ignored.
+ *
+ * @return
+ *   0  : Range deallocated.
+ *  -1  : Invalid file descriptor, or not opened for writing.
+ *  -2  : File data is pinned by an outstanding read view.
+ *  -3  : Invalid range.
+ *  -4  : The data of the file could not be read back from the spill file.
+ */
+int PunchHole(int fd, int64_t offset, uint64_t length)
+{
+    PINODE inode = NULL;
+    unsigned char *map = NULL;
+    uint64_t size = 0, end = 0, edge = 0;
+    int64_t first = 0, last = 0;
+
+    if (fd < 0 || fd >= 50 || UFDTArr[fd].ptrfiletable == NULL)
+        return -1;
+    if ((UFDTArr[fd].ptrfiletable->mode & WRITE) == 0)
+        return -1;
+
+    inode = UFDTArr[fd].ptrfiletable->ptrinode;
+    if (Leased(inode))
+        return -2;  // Buffer is still leased
+
+    FlushInode(inode);
+    size = inode->FileActualSize;
+    if (offset < 0 || length == 0 || (uint64_t)offset > size)
+        return -3;
+    end = length > size - (uint64_t)offset ? size : (uint64_t)offset + length;
+    if ((uint64_t)offset == end)
+        return 0;
+
+    if (TierTouch(inode) != 0)
+        return -4;
+
+    map = InodeAllocMap(inode);
+    first = BlocksOf((uint64_t)offset);
+    last = end == size ? BlocksOf(end) : (int64_t)(end / BLOCKSIZE);
+    VersionBegin(inode);
+
+    // Head: from offset to the first whole block
+    edge = (uint64_t)first * BLOCKSIZE < end ? (uint64_t)first * BLOCKSIZE : end;
+    if ((uint64_t)offset < edge && (map[offset / BLOCKSIZE / 8] >> (offset / BLOCKSIZE % 8)) & 1)
+        memset(InodeData(inode) + offset, 0, edge - offset);
+
+    // Tail: from the last whole block to end, unless the head covered it
+    edge = (uint64_t)last * BLOCKSIZE;
+    if (first <= last && edge < end && (map[last / 8] >> (last % 8)) & 1)
+        memset(InodeData(inode) + edge, 0, end - edge);
+
+    if (first < last)
+        FreeBlocks(inode, first, last);
+    MarkBlocksDirty(inode, offset, end - offset);
+    VersionEnd(inode);
+
+    return 0;
+}
+
+
+
+/*
+ * Function: DoReadFileNoLock
+ * --------------------------
+ * DoReadFile() for a caller that does not hold the instance lock. The read
+ * runs inside an epoch (see EpochEnter), so other threads may create, write,
+ * close and delete files under LockVFS() meanwhile: a file deleted during
+ * the read is only reclaimed after it. A read that has to change the file
+ * system first takes the lock instead: flushing the descriptor's write
+ * buffer, or any read of a tiered or shared instance (whose other processes
+ * do not announce their reads). Threads reading the same descriptor take
+ * turns on its read lock (FILETABLE::ReadLock), which also guards the
+ * readahead state.
+ *
+ * @return Same as DoReadFile().
+ */
+int64_t DoReadFileNoLock(int fd, char *arr, uint64_t isize)
+{
+    PFILETABLE ft = NULL;
+    int64_t ret = 0;
+    int done = 1;
+
+    if (fd < 0 || fd >= 50)
+        return -1;
+
+    if (CurrentVFS->Shared == NULL && CurrentVFS->Tier == NULL && EpochEnter() == 0)
+    {
+        ft = __atomic_load_n(&UFDTArr[fd].ptrfiletable, __ATOMIC_SEQ_CST);
+        if (ft == NULL || (ft->mode & READ) == 0)
+            ret = -1;  // Invalid file descriptor or mode
+        else if (__atomic_load_n(&ft->WBufLen, __ATOMIC_RELAXED) == 0)
+            ret = ReadOpenFile(ft, arr, isize);
+        else
+            done = 0;  // Buffered writes have to be flushed first
+        EpochExit();
+
+        if (done)
+            return ret;
+    }
+
+    LockVFS();
+    ret = DoReadFile(fd, arr, isize);
+    UnlockVFS();
+
+    return ret;
+}
+
+
+/*
+ * Traced entry points
+ * -------------------
+ * The public file functions. Each runs the Do* function of the same name
+ * and, while a trace is being recorded, records the call (see StartTrace).
+ */
+int CreateFile(char *name, int permission)
+{
+    uint64_t start = TraceBegin();
+    int ret = DoCreateFile(name, permission);
+
+    TraceEnd(start, OP_CREATE, -1, name, permission, 0, ret);
+    return ret;
+}
+
+int OpenFile(char *name, int mode)
+{
+    uint64_t start = TraceBegin();
+    int ret = DoOpenFile(name, mode);
+
+    TraceEnd(start, OP_OPEN, -1, name, mode, 0, ret);
+    return ret;
+}
+
+int rm_File(char *name)
+{
+    uint64_t start = TraceBegin();
+    int ret = DoRmFile(name);
+
+    TraceEnd(start, OP_RM, -1, name, 0, 0, ret);
+    return ret;
+}
+
+int64_t ReadFile(int fd, char *arr, uint64_t isize)
+{
+    uint64_t start = TraceBegin();
+    int64_t ret = DoReadFile(fd, arr, isize);
+
+    TraceEnd(start, OP_READ, fd, NULL, (int64_t)isize, 0, ret);
+    return ret;
+}
+
+int64_t ReadFileNoLock(int fd, char *arr, uint64_t isize)
+{
+    uint64_t start = TraceBegin();
+    int64_t ret = DoReadFileNoLock(fd, arr, isize);
+
+    TraceEnd(start, OP_READ, fd, NULL, (int64_t)isize, 0, ret);
+    return ret;
+}
+
+int64_t ReadView(int fd, uint64_t isize, PVIEWLEASE lease)
+{
+    uint64_t start = TraceBegin();
+    int64_t ret = DoReadView(fd, isize, lease);
+
+    TraceEnd(start, OP_READ, fd, NULL, (int64_t)isize, 0, ret);
+    return ret;
+}
+
+int64_t WriteFile(int fd, char *arr, uint64_t isize)
+{
+    uint64_t start = TraceBegin();
+    int64_t ret = DoWriteFile(fd, arr, isize);
+
+    TraceEnd(start, OP_WRITE, fd, NULL, (int64_t)isize, 0, ret);
+    return ret;
+}
+
+int LseekFile(int fd, int64_t offset, int from)
+{
+    uint64_t start = TraceBegin();
+    int ret = DoLseekFile(fd, offset, from);
+
+    TraceEnd(start, OP_LSEEK, fd, NULL, offset, from, ret);
+    return ret;
+}
+
+
+
+/*
+ * Parallel Search
+ * ---------------
+ * GrepFiles() looks for a byte string in the data of every readable regular
+ * file. The data is scanned in place, never copied through ReadFile. Files
+ * are cut into GREPCHUNKSIZE chunks and a set of worker threads takes
+ * chunks from a shared counter, so one large file is searched by all
+ * threads at once. A chunk owns the matches that start inside it. It reads
+ * pattern length - 1 bytes past its end, so matches that cross a chunk
+ * boundary are found exactly once.
+ *
+ * Candidates are found 16 (SSE2) or 32 (AVX2) positions at a time by
+ * comparing the first and the last byte of the pattern. Only positions
+ * where both match are verified with memcmp.
+ */
+#define GREPCHUNKSIZE (4 * 1024 * 1024)
+#define GREPMAXTHREADS 64
+#define GREPMAXOFFSETS 8
+
+
+/*
+ * Structure: grepmatch
+ * --------------------
+ * Result of GrepFiles() for one file.
+ *
+ * Fields:
+ *  - ptrinode    : The matching file.
+ *  - Count       : Number of occurrences (overlapping occurrences count separately).
+ *  - OffsetCount : Number of valid entries in Offsets.
+ *  - Offsets     : Offsets of the first GREPMAXOFFSETS occurrences, ascending.
+ */
+typedef struct grepmatch
+{
+    PINODE ptrinode;
+    uint64_t Count;
+    int OffsetCount;
+    uint64_t Offsets[GREPMAXOFFSETS];
+}GREPMATCH, *PGREPMATCH;
+
+
+/*
+ * Structure: grepchunk
+ * --------------------
+ * One unit of work: the occurrences starting in [Start, End) of a file.
+ */
+typedef struct grepchunk
+{
+    const char *Data;
+    uint64_t Size;
+    uint64_t Start;
+    uint64_t End;
+    int File;
+    uint64_t Count;
+    int OffsetCount;
+    uint64_t Offsets[GREPMAXOFFSETS];
+}GREPCHUNK, *PGREPCHUNK;
+
+
+/*
+ * Structure: grepjob
+ * ------------------
+ * State shared by the worker threads of one GrepFiles() call.
+ */
+typedef struct grepjob
+{
+    const char *Pattern;
+    size_t Length;
+    PGREPCHUNK Chunks;
+    int ChunkCount;
+    std::atomic<int> Next;
+}GREPJOB, *PGREPJOB;
+
+
+/*
+ * Function: RecordMatch
+ * ---------------------
+ * Counts an occurrence found at file offset `offset`.
+ */
+void RecordMatch(PGREPCHUNK chunk, uint64_t offset)
+{
+    chunk->Count++;
+    if (chunk->OffsetCount < GREPMAXOFFSETS)
+        chunk->Offsets[chunk->OffsetCount++] = offset;
+}
+
+
+/*
+ * Function: ScanChunk
+ * -------------------
+ * Finds every occurrence of the pattern that starts inside the chunk.
+ */
+void ScanChunk(PGREPJOB job, PGREPCHUNK chunk)
+{
+    const char *pat = job->Pattern;
+    size_t m = job->Length;
+    const char *text = chunk->Data + chunk->Start;
+    uint64_t n = 0, i = 0;
+
+    // Readable bytes: the chunk plus the tail of a match starting at its end
+    n = chunk->End + m - 1;
+    if (n > chunk->Size)
+        n = chunk->Size;
+    n -= chunk->Start;
+
+#if defined(__AVX2__)
+    const __m256i first = _mm256_set1_epi8(pat[0]);
+    const __m256i last = _mm256_set1_epi8(pat[m - 1]);
+    unsigned mask = 0;
+    int bit = 0;
+
+    while (i + m - 1 + 32 <= n)
+    {
+        __m256i bf = _mm256_loadu_si256((const __m256i *)(text + i));
+        __m256i bl = _mm256_loadu_si256((const __m256i *)(text + i + m - 1));
+
+        mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(bf, first),
+                                                               _mm256_cmpeq_epi8(bl, last)));
+        while (mask != 0)
+        {
+            bit = __builtin_ctz(mask);
+            if (m <= 2 || memcmp(text + i + bit + 1, pat + 1, m - 2) == 0)
+                RecordMatch(chunk, chunk->Start + i + bit);
+            mask &= mask - 1;
+        }
+        i += 32;
+    }
+#elif defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(pat[0]);
+    const __m128i last = _mm_set1_epi8(pat[m - 1]);
+    unsigned mask = 0;
+    int bit = 0;
+
+    while (i + m - 1 + 16 <= n)
+    {
+        __m128i bf = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i bl = _mm_loadu_si128((const __m128i *)(text + i + m - 1));
+
+        mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(bf, first),
+                                                         _mm_cmpeq_epi8(bl, last)));
+        while (mask != 0)
+        {
+            bit = __builtin_ctz(mask);
+            if (m <= 2 || memcmp(text + i + bit + 1, pat + 1, m - 2) == 0)
+                RecordMatch(chunk, chunk->Start + i + bit);
+            mask &= mask - 1;
+        }
+        i += 16;
+    }
+#endif
+
+    // Remaining positions, or all of them without SIMD support
+    while (i + m <= n)
+    {
+        if (text[i] == pat[0] && memcmp(text + i, pat, m) == 0)
+            RecordMatch(chunk, chunk->Start + i);
+        i++;
+    }
+}
+
+
+/*
+ * Function: GrepWorker
+ * --------------------
+ * Worker thread body: scans chunks until none are left.
+ */
+void *GrepWorker(void *arg)
+{
+    PGREPJOB job = (PGREPJOB)arg;
+    int i = 0;
+
+    while ((i = job->Next.fetch_add(1, std::memory_order_relaxed)) < job->ChunkCount)
+        ScanChunk(job, &job->Chunks[i]);
+
+    return NULL;
+}
+
+
+/*
+ * Function: GrepFiles
+ * -------------------
+ * Searches the data of all regular files with read permission for `pattern`.
+ * Must be called with the instance locked; the worker threads only read
+ * file data, which stays valid while the lock is held.
+ *
+ * @param pattern - Byte string to look for.
+ * @param threads - Number of threads to use, 0 for one per online CPU.
+ * @param out     - Receives one entry per matching file, in name order.
+ * @param max     - Capacity of `out`.
+ *
+ * @return
+ *  >= 0 : Number of matching files stored in `out`.
+ *   -1  : Invalid parameters.
+ *   -2  : Memory allocation failed.
+ */
+int GrepFiles(const char *pattern, int threads, PGREPMATCH out, int max)
+{
+    GREPJOB job;
+    PGREPCHUNK chunks = NULL;
+    pthread_t workers[GREPMAXTHREADS];
+    PINODE *files = NULL, temp = NULL;
+    uint64_t start = 0;
+    int nfiles = 0, nchunks = 0, started = 0, found = 0, i = 0, c = 0, k = 0;
+
+    if (pattern == NULL || pattern[0] == '\0' || out == NULL || max <= 0 || threads < 0)
+        return -1;
+
+    if (threads == 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1)
+        threads = 1;
+    if (threads > GREPMAXTHREADS)
+        threads = GREPMAXTHREADS;
+
+    // Not on the stack: a build with a large MAXINODE would overflow it
+    files = (PINODE *)malloc((CurrentVFS->Names->Count + 1) * sizeof(PINODE));
+    if (files == NULL)
+        return -2;
+
+    // Files in name order, so results come out sorted
+    while (i < CurrentVFS->Names->Count)
+    {
+        temp = IndexedInode(i);
+        if (temp->FileType == REGULAR && (temp->Permission & READ) && temp->FileActualSize > 0 &&
+            EnsureResident(temp) == 0)
+        {
+            files[nfiles++] = temp;
+            nchunks += (int)((temp->FileActualSize + GREPCHUNKSIZE - 1) / GREPCHUNKSIZE);
+        }
+        i++;
+    }
+    if (nchunks == 0)
+    {
+        free(files);
+        return 0;
+    }
+
+    chunks = (PGREPCHUNK)calloc(nchunks, sizeof(GREPCHUNK));
+    if (chunks == NULL)
+    {
+        free(files);
+        return -2;
+    }
+
+    c = 0;
+    for (i = 0; i < nfiles; i++)
+    {
+        for (start = 0; start < files[i]->FileActualSize; start += GREPCHUNKSIZE)
+        {
+            chunks[c].Data = InodeData(files[i]);
+            chunks[c].Size = files[i]->FileActualSize;
+            chunks[c].Start = start;
+            chunks[c].End = start + GREPCHUNKSIZE < chunks[c].Size ? start + GREPCHUNKSIZE : chunks[c].Size;
+            chunks[c].File = i;
+            c++;
+        }
+    }
+
+    job.Pattern = pattern;
+    job.Length = strlen(pattern);
+    job.Chunks = chunks;
+    job.ChunkCount = nchunks;
+    job.Next.store(0);
+
+    if (threads > nchunks)
+        threads = nchunks;
+
+    // The calling thread is one of the workers
+    while (started < threads - 1)
+    {
+        if (pthread_create(&workers[started], NULL, GrepWorker, &job) != 0)
+            break;
+        started++;
+    }
+    GrepWorker(&job);
+    for (i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+
+    // Merge the chunks of each file in offset order
+    c = 0;
+    for (i = 0; i < nfiles && found < max; i++)
+    {
+        out[found].ptrinode = files[i];
+        out[found].Count = 0;
+        out[found].OffsetCount = 0;
+
+        while (c < nchunks && chunks[c].File == i)
+        {
+            out[found].Count += chunks[c].Count;
+            for (k = 0; k < chunks[c].OffsetCount && out[found].OffsetCount < GREPMAXOFFSETS; k++)
+                out[found].Offsets[out[found].OffsetCount++] = chunks[c].Offsets[k];
+            c++;
+        }
+
+        if (out[found].Count > 0)
+            found++;
+    }
+
+    free(chunks);
+    free(files);
+    EnforceBudget(NULL);
+    return found;
+}
+
+
+
+/*
+ * Bulk Transfer
+ * -------------
+ * ImportDirectory() and ExportDirectory() copy every regular file between a
+ * host directory and the VFS. Inodes are created and released only by the
+ * calling thread; the copying itself is spread over a set of worker threads
+ * that take files from a shared counter. Data moves with plain read() and
+ * write() calls straight into and out of the data area, so there is no
+ * intermediate buffer and no per-block call into ReadFile/WriteFile.
+ */
+#define TRANSFERMAXTHREADS 64
+#define TRANSFERIOSIZE (64 * 1024 * 1024)
+
+
+/*
+ * Structure: transferstats
+ * ------------------------
+ * Result of a bulk transfer.
+ *
+ * Fields:
+ *  - Files   : Files copied.
+ *  - Bytes   : Bytes copied.
+ *  - Skipped : Files left out (already present, too large, no inode or no room for the name).
+ *  - Errors  : Files that failed while being copied.
+ *  - Seconds : Wall clock time of the whole transfer.
+ */
+typedef struct transferstats
+{
+    long Files;
+    uint64_t Bytes;
+    long Skipped;
+    long Errors;
+    double Seconds;
+}TRANSFERSTATS, *PTRANSFERSTATS;
+
+
+/*
+ * Structure: transferitem
+ * -----------------------
+ * One file of a bulk transfer. Data and Map point at the data area and the
+ * allocation bitmap of ptrinode; Blocks counts the bits an import set.
+ */
+typedef struct transferitem
+{
+    char Path[PATH_MAX];
+    PINODE ptrinode;
+    char *Data;
+    unsigned char *Map;
+    int64_t Blocks;
+    uint64_t Size;
+    int Status;
+}TRANSFERITEM, *PTRANSFERITEM;
+
+
+/*
+ * Structure: transferjob
+ * ----------------------
+ * State shared by the worker threads of one transfer.
+ */
+typedef struct transferjob
+{
+    PTRANSFERITEM Items;
+    int Count;
+    int Import;
+    std::atomic<int> Next;
+}TRANSFERJOB, *PTRANSFERJOB;
+
+
+/*
+ * Function: ImportItem
+ * --------------------
+ * Reads one host file into its data slot. Only the data runs of a sparse
+ * host file are read (SEEK_DATA / SEEK_HOLE); its holes stay holes. Size is
+ * updated to the size of the file; Status is set to -1 if the file could
+ * not be read.
+ */
+void ImportItem(PTRANSFERITEM item)
+{
+    struct stat st;
+    uint64_t size = 0, pos = 0, done = 0, want = 0;
+    off_t start = 0, end = 0;
+    ssize_t n = 0;
+    int fd = 0;
+
+    fd = open(item->Path, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1)
+    {
+        if (fd != -1)
+            close(fd);
+        item->Status = -1;
+        return;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    // The file may have changed since it was listed; never go past the slot
+    size = (uint64_t)st.st_size < (uint64_t)MAXFILESIZE ? (uint64_t)st.st_size : (uint64_t)MAXFILESIZE;
+
+    while (pos < size && item->Status == 0)
+    {
+        start = (off_t)pos;
+        end = (off_t)size;
+#ifdef SEEK_DATA
+        start = lseek(fd, (off_t)pos, SEEK_DATA);
+        if (start == -1 && errno == ENXIO)
+            break;  // Only a hole is left
+        if (start == -1)
+            start = (off_t)pos;  // Host file system without sparse file support
+        else
+            end = lseek(fd, start, SEEK_HOLE);
+        if (end == -1 || (uint64_t)end > size)
+            end = (off_t)size;
+#endif
+        if ((uint64_t)start >= size)
+            break;
+
+        for (done = (uint64_t)start; done < (uint64_t)end; done += (uint64_t)n)
+        {
+            want = (uint64_t)end - done;
+            if (want > TRANSFERIOSIZE)
+                want = TRANSFERIOSIZE;
+
+            n = pread(fd, item->Data + done, want, (off_t)done);
+            if (n == -1 && errno == EINTR)
+            {
+                n = 0;
+                continue;
+            }
+            if (n <= 0)
+                break;
+        }
+        item->Blocks += SetBlocks(item->Map, start, done - (uint64_t)start);
+
+        if (n == -1)
+            item->Status = -1;
+        else if (done < (uint64_t)end)
+            size = done;  // Shrunk while being read
+        pos = done;
+    }
+
+    close(fd);
+    item->Size = size;
+}
+
+
+/*
+ * Function: ExportItem
+ * --------------------
+ * Writes the data of one file to its host path. Only blocks that hold data
+ * are written, so holes become holes of the host file. Status is set to -1
+ * on failure.
+ */
+void ExportItem(PTRANSFERITEM item)
+{
+    int64_t blocks = BlocksOf(item->Size), first = 0, last = 0;
+    uint64_t done = 0, want = 0, end = 0;
+    ssize_t n = 0;
+    int fd = 0;
+
+    if (item->Status != 0)
+        return;  // Data could not be brought back from the spill file
+
+    fd = open(item->Path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        item->Status = -1;
+        return;
+    }
+
+    while (first < blocks && item->Status == 0)
+    {
+        first = FindBlock(item->Map, first, blocks, 1);
+        if (first >= blocks)
+            break;
+        last = FindBlock(item->Map, first, blocks, 0);
+
+        end = (uint64_t)last * BLOCKSIZE < item->Size ? (uint64_t)last * BLOCKSIZE : item->Size;
+        for (done = (uint64_t)first * BLOCKSIZE; done < end; done += (uint64_t)n)
+        {
+            want = end - done;
+            if (want > TRANSFERIOSIZE)
+                want = TRANSFERIOSIZE;
+
+            n = pwrite(fd, item->Data + done, want, (off_t)done);
+            if (n == -1 && errno == EINTR)
+            {
+                n = 0;
+                continue;
+            }
+            if (n <= 0)
+            {
+                item->Status = -1;
+                break;
+            }
+        }
+
+        first = last;
+    }
+
+    // A trailing hole only moves the end of file
+    if (item->Status == 0 && ftruncate(fd, (off_t)item->Size) == -1)
+        item->Status = -1;
+    if (close(fd) == -1)
+        item->Status = -1;
+}
+
+
+/*
+ * Function: TransferWorker
+ * ------------------------
+ * Worker thread body: copies files until none are left.
+ */
+void *TransferWorker(void *arg)
+{
+    PTRANSFERJOB job = (PTRANSFERJOB)arg;
+    int i = 0;
+
+    while ((i = job->Next.fetch_add(1, std::memory_order_relaxed)) < job->Count)
+    {
+        if (job->Import)
+            ImportItem(&job->Items[i]);
+        else
+            ExportItem(&job->Items[i]);
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Function: RunTransfer
+ * ---------------------
+ * Runs TransferWorker on `threads` threads, the calling thread included.
+ */
+void RunTransfer(PTRANSFERJOB job, int threads)
+{
+    pthread_t workers[TRANSFERMAXTHREADS];
+    int started = 0, i = 0;
+
+    if (threads == 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1)
+        threads = 1;
+    if (threads > TRANSFERMAXTHREADS)
+        threads = TRANSFERMAXTHREADS;
+    if (threads > job->Count)
+        threads = job->Count;
+
+    job->Next.store(0);
+    while (started < threads - 1)
+    {
+        if (pthread_create(&workers[started], NULL, TransferWorker, job) != 0)
+            break;
+        started++;
+    }
+    TransferWorker(job);
+    for (i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+}
+
+
+/*
+ * Function: ElapsedSince
+ * ----------------------
+ * @return Seconds of CLOCK_MONOTONIC time since `start`.
+ */
+double ElapsedSince(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+/*
+ * Function: ImportDirectory
+ * -------------------------
+ * Copies every regular file of a host directory into the VFS as a new file
+ * with read and write permission. Files whose name is too long, already
+ * exists in the VFS or that are larger than MAXFILESIZE are skipped, as are
+ * files beyond the number of free inodes. Must be called with the instance
+ * locked.
+ *
+ * @param hostdir - Host directory to read.
+ * @param threads - Number of threads to use, 0 for one per online CPU.
+ * @param stats   - Receives the counts and the elapsed time.
+ *
+ * @return
+ *   0 : Transfer finished (see stats for per-file results).
+ *  -1 : Invalid parameters.
+ *  -2 : The host directory cannot be opened.
+ *  -3 : Memory allocation failed.
+ */
+int ImportDirectory(const char *hostdir, int threads, PTRANSFERSTATS stats)
+{
+    TRANSFERJOB job;
+    PTRANSFERITEM items = NULL;
+    DIR *dir = NULL;
+    struct dirent *entry = NULL;
+    struct stat st;
+    struct timespec start;
+    PINODE temp = NULL;
+    int count = 0, i = 0;
+
+    if (hostdir == NULL || stats == NULL || threads < 0)
+        return -1;
+
+    memset(stats, 0, sizeof(*stats));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    dir = opendir(hostdir);
+    if (dir == NULL)
+        return -2;
+
+    items = (PTRANSFERITEM)calloc(MAXINODE, sizeof(TRANSFERITEM));
+    if (items == NULL)
+    {
+        closedir(dir);
+        return -3;
+    }
+
+    // Create the files up front; only this thread touches the inode table
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        snprintf(items[count].Path, sizeof(items[count].Path), "%s/%s", hostdir, entry->d_name);
+        if (stat(items[count].Path, &st) == -1 || !S_ISREG(st.st_mode))
+            continue;
+
+        if ((uint64_t)st.st_size > (uint64_t)MAXFILESIZE ||
+            Get_Inode(entry->d_name) != NULL ||
+            count == MAXINODE)
+        {
+            stats->Skipped++;
+            continue;
+        }
+
+        temp = AllocateInode(entry->d_name, READ + WRITE);
+        if (temp == NULL)
+        {
+            stats->Skipped++;
+            continue;
+        }
+
+        items[count].ptrinode = temp;
+        items[count].Data = InodeData(temp);
+        items[count].Map = InodeAllocMap(temp);
+        count++;
+    }
+    closedir(dir);
+
+    job.Items = items;
+    job.Count = count;
+    job.Import = 1;
+    if (count > 0)
+        RunTransfer(&job, threads);
+
+    // Publish the sizes, or give the inodes of failed files back
+    for (i = 0; i < count; i++)
+    {
+        temp = items[i].ptrinode;
+        temp->AllocatedBlocks = items[i].Blocks;
+        SUPERBLOCKobj.FreeBytes -= (long)items[i].Blocks * BLOCKSIZE;
+        if (items[i].Status != 0)
+        {
+            FreeBlocks(temp, 0, MAXBLOCKS);
+            TierForget(temp);
+            IndexRemove(temp);
+            temp->FileType = 0;
+            DropName(temp);
+            VersionEnd(temp);
+            ReleaseInodeSlot(temp);
+            SUPERBLOCKobj.FreeInodes++;
+            stats->Errors++;
+            continue;
+        }
+
+        temp->FileActualSize = items[i].Size;
+        MarkBlocksDirty(temp, 0, items[i].Size);
+        VersionEnd(temp);
+        stats->Files++;
+        stats->Bytes += items[i].Size;
+    }
+
+    free(items);
+    EnforceBudget(NULL);
+    stats->Seconds = ElapsedSince(&start);
+    return 0;
+}
+
+
+/*
+ * Function: ExportDirectory
+ * -------------------------
+ * Writes every regular file with read permission to a host directory,
+ * creating the directory if needed and replacing files of the same name.
+ * Must be called with the instance locked.
+ *
+ * @param hostdir - Host directory to write.
+ * @param threads - Number of threads to use, 0 for one per online CPU.
+ * @param stats   - Receives the counts and the elapsed time.
+ *
+ * @return
+ *   0 : Transfer finished (see stats for per-file results).
+ *  -1 : Invalid parameters.
+ *  -2 : The host directory cannot be created.
+ *  -3 : Memory allocation failed.
+ */
+int ExportDirectory(const char *hostdir, int threads, PTRANSFERSTATS stats)
+{
+    TRANSFERJOB job;
+    PTRANSFERITEM items = NULL;
+    struct timespec start;
+    PINODE temp = NULL;
+    int count = 0, i = 0;
+
+    if (hostdir == NULL || stats == NULL || threads < 0)
+        return -1;
+
+    memset(stats, 0, sizeof(*stats));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (mkdir(hostdir, 0755) == -1 && errno != EEXIST)
+        return -2;
+
+    items = (PTRANSFERITEM)calloc(MAXINODE, sizeof(TRANSFERITEM));
+    if (items == NULL)
+        return -3;
+
+    while (i < CurrentVFS->Names->Count)
+    {
+        temp = IndexedInode(i);
+        if (temp->FileType == REGULAR && (temp->Permission & READ))
+        {
+            snprintf(items[count].Path, sizeof(items[count].Path), "%s/%s", hostdir, InodeName(temp));
+            items[count].ptrinode = temp;
+            items[count].Data = InodeData(temp);
+            items[count].Map = InodeAllocMap(temp);
+            items[count].Size = temp->FileActualSize;
+            items[count].Status = EnsureResident(temp);
+            count++;
+        }
+        i++;
+    }
+
+    job.Items = items;
+    job.Count = count;
+    job.Import = 0;
+    if (count > 0)
+        RunTransfer(&job, threads);
+    EnforceBudget(NULL);
+
+    for (i = 0; i < count; i++)
+    {
+        if (items[i].Status != 0)
+        {
+            stats->Errors++;
+            continue;
+        }
+        stats->Files++;
+        stats->Bytes += items[i].Size;
+    }
+
+    free(items);
+    stats->Seconds = ElapsedSince(&start);
+    return 0;
+}
+
+
+/*
+ * Delta Replication
+ * -----------------
+ * ExportDelta() writes the changes made since a generation to a host file or
+ * pipe and ApplyDelta() makes them on another instance, which keeps a warm
+ * standby in step without copying everything.
+ *
+ * Every change is logged with a new generation (see LogChange), and every
+ * block carries the generation of its latest change. A delta walks the log
+ * entries after `since`: the files they name are sent whole (name, size,
+ * permission, or that the inode is free), and of their changed blocks only
+ * those whose generation is the entry's own, so a block written many times
+ * is sent once, with its current data. Neighbouring blocks go as one run.
+ * The work and the stream grow with the number of changes, not with the
+ * size of the file system. When the log no longer reaches back to `since`
+ * (or `since` is 0) the delta is full: every inode and every block that
+ * holds data.
+ *
+ * The standby mirrors inode numbers; the stream is
+ *
+ *   DELTAHEADER, DELTA_FILE records (+ name), DELTA_DATA (+ data) and
+ *   DELTA_HOLE records, DELTA_END
+ *
+ * with all file records before the data. A delta is only applied on top of
+ * the one before it from the same file system (DeltaId), or when it is
+ * full. Both functions must be called with the instance locked.
+ */
+#define DELTAMAGIC "CVFSDLT1"
+#define DELTABUFSIZE (1024 * 1024)
+
+#define DELTA_FILE 1
+#define DELTA_DATA 2
+#define DELTA_HOLE 3
+#define DELTA_END 4
+
+#define DELTA_EXISTS 1
+#define DELTA_FRESH 2
+
+
+/*
+ * Structure: deltaheader
+ * ----------------------
+ * Start of a delta stream.
+ *
+ * Fields:
+ *  - Magic : DELTAMAGIC.
+ *  - Id    : DeltaId of the file system the delta comes from.
+ *  - From  : Generation the delta starts after, 0 for a full delta.
+ *  - To    : Generation the receiver is at once the delta is applied.
+ *  - Full  : Non-zero if the delta holds the whole file system.
+ */
+typedef struct deltaheader
+{
+    char Magic[8];
+    uint64_t Id;
+    uint64_t From;
+    uint64_t To;
+    uint32_t Full;
+    uint32_t Reserved;
+}DELTAHEADER;
+
+
+/*
+ * Structure: deltarecord
+ * ----------------------
+ * One record of a delta stream.
+ *
+ * Fields:
+ *  - Type       : DELTA_FILE, DELTA_DATA, DELTA_HOLE or DELTA_END.
+ *  - Inode      : Inode table index of the file.
+ *  - Offset     : FILE: size of the file; DATA, HOLE: first byte of the run.
+ *  - Length     : FILE: length of the name that follows; DATA: bytes of data
+ *                 that follow; HOLE: bytes of the run.
+ *  - Permission : FILE: permission of the file.
+ *  - Flags      : FILE: DELTA_EXISTS unless the inode is free, DELTA_FRESH if
+ *                 the receiver has to make the file anew.
+ */
+typedef struct deltarecord
+{
+    uint32_t Type;
+    int32_t Inode;
+    uint64_t Offset;
+    uint64_t Length;
+    uint32_t Permission;
+    uint32_t Flags;
+}DELTARECORD;
+
+
+/*
+ * Structure: deltastats
+ * ---------------------
+ * Result of ExportDelta() or ApplyDelta().
+ *
+ * Fields:
+ *  - From, To    : Generations the delta spans.
+ *  - Full        : Non-zero for a full delta.
+ *  - Files       : File records.
+ *  - Runs        : Data and hole records.
+ *  - DataBytes   : Bytes of file data.
+ *  - StreamBytes : Size of the stream.
+ *  - Seconds     : Wall clock time.
+ */
+typedef struct deltastats
+{
+    uint64_t From;
+    uint64_t To;
+    int Full;
+    long Files;
+    long Runs;
+    uint64_t DataBytes;
+    uint64_t StreamBytes;
+    double Seconds;
+}DELTASTATS, *PDELTASTATS;
+
+
+/*
+ * Structure: deltastream
+ * ----------------------
+ * Buffered end of a delta stream. Error is set by the first failure: 1 if
+ * the host file failed, 2 if file data could not be read back.
+ */
+typedef struct deltastream
+{
+    int Fd;
+    char *Buf;
+    size_t Len;
+    size_t Pos;
+    uint64_t Bytes;
+    int Error;
+}DELTASTREAM, *PDELTASTREAM;
+
+
+/*
+ * Function: DeltaFlush
+ * --------------------
+ * Writes out the buffered part of an outgoing stream.
+ */
+void DeltaFlush(PDELTASTREAM s)
+{
+    if (s->Len > 0 && !s->Error && WriteAll(s->Fd, s->Buf, s->Len) != 0)
+        s->Error = 1;
+    s->Len = 0;
+}
+
+
+/*
+ * Function: DeltaPut
+ * ------------------
+ * Appends bytes to an outgoing stream; large blocks of data skip the buffer.
+ */
+void DeltaPut(PDELTASTREAM s, const void *data, size_t length)
+{
+    if (s->Len + length > DELTABUFSIZE)
+        DeltaFlush(s);
+
+    if (length >= DELTABUFSIZE)
+    {
+        if (!s->Error && WriteAll(s->Fd, data, length) != 0)
+            s->Error = 1;
+    }
+    else
+    {
+        memcpy(s->Buf + s->Len, data, length);
+        s->Len += length;
+    }
+    s->Bytes += length;
+}
+
+
+/*
+ * Function: DeltaGet
+ * ------------------
+ * Reads exactly `length` bytes of an incoming stream; large blocks of data
+ * skip the buffer.
+ *
+ * @return 0 on success, -1 if the stream failed or ended first.
+ */
+int DeltaGet(PDELTASTREAM s, void *data, size_t length)
+{
+    char *out = (char *)data;
+    size_t n = 0;
+    ssize_t got = 0;
+
+    while (length > 0 && !s->Error)
+    {
+        if (s->Pos < s->Len)
+        {
+            n = s->Len - s->Pos < length ? s->Len - s->Pos : length;
+            memcpy(out, s->Buf + s->Pos, n);
+            s->Pos += n;
+        }
+        else
+        {
+            if (length >= DELTABUFSIZE)
+                got = read(s->Fd, out, length);
+            else
+                got = read(s->Fd, s->Buf, DELTABUFSIZE);
+            if (got == -1 && errno == EINTR)
+                continue;
+            if (got <= 0)
+            {
+                s->Error = 1;
+                break;
+            }
+            if (length >= DELTABUFSIZE)
+                n = (size_t)got;
+            else
+            {
+                s->Len = (size_t)got;
+                s->Pos = 0;
+                continue;
+            }
+        }
+        out += n;
+        length -= n;
+        s->Bytes += n;
+    }
+
+    return s->Error ? -1 : 0;
+}
+
+
+/*
+ * Function: LoggedChange
+ * ----------------------
+ * @return The change log entry of generation `gen`, once it is complete,
+ *         or NULL if the log has moved past it.
+ */
+PCHANGERECORD LoggedChange(uint64_t gen)
+{
+    PCHANGERECORD rec = &CurrentVFS->ChangeLog[gen % CHANGELOGSIZE];
+    uint64_t seen = 0;
+
+    // A writer without the lock may still be filling it in
+    while ((seen = __atomic_load_n(&rec->Gen, __ATOMIC_ACQUIRE)) < gen)
+        sched_yield();
+
+    return seen == gen ? rec : NULL;
+}
+
+
+/*
+ * Function: PutRun
+ * ----------------
+ * Writes blocks [first, last) of a file, clipped to its size, as one DATA
+ * record with the data, or one HOLE record.
+ */
+void PutRun(PDELTASTREAM s, PINODE inode, int data, int64_t first, int64_t last, PDELTASTATS stats)
+{
+    DELTARECORD rec;
+    uint64_t end = (uint64_t)last * BLOCKSIZE;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.Type = data ? DELTA_DATA : DELTA_HOLE;
+    rec.Inode = InodeNumber(inode) - 1;
+    rec.Offset = (uint64_t)first * BLOCKSIZE;
+    rec.Length = (end < inode->FileActualSize ? end : inode->FileActualSize) - rec.Offset;
+
+    if (data && TierTouch(inode) != 0)
+    {
+        s->Error = 2;
+        return;
+    }
+
+    DeltaPut(s, &rec, sizeof(rec));
+    if (data)
+    {
+        DeltaPut(s, InodeData(inode) + rec.Offset, rec.Length);
+        stats->DataBytes += rec.Length;
+    }
+    stats->Runs++;
+}
+
+
+/*
+ * Function: PutBlocks
+ * -------------------
+ * Writes the blocks in [first, last) of a file that belong to a delta, in
+ * runs (see PutRun). With `since` 0 these are all blocks that hold data,
+ * otherwise the blocks changed in generations (since, to], holes included
+ * unless `holes` is 0.
+ */
+void PutBlocks(PDELTASTREAM s, PINODE inode, int64_t first, int64_t last, uint64_t since, uint64_t to,
+               int holes, PDELTASTATS stats)
+{
+    unsigned char *map = InodeAllocMap(inode);
+    uint64_t *gens = InodeBlockGens(inode);
+    int64_t block = first, start = 0;
+    int data = 0;
+
+    // Blocks past the end of file go with the size
+    if (last > BlocksOf(inode->FileActualSize))
+        last = BlocksOf(inode->FileActualSize);
+
+    while (block < last && !s->Error)
+    {
+        if (since == 0)
+        {
+            start = FindBlock(map, block, last, 1);
+            block = FindBlock(map, start, last, 0);
+            if (start < block)
+                PutRun(s, inode, 1, start, block, stats);
+            continue;
+        }
+
+        if (gens[block] <= since || gens[block] > to)
+        {
+            block++;
+            continue;
+        }
+
+        start = block;
+        data = (map[block / 8] >> (block % 8)) & 1;
+        while (block < last && gens[block] > since && gens[block] <= to &&
+               ((map[block / 8] >> (block % 8)) & 1) == data)
+            block++;
+        if (data || holes)
+            PutRun(s, inode, data, start, block, stats);
+    }
+}
+
+
+int CompareChange(const void *a, const void *b)
+{
+    const CHANGERECORD *x = (const CHANGERECORD *)a, *y = (const CHANGERECORD *)b;
+
+    if (x->Inode != y->Inode)
+        return x->Inode - y->Inode;
+    if (x->First != y->First)
+        return x->First < y->First ? -1 : 1;
+    return 0;
+}
+
+
+/*
+ * Function: ExportDelta
+ * ---------------------
+ * Writes the changes made since generation `since` to `path`, a host file
+ * that is replaced or a pipe, for ApplyDelta() on another instance.
+ *
+ * @param path  - Host file or named pipe to write.
+ * @param since - Generation the receiver is at (DeltaStats.To of the last
+ *                delta it applied), 0 for a full delta.
+ * @param stats - Receives the generations spanned and the counts.
+ *
+ * @return
+ *   0 : Delta written.
+ *  -1 : Invalid parameters, or `since` is past the current generation.
+ *  -2 : The host file cannot be opened or written.
+ *  -3 : Memory allocation failed.
+ *  -4 : File data could not be read back from the spill file.
+ */
+int ExportDelta(const char *path, uint64_t since, PDELTASTATS stats)
+{
+    DELTASTREAM s;
+    DELTAHEADER hdr;
+    DELTARECORD rec;
+    PCHANGERECORD change = NULL, ranges = NULL;
+    PINODE inode = NULL;
+    struct timespec start;
+    unsigned char changed[MAXINODE], fresh[MAXINODE];
+    uint64_t to = __atomic_load_n(&SUPERBLOCKobj.Generation, __ATOMIC_ACQUIRE), gen = 0;
+    long count = 0, next = 0;
+    int full = 0, i = 0;
+
+    if (path == NULL || stats == NULL || since > to)
+        return -1;
+
+    memset(stats, 0, sizeof(*stats));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    full = since == 0 || to - since > CHANGELOGSIZE;
+    if (!full)
+    {
+        ranges = (PCHANGERECORD)malloc((to - since + 1) * sizeof(CHANGERECORD));
+        if (ranges == NULL)
+            return -3;
+    }
+
+    // The files named by the changes since then and the blocks they changed,
+    // unless the log lost some
+    memset(changed, 0, sizeof(changed));
+    memset(fresh, 0, sizeof(fresh));
+    for (gen = since + 1; !full && gen <= to; gen++)
+    {
+        change = LoggedChange(gen);
+        if (change == NULL)
+            full = 1;
+        else
+        {
+            changed[change->Inode] = 1;
+            fresh[change->Inode] |= change->Created;
+            if (change->First < change->Last)
+                ranges[count++] = *change;
+        }
+    }
+    if (full)
+    {
+        memset(changed, 1, sizeof(changed));
+        memset(fresh, 1, sizeof(fresh));
+        since = 0;
+    }
+
+    memset(&s, 0, sizeof(s));
+    s.Buf = (char *)malloc(DELTABUFSIZE);
+    if (s.Buf == NULL)
+    {
+        free(ranges);
+        return -3;
+    }
+    s.Fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (s.Fd == -1)
+    {
+        free(ranges);
+        free(s.Buf);
+        return -2;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.Magic, DELTAMAGIC, sizeof(hdr.Magic));
+    hdr.Id = SUPERBLOCKobj.DeltaId;
+    hdr.From = since;
+    hdr.To = to;
+    hdr.Full = full;
+    DeltaPut(&s, &hdr, sizeof(hdr));
+
+    for (i = 0; i < MAXINODE; i++)
+    {
+        if (!changed[i])
+            continue;
+
+        inode = &CurrentVFS->InodeTable[i];
+        memset(&rec, 0, sizeof(rec));
+        rec.Type = DELTA_FILE;
+        rec.Inode = i;
+        if (inode->FileType != 0)
+        {
+            rec.Offset = inode->FileActualSize;
+            rec.Length = strlen(InodeName(inode));
+            rec.Permission = inode->Permission;
+            rec.Flags = DELTA_EXISTS | (fresh[i] ? DELTA_FRESH : 0);
+        }
+        DeltaPut(&s, &rec, sizeof(rec));
+        DeltaPut(&s, InodeName(inode), rec.Length);
+        stats->Files++;
+    }
+
+    if (full)
+    {
+        for (i = 0; i < MAXINODE; i++)
+        {
+            inode = &CurrentVFS->InodeTable[i];
+            if (inode->FileType != 0)
+                PutBlocks(&s, inode, 0, MAXBLOCKS, 0, to, 0, stats);
+        }
+    }
+    else
+    {
+        // Overlapping and neighbouring ranges of a file are scanned once, so
+        // runs span changes
+        qsort(ranges, count, sizeof(CHANGERECORD), CompareChange);
+        while (next < count && !s.Error)
+        {
+            change = &ranges[next++];
+            while (next < count && ranges[next].Inode == change->Inode && ranges[next].First <= change->Last)
+            {
+                if (ranges[next].Last > change->Last)
+                    change->Last = ranges[next].Last;
+                next++;
+            }
+
+            inode = &CurrentVFS->InodeTable[change->Inode];
+            if (inode->FileType != 0)
+                PutBlocks(&s, inode, change->First, change->Last, since, to, !fresh[change->Inode], stats);
+        }
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.Type = DELTA_END;
+    DeltaPut(&s, &rec, sizeof(rec));
+    DeltaFlush(&s);
+
+    if (close(s.Fd) != 0)
+        s.Error = 1;
+    free(s.Buf);
+    free(ranges);
+
+    stats->From = since;
+    stats->To = to;
+    stats->Full = full;
+    stats->StreamBytes = s.Bytes;
+    stats->Seconds = ElapsedSince(&start);
+
+    if (s.Error)
+        return s.Error == 2 ? -4 : -2;
+    return 0;
+}
+
+
+/*
+ * Function: ApplyFileRecord
+ * -------------------------
+ * Makes inode `index` match a DELTA_FILE record: frees it, or makes it the
+ * file `name` (anew if the record says so, or if it holds another file)
+ * with the given size and permission. Another inode holding `name` is
+ * freed first.
+ *
+ * @return 0 on success, -1 if the inode cannot be taken or the name stored.
+ */
+int ApplyFileRecord(int index, char *name, uint64_t size, int permission, uint32_t flags)
+{
+    PINODE inode = &CurrentVFS->InodeTable[index], other = NULL;
+
+    if (inode->FileType != 0 &&
+        (!(flags & DELTA_EXISTS) || (flags & DELTA_FRESH) || strcmp(InodeName(inode), name) != 0))
+    {
+        VersionBegin(inode);
+        RemoveInode(inode);
+        VersionEnd(inode);
+    }
+    if (!(flags & DELTA_EXISTS))
+        return 0;
+
+    other = Get_Inode(name);
+    if (other != NULL && other != inode)
+    {
+        VersionBegin(other);
+        RemoveInode(other);
+        VersionEnd(other);
+    }
+
+    if (inode->FileType == 0)
+    {
+        if (Leased(inode))
+            ReclaimRetired();
+        if (Leased(inode) || ClaimInode(inode, name, permission) != 0)
+            return -1;  // Still read, or no room for the name
+    }
+    else
+        VersionBegin(inode);
+
+    inode->Permission = permission;
+    TruncateInode(inode, size);
+    VersionEnd(inode);
+
+    return 0;
+}
+
+
+/*
+ * Function: ApplyRun
+ * ------------------
+ * Applies a DELTA_DATA record, whose data is read from the stream into the
+ * file, or a DELTA_HOLE record.
+ *
+ * @return 0 on success, -2 if the stream failed, -5 if the record is invalid.
+ */
+int ApplyRun(PDELTASTREAM s, DELTARECORD *rec, PDELTASTATS stats)
+{
+    PINODE inode = NULL;
+
+    if (rec->Inode < 0 || rec->Inode >= MAXINODE)
+        return -5;
+    inode = &CurrentVFS->InodeTable[rec->Inode];
+    if (inode->FileType == 0 || rec->Offset % BLOCKSIZE != 0 || rec->Length == 0 ||
+        rec->Offset > inode->FileActualSize || rec->Length > inode->FileActualSize - rec->Offset)
+        return -5;
+    if (TierTouch(inode) != 0)
+        return -5;
+
+    VersionBegin(inode);
+    if (rec->Type == DELTA_DATA)
+    {
+        if (DeltaGet(s, InodeData(inode) + rec->Offset, rec->Length) != 0)
+        {
+            VersionEnd(inode);
+            return -2;
+        }
+        AllocateBlocks(inode, rec->Offset, rec->Length);
+        stats->DataBytes += rec->Length;
+    }
+    else
+        FreeBlocks(inode, rec->Offset / BLOCKSIZE, BlocksOf(rec->Offset + rec->Length));
+    MarkBlocksDirty(inode, rec->Offset, rec->Length);
+    VersionEnd(inode);
+
+    EnforceBudget(inode);
+    stats->Runs++;
+    return 0;
+}
+
+
+/*
+ * Function: ApplyDelta
+ * --------------------
+ * Reads a delta written by ExportDelta() from `path`, a host file or pipe,
+ * and makes its changes. A delta that stops early can be applied again.
+ *
+ * @param path  - Host file or named pipe to read.
+ * @param stats - Receives the generations spanned and the counts.
+ *
+ * @return
+ *   0 : Delta applied; SourceGen is its To generation.
+ *  -1 : Invalid parameters.
+ *  -2 : The host file cannot be opened or read, or the stream ended early.
+ *  -3 : Memory allocation failed.
+ *  -4 : The delta does not follow the last one applied here; a full delta is needed.
+ *  -5 : The stream is malformed, or a file could not be made.
+ */
+int ApplyDelta(const char *path, PDELTASTATS stats)
+{
+    DELTASTREAM s;
+    DELTAHEADER hdr;
+    DELTARECORD rec;
+    struct timespec start;
+    char *name = NULL;
+    int ret = 0;
+
+    if (path == NULL || stats == NULL)
+        return -1;
+
+    memset(stats, 0, sizeof(*stats));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    memset(&s, 0, sizeof(s));
+    s.Buf = (char *)malloc(DELTABUFSIZE);
+    if (s.Buf == NULL)
+        return -3;
+    s.Fd = open(path, O_RDONLY);
+    if (s.Fd == -1)
+    {
+        free(s.Buf);
+        return -2;
+    }
+
+    if (DeltaGet(&s, &hdr, sizeof(hdr)) != 0)
+        ret = -2;
+    else if (memcmp(hdr.Magic, DELTAMAGIC, sizeof(hdr.Magic)) != 0)
+        ret = -5;
+    else if (!hdr.Full && (hdr.Id != SUPERBLOCKobj.SourceId || hdr.From != SUPERBLOCKobj.SourceGen))
+        ret = -4;
+
+    while (ret == 0)
+    {
+        if (DeltaGet(&s, &rec, sizeof(rec)) != 0)
+        {
+            ret = -2;
+            break;
+        }
+
+        if (rec.Type == DELTA_END)
+        {
+            SUPERBLOCKobj.SourceId = hdr.Id;
+            SUPERBLOCKobj.SourceGen = hdr.To;
+            break;
+        }
+        else if (rec.Type == DELTA_DATA || rec.Type == DELTA_HOLE)
+            ret = ApplyRun(&s, &rec, stats);
+        else if (rec.Type == DELTA_FILE)
+        {
+            if (rec.Inode < 0 || rec.Inode >= MAXINODE || rec.Length > NAMEARENASIZE || rec.Offset > (uint64_t)MAXFILESIZE ||
+                ((rec.Flags & DELTA_EXISTS) && (rec.Length == 0 || rec.Permission == 0 || rec.Permission > 3)))
+            {
+                ret = -5;
+                break;
+            }
+            name = (char *)malloc(rec.Length + 1);
+            if (name == NULL)
+                ret = -3;
+            else if (DeltaGet(&s, name, rec.Length) != 0)
+                ret = -2;
+            else
+            {
+                name[rec.Length] = '\0';
+                if (strlen(name) != rec.Length ||
+                    ApplyFileRecord(rec.Inode, name, rec.Offset, rec.Permission, rec.Flags) != 0)
+                    ret = -5;
+                stats->Files++;
+            }
+            free(name);
+        }
+        else
+            ret = -5;
+    }
+
+    close(s.Fd);
+    free(s.Buf);
+
+    stats->From = hdr.From;
+    stats->To = hdr.To;
+    stats->Full = hdr.Full;
+    stats->StreamBytes = s.Bytes;
+    stats->Seconds = ElapsedSince(&start);
+
+    return ret;
+}
+
+
+/*
+ * Submission / Completion Ring
+ * ----------------------------
+ * An io_uring style front-end for the VFS. Callers push requests into the
+ * submission queue (SQ), a pool of worker threads executes them and posts
+ * one completion per request into the completion queue (CQ).
+ *
+ * Requests marked with REQ_LINK are chained to the request that follows them
+ * in the same SubmitRequests() call; a chain runs in order on one worker, and
+ * a failing request cancels the rest of its chain. A request whose fd is
+ * FD_FROM_LINK uses the descriptor returned by the last open or create of
+ * its chain, which allows open -> read -> close in a single submission.
+ */
+#define RINGSIZE 256
+#define RINGWORKERS 4
+
+#define REQ_LINK 1
+
+#define FD_FROM_LINK -100
+#define RING_CANCELED -99
+
+
+/*
+ * Structure: filestat
+ * -------------------
+ * Metadata snapshot returned by GetFileStat() and OP_STAT requests.
+ */
+typedef struct filestat
+{
+    int InodeNumber;
+    uint64_t FileSize;
+    uint64_t FileActualSize;
+    int LinkCount;
+    int ReferenceCount;
+    int Permission;
+}FILESTAT, *PFILESTAT;
+
+
+/*
+ * Structure: vfsrequest
+ * ---------------------
+ * One submission queue entry.
+ *
+ * Fields:
+ *  - opcode   : Operation to perform (OP_CREATE, OP_READ, ...).
+ *  - fd       : File descriptor, or FD_FROM_LINK to use the previous result.
+ *  - name     : File name for create, open, stat and rm.
+ *  - buffer   : Data buffer for read/write, FILESTAT for stat.
+ *  - size     : Byte count for read/write, offset for lseek,
+ *               permission/mode for create/open.
+ *  - from     : Whence for lseek (START, CURRENT, END).
+ *  - flags    : REQ_LINK to chain with the next request.
+ *  - userdata : Opaque value copied into the completion.
+ *  - callback : Optional; when set, the worker calls it with userdata and
+ *               the result instead of posting a completion to the CQ.
+ */
+typedef struct vfsrequest
+{
+    int opcode;
+    int fd;
+    char *name;
+    char *buffer;
+    int64_t size;
+    int from;
+    int flags;
+    void *userdata;
+    void (*callback)(void *userdata, int64_t result);
+}VFSREQUEST, *PVFSREQUEST;
+
+
+/*
+ * Structure: vfscompletion
+ * ------------------------
+ * One completion queue entry: the request's userdata and the value the
+ * corresponding VFS function returned (or RING_CANCELED).
+ */
+typedef struct vfscompletion
+{
+    void *userdata;
+    int64_t result;
+}VFSCOMPLETION, *PVFSCOMPLETION;
+
+
+/*
+ * Structure: vfsring
+ * ------------------
+ * Both queues are power-of-two circular buffers indexed by free running
+ * head/tail counters, protected by RingLock.
+ */
+typedef struct vfsring
+{
+    VFSREQUEST SubmissionQueue[RINGSIZE];
+    unsigned SqHead;
+    unsigned SqTail;
+    VFSCOMPLETION CompletionQueue[RINGSIZE];
+    unsigned CqHead;
+    unsigned CqTail;
+    pthread_mutex_t RingLock;
+    pthread_cond_t SqNotEmpty;
+    pthread_cond_t CqNotEmpty;
+    pthread_cond_t CqNotFull;
+    pthread_t Workers[RINGWORKERS];
+    int WorkerCount;
+    int Running;
+}VFSRING, *PVFSRING;
+
+
+VFSRING RingObj;
+
+
+/*
+ * Function: GetFileStat
+ * ---------------------
+ * Fills a FILESTAT with the metadata of the named file.
+ *
+ * @return
+ *   0  : Success.
+ *  -1  : Invalid parameters.
+ *  -2  : File not found.
+ */
+int GetFileStat(char *name, PFILESTAT st)
+{
+    PINODE temp = NULL;
+
+    if (name == NULL || st == NULL)
+        return -1;
+
+    temp = Get_Inode(name);
+    if (temp == NULL || temp->FileType == 0)
+        return -2;
+
+    st->InodeNumber = InodeNumber(temp);
+    st->FileSize = MAXFILESIZE;
+    st->FileActualSize = temp->FileActualSize;
+    st->LinkCount = temp->LinkCount;
+    st->ReferenceCount = temp->ReferenceCount;
+    st->Permission = temp->Permission;
+
+    return 0;
+}
+
+
+/*
+ * Function: ExecuteRequest
+ * ------------------------
+ * Runs a single request against the VFS. Must be called with the instance locked (LockVFS).
+ *
+ * @param req    - Request to execute.
+ * @param linkfd - Descriptor opened earlier in the chain (for FD_FROM_LINK).
+ *
+ * @return The value returned by the underlying VFS function.
+ */
+int64_t ExecuteRequest(PVFSREQUEST req, int linkfd)
+{
+    int fd = req->fd;
+
+    if (fd == FD_FROM_LINK)
+        fd = linkfd;
+
+    switch (req->opcode)
+    {
+        case OP_NOP:
+            return 0;
+        case OP_CREATE:
+            return CreateFile(req->name, (int)req->size);
+        case OP_OPEN:
+            return OpenFile(req->name, (int)req->size);
+        case OP_STAT:
+            return GetFileStat(req->name, (PFILESTAT)req->buffer);
+        case OP_RM:
+            return rm_File(req->name);
+    }
+
+    // Remaining operations work on a descriptor
+    if (fd < 0 || fd >= 50 || UFDTArr[fd].ptrfiletable == NULL)
+        return -1;
+
+    switch (req->opcode)
+    {
+        case OP_READ:
+            return ReadFile(fd, req->buffer, req->size);
+        case OP_WRITE:
+            return WriteFile(fd, req->buffer, req->size);
+        case OP_LSEEK:
+            return LseekFile(fd, req->size, req->from);
+        case OP_CLOSE:
+            CloseFileByName(fd);
+            return 0;
+    }
+
+    return -1;  // Unknown opcode
+}
+
+
+/*
+ * Function: PostCompletion
+ * ------------------------
+ * Appends a completion to the CQ, waiting while the CQ is full. Once the
+ * ring is shutting down a full CQ drops the completion instead.
+ * Must be called with RingLock held.
+ */
+void PostCompletion(void *userdata, int64_t result)
+{
+    while (RingObj.CqTail - RingObj.CqHead == RINGSIZE && RingObj.Running)
+        pthread_cond_wait(&RingObj.CqNotFull, &RingObj.RingLock);
+
+    if (RingObj.CqTail - RingObj.CqHead == RINGSIZE)
+        return;  // Nobody is reaping any more
+
+    RingObj.CompletionQueue[RingObj.CqTail % RINGSIZE].userdata = userdata;
+    RingObj.CompletionQueue[RingObj.CqTail % RINGSIZE].result = result;
+    RingObj.CqTail++;
+
+    pthread_cond_broadcast(&RingObj.CqNotEmpty);
+}
+
+
+/*
+ * Function: RingWorker
+ * --------------------
+ * Worker thread body. Takes one chain of linked requests off the SQ,
+ * executes it under a single LockVFS() acquisition and posts the results
+ * (or hands them to the requests' callbacks). A read that is not part of a
+ * chain runs without the lock (see DoReadFileNoLock), so reads of several
+ * workers overlap, for example while the backing file pages data in.
+ */
+void *RingWorker(void *)
+{
+    VFSREQUEST chain[RINGSIZE];
+    int64_t results[RINGSIZE], last = 0;
+    int n = 0, i = 0, linkfd = -1;
+
+    pthread_mutex_lock(&RingObj.RingLock);
+    while (1)
+    {
+        while (RingObj.Running && RingObj.SqHead == RingObj.SqTail)
+            pthread_cond_wait(&RingObj.SqNotEmpty, &RingObj.RingLock);
+
+        if (RingObj.SqHead == RingObj.SqTail)
+            break;  // Ring shut down and drained
+
+        // Dequeue the whole chain while still holding RingLock
+        n = 0;
+        do
+        {
+            chain[n] = RingObj.SubmissionQueue[RingObj.SqHead % RINGSIZE];
+            RingObj.SqHead++;
+            n++;
+        } while ((chain[n - 1].flags & REQ_LINK) && RingObj.SqHead != RingObj.SqTail);
+        pthread_mutex_unlock(&RingObj.RingLock);
+
+        if (n == 1 && chain[0].opcode == OP_READ && chain[0].fd != FD_FROM_LINK)
+            results[0] = ReadFileNoLock(chain[0].fd, chain[0].buffer, chain[0].size);
+        else
+        {
+            LockVFS();
+            last = 0;
+            linkfd = -1;
+            for (i = 0; i < n; i++)
+            {
+                if (last < 0)
+                {
+                    results[i] = RING_CANCELED;
+                    continue;
+                }
+                results[i] = ExecuteRequest(&chain[i], linkfd);
+                last = results[i];
+
+                // Later requests of the chain may refer to this descriptor
+                if ((chain[i].opcode == OP_OPEN || chain[i].opcode == OP_CREATE) && last >= 0)
+                    linkfd = (int)last;
+            }
+            UnlockVFS();
+        }
+
+        // Callbacks run without any lock held, they may submit again
+        for (i = 0; i < n; i++)
+            if (chain[i].callback != NULL)
+                chain[i].callback(chain[i].userdata, results[i]);
+
+        pthread_mutex_lock(&RingObj.RingLock);
+        for (i = 0; i < n; i++)
+            if (chain[i].callback == NULL)
+                PostCompletion(chain[i].userdata, results[i]);
+    }
+    pthread_mutex_unlock(&RingObj.RingLock);
+
+    return NULL;
+}
+
+
+/*
+ * Function: ShutdownRing
+ * ----------------------
+ * Lets the workers drain the SQ, then joins them. Completions that have not
+ * been reaped by then may be discarded.
+ */
+void ShutdownRing()
+{
+    int i = 0;
+
+    pthread_mutex_lock(&RingObj.RingLock);
+    RingObj.Running = 0;
+    pthread_cond_broadcast(&RingObj.SqNotEmpty);
+    pthread_cond_broadcast(&RingObj.CqNotFull);
+    pthread_mutex_unlock(&RingObj.RingLock);
+
+    while (i < RingObj.WorkerCount)
+    {
+        pthread_join(RingObj.Workers[i], NULL);
+        i++;
+    }
+    RingObj.WorkerCount = 0;
+}
+
+
+/*
+ * Function: InitialiseRing
+ * ------------------------
+ * Resets both queues and starts the worker threads.
+ *
+ * @param workers - Number of worker threads (1 to RINGWORKERS).
+ *
+ * @return
+ *   0  : Ring started.
+ *  -1  : Invalid worker count or ring already running.
+ *  -2  : Thread creation failed.
+ */
+int InitialiseRing(int workers)
+{
+    int i = 0;
+
+    if (workers <= 0 || workers > RINGWORKERS || RingObj.Running)
+        return -1;
+
+    RingObj.SqHead = RingObj.SqTail = 0;
+    RingObj.CqHead = RingObj.CqTail = 0;
+    pthread_mutex_init(&RingObj.RingLock, NULL);
+    pthread_cond_init(&RingObj.SqNotEmpty, NULL);
+    pthread_cond_init(&RingObj.CqNotEmpty, NULL);
+    pthread_cond_init(&RingObj.CqNotFull, NULL);
+    RingObj.Running = 1;
+    RingObj.WorkerCount = 0;
+
+    while (i < workers)
+    {
+        if (pthread_create(&RingObj.Workers[i], NULL, RingWorker, NULL) != 0)
+        {
+            ShutdownRing();
+            return -2;
+        }
+        RingObj.WorkerCount++;
+        i++;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Function: SubmitRequests
+ * ------------------------
+ * Copies a batch of requests into the SQ with one lock acquisition and
+ * wakes the workers. The last request of a batch always ends its chain.
+ *
+ * @param reqs  - Array of requests.
+ * @param count - Number of requests in the array.
+ *
+ * @return
+ *  >= 0 : Number of requests queued.
+ *   -1  : Invalid parameters or ring not running.
+ *   -2  : Not enough free SQ entries for the whole batch.
+ */
+int SubmitRequests(PVFSREQUEST reqs, int count)
+{
+    int i = 0;
+
+    if (reqs == NULL || count <= 0 || count > RINGSIZE)
+        return -1;
+
+    pthread_mutex_lock(&RingObj.RingLock);
+    if (!RingObj.Running)
+    {
+        pthread_mutex_unlock(&RingObj.RingLock);
+        return -1;
+    }
+    if (RINGSIZE - (RingObj.SqTail - RingObj.SqHead) < (unsigned)count)
+    {
+        pthread_mutex_unlock(&RingObj.RingLock);
+        return -2;  // Submission queue full
+    }
+
+    while (i < count)
+    {
+        RingObj.SubmissionQueue[RingObj.SqTail % RINGSIZE] = reqs[i];
+        if (i == count - 1)
+            RingObj.SubmissionQueue[RingObj.SqTail % RINGSIZE].flags &= ~REQ_LINK;
+        RingObj.SqTail++;
+        i++;
+    }
+
+    pthread_cond_broadcast(&RingObj.SqNotEmpty);
+    pthread_mutex_unlock(&RingObj.RingLock);
+
+    return count;
+}
+
+
+/*
+ * Function: ReapCompletions
+ * -------------------------
+ * Moves up to `max` completions out of the CQ, waiting until at least
+ * `minimum` are available.
+ *
+ * @return Number of completions copied into `out`.
+ */
+int ReapCompletions(PVFSCOMPLETION out, int max, int minimum)
+{
+    int n = 0;
+
+    if (out == NULL || max <= 0)
+        return 0;
+    if (minimum > max)
+        minimum = max;
+
+    pthread_mutex_lock(&RingObj.RingLock);
+    while ((int)(RingObj.CqTail - RingObj.CqHead) < minimum && RingObj.Running)
+        pthread_cond_wait(&RingObj.CqNotEmpty, &RingObj.RingLock);
+
+    while (n < max && RingObj.CqHead != RingObj.CqTail)
+    {
+        out[n] = RingObj.CompletionQueue[RingObj.CqHead % RINGSIZE];
+        RingObj.CqHead++;
+        n++;
+    }
+
+    if (n > 0)
+        pthread_cond_broadcast(&RingObj.CqNotFull);
+    pthread_mutex_unlock(&RingObj.RingLock);
+
+    return n;
+}
+
+
+
+/*
+ * Sharded VFS
+ * -----------
+ * A shared-nothing mode in which the namespace is hash-partitioned over
+ * NumShards complete VFS instances, each with its own superblock, inode list,
+ * descriptor table and buffers, and each served by one thread pinned to one
+ * core. Client threads never touch shard state: requests travel to the owning
+ * shard over a lock-free single-producer/single-consumer queue per
+ * (client, shard) pair and the result comes back through the message itself.
+ *
+ * Name based requests go to ShardOf(name). Descriptors returned by the shards
+ * are global: fd = shard * 50 + local fd.
+ */
+#define MAXSHARDS 64
+#define MAXSHARDCLIENTS 64
+#define SHARDQUEUESIZE 64
+#define SHARDIDLESPINS 128      // Empty polls before a shard thread sleeps
+
+
+/*
+ * Structure: shardmsg
+ * -------------------
+ * A request in flight to a shard. The client owns the message; the shard
+ * writes `result` and then releases `done`.
+ */
+typedef struct shardmsg
+{
+    VFSREQUEST req;
+    int64_t result;
+    std::atomic<int> done;
+}SHARDMSG, *PSHARDMSG;
+
+
+/*
+ * Structure: spscqueue
+ * --------------------
+ * Bounded single-producer/single-consumer ring of message pointers. The
+ * producer only writes Tail, the consumer only writes Head.
+ */
+typedef struct spscqueue
+{
+    PSHARDMSG Slots[SHARDQUEUESIZE];
+    alignas(64) std::atomic<unsigned> Head;
+    alignas(64) std::atomic<unsigned> Tail;
+}SPSCQUEUE, *PSPSCQUEUE;
+
+
+/*
+ * Structure: vfsshard
+ * -------------------
+ * One shard: its private VFS instance, its thread and one inbound queue per
+ * client. Aligned so that neighbouring shards never share a cache line.
+ *
+ * A shard thread that finds its queues empty SHARDIDLESPINS times in a row
+ * sets Asleep and waits on Doorbell; clients ring the doorbell after queuing
+ * a message to a sleeping shard.
+ */
+typedef struct alignas(64) vfsshard
+{
+    VFSINSTANCE Instance;
+    SPSCQUEUE Inbox[MAXSHARDCLIENTS];
+    alignas(64) std::atomic<int> Asleep;
+    std::atomic<unsigned> Doorbell;
+    pthread_t Thread;
+    int Core;
+}VFSSHARD, *PVFSSHARD;
+
+
+PVFSSHARD Shards = NULL;
+int NumShards = 0;
+std::atomic<int> ShardsRunning(0);
+std::atomic<int> ShardClients(0);               // Highest client slot in use + 1
+std::atomic<int> ShardClientUsed[MAXSHARDCLIENTS];
+
+
+/*
+ * Structure: shardclient
+ * ----------------------
+ * The calling thread's client slot, taken on its first ShardCall(). The
+ * destructor runs when the thread exits and frees the slot for a new
+ * thread, so the limit is MAXSHARDCLIENTS threads at a time.
+ */
+struct ShardClient
+{
+    int Id = -1;
+
+    ~ShardClient()
+    {
+        if (Id >= 0)
+            ShardClientUsed[Id].store(0, std::memory_order_release);
+    }
+};
+
+thread_local ShardClient ShardClientSlot;
+
+
+/*
+ * Function: SpscPush
+ * ------------------
+ * @return 1 if the message was queued, 0 if the queue is full.
+ */
+int SpscPush(PSPSCQUEUE q, PSHARDMSG msg)
+{
+    unsigned tail = q->Tail.load(std::memory_order_relaxed);
+
+    if (tail - q->Head.load(std::memory_order_acquire) == SHARDQUEUESIZE)
+        return 0;
+
+    q->Slots[tail % SHARDQUEUESIZE] = msg;
+    q->Tail.store(tail + 1, std::memory_order_release);
+    return 1;
+}
+
+
+/*
+ * Function: SpscPop
+ * -----------------
+ * @return The oldest queued message, or NULL if the queue is empty.
+ */
+PSHARDMSG SpscPop(PSPSCQUEUE q)
+{
+    unsigned headpos = q->Head.load(std::memory_order_relaxed);
+    PSHARDMSG msg = NULL;
+
+    if (headpos == q->Tail.load(std::memory_order_acquire))
+        return NULL;
+
+    msg = q->Slots[headpos % SHARDQUEUESIZE];
+    q->Head.store(headpos + 1, std::memory_order_release);
+    return msg;
+}
+
+
 /*
- * Function: CreateDILB
- * --------------------
- * Creates the Disk Inode List Block (DILB), which is a linked list of inodes.
- * Initializes all inodes with default values and assigns unique inode numbers.
- *
- * This function sets up the file system’s basic structure for managing files.
+ * Function: AcquireShardClient
+ * ----------------------------
+ * Takes a free client slot for the calling thread and raises ShardClients
+ * so the shard threads poll its queues.
  *
- * Prints a success message once all inodes are created.
+ * @return The slot, or -1 if MAXSHARDCLIENTS threads hold one.
  */
-void CreateDILB()
+int AcquireShardClient()
 {
-    int i = 1;
-    PINODE newn = NULL;
-    PINODE temp = head;
+    int i = 0, expected = 0, top = 0;
 
-    while(i <= MAXINODE)
+    while (i < MAXSHARDCLIENTS)
     {
-        newn = (PINODE)malloc(sizeof(INODE));
-        
-        // Check if memory allocation was successful
-        if (newn == NULL)
-        {
-            printf("Memory allocation failed for inode %d\n", i);
-            return;
-        }
+        expected = 0;
+        if (ShardClientUsed[i].compare_exchange_strong(expected, 1, std::memory_order_acquire))
+            break;
+        i++;
+    }
+    if (i == MAXSHARDCLIENTS)
+        return -1;
 
-        // Initialize inode fields
-        newn->LinkCount = 0;
-        newn->ReferenceCount = 0;
-        newn->FileType = 0;
-        newn->FileSize = 0;
-        newn->Buffer = NULL;
-        newn->InodeNumber = i;
-        newn->next = NULL;  // No need to initialize this, malloc does it by default.
+    top = ShardClients.load(std::memory_order_relaxed);
+    while (top < i + 1 && !ShardClients.compare_exchange_weak(top, i + 1, std::memory_order_release))
+        ;
+
+    return i;
+}
+
+
+/*
+ * Function: RingShard
+ * -------------------
+ * Wakes a shard thread that went to sleep on its doorbell. Called after a
+ * message was queued; the fence pairs with the one in ShardMain so either
+ * the shard sees the message or the client sees Asleep.
+ */
+void RingShard(PVFSSHARD shard)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (shard->Asleep.load(std::memory_order_relaxed))
+    {
+        shard->Doorbell.fetch_add(1, std::memory_order_release);
+        shard->Doorbell.notify_one();
+    }
+}
+
+
+/*
+ * Function: ShardOf
+ * -----------------
+ * FNV-1a hash of the file name, reduced to a shard index.
+ */
+int ShardOf(const char *name)
+{
+    unsigned hash = 2166136261u;
+
+    while (*name != '\0')
+    {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+
+    return (int)(hash % (unsigned)NumShards);
+}
+
+
+/*
+ * Function: ShardMain
+ * -------------------
+ * Shard thread body. Pins itself to its core, builds its private instance
+ * and then polls its client queues until the shards are shut down. After
+ * SHARDIDLESPINS empty polls it sleeps on its doorbell (see RingShard).
+ */
+void *ShardMain(void *arg)
+{
+    PVFSSHARD shard = (PVFSSHARD)arg;
+    PSHARDMSG msg = NULL;
+    unsigned bell = 0;
+    int i = 0, idle = 0, spins = 0, clients = 0;
+
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(shard->Core, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+
+    // Allocated on this thread, so the memory is local to this core
+    CurrentVFS = &shard->Instance;
+    head = NULL;
+    InitialiseSuperBlock();
+    CreateDILB();
 
-        if(temp == NULL)
+    while (ShardsRunning.load(std::memory_order_acquire))
+    {
+        idle = 1;
+        clients = ShardClients.load(std::memory_order_acquire);
+        if (clients > MAXSHARDCLIENTS)
+            clients = MAXSHARDCLIENTS;
+        for (i = 0; i < clients; i++)
+        {
+            while ((msg = SpscPop(&shard->Inbox[i])) != NULL)
+            {
+                msg->result = ExecuteRequest(&msg->req, -1);
+                msg->done.store(1, std::memory_order_release);
+                idle = 0;
+            }
+        }
+        if (!idle)
         {
-            head = newn;
-            temp = head;
+            spins = 0;
+            continue;
         }
-        else
+        if (++spins < SHARDIDLESPINS)
         {
-            temp->next = newn;
-            temp = temp->next;
+            sched_yield();
+            continue;
         }
+
+        // Announce the sleep, then look once more before waiting
+        bell = shard->Doorbell.load(std::memory_order_acquire);
+        shard->Asleep.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        clients = ShardClients.load(std::memory_order_acquire);
+        if (clients > MAXSHARDCLIENTS)
+            clients = MAXSHARDCLIENTS;
+        for (i = 0; i < clients && idle; i++)
+            if (shard->Inbox[i].Head.load(std::memory_order_relaxed) != shard->Inbox[i].Tail.load(std::memory_order_acquire))
+                idle = 0;
+        if (idle && ShardsRunning.load(std::memory_order_acquire))
+            shard->Doorbell.wait(bell, std::memory_order_acquire);
+        shard->Asleep.store(0, std::memory_order_relaxed);
+        spins = 0;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Function: ShutdownShards
+ * ------------------------
+ * Stops and joins the shard threads and releases the shards. Callers must
+ * not have ShardCall() requests in flight.
+ */
+void ShutdownShards()
+{
+    int i = 0;
+
+    if (Shards == NULL)
+        return;
+
+    ShardsRunning.store(0, std::memory_order_release);
+    while (i < NumShards)
+    {
+        Shards[i].Doorbell.fetch_add(1, std::memory_order_release);
+        Shards[i].Doorbell.notify_one();
+        pthread_join(Shards[i].Thread, NULL);
         i++;
     }
-    printf("DILB created successfully\n");
+
+    delete[] Shards;
+    Shards = NULL;
+    NumShards = 0;
 }
 
+
 /*
- * Function: InitialiseSuperBlock
- * ------------------------------
- * Initializes the SuperBlock and User File Descriptor Table (UFDT).
+ * Function: InitialiseShards
+ * --------------------------
+ * Creates `count` shards, shard i pinned to core i modulo the online cores.
  *
- * - Sets all entries in the UFDT array to NULL (no files are open initially).
- * - Sets the total and free inode count in the superblock to MAXINODE.
- *
- * This function prepares the file system for use by resetting its metadata.
+ * @return
+ *   0  : Shards started.
+ *  -1  : Invalid count or shards already running.
+ *  -2  : Memory allocation or thread creation failed.
  */
-void InitialiseSuperBlock()
+int InitialiseShards(int count)
 {
     int i = 0;
-    while(i < MAXINODE)
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (count <= 0 || count > MAXSHARDS || Shards != NULL)
+        return -1;
+    if (cores <= 0)
+        cores = 1;
+
+    Shards = new (std::nothrow) VFSSHARD[count]();
+    if (Shards == NULL)
+        return -2;
+
+    NumShards = count;
+    ShardsRunning.store(1);
+    while (i < count)
     {
-        UFDTArr[i].ptrfiletable = NULL;
+        Shards[i].Instance.FileSpan = SpanOf(DataAreaSize / count);  // The shards share one data budget
+        Shards[i].Core = (int)(i % cores);
+        if (pthread_create(&Shards[i].Thread, NULL, ShardMain, &Shards[i]) != 0)
+        {
+            NumShards = i;
+            ShutdownShards();
+            return -2;
+        }
         i++;
     }
 
-    SUPERBLOCKobj.TotalInodes = MAXINODE;
-    SUPERBLOCKobj.FreeInodes = MAXINODE;
+    return 0;
 }
 
 
-
 /*
- * Function: CreateFile
- * --------------------
- * Creates a new regular file in the virtual file system with the given name and permission.
- * Allocates an inode, initializes metadata, and assigns a file descriptor entry.
+ * Function: ShardCall
+ * -------------------
+ * Routes one request to its owning shard and waits for the result. The
+ * calling thread takes a shard client slot on first use and keeps it until
+ * it exits.
  *
- * @param name       - The name of the file to be created.
- * @param permission - Access permission (1 = Read, 2 = Write, 3 = Read + Write).
+ * For fd based requests `req->fd` is a global descriptor; OP_CREATE and
+ * OP_OPEN return global descriptors.
  *
- * @return 
- *  >= 0  : File descriptor index if the file is successfully created.
- *   -1   : Invalid parameters (null name or incorrect permission).
- *   -2   : No free inodes available.
- *   -3   : File with the same name already exists.
- *   -4   : No available inode slot found.
- *   -5   : No available file descriptor slot in UFDT.
- *   -6   : Memory allocation failed for file table.
- *   -7   : Memory allocation failed for file data buffer.
+ * @return The result of the request, or -1 for an invalid descriptor,
+ *         -10 when the shards are not running or MAXSHARDCLIENTS other
+ *         threads hold a client slot.
  */
-
-int CreateFile(char *name, int permission)
+int64_t ShardCall(PVFSREQUEST req)
 {
-    int i = 0;
-    PINODE temp = head;
+    SHARDMSG msg;
+    int shard = 0;
 
-    // Check if name is valid, permission is in the range 1 to 3
-    if ((name == NULL) || (permission == 0) || (permission > 3))
-        return -1;  // Invalid input
-
-    // Check if there are free inodes
-    if (SUPERBLOCKobj.FreeInodes == 0)
-        return -2;  // No free inodes available
+    if (!ShardsRunning.load(std::memory_order_acquire))
+        return -10;
 
-    // Decrement free inodes
-    SUPERBLOCKobj.FreeInodes--;
+    if (ShardClientSlot.Id == -1)
+        ShardClientSlot.Id = AcquireShardClient();
+    if (ShardClientSlot.Id == -1)
+        return -10;
 
-    // Check if file with the same name already exists
-    if (Get_Inode(name) != NULL)
-        return -3;  // File already exists
+    msg.req = *req;
+    msg.req.flags = 0;
+    msg.req.callback = NULL;
+    msg.done.store(0, std::memory_order_relaxed);
 
-    // Find an available inode with FileType 0 (empty slot)
-    while (temp != NULL)
+    if (req->opcode == OP_CREATE || req->opcode == OP_OPEN ||
+        req->opcode == OP_STAT || req->opcode == OP_RM)
     {
-        if (temp->FileType == 0)  // Found an empty inode slot
-            break;
-        temp = temp->next;
+        if (req->name == NULL)
+            return -1;
+        shard = ShardOf(req->name);
     }
-
-    // If no empty inode slot was found
-    if (temp == NULL)
-        return -4;  // No available inode for new file
-
-    // Find an available slot in the UFDT array
-    while (i < 50)
+    else
     {
-        if (UFDTArr[i].ptrfiletable == NULL)  // Found an empty slot in UFDT
-            break;
-        i++;
+        if (req->fd < 0 || req->fd >= NumShards * 50)
+            return -1;
+        shard = req->fd / 50;
+        msg.req.fd = req->fd % 50;
     }
 
-    // If no available file descriptor slot was found
-    if (i == 50)
-        return -5;  // No available file descriptor slot
+    while (!SpscPush(&Shards[shard].Inbox[ShardClientSlot.Id], &msg))
+        sched_yield();
+    RingShard(&Shards[shard]);
 
-    // Allocate memory for the file table entry
-    UFDTArr[i].ptrfiletable = (PFILETABLE)malloc(sizeof(FILETABLE));
-    if (UFDTArr[i].ptrfiletable == NULL)  // Check malloc success
+    while (!msg.done.load(std::memory_order_acquire))
+        sched_yield();
+
+    if ((req->opcode == OP_CREATE || req->opcode == OP_OPEN) && msg.result >= 0)
+        return shard * 50 + msg.result;
+
+    return msg.result;
+}
+
+
+
+/*
+ * Coroutine Front-End
+ * -------------------
+ * Awaitable versions of the core operations, e.g.
+ *
+ *     int n = co_await vfs.read(fd, buf, size);
+ *
+ * An awaitable first tries to run its request inline: if the VFS lock is free the
+ * operation completes on the calling thread and the coroutine continues
+ * without being suspended. Otherwise the request is submitted to the ring and
+ * the coroutine is resumed by the ring worker that completes it, so any number
+ * of logical operations can be in flight on RINGWORKERS threads.
+ * The ring must have been started with InitialiseRing(); without it the
+ * slow path blocks on the VFS lock instead.
+ */
+class VfsAwaitable
+{
+public:
+    explicit VfsAwaitable(VFSREQUEST r) : req(r), result(0)
     {
-        printf("Memory allocation failed for file table entry.\n");
-        return -6;  // Memory allocation failed
     }
 
-    // Initialize the file table entry
-    UFDTArr[i].ptrfiletable->count = 1;
-    UFDTArr[i].ptrfiletable->mode = permission;
-    UFDTArr[i].ptrfiletable->readoffset = 0;
-    UFDTArr[i].ptrfiletable->writeoffset = 0;
+    bool await_ready()
+    {
+        if (TryLockVFS() != 0)
+            return false;
 
-    UFDTArr[i].ptrfiletable->ptrinode = temp;
+        result = ExecuteRequest(&req, -1);
+        UnlockVFS();
+        return true;
+    }
 
-    // Assign the file name and initialize inode attributes
-    strcpy(UFDTArr[i].ptrfiletable->ptrinode->FileName, name);
-    UFDTArr[i].ptrfiletable->ptrinode->FileType = REGULAR;
-    UFDTArr[i].ptrfiletable->ptrinode->ReferenceCount = 1;
-    UFDTArr[i].ptrfiletable->ptrinode->LinkCount = 1;
-    UFDTArr[i].ptrfiletable->ptrinode->FileSize = MAXFILESIZE;
-    UFDTArr[i].ptrfiletable->ptrinode->FileActualSize = 0;
-    UFDTArr[i].ptrfiletable->ptrinode->Permission = permission;
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+        handle = h;
+        req.flags = 0;
+        req.userdata = this;
+        req.callback = Resume;
+
+        if (SubmitRequests(&req, 1) == 1)
+            return true;
+
+        // Ring not running or full: complete synchronously
+        LockVFS();
+        result = ExecuteRequest(&req, -1);
+        UnlockVFS();
+        return false;
+    }
 
-    // Allocate memory for the file data buffer
-    UFDTArr[i].ptrfiletable->ptrinode->Buffer = (char *)malloc(MAXFILESIZE);
-    if (UFDTArr[i].ptrfiletable->ptrinode->Buffer == NULL)  // Check malloc success
+    int64_t await_resume()
     {
-        printf("Memory allocation failed for file buffer.\n");
-        free(UFDTArr[i].ptrfiletable);  // Clean up already allocated memory
-        return -7;  // Memory allocation failed for file buffer
+        return result;
     }
 
-    return i;  // Return the file descriptor index
-}
+private:
+    static void Resume(void *userdata, int64_t result)
+    {
+        VfsAwaitable *self = (VfsAwaitable *)userdata;
+
+        self->result = result;
+        self->handle.resume();
+    }
+
+    VFSREQUEST req;
+    int64_t result;
+    std::coroutine_handle<> handle;
+};
+
 
 /*
- * Function: rm_File
- * -----------------
- * Deletes the specified file from the virtual file system.
- * Decreases its link count, and if it reaches zero, frees its resources
- * (buffer, file table, and marks inode as free).
- *
- * @param name - Name of the file to be deleted.
- *
- * @return 
- *   0  : File successfully deleted or unlinked.
- *  -1  : File not found (invalid name or not open).
+ * Class: AsyncVFS
+ * ---------------
+ * Factory for awaitables. Arguments and return values mirror the
+ * synchronous functions (CreateFile, OpenFile, ReadFile, ...).
  */
-int rm_File(char *name)
+class AsyncVFS
 {
-    int fd = 0;
+public:
+    VfsAwaitable create(char *name, int permission)
+    {
+        return Make(OP_CREATE, 0, name, NULL, permission, 0);
+    }
 
-    fd = GetFDFromName(name);
-    if(fd == -1)
-        return -1;  // File descriptor not found
+    VfsAwaitable open(char *name, int mode)
+    {
+        return Make(OP_OPEN, 0, name, NULL, mode, 0);
+    }
 
-    // Decrease link count of the inode
-    (UFDTArr[fd].ptrfiletable->ptrinode->LinkCount)--;
+    VfsAwaitable read(int fd, char *arr, uint64_t size)
+    {
+        return Make(OP_READ, fd, NULL, arr, size, 0);
+    }
 
-    // If no more links, delete the file
-    if(UFDTArr[fd].ptrfiletable->ptrinode->LinkCount == 0)
+    VfsAwaitable write(int fd, char *arr, uint64_t size)
     {
-        UFDTArr[fd].ptrfiletable->ptrinode->FileType = 0;  // Mark inode as unused
-        free(UFDTArr[fd].ptrfiletable->ptrinode->Buffer);  // Free file data buffer
-        free(UFDTArr[fd].ptrfiletable);  // Free the file table entry
+        return Make(OP_WRITE, fd, NULL, arr, size, 0);
     }
 
-    // Set the file descriptor slot to NULL
-    UFDTArr[fd].ptrfiletable = NULL;
+    VfsAwaitable lseek(int fd, int64_t offset, int from)
+    {
+        return Make(OP_LSEEK, fd, NULL, NULL, offset, from);
+    }
 
-    // Increment free inodes in superblock
-    (SUPERBLOCKobj.FreeInodes)++;
+    VfsAwaitable close(int fd)
+    {
+        return Make(OP_CLOSE, fd, NULL, NULL, 0, 0);
+    }
+
+    VfsAwaitable stat(char *name, PFILESTAT st)
+    {
+        return Make(OP_STAT, 0, name, (char *)st, 0, 0);
+    }
+
+    VfsAwaitable rm(char *name)
+    {
+        return Make(OP_RM, 0, name, NULL, 0, 0);
+    }
+
+private:
+    static VfsAwaitable Make(int opcode, int fd, char *name, char *buffer, int64_t size, int from)
+    {
+        VFSREQUEST req;
+
+        memset(&req, 0, sizeof(req));
+        req.opcode = opcode;
+        req.fd = fd;
+        req.name = name;
+        req.buffer = buffer;
+        req.size = size;
+        req.from = from;
+
+        return VfsAwaitable(req);
+    }
+};
+
+AsyncVFS vfs;
 
-    return 0;  // Success
-}
 
 
 /*
- * Function: ReadFile
- * ------------------
- * Reads data from a file into the provided buffer, starting from the current read offset.
+ * Embedded Engine
+ * ---------------
+ * BasicVfs<Config> is a thin wrapper that runs the engine above on an
+ * instance of its own, for programs that embed the file system instead of
+ * talking to the shell or the server. A Config type picks three settings:
  *
- * @param fd    - File descriptor from which to read.
- * @param arr   - Buffer where the read data will be stored.
- * @param isize - Number of bytes to read.
+ *   Lock      : NoLock for single-threaded users, whose calls then take no
+ *               mutex at all, or InstanceLock to serialise callers on the
+ *               instance lock, as the server does.
+ *   DataSize  : Bytes of address space reserved for file data; the largest
+ *               file is an equal share of it, but at least one huge page,
+ *               so a build with a large MAXINODE reserves more (see SpanOf).
+ *   HugePages : Whether the data area is backed by 2 MB pages (see
+ *               AllocateArena).
  *
- * @return 
- *  > 0  : Number of bytes actually read.
- *  -1   : Invalid file descriptor or file not opened in readable mode.
- *  -2   : Read permission denied.
- *  -3   : End of file reached.
- *  -4   : File is not a regular file.
+ * Only the lock choice is resolved at compile time (if constexpr); the data
+ * size and page backing are runtime settings of the instance. Everything
+ * else is the one engine every profile shares: BLOCKSIZE and MAXINODE stay
+ * build-wide #defines (MAXINODE can be set with -D for a whole build, not
+ * per profile), the name index is always the sorted index, the allocator is
+ * always AllocateArena, and a NoLock profile still runs the engine's
+ * atomics, sequence locks and epochs, which single-threaded use does not
+ * need. Every call also switches the thread's CurrentVFS to the object's
+ * instance and back, so objects of several profiles can be used side by
+ * side with the shell's own instance. The instance lives until the process
+ * exits.
+ *
+ *   BasicVfs<EmbeddedConfig> store;
+ *   int fd = store.CreateFile(name, READ + WRITE);
  */
-int ReadFile(int fd, char *arr, int isize)
+struct NoLock
 {
-    int read_size = 0;
+    static constexpr bool Concurrent = false;
+};
 
-    // Check if file descriptor is valid
-    if(UFDTArr[fd].ptrfiletable == NULL)
-        return -1;  // Invalid file descriptor
+struct InstanceLock
+{
+    static constexpr bool Concurrent = true;
+};
 
-    // Check if file is in read or read-write mode
-    if(UFDTArr[fd].ptrfiletable->mode != READ && UFDTArr[fd].ptrfiletable->mode != (READ + WRITE))
-        return -1;  // Invalid file mode
+struct EmbeddedConfig
+{
+    typedef NoLock Lock;
+    static constexpr int64_t DataSize = 128LL * 1024 * 1024;
+    static constexpr bool HugePages = false;
+};
 
-    // Check if user has permission to read
-    if(UFDTArr[fd].ptrfiletable->ptrinode->Permission != READ && UFDTArr[fd].ptrfiletable->ptrinode->Permission != (READ + WRITE))
-        return -2;  // Permission denied
+struct ServerConfig
+{
+    typedef InstanceLock Lock;
+    static constexpr int64_t DataSize = DATAAREASIZE;
+    static constexpr bool HugePages = true;
+};
 
-    // Check if read offset is at the end of the file
-    if(UFDTArr[fd].ptrfiletable->readoffset == UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize)
-        return -3;  // End of file reached
 
-    // Check if the file is of regular type
-    if(UFDTArr[fd].ptrfiletable->ptrinode->FileType != REGULAR)
-        return -4;  // Invalid file type
+template<class Config>
+class BasicVfs
+{
+public:
+    static constexpr bool Concurrent = Config::Lock::Concurrent;
+    static constexpr int64_t MaxFileSize = SpanOf(Config::DataSize);
 
-    // Calculate the actual number of bytes to read
-    read_size = UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize - UFDTArr[fd].ptrfiletable->readoffset;
-    
-    // Ensure we don't read beyond the available file data
-    if(read_size < isize)
+    BasicVfs() : Instance()
     {
-        // Copy the data into the provided buffer
-        strncpy(arr, UFDTArr[fd].ptrfiletable->ptrinode->Buffer + UFDTArr[fd].ptrfiletable->readoffset, read_size);
+        PVFSINSTANCE saved = CurrentVFS;
+        int hugepages = UseHugePages;
+
+        CurrentVFS = &Instance;
+        Instance.FileSpan = MaxFileSize;
+        UseHugePages = Config::HugePages;
+        InitialiseSuperBlock();
+        CreateDILB();
+        UseHugePages = hugepages;
+        CurrentVFS = saved;
+    }
 
-        // Update the read offset
-        UFDTArr[fd].ptrfiletable->readoffset += read_size;
+    BasicVfs(const BasicVfs &) = delete;
+    BasicVfs &operator=(const BasicVfs &) = delete;
+
+    int CreateFile(char *name, int permission)
+    {
+        return Run([&] { return ::CreateFile(name, permission); });
     }
-    else
+
+    int OpenFile(char *name, int mode)
     {
-        // Copy the exact amount requested
-        strncpy(arr, UFDTArr[fd].ptrfiletable->ptrinode->Buffer + UFDTArr[fd].ptrfiletable->readoffset, isize);
+        return Run([&] { return ::OpenFile(name, mode); });
+    }
+
+    void CloseFile(int fd)
+    {
+        Run([&] { ::CloseFileByName(fd); return 0; });
+    }
+
+    int RemoveFile(char *name)
+    {
+        return Run([&] { return ::rm_File(name); });
+    }
+
+    int64_t ReadFile(int fd, char *arr, uint64_t size)
+    {
+        return Run([&] { return ::ReadFile(fd, arr, size); });
+    }
 
-        // Update the read offset
-        UFDTArr[fd].ptrfiletable->readoffset += isize;
+    int64_t WriteFile(int fd, char *arr, uint64_t size)
+    {
+        return Run([&] { return ::WriteFile(fd, arr, size); });
     }
 
-    // Return the actual number of bytes read
-    return read_size < isize ? read_size : isize;
-}
+    int LseekFile(int fd, int64_t offset, int from)
+    {
+        return Run([&] { return ::LseekFile(fd, offset, from); });
+    }
 
+    int TruncateFile(char *name, uint64_t size)
+    {
+        return Run([&] { return ::truncate_File(name, size); });
+    }
 
-/*
- * Function: WriteFile
- * -------------------
- * Writes data from the provided buffer into the file starting at the current write offset.
- *
- * @param fd    - File descriptor of the file to write to.
- * @param arr   - Data buffer to be written into the file.
- * @param isize - Number of bytes to write.
- *
- * @return 
- *  > 0  : Number of bytes successfully written.
- *  -1   : Invalid file descriptor or write permission denied.
- *  -2   : File has reached its maximum size.
- *  -3   : File is not a regular file.
- */
-int WriteFile(int fd, char *arr, int isize)
-{
-    // Check if file is in correct mode for writing
-    if ((UFDTArr[fd].ptrfiletable->mode != WRITE) && (UFDTArr[fd].ptrfiletable->mode != (READ + WRITE)))
-        return -1;  // Invalid mode for writing
+    int StatFile(char *name, PFILESTAT st)
+    {
+        return Run([&] { return ::GetFileStat(name, st); });
+    }
 
-    // Check if user has write permission
-    if ((UFDTArr[fd].ptrfiletable->ptrinode->Permission != WRITE) && (UFDTArr[fd].ptrfiletable->ptrinode->Permission != (READ + WRITE)))
-        return -1;  // Permission denied
+private:
+    VFSINSTANCE Instance;
 
-    // Check if the file size exceeds the limit
-    if (UFDTArr[fd].ptrfiletable->writeoffset == MAXFILESIZE)
-        return -2;  // File is full
+    // Runs fn on this object's instance, under its lock if the profile has one
+    template<class F>
+    auto Run(F fn)
+    {
+        PVFSINSTANCE saved = CurrentVFS;
 
-    // Check if the file is of regular type
-    if (UFDTArr[fd].ptrfiletable->ptrinode->FileType != REGULAR)
-        return -3;  // Invalid file type
+        CurrentVFS = &Instance;
+        if constexpr (Concurrent)
+            LockVFS();
+        auto ret = fn();
+        if constexpr (Concurrent)
+            UnlockVFS();
+        CurrentVFS = saved;
 
-    // Ensure we don't write past the maximum file size
-    if (UFDTArr[fd].ptrfiletable->writeoffset + isize > MAXFILESIZE)
-    {
-        isize = MAXFILESIZE - UFDTArr[fd].ptrfiletable->writeoffset;  // Adjust write size
+        return ret;
     }
+};
 
-    // Write data into the buffer
-    strncpy(UFDTArr[fd].ptrfiletable->ptrinode->Buffer + UFDTArr[fd].ptrfiletable->writeoffset, arr, isize);
 
-    // Update the write offset
-    UFDTArr[fd].ptrfiletable->writeoffset += isize;
 
-    // Update the actual file size
-    UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize += isize;
+/*
+ * Server Mode
+ * -----------
+ * `CVFS --server /path/to/socket` serves the file system to local clients
+ * over a Unix domain socket with the binary protocol of CVFSClient.h.
+ * A single epoll loop multiplexes all connections. Every readable event
+ * drains the socket and executes all complete frames found in the input
+ * buffer under one lock acquisition, so pipelined clients pay for one
+ * wake-up and one lock per batch rather than per operation.
+ *
+ * Descriptors opened by a connection are closed when it disconnects.
+ */
+#define MAXCONNECTIONS 1024
 
-    return isize;  // Return the number of bytes written
-}
 
+/*
+ * Structure: connection
+ * ---------------------
+ * Fields:
+ *  - Sock     : Client socket.
+ *  - InBuf    : Received bytes not yet executed.
+ *  - OutBuf   : Responses not yet sent; OutSent bytes of it are already gone.
+ *  - OwnedFds : Descriptors opened through this connection.
+ */
+typedef struct connection
+{
+    int Sock;
+    char *InBuf;
+    size_t InLen;
+    size_t InCap;
+    char *OutBuf;
+    size_t OutLen;
+    size_t OutCap;
+    size_t OutSent;
+    unsigned char OwnedFds[50];
+}CONNECTION, *PCONNECTION;
 
 
 /*
- * Function: OpenFile
- * ------------------
- * Opens an existing file with the specified access mode and creates
- * an entry in the User File Descriptor Table (UFDT).
- *
- * @param name - Name of the file to open.
- * @param mode - Mode to open the file in (1 = Read, 2 = Write, 3 = Read + Write).
+ * Function: ServeFrame
+ * --------------------
+ * Executes one request frame and appends its response to the connection's
+ * output buffer. Must be called with the instance locked.
  *
- * @return 
- *  >= 0 : File descriptor index if the file is successfully opened.
- *   -1  : Invalid parameters (null name or invalid mode).
- *   -2  : File does not exist.
- *   -3  : Permission denied.
- *   -4  : No free file descriptor available.
- *   -5  : Memory allocation failure.
+ * @return 0 on success, -1 if the response could not be buffered.
  */
-int OpenFile(char *name, int mode)
+int ServeFrame(PCONNECTION conn, CVFSREQHDR *hdr, char *payload)
 {
-    int i = 0;
-    PINODE temp = NULL;
+    VFSREQUEST req;
+    CVFSRESPHDR resp;
+    FILESTAT st;
+    CVFSSTAT wire;
+    char name[256];
+    size_t len = hdr->Length - sizeof(CVFSREQHDR);
+    size_t base = conn->OutLen;
+    int64_t result = 0;
+    int fd = -1;
+
+    memset(&req, 0, sizeof(req));
+    req.opcode = hdr->Opcode;
+    req.fd = hdr->Fd;
+    req.size = hdr->Arg;
+    req.from = hdr->From;
+
+    if (CvfsReserve(&conn->OutBuf, &conn->OutCap, base + sizeof(resp) + sizeof(wire)) != 0)
+        return -1;
 
-    // Check if the name is valid and mode is positive
-    if (name == NULL || mode <= 0)
-        return -1;  // Invalid input
+    switch (hdr->Opcode)
+    {
+        case CVFSP_CREATE:
+        case CVFSP_OPEN:
+        case CVFSP_STAT:
+        case CVFSP_RM:
+            if (len == 0 || len >= sizeof(name))
+            {
+                result = CVFSP_BADREQUEST;
+                break;
+            }
+            memcpy(name, payload, len);
+            name[len] = '\0';
+            req.name = name;
+            req.buffer = (char *)&st;
 
-    // Get inode based on file name
-    temp = Get_Inode(name);
-    if (temp == NULL)
-        return -2;  // File not found
+            if (hdr->Opcode == CVFSP_RM)
+                fd = GetFDFromName(name);
 
-    // Check if the file has the required permission
-    if ((temp->Permission & mode) != mode)
-        return -3;  // Permission denied
+            result = ExecuteRequest(&req, -1);
 
-    // Find an empty slot in UFDT array
-    while (i < 50)
-    {
-        if (UFDTArr[i].ptrfiletable == NULL)
+            if ((hdr->Opcode == CVFSP_CREATE || hdr->Opcode == CVFSP_OPEN) && result >= 0)
+                conn->OwnedFds[result] = 1;
+            if (hdr->Opcode == CVFSP_RM && result == 0 && fd >= 0)
+                conn->OwnedFds[fd] = 0;
+            if (hdr->Opcode == CVFSP_STAT && result == 0)
+            {
+                wire.InodeNumber = st.InodeNumber;
+                wire.FileSize = st.FileSize;
+                wire.FileActualSize = st.FileActualSize;
+                wire.LinkCount = st.LinkCount;
+                wire.ReferenceCount = st.ReferenceCount;
+                wire.Permission = st.Permission;
+                memcpy(conn->OutBuf + base + sizeof(resp), &wire, sizeof(wire));
+            }
             break;
-        i++;
-    }
 
-    // If no free slots available in UFDT array
-    if (i == 50)
-        return -4;  // No free file descriptor
+        case CVFSP_READ:
+            if (hdr->Arg <= 0 || hdr->Arg > CVFSP_MAXFRAME - (int64_t)sizeof(resp))
+            {
+                result = CVFSP_BADREQUEST;
+                break;
+            }
+            if (CvfsReserve(&conn->OutBuf, &conn->OutCap, base + sizeof(resp) + hdr->Arg) != 0)
+                return -1;
 
-    // Allocate memory for the file table entry
-    UFDTArr[i].ptrfiletable = (PFILETABLE)malloc(sizeof(FILETABLE));
-    if (UFDTArr[i].ptrfiletable == NULL)
-        return -5;  // Memory allocation failure
+            // Read straight into the response
+            req.buffer = conn->OutBuf + base + sizeof(resp);
+            result = ExecuteRequest(&req, -1);
+            break;
 
-    // Initialize the file table entry
-    UFDTArr[i].ptrfiletable->count = 1;
-    UFDTArr[i].ptrfiletable->mode = mode;
+        case CVFSP_PREAD:
+            if (len != sizeof(int64_t) || hdr->Arg <= 0 || hdr->Arg > CVFSP_MAXFRAME - (int64_t)sizeof(resp))
+            {
+                result = CVFSP_BADREQUEST;
+                break;
+            }
+            if (CvfsReserve(&conn->OutBuf, &conn->OutCap, base + sizeof(resp) + hdr->Arg) != 0)
+                return -1;
+
+            // Seek and read under the same lock, so no other request comes between
+            req.opcode = OP_LSEEK;
+            memcpy(&req.size, payload, sizeof(int64_t));
+            req.from = START;
+            result = ExecuteRequest(&req, -1);
+            if (result != 0)
+                break;
 
-    // Initialize read and write offsets based on the mode
-    if (mode == (READ + WRITE))
-    {
-        UFDTArr[i].ptrfiletable->readoffset = 0;
-        UFDTArr[i].ptrfiletable->writeoffset = 0;
-    }
-    else if (mode == READ)
-    {
-        UFDTArr[i].ptrfiletable->readoffset = 0;
-    }
-    else if (mode == WRITE)
-    {
-        UFDTArr[i].ptrfiletable->writeoffset = 0;
+            req.opcode = OP_READ;
+            req.size = hdr->Arg;
+            req.buffer = conn->OutBuf + base + sizeof(resp);
+            result = ExecuteRequest(&req, -1);
+            break;
+
+        case CVFSP_WRITE:
+            req.buffer = payload;
+            req.size = (int64_t)len;
+            result = ExecuteRequest(&req, -1);
+            break;
+
+        case CVFSP_LSEEK:
+            result = ExecuteRequest(&req, -1);
+            break;
+
+        case CVFSP_CLOSE:
+            result = ExecuteRequest(&req, -1);
+            if (result == 0)
+                conn->OwnedFds[hdr->Fd] = 0;
+            break;
+
+        default:
+            result = CVFSP_BADREQUEST;
     }
 
-    // Link the file table entry to the inode
-    UFDTArr[i].ptrfiletable->ptrinode = temp;
+    resp.Id = hdr->Id;
+    resp.Result = result;
+    resp.Length = sizeof(resp);
+    if ((hdr->Opcode == CVFSP_READ || hdr->Opcode == CVFSP_PREAD) && result > 0)
+        resp.Length += result;
+    if (hdr->Opcode == CVFSP_STAT && result == 0)
+        resp.Length += sizeof(wire);
 
-    // Increment the reference count of the inode
-    UFDTArr[i].ptrfiletable->ptrinode->ReferenceCount++;
+    memcpy(conn->OutBuf + base, &resp, sizeof(resp));
+    conn->OutLen += resp.Length;
 
-    return i;  // Return the file descriptor index
+    return 0;
 }
 
 
 /*
- * Function: CloseFileByName
+ * Function: ServeConnection
  * -------------------------
- * Closes the file associated with the given file descriptor.
- * Resets read/write offsets and decreases the reference count of the inode.
- * If no references remain, frees the file table entry.
+ * Executes every complete frame in the input buffer under one lock.
  *
- * @param fd - File descriptor of the file to close.
+ * @return 0 on success, -1 if the client sent a malformed frame.
  */
-void CloseFileByName(int fd)
+int ServeConnection(PCONNECTION conn)
 {
-    if (UFDTArr[fd].ptrfiletable == NULL)
-        return;
-
-    // Reset the file offsets
-    UFDTArr[fd].ptrfiletable->readoffset = 0;
-    UFDTArr[fd].ptrfiletable->writeoffset = 0;
-
-    // Decrease reference count
-    (UFDTArr[fd].ptrfiletable->ptrinode->ReferenceCount)--;
+    CVFSREQHDR hdr;
+    size_t pos = 0;
+    int ret = 0;
 
-    // If no references are left, free the file table entry
-    if (UFDTArr[fd].ptrfiletable->ptrinode->ReferenceCount == 0)
+    LockVFS();
+    while (conn->InLen - pos >= sizeof(hdr))
     {
-        free(UFDTArr[fd].ptrfiletable);
-        UFDTArr[fd].ptrfiletable = NULL;
+        memcpy(&hdr, conn->InBuf + pos, sizeof(hdr));
+        if (hdr.Length < sizeof(hdr) || hdr.Length > CVFSP_MAXFRAME)
+        {
+            ret = -1;
+            break;
+        }
+        if (conn->InLen - pos < hdr.Length)
+            break;  // Rest of the frame has not arrived yet
+
+        if (ServeFrame(conn, &hdr, conn->InBuf + pos + sizeof(hdr)) != 0)
+        {
+            ret = -1;
+            break;
+        }
+        pos += hdr.Length;
     }
-}
+    UnlockVFS();
 
+    conn->InLen -= pos;
+    memmove(conn->InBuf, conn->InBuf + pos, conn->InLen);
+
+    return ret;
+}
 
 
 /*
- * Function: CloseFileByName
+ * Function: FlushConnection
  * -------------------------
- * Closes the file with the given name by locating its file descriptor
- * and delegating to the descriptor-based close function.
- *
- * @param name - Name of the file to be closed.
+ * Sends as much buffered output as the socket accepts.
  *
- * @return 
- *   0  : File closed successfully.
- *  -1  : File not found (invalid or unopened).
+ * @return 1 if output is still pending, 0 if all was sent, -1 on error.
  */
-
-int CloseFileByName(char *name)
+int FlushConnection(PCONNECTION conn)
 {
-    int i = 0;
-    i = GetFDFromName(name);
-
-    if (i == -1)
-        return -1;  // File not found
+    ssize_t n = 0;
 
-    // Close the file by its index
-    CloseFileByName(i);
+    while (conn->OutSent < conn->OutLen)
+    {
+        n = send(conn->Sock, conn->OutBuf + conn->OutSent, conn->OutLen - conn->OutSent, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 1;
+        if (n <= 0)
+            return -1;
+        conn->OutSent += (size_t)n;
+    }
 
+    conn->OutLen = 0;
+    conn->OutSent = 0;
     return 0;
 }
 
 
-
 /*
- * Function: CloseAllFile
- * ----------------------
- * Closes all currently opened files in the system by iterating through
- * the User File Descriptor Table (UFDT) and calling the file-close function
- * for each active entry.
- *
- * This helps to release resources and reset the system state.
+ * Function: DropConnection
+ * ------------------------
+ * Closes the client socket and every descriptor the client left open.
  */
-void CloseAllFile()
+void DropConnection(PCONNECTION conn)
 {
     int i = 0;
+
+    LockVFS();
     while (i < 50)
     {
-        if (UFDTArr[i].ptrfiletable != NULL)
-        {
-            CloseFileByName(i);  // Close file at index i
-        }
+        if (conn->OwnedFds[i] && UFDTArr[i].ptrfiletable != NULL)
+            CloseFileByName(i);
         i++;
     }
-}
+    UnlockVFS();
 
+    close(conn->Sock);
+    free(conn->InBuf);
+    free(conn->OutBuf);
+    free(conn);
+}
 
 
 /*
- * Function: LseekFile
+ * Function: RunServer
  * -------------------
- * Changes the current read or write offset in an open file, similar to the lseek() system call.
- * The new position is calculated relative to the start, current position, or end of the file.
- *
- * @param fd    - File descriptor of the file.
- * @param size  - Number of bytes to move the offset by.
- * @param from  - Reference point for the offset (0 = START, 1 = CURRENT, 2 = END).
+ * Listens on the Unix domain socket `path` and serves clients until an
+ * unrecoverable error occurs.
  *
- * @return 
- *   0  : Offset successfully updated.
- *  -1  : Invalid parameters, invalid file descriptor, or operation out of bounds.
- *
- * Notes:
- * - For read mode, it updates the read offset.
- * - For write mode, it updates the write offset.
- * - Does not allow seeking beyond file size or below zero.
+ * @return -1 if the socket or epoll instance cannot be set up.
  */
-int LseekFile(int fd, int size, int from)
+int RunServer(const char *path)
 {
-    if (fd < 0 || from > 2) 
+    struct sockaddr_un addr;
+    struct epoll_event ev, events[64];
+    PCONNECTION conn = NULL;
+    int lsock = -1, ep = -1, n = 0, i = 0, sock = 0, pending = 0;
+    ssize_t got = 0;
+
+    lsock = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (lsock == -1)
         return -1;
 
-    if (UFDTArr[fd].ptrfiletable == NULL) 
-        return -1;  // Invalid file descriptor
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
 
-    // Reading
-    if ((UFDTArr[fd].ptrfiletable->mode == READ) || (UFDTArr[fd].ptrfiletable->mode == (READ + WRITE)))
+    if (bind(lsock, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(lsock, 512) == -1)
     {
-        if (from == CURRENT)
-        {
-            if (((UFDTArr[fd].ptrfiletable->readoffset) + size) > UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize) 
-                return -1;  // Beyond actual file size
-
-            if (((UFDTArr[fd].ptrfiletable->readoffset) + size) < 0) 
-                return -1;  // Negative offset is invalid
+        close(lsock);
+        return -1;
+    }
 
-            UFDTArr[fd].ptrfiletable->readoffset += size;  // Update read offset
-        }
-        else if (from == START)
-        {
-            if (size > UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize)
-                return -1;  // Beyond actual file size
-            if (size < 0)
-                return -1;  // Invalid size
+    ep = epoll_create1(0);
+    if (ep == -1)
+    {
+        close(lsock);
+        return -1;
+    }
 
-            UFDTArr[fd].ptrfiletable->readoffset = size;  // Set the read offset to start from `size`
-        }
-        else if (from == END)
-        {
-            if ((UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize) + size > MAXFILESIZE) 
-                return -1;  // Exceeds max file size
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;  // NULL marks the listening socket
+    epoll_ctl(ep, EPOLL_CTL_ADD, lsock, &ev);
 
-            if (((UFDTArr[fd].ptrfiletable->readoffset) + size) < 0) 
-                return -1;  // Negative offset is invalid
+    printf("Serving on %s\n", path);
+    fflush(stdout);
 
-            UFDTArr[fd].ptrfiletable->readoffset = (UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize) + size;  // Set the read offset from the end
-        }
-    }
-    // Writing
-    else if (UFDTArr[fd].ptrfiletable->mode == WRITE)
+    while (1)
     {
-        if (from == CURRENT)
-        {
-            if (((UFDTArr[fd].ptrfiletable->writeoffset) + size) > MAXFILESIZE)
-                return -1;  // Exceeds max file size
-
-            if (((UFDTArr[fd].ptrfiletable->writeoffset) + size) < 0)
-                return -1;  // Negative offset is invalid
-
-            if (((UFDTArr[fd].ptrfiletable->writeoffset) + size) > (UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize)) 
-                UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize = (UFDTArr[fd].ptrfiletable->writeoffset) + size;
+        n = epoll_wait(ep, events, 64, -1);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+            break;
 
-            UFDTArr[fd].ptrfiletable->writeoffset += size;  // Update write offset
-        }
-        else if (from == START)
+        for (i = 0; i < n; i++)
         {
-            if (size > MAXFILESIZE) 
-                return -1;  // Invalid size
+            if (events[i].data.ptr == NULL)
+            {
+                while ((sock = accept4(lsock, NULL, NULL, SOCK_NONBLOCK)) != -1)
+                {
+                    conn = (PCONNECTION)calloc(1, sizeof(CONNECTION));
+                    if (conn == NULL)
+                    {
+                        close(sock);
+                        continue;
+                    }
+                    conn->Sock = sock;
+                    ev.events = EPOLLIN;
+                    ev.data.ptr = conn;
+                    epoll_ctl(ep, EPOLL_CTL_ADD, sock, &ev);
+                }
+                continue;
+            }
 
-            if (size < 0) 
-                return -1;  // Invalid size
+            conn = (PCONNECTION)events[i].data.ptr;
 
-            if (size > (UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize)) 
-                UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize = size;  // Adjust file size if necessary
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                while (1)
+                {
+                    if (CvfsReserve(&conn->InBuf, &conn->InCap, conn->InLen + 65536) != 0)
+                        break;
+                    got = recv(conn->Sock, conn->InBuf + conn->InLen, conn->InCap - conn->InLen, 0);
+                    if (got > 0)
+                    {
+                        conn->InLen += (size_t)got;
+                        continue;
+                    }
+                    if (got == -1 && errno == EINTR)
+                        continue;
+                    break;
+                }
 
-            UFDTArr[fd].ptrfiletable->writeoffset = size;  // Set the write offset to `size`
-        }
-        else if (from == END)
-        {
-            if ((UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize) + size > MAXFILESIZE) 
-                return -1;  // Exceeds max file size
+                if (got == 0 || (got == -1 && errno != EAGAIN && errno != EWOULDBLOCK) ||
+                    ServeConnection(conn) != 0)
+                {
+                    epoll_ctl(ep, EPOLL_CTL_DEL, conn->Sock, NULL);
+                    DropConnection(conn);
+                    continue;
+                }
+            }
 
-            if (((UFDTArr[fd].ptrfiletable->writeoffset) + size) < 0) 
-                return -1;  // Negative offset is invalid
+            pending = FlushConnection(conn);
+            if (pending == -1)
+            {
+                epoll_ctl(ep, EPOLL_CTL_DEL, conn->Sock, NULL);
+                DropConnection(conn);
+                continue;
+            }
 
-            UFDTArr[fd].ptrfiletable->writeoffset = (UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize) + size;  // Set the write offset from the end
+            ev.events = pending ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+            ev.data.ptr = conn;
+            epoll_ctl(ep, EPOLL_CTL_MOD, conn->Sock, &ev);
         }
     }
 
-    return 0;
+    close(ep);
+    close(lsock);
+    return -1;
 }
 
 
 
 /*
- * Function: ls_file
- * -----------------
- * Lists all files currently present in the virtual file system.
- * It prints each file's name, inode number, actual size, and link count.
- *
- * If no files are present, it displays an appropriate message.
+ * Trace Replay
+ * ------------
+ * ReplayTrace() re-executes a recorded trace against the current instance,
+ * one call at a time in the order the calls started. Descriptors returned
+ * by create and open in the trace are mapped to the ones returned during
+ * the replay. Writes use filler data of the recorded size and reads are
+ * replayed with ReadFile. Each call is timed, and calls whose result
+ * differs from the recorded one are counted as mismatches.
  */
 
-void ls_file()
-{
-    PINODE temp = head;
-
-    if (SUPERBLOCKobj.FreeInodes == MAXINODE)
-    {
-        printf("Error: There are no files\n");
-        return;
-    }
-
-    printf("\nFile Name\tInode number\tFile size\tLink count\n");
-    printf("--------------------------------------------------------\n");
-
-    while (temp != NULL)
-    {
-        if (temp->FileType != 0)  
-        {
-            printf("%s\t\t%d\t\t%d\t\t%d\n", temp->FileName, temp->InodeNumber, temp->FileActualSize, temp->LinkCount);
-        }
-        temp = temp->next;
-    }
-    printf("-------------------------------------\n");
-}
-
-
-
 /*
- * Function: fstat_file
- * --------------------
- * Displays metadata about an open file using its file descriptor.
- * Prints details such as file name, inode number, file size, link count,
- * reference count, and permissions.
- *
- * @param fd - File descriptor of the file to be inspected.
- *
- * @return 
- *   0  : Success.
- *  -1  : Invalid file descriptor (negative value).
- *  -2  : File not currently open (null filetable entry).
+ * Structure: replaystats
+ * ----------------------
+ * Result of ReplayTrace(). Latencies are in nanoseconds, per OP_* code.
  */
-int fstat_file(int fd)
+typedef struct replaystats
 {
-    PINODE temp = head;
-
-    if (fd < 0) return -1;
-    if (UFDTArr[fd].ptrfiletable == NULL) return -2;
-
-    temp = UFDTArr[fd].ptrfiletable->ptrinode;
+    long Records;
+    long Mismatches;
+    double Seconds;
+    long Count[OP_COUNT];
+    uint64_t P50[OP_COUNT];
+    uint64_t P99[OP_COUNT];
+    uint64_t P999[OP_COUNT];
+    uint64_t Max[OP_COUNT];
+}REPLAYSTATS, *PREPLAYSTATS;
+
+
+int CompareRecordTime(const void *a, const void *b)
+{
+    const TRACERECORD *x = (const TRACERECORD *)a, *y = (const TRACERECORD *)b;
 
-    printf("\n---------------------- Statistical Information about file------------------\n");
-    printf("File name: %s\n", temp->FileName);
-    printf("Inode Number: %d\n", temp->InodeNumber);
-    printf("File size: %d\n", temp->FileActualSize);  
-    printf("Actual File size: %d\n", temp->FileActualSize);
-    printf("Link count: %d\n", temp->LinkCount);
-    printf("Reference count: %d\n", temp->ReferenceCount);
+    if (x->Time != y->Time)
+        return x->Time < y->Time ? -1 : 1;
+    return x->Thread - y->Thread;
+}
 
-   
-    if (temp->Permission == 1)
-        printf("File Permission: Read only\n");
-    else if (temp->Permission == 2)
-        printf("File Permission: Write\n");
-    else if (temp->Permission == 3)
-        printf("File Permission: Read & Write\n");
 
-    printf("------------------\n\n");
+int CompareLatency(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
 
-    return 0;
+    return x < y ? -1 : (x > y ? 1 : 0);
 }
 
 
 /*
- * Function: stat_file
- * -------------------
- * Displays metadata about a file using its name.
- * Searches the inode list to find the file and prints information such as
- * name, inode number, size, link count, reference count, and permissions.
+ * Function: ReplayTrace
+ * ---------------------
+ * Runs the calls of a trace file against the current instance.
  *
- * @param name - Name of the file to inspect.
+ * @param path  - Trace file written by StartTrace().
+ * @param timed - Non-zero to start each call at its recorded time offset,
+ *                zero to run the calls back to back.
+ * @param stats - Receives throughput and latency percentiles.
  *
- * @return 
- *   0  : Success.
- *  -1  : Invalid input (null file name).
- *  -2  : File not found in the inode list.
+ * @return
+ *   0 : Trace replayed.
+ *  -1 : Invalid parameters.
+ *  -2 : The trace file cannot be read or is not a trace.
+ *  -3 : Memory allocation failed.
  */
-int stat_file(char *name)
+int ReplayTrace(const char *path, int timed, PREPLAYSTATS stats)
 {
-    PINODE temp = head;
+    TRACEHEADER hdr;
+    PTRACERECORD recs = NULL, rec = NULL;
+    uint64_t *lat = NULL, *sorted = NULL, start = 0, t = 0, maxio = 1;
+    struct timespec target;
+    struct stat st;
+    char *buf = NULL;
+    int fdmap[50], fd = 0, file = 0, op = 0;
+    long count = 0, i = 0, k = 0, n = 0;
+    int64_t ret = 0;
+
+    if (path == NULL || stats == NULL)
+        return -1;
+    memset(stats, 0, sizeof(*stats));
 
-    if (name == NULL) return -1;
+    file = open(path, O_RDONLY);
+    if (file == -1)
+        return -2;
+    if (fstat(file, &st) == -1 || read(file, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr) ||
+        memcmp(hdr.Magic, TRACEMAGIC, sizeof(hdr.Magic)) != 0 || hdr.RecordSize != sizeof(TRACERECORD))
+    {
+        close(file);
+        return -2;
+    }
 
-    while (temp != NULL)
+    count = (long)((st.st_size - (off_t)sizeof(hdr)) / (off_t)sizeof(TRACERECORD));
+    recs = (PTRACERECORD)malloc((count > 0 ? count : 1) * sizeof(TRACERECORD));
+    lat = (uint64_t *)malloc((count > 0 ? count : 1) * sizeof(uint64_t));
+    sorted = (uint64_t *)malloc((count > 0 ? count : 1) * sizeof(uint64_t));
+    if (recs == NULL || lat == NULL || sorted == NULL)
     {
-        if (strcmp(name, temp->FileName) == 0)
-            break;
-        temp = temp->next;
+        close(file);
+        free(recs);
+        free(lat);
+        free(sorted);
+        return -3;
     }
+    if (count > 0 && read(file, recs, count * sizeof(TRACERECORD)) != (ssize_t)(count * sizeof(TRACERECORD)))
+        count = 0;
+    close(file);
 
-    if (temp == NULL) return -2;
+    // Threads flush in batches, so the file is only sorted per thread
+    qsort(recs, count, sizeof(TRACERECORD), CompareRecordTime);
 
-    printf("\nStatistical Information about file-------\n");
-    printf("File name: %s\n", temp->FileName);
-    printf("Inode Number: %d\n", temp->InodeNumber);
-    printf("File size: %d\n", temp->FileActualSize);
-    printf("Actual File size: %d\n", temp->FileActualSize);
-    printf("Link count: %d\n", temp->LinkCount);
-    printf("Reference count: %d\n", temp->ReferenceCount);
+    for (i = 0; i < count; i++)
+    {
+        if ((recs[i].Op == OP_READ || recs[i].Op == OP_WRITE) && recs[i].Arg > 0 && (uint64_t)recs[i].Arg > maxio)
+            maxio = (uint64_t)recs[i].Arg;
+    }
+    if (maxio > (uint64_t)MAXFILESIZE)
+        maxio = MAXFILESIZE;
+    buf = (char *)mmap(NULL, maxio, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (buf == (char *)MAP_FAILED)
+    {
+        free(recs);
+        free(lat);
+        free(sorted);
+        return -3;
+    }
+    memset(buf, 'x', maxio < 65536 ? maxio : 65536);
 
-    
-    if (temp->Permission == 1)
-        printf("File Permission: Read only\n");
-    else if (temp->Permission == 2)
-        printf("File Permission: Write\n");
-    else if (temp->Permission == 3)
-        printf("File Permission: Read & Write\n");
+    for (i = 0; i < 50; i++)
+        fdmap[i] = i;
 
-    printf("-------------\n\n");
+    start = TraceNow();
+    for (i = 0; i < count; i++)
+    {
+        rec = &recs[i];
+        rec->Name[sizeof(rec->Name) - 1] = '\0';
 
-    return 0;
-}
+        if (timed)
+        {
+            t = start + rec->Time;
+            target.tv_sec = (time_t)(t / 1000000000ULL);
+            target.tv_nsec = (long)(t % 1000000000ULL);
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, NULL) == EINTR)
+                ;
+        }
 
+        fd = (rec->Fd >= 0 && rec->Fd < 50) ? fdmap[rec->Fd] : rec->Fd;
+        t = TraceNow();
+        switch (rec->Op)
+        {
+            case OP_CREATE:
+                ret = CreateFile(rec->Name, (int)rec->Arg);
+                break;
+            case OP_OPEN:
+                ret = OpenFile(rec->Name, (int)rec->Arg);
+                break;
+            case OP_RM:
+                ret = rm_File(rec->Name);
+                break;
+            case OP_READ:
+                ret = (fd >= 0 && fd < 50 && UFDTArr[fd].ptrfiletable != NULL) ?
+                      ReadFile(fd, buf, (uint64_t)rec->Arg < maxio ? (uint64_t)rec->Arg : maxio) : -1;
+                break;
+            case OP_WRITE:
+                ret = (fd >= 0 && fd < 50 && UFDTArr[fd].ptrfiletable != NULL) ?
+                      WriteFile(fd, buf, (uint64_t)rec->Arg < maxio ? (uint64_t)rec->Arg : maxio) : -1;
+                break;
+            case OP_LSEEK:
+                ret = LseekFile(fd, rec->Arg, rec->From);
+                break;
+            case OP_CLOSE:
+                if (fd >= 0 && fd < 50)
+                    CloseFileByName(fd);
+                ret = 0;
+                break;
+            default:
+                ret = rec->Result;
+                break;
+        }
+        lat[i] = TraceNow() - t;
 
+        // Descriptor numbers may differ from the recorded run
+        if ((rec->Op == OP_CREATE || rec->Op == OP_OPEN) && rec->Result >= 0 && rec->Result < 50 && ret >= 0)
+            fdmap[rec->Result] = (int)ret;
 
-/*
- * Function: truncate_File
- * -----------------------
- * Removes all data from the specified file without deleting the file itself.
- * Resets the file's buffer, read/write offsets, and actual size to zero.
- *
- * @param name - Name of the file to truncate.
- *
- * @return 
- *   0  : File successfully truncated.
- *  -1  : File not found or not open.
- */
-int truncate_File(char *name)
-{
-    int fd = GetFDFromName(name);
-    if (fd == -1)
-        return -1;
+        if ((rec->Op == OP_CREATE || rec->Op == OP_OPEN) ? ((ret >= 0) != (rec->Result >= 0)) : (ret != rec->Result))
+            stats->Mismatches++;
+    }
+    stats->Seconds = (TraceNow() - start) / 1e9;
+    stats->Records = count;
 
-    // Clear the file buffer and reset offsets
-    memset(UFDTArr[fd].ptrfiletable->ptrinode->Buffer, 0, MAXFILESIZE);
-    UFDTArr[fd].ptrfiletable->readoffset = 0;
-    UFDTArr[fd].ptrfiletable->writeoffset = 0;
-    UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize = 0;
+    // Percentiles per operation
+    for (op = 0; op < OP_COUNT; op++)
+    {
+        n = 0;
+        for (k = 0; k < count; k++)
+        {
+            if (recs[k].Op == op)
+                sorted[n++] = lat[k];
+        }
+        if (n == 0)
+            continue;
+
+        qsort(sorted, n, sizeof(uint64_t), CompareLatency);
+        stats->Count[op] = n;
+        stats->P50[op] = sorted[n * 50 / 100];
+        stats->P99[op] = sorted[n * 99 / 100];
+        stats->P999[op] = sorted[n * 999 / 1000];
+        stats->Max[op] = sorted[n - 1];
+    }
 
-    return 0;  
+    munmap(buf, maxio);
+    free(recs);
+    free(lat);
+    free(sorted);
+    return 0;
 }
 
 
 
+/*
+ * The benchmark and test programs (CVFSBench.cpp, CVFSTest.cpp) include this
+ * file with CVFS_NO_MAIN defined and bring their own main().
+ */
+#ifndef CVFS_NO_MAIN
+
 /*
  * Function: main
  * --------------
@@ -1117,18 +9344,149 @@ int truncate_File(char *name)
  *  - display help, manual pages, and list files
  *  - exit the virtual file system
  *
- * Command parsing is done using sscanf() with support for up to 4 arguments.
+ * Command parsing is done using sscanf() with support for up to 8 arguments.
+ *
+ * Started as `CVFS --shm /name` the shell attaches to a file system in
+ * shared memory that other CVFS processes can use at the same time.
+ * Each command runs with the file system locked.
+ *
+ * Started as `CVFS --backing /path/to/file` file data is kept in that
+ * host file and paged in on demand, with readahead for sequential reads.
+ *
+ * `--hugepages` may precede the other options to back in-memory file data
+ * with 2 MB pages (see AllocateArena), `--no-readahead` turns off
+ * readahead for backed file data, and `--data-size GB` sets the total data
+ * area, which fixes the maximum file size at a MAXINODE-th of it
+ * (see SizeDataArea).
+ *
+ * Started as `CVFS --server /path/to/socket` no shell is run; the file
+ * system is served to clients over a Unix domain socket (see RunServer).
+ *
+ * `--spill /path/to/file Budget_MB` keeps at most Budget_MB of file data in
+ * RAM (see EnableTiering), and `--trace /path/to/file` records every file
+ * operation from the start (see StartTrace). Started as
+ * `CVFS --replay /path/to/trace [--timed]` a recorded trace is run against
+ * the fresh file system and a report is printed (see ReplayTrace).
  *
  * @return 0 on successful program termination.
  */
-int main()
+int main(int argc, char *argv[])
 {
     char *ptr = NULL;
     int ret = 0, fd = 0, count = 0;
-    char command[4][80], str[80], arr[1024];
+    char command[8][80], str[80], arr[1024];
+    char *spill = NULL, *trace = NULL;
+    uint64_t budget = 0;
 
-    InitialiseSuperBlock();
-    CreateDILB();
+    if (argc > 1 && strcmp(argv[1], "--hugepages") == 0)
+    {
+        UseHugePages = 1;
+        argc--;
+        argv++;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--no-readahead") == 0)
+    {
+        UseReadahead = 0;
+        argc--;
+        argv++;
+    }
+
+    if (argc > 2 && strcmp(argv[1], "--data-size") == 0)
+    {
+        DataAreaSize = (int64_t)strtoull(argv[2], NULL, 10) * 1024 * 1024 * 1024;
+        if (DataAreaSize <= 0)
+        {
+            printf("ERROR: Invalid data area size %s\n", argv[2]);
+            return 1;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc > 3 && strcmp(argv[1], "--spill") == 0)
+    {
+        spill = argv[2];
+        budget = strtoull(argv[3], NULL, 10) * 1024 * 1024;
+        argc -= 3;
+        argv += 3;
+    }
+
+    if (argc > 2 && strcmp(argv[1], "--trace") == 0)
+    {
+        trace = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc == 3 && strcmp(argv[1], "--shm") == 0)
+    {
+        ret = AttachSharedVFS(argv[2]);
+        if (ret != 0)
+        {
+            printf("ERROR: Unable to attach shared file system %s\n", argv[2]);
+            return 1;
+        }
+        printf("Attached to shared file system %s\n", argv[2]);
+    }
+    else if (argc == 3 && strcmp(argv[1], "--backing") == 0)
+    {
+        if (OpenBackingStore(argv[2]) != 0)
+        {
+            printf("ERROR: Unable to use backing file %s\n", argv[2]);
+            return 1;
+        }
+        InitialiseSuperBlock();
+        CreateDILB();
+    }
+    else
+    {
+        InitialiseSuperBlock();
+        CreateDILB();
+    }
+
+    if (spill != NULL && EnableTiering(spill, budget) != 0)
+    {
+        printf("ERROR: Unable to use spill file %s\n", spill);
+        return 1;
+    }
+
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "--replay") == 0)
+    {
+        static const char *names[OP_COUNT] = { "nop", "create", "open", "read", "write", "lseek", "close", "stat", "rm" };
+        REPLAYSTATS stats;
+        int i = 0;
+
+        ret = ReplayTrace(argv[2], argc == 4 && strcmp(argv[3], "--timed") == 0, &stats);
+        if (ret != 0)
+        {
+            printf("ERROR: Unable to replay trace %s\n", argv[2]);
+            return 1;
+        }
+
+        printf("%ld operations in %.3f s (%.0f ops/s), %ld results differ from the trace\n", stats.Records,
+               stats.Seconds, stats.Seconds > 0 ? stats.Records / stats.Seconds : 0.0, stats.Mismatches);
+        for (i = 0; i < OP_COUNT; i++)
+        {
+            if (stats.Count[i] > 0)
+                printf("%-6s %10ld ops  p50 %8.1f us  p99 %8.1f us  p99.9 %8.1f us  max %8.1f us\n", names[i],
+                       stats.Count[i], stats.P50[i] / 1e3, stats.P99[i] / 1e3, stats.P999[i] / 1e3, stats.Max[i] / 1e3);
+        }
+        return 0;
+    }
+
+    if (trace != NULL && StartTrace(trace) != 0)
+    {
+        printf("ERROR: Unable to record trace %s\n", trace);
+        return 1;
+    }
+
+    if (argc == 3 && strcmp(argv[1], "--server") == 0)
+    {
+        if (RunServer(argv[2]) != 0)
+            printf("ERROR: Unable to serve on %s\n", argv[2]);
+        return 1;
+    }
 
     while(1)
     {
@@ -1139,14 +9497,181 @@ int main()
 
         fgets(str, 80, stdin);  // Use fgets instead of scanf
 
-        count = sscanf(str, "%s %s %s %s", command[0], command[1], command[2], command[3]);
+        count = sscanf(str, "%s %s %s %s %s %s %s %s", command[0], command[1], command[2], command[3],
+                       command[4], command[5], command[6], command[7]);
+
+        VfsGuard guard;
+
+        if(count >= 1 && strcmp(command[0], "ls") == 0)
+        {
+            char *pattern = NULL, *after = NULL;
+            int limit = MAXINODE, i = 1;
+
+            while (i < count)
+            {
+                if (strcmp(command[i], "--limit") == 0 && i + 1 < count)
+                    limit = atoi(command[++i]);
+                else if (strcmp(command[i], "--after") == 0 && i + 1 < count)
+                    after = command[++i];
+                else if (pattern == NULL && command[i][0] != '-')
+                    pattern = command[i];
+                else
+                    break;
+                i++;
+            }
+
+            if (i < count || limit <= 0)
+                printf("ERROR: Incorrect parameters\n");
+            else
+                ls_file(pattern, after, limit);
+            continue;
+        }
+
+        if((count == 2 || count == 3) && strcmp(command[0], "grep") == 0)
+        {
+            PGREPMATCH matches = (PGREPMATCH)malloc(MAXINODE * sizeof(GREPMATCH));
+            int i = 0, k = 0;
+
+            ret = matches == NULL ? -2 : GrepFiles(command[1], count == 3 ? atoi(command[2]) : 0, matches, MAXINODE);
+            if(ret == -1)
+                printf("ERROR: Incorrect parameters\n");
+            else if(ret == -2)
+                printf("ERROR: Memory allocation failure\n");
+            else if(ret == 0)
+                printf("No matches\n");
+            while(i < ret)
+            {
+                printf("%s\t\t%" PRIu64 " matches at", InodeName(matches[i].ptrinode), matches[i].Count);
+                for(k = 0; k < matches[i].OffsetCount; k++)
+                    printf(" %" PRIu64, matches[i].Offsets[k]);
+                printf(matches[i].Count > (uint64_t)matches[i].OffsetCount ? " ...\n" : "\n");
+                i++;
+            }
+            free(matches);
+            continue;
+        }
+
+        if(count >= 2 && strcmp(command[0], "trace") == 0)
+        {
+            if(count == 3 && strcmp(command[1], "start") == 0)
+            {
+                ret = StartTrace(command[2]);
+                if(ret == -1)
+                    printf("ERROR: A trace is already being recorded\n");
+                else if(ret != 0)
+                    printf("ERROR: Unable to record trace %s\n", command[2]);
+                else
+                    printf("Recording trace into %s\n", command[2]);
+            }
+            else if(count == 2 && strcmp(command[1], "stop") == 0)
+            {
+                if(StopTrace() != 0)
+                    printf("ERROR: No trace is being recorded\n");
+                else
+                    printf("Trace stopped: %ld records written, %ld dropped\n", Trace.Written.load(), Trace.Dropped.load());
+            }
+            else
+                printf("ERROR: Incorrect parameters\n");
+            continue;
+        }
+
+        if((count == 2 || count == 3) &&
+           (strcmp(command[0], "import") == 0 || strcmp(command[0], "export") == 0))
+        {
+            TRANSFERSTATS stats;
+            int threads = count == 3 ? atoi(command[2]) : 0;
+
+            if(strcmp(command[0], "import") == 0)
+                ret = ImportDirectory(command[1], threads, &stats);
+            else
+                ret = ExportDirectory(command[1], threads, &stats);
+
+            if(ret == -1)
+                printf("ERROR: Incorrect parameters\n");
+            else if(ret == -2)
+                printf("ERROR: Unable to use host directory %s\n", command[1]);
+            else if(ret == -3)
+                printf("ERROR: Memory allocation failure\n");
+            else
+            {
+                if(stats.Seconds <= 0)
+                    stats.Seconds = 1e-9;
+                printf("%ld files, %" PRIu64 " bytes in %.3f s (%.0f files/s, %.1f MB/s)\n",
+                       stats.Files, stats.Bytes, stats.Seconds, stats.Files / stats.Seconds,
+                       stats.Bytes / stats.Seconds / (1024 * 1024));
+                if(stats.Skipped > 0 || stats.Errors > 0)
+                    printf("%ld skipped, %ld failed\n", stats.Skipped, stats.Errors);
+            }
+            continue;
+        }
+
+        if((count == 3 && strcmp(command[0], "export-delta") == 0) ||
+           (count == 2 && strcmp(command[0], "apply-delta") == 0))
+        {
+            DELTASTATS stats;
+
+            if(count == 3)
+                ret = ExportDelta(command[2], strtoull(command[1], NULL, 10), &stats);
+            else
+                ret = ApplyDelta(command[1], &stats);
+
+            if(ret == -1)
+                printf("ERROR: Incorrect parameters\n");
+            else if(ret == -2)
+                printf("ERROR: Unable to use host file %s\n", command[count - 1]);
+            else if(ret == -3)
+                printf("ERROR: Memory allocation failure\n");
+            else if(ret == -4 && count == 3)
+                printf("ERROR: Unable to read back spilled file data\n");
+            else if(ret == -4)
+                printf("ERROR: Delta does not follow generation %" PRIu64 ", apply a full delta first\n",
+                       SUPERBLOCKobj.SourceGen);
+            else if(ret == -5)
+                printf("ERROR: Invalid delta or no room for its files\n");
+            else
+                printf("Delta from generation %" PRIu64 " to %" PRIu64 "%s: %ld files, %ld runs, %" PRIu64
+                       " data bytes, %" PRIu64 " bytes in %.3f s\n", stats.From, stats.To, stats.Full ? " (full)" : "",
+                       stats.Files, stats.Runs, stats.DataBytes, stats.StreamBytes, stats.Seconds);
+            continue;
+        }
 
         if(count == 1)
         {
-            if(strcmp(command[0], "ls") == 0)
+            if(strcmp(command[0], "df") == 0)
+            {
+                printf("Inodes: %d total, %d used, %d free\n", SUPERBLOCKobj.TotalInodes,
+                       SUPERBLOCKobj.TotalInodes - SUPERBLOCKobj.FreeInodes, SUPERBLOCKobj.FreeInodes);
+                printf("Data bytes: %ld total, %ld used, %ld free\n", SUPERBLOCKobj.TotalBytes,
+                       SUPERBLOCKobj.TotalBytes - SUPERBLOCKobj.FreeBytes, SUPERBLOCKobj.FreeBytes);
+                printf("Generation: %" PRIu64 "\n", SUPERBLOCKobj.Generation);
+                if (CurrentVFS->ArenaPages == ARENA_EXPLICIT)
+                    printf("Data pages: 2 MB, explicit\n");
+                else if (CurrentVFS->ArenaPages == ARENA_TRANSPARENT)
+                    printf("Data pages: 2 MB, transparent\n");
+                continue;
+            }
+            else if(strcmp(command[0], "tierstat") == 0)
+            {
+                PTIERSTATE tier = CurrentVFS->Tier;
+                if (tier == NULL)
+                {
+                    printf("Tiering is not enabled\n");
+                    continue;
+                }
+                printf("Resident: %" PRIu64 " bytes, budget %" PRIu64 " bytes\n", ResidentBytes(), tier->Budget);
+                printf("Spilled: %" PRIu64 " bytes, spill file %" PRIu64 " bytes\n", tier->SpillLive, tier->SpillEnd);
+                printf("Promotions: %ld\nDemotions: %ld\n", tier->Promotions, tier->Demotions);
+                printf("Reload latency: %.1f us average, %.1f us max\n",
+                       tier->Promotions ? tier->ReloadSeconds / tier->Promotions * 1e6 : 0.0, tier->ReloadMax * 1e6);
+                continue;
+            }
+            else if(strcmp(command[0], "rastat") == 0)
             {
-                ls_file();
-            } 
+                long hits = 0, waste = 0;
+                GetReadaheadStats(&hits, &waste);
+                printf("Readahead hits: %ld bytes\nReadahead waste: %ld bytes\n", hits, waste);
+                continue;
+            }
             else if(strcmp(command[0], "closeall") == 0)
             {
                 CloseAllFile();
@@ -1166,6 +9691,7 @@ int main()
             else if(strcmp(command[0], "exit") == 0)
             {
                 printf("Terminating the Customized Virtual File System\n");
+                StopTrace();  // Write out a trace that is still being recorded
                 break;
             }
             else
@@ -1195,6 +9721,17 @@ int main()
                     printf("ERROR: There is no such file\n");
                 continue;
             }
+            else if(strcmp(command[0], "dup") == 0)
+            {
+                ret = DupFile(atoi(command[1]));
+                if(ret == -1)
+                    printf("ERROR: Incorrect parameters\n");
+                else if(ret == -2)
+                    printf("ERROR: No free file descriptor\n");
+                else
+                    printf("File descriptor %d shares the open file\n", ret);
+                continue;
+            }
 
 
             else if(strcmp(command[0], "close") == 0) 
@@ -1209,6 +9746,8 @@ int main()
                 ret = rm_File(command[1]);
                 if(ret == -1)
                     printf("ERROR: There is no such file\n");
+                if(ret == -2)
+                    printf("ERROR: File is in use\n");
                 continue;
             }
             else if(strcmp(command[0], "man") == 0)
@@ -1224,7 +9763,18 @@ int main()
                     continue;
                 }
                 printf("Enter the data: \n"); 
+
+                // Do not hold the file system while waiting for input
+                UnlockVFS();
                 scanf("%[^\n]", arr);
+                LockVFS();
+
+                fd = GetFDFromName(command[1]);
+                if(fd == -1)
+                {
+                    printf("ERROR: File was closed\n");
+                    continue;
+                }
 
                 ret = strlen(arr);
                 if(ret == 0) 
@@ -1239,12 +9789,27 @@ int main()
                     printf("ERROR: There is no sufficient memory to write\n");
                 if(ret == -3)
                     printf("ERROR: It is not a regular file\n");
+                if(ret == -4)
+                    printf("ERROR: Unable to reload file data from the spill file\n");
             }
             else if(strcmp(command[0], "truncate") == 0) 
             {
-                ret = truncate_File(command[1]);
+                ret = truncate_File(command[1], 0);
                 if(ret == -1)
                     printf("ERROR: Incorrect parameter\n");
+                if(ret == -2)
+                    printf("ERROR: File is in use\n");
+            }
+            else if(strcmp(command[0], "flush") == 0)
+            {
+                fd = GetFDFromName(command[1]);
+                if(fd == -1)
+                {
+                    printf("ERROR: Incorrect parameter\n");
+                    continue;
+                }
+                if(FlushFile(fd) < 0)
+                    printf("ERROR: Unable to flush buffered writes\n");
             }
             else
             {
@@ -1282,6 +9847,43 @@ int main()
                     printf("ERROR: Permission denied\n");
                 continue;
             }
+            else if(strcmp(command[0], "truncate") == 0)
+            {
+                ret = truncate_File(command[1], strtoull(command[2], NULL, 10));
+                if(ret == -1)
+                    printf("ERROR: Incorrect parameter\n");
+                if(ret == -2)
+                    printf("ERROR: File is in use\n");
+                if(ret == -3)
+                    printf("ERROR: Invalid size\n");
+                continue;
+            }
+            else if(strcmp(command[0], "dup") == 0)
+            {
+                ret = Dup2File(atoi(command[1]), atoi(command[2]));
+                if(ret == -1)
+                    printf("ERROR: Incorrect parameters\n");
+                else
+                    printf("File descriptor %d shares the open file\n", ret);
+                continue;
+            }
+            else if(strcmp(command[0], "wbuf") == 0)
+            {
+                fd = GetFDFromName(command[1]);
+                if(fd == -1)
+                {
+                    printf("ERROR: Incorrect parameter\n");
+                    continue;
+                }
+                ret = SetWriteBuffer(fd, strtoull(command[2], NULL, 10));
+                if(ret == -1)
+                    printf("ERROR: File is not opened for writing\n");
+                else if(ret == -2)
+                    printf("ERROR: Buffer size is larger than %d bytes\n", WBUFMAX);
+                else if(ret == -3)
+                    printf("ERROR: Unable to set the write buffer\n");
+                continue;
+            }
             else if(strcmp(command[0], "read") == 0)
 {
     if(count != 3)  // Expecting: read <fd> <size>
@@ -1297,21 +9899,15 @@ int main()
         continue;
     }
 
-    int size = atoi(command[2]);
+    int64_t size = strtoll(command[2], NULL, 10);
     if(size <= 0)
     {
         printf("ERROR: Invalid size\n");
         continue;
     }
 
-    char *ptr = (char *)malloc(size + 1);
-    if(ptr == NULL)
-    {
-        printf("ERROR: Memory allocation failure\n");
-        continue;
-    }
-
-    int ret = ReadFile(fd, ptr, size);
+    VIEWLEASE view;
+    int64_t ret = ReadView(fd, size, &view);
     if(ret == -1)
         printf("ERROR: File not existing\n");
     else if(ret == -2)
@@ -1320,15 +9916,16 @@ int main()
         printf("ERROR: Reached end of file\n");
     else if(ret == -4)
         printf("ERROR: It is not a regular file\n");
+    else if(ret == -5)
+        printf("ERROR: Unable to reload file data from the spill file\n");
     else if(ret == 0)
         printf("ERROR: File is empty\n");
     else if(ret > 0)
     {
-        ptr[ret] = '\0';  // Null-terminate the string
-        printf("Data Read: %s\n", ptr);
+        printf("Data Read: %.*s\n", (int)view.length, view.data);
+        ReleaseView(&view);
     }
 
-    free(ptr);  // Free allocated memory
     continue;
 }
 
@@ -1348,13 +9945,32 @@ int main()
                     printf("ERROR: Incorrect parameter\n");
                     continue;
                 }
-                ret = LseekFile(fd, atoi(command[2]), atoi(command[3]));
+                ret = LseekFile(fd, strtoll(command[2], NULL, 10), atoi(command[3]));
                 if(ret == -1)
                 {
                     printf("ERROR: Unable to perform Iseek\n");
                 }
                 continue;
             }
+            else if(strcmp(command[0], "punch") == 0)
+            {
+                fd = GetFDFromName(command[1]);
+                if(fd == -1)
+                {
+                    printf("ERROR: Incorrect parameter\n");
+                    continue;
+                }
+                ret = PunchHole(fd, strtoll(command[2], NULL, 10), strtoull(command[3], NULL, 10));
+                if(ret == -1)
+                    printf("ERROR: File is not opened for writing\n");
+                else if(ret == -2)
+                    printf("ERROR: File data is in use by a read view\n");
+                else if(ret == -3)
+                    printf("ERROR: Invalid range\n");
+                else if(ret == -4)
+                    printf("ERROR: Unable to read file data back from the spill file\n");
+                continue;
+            }
             else
             {
                 printf("\nERROR: Command not found !!!\n");
@@ -1362,5 +9978,8 @@ int main()
             }
         }
     }
+    DetachSharedVFS();
     return 0;
 }
+
+#endif
@@ -0,0 +1,1790 @@
+/*
+    Project Name: Unix based Customized Virtual File System
+
+    Description:
+    In-process benchmarks of the file system in CVFS.cpp. The file is
+    compiled in with CVFS_NO_MAIN, so every benchmark drives the same code
+    the shell and the server run. Each benchmark sets up the default
+    instance, runs its workload and prints one line per setting.
+
+    Build : g++ -std=c++20 -O2 CVFSBench.cpp -o CVFSBench -pthread
+    Usage : CVFSBench Benchmark [arguments]
+            CVFSBench            (lists the benchmarks)
+*/
+
+#define CVFS_NO_MAIN
+#include "CVFS.cpp"
+
+#include<vector>
+#include<sys/resource.h>
+
+#define BENCHFILES 16
+#define BENCHIO 4096
+
+
+double Now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+ * Function: StartInstance
+ * -----------------------
+ * Sets up the default instance, with its data in the host file `backing`
+ * unless that is NULL.
+ *
+ * @return 0 on success, -1 if the backing file cannot be used.
+ */
+int StartInstance(const char *backing)
+{
+    if (backing != NULL && OpenBackingStore(backing) != 0)
+    {
+        printf("ERROR: Unable to use backing file %s\n", backing);
+        return -1;
+    }
+
+    InitialiseSuperBlock();
+    CreateDILB();
+    return 0;
+}
+
+
+/*
+ * Function: FillFile
+ * ------------------
+ * Creates `name` with `size` bytes of `c`.
+ *
+ * @return The descriptor (opened for reading and writing), or -1 on failure.
+ */
+int FillFile(const char *name, uint64_t size, char c)
+{
+    static char chunk[1024 * 1024];
+    uint64_t done = 0, n = 0;
+    int fd = CreateFile((char *)name, READ + WRITE);
+
+    if (fd < 0)
+        return -1;
+
+    memset(chunk, c, sizeof(chunk));
+    while (done < size)
+    {
+        n = size - done < sizeof(chunk) ? size - done : sizeof(chunk);
+        if (WriteFile(fd, chunk, n) != (int64_t)n)
+            return -1;
+        done += n;
+    }
+
+    return fd;
+}
+
+
+/*
+ * Function: BenchRing
+ * -------------------
+ * 4 KB reads spread over BENCHFILES files, issued through the ring with
+ * 1, 8, 64 and 256 requests in flight, next to the same reads as direct
+ * ReadFile() calls.
+ *
+ * Arguments: [Reads] [Backing_File]
+ */
+int BenchRing(int argc, char *argv[])
+{
+    static const int depths[] = { 1, 8, 64, 256 };
+    std::vector<VFSREQUEST> reqs(RINGSIZE);
+    std::vector<VFSCOMPLETION> done(RINGSIZE);
+    std::vector<char> bufs((size_t)RINGSIZE * BENCHIO);
+    long reads = argc > 0 ? atol(argv[0]) : 262144, issued = 0, reaped = 0, errors = 0;
+    uint64_t filesize = 0;
+    char name[32];
+    int fds[BENCHFILES], d = 0, i = 0, n = 0;
+    double start = 0, elapsed = 0;
+
+    if (reads <= 0 || StartInstance(argc > 1 ? argv[1] : NULL) != 0)
+        return 1;
+
+    // Large enough that no run reaches the end of a file
+    filesize = ((uint64_t)reads / BENCHFILES + 1) * BENCHIO;
+    for (i = 0; i < BENCHFILES; i++)
+    {
+        snprintf(name, sizeof(name), "ring%d", i);
+        fds[i] = FillFile(name, filesize, 'a' + i);
+        if (fds[i] < 0)
+        {
+            printf("ERROR: Unable to create %s\n", name);
+            return 1;
+        }
+    }
+
+    printf("%ld reads of %d bytes over %d files of %" PRIu64 " KB, %d ring workers%s\n", reads, BENCHIO,
+           BENCHFILES, filesize / 1024, RINGWORKERS, argc > 1 ? ", backed" : "");
+
+    for (i = 0; i < BENCHFILES; i++)
+        LseekFile(fds[i], 0, START);
+    start = Now();
+    for (issued = 0; issued < reads; issued++)
+        errors += ReadFile(fds[issued % BENCHFILES], &bufs[0], BENCHIO) != BENCHIO;
+    elapsed = Now() - start;
+    printf("direct     %10.0f reads/s  %7.2f us/read  errors %ld\n", reads / elapsed, elapsed / reads * 1e6, errors);
+
+    if (InitialiseRing(RINGWORKERS) != 0)
+    {
+        printf("ERROR: Unable to start the ring\n");
+        return 1;
+    }
+
+    for (d = 0; d < (int)(sizeof(depths) / sizeof(depths[0])); d++)
+    {
+        for (i = 0; i < BENCHFILES; i++)
+            LseekFile(fds[i], 0, START);
+
+        issued = reaped = errors = 0;
+        start = Now();
+        while (reaped < reads)
+        {
+            // Top the ring up to the queue depth, one submission per batch
+            n = 0;
+            while (issued + n < reads && issued + n - reaped < depths[d])
+            {
+                memset(&reqs[n], 0, sizeof(VFSREQUEST));
+                reqs[n].opcode = OP_READ;
+                reqs[n].fd = fds[(issued + n) % BENCHFILES];
+                reqs[n].buffer = &bufs[(size_t)((issued + n) % RINGSIZE) * BENCHIO];
+                reqs[n].size = BENCHIO;
+                n++;
+            }
+            if (n > 0 && SubmitRequests(&reqs[0], n) == n)
+                issued += n;
+
+            n = ReapCompletions(&done[0], RINGSIZE, 1);
+            for (i = 0; i < n; i++)
+                errors += done[i].result != BENCHIO;
+            reaped += n;
+        }
+        elapsed = Now() - start;
+
+        printf("depth %3d  %10.0f reads/s  %7.2f us/read  errors %ld\n", depths[d], reads / elapsed,
+               elapsed / reads * 1e6, errors);
+    }
+
+    ShutdownRing();
+    return 0;
+}
+
+
+/*
+ * Function: BenchView
+ * -------------------
+ * Reads a 16 MB file in 64 KB, 256 KB, 1 MB, 4 MB and 16 MB pieces with
+ * ReadFile() into a preallocated buffer and with ReadView(). The consumer
+ * touches one byte per 4 KB page of each piece, as a caller that inspects
+ * or forwards the data would.
+ *
+ * Arguments: [Megabytes_Per_Size]
+ */
+int BenchView(int argc, char *argv[])
+{
+    static const uint64_t sizes[] = { 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024 };
+    const uint64_t filesize = 16 * 1024 * 1024;
+    long megabytes = argc > 0 ? atol(argv[0]) : 4096, reads = 0, r = 0, errors = 0;
+    std::vector<char> buf(filesize);
+    VIEWLEASE view;
+    const char *data = NULL;
+    uint64_t size = 0, off = 0;
+    int64_t n = 0, pos = 0;
+    int fd = 0, s = 0, mode = 0;
+    volatile char sink = 0;
+    double start = 0, elapsed = 0;
+
+    if (megabytes <= 0 || StartInstance(NULL) != 0)
+        return 1;
+
+    fd = FillFile("view", filesize, 'v');
+    if (fd < 0)
+    {
+        printf("ERROR: Unable to create view\n");
+        return 1;
+    }
+
+    printf("%ld MB read per size from a %" PRIu64 " MB file\n", megabytes, filesize / (1024 * 1024));
+    for (s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+    {
+        size = sizes[s];
+        reads = (long)((uint64_t)megabytes * 1024 * 1024 / size);
+        if (reads == 0)
+            reads = 1;
+
+        printf("%6" PRIu64 " KB", size / 1024);
+        for (mode = 0; mode < 2; mode++)
+        {
+            LseekFile(fd, 0, START);
+            pos = 0;
+            errors = 0;
+            start = Now();
+            for (r = 0; r < reads; r++)
+            {
+                if (mode == 0)
+                {
+                    n = ReadFile(fd, &buf[0], size);
+                    data = &buf[0];
+                }
+                else
+                {
+                    n = ReadView(fd, size, &view);
+                    data = view.data;
+                }
+
+                if (n != (int64_t)size)
+                    errors++;
+                for (off = 0; n > 0 && off < (uint64_t)n; off += 4096)
+                    sink = sink + data[off];
+
+                if (mode == 1 && n > 0)
+                    ReleaseView(&view);
+                pos += n;
+                if (n <= 0 || pos >= (int64_t)filesize)
+                {
+                    LseekFile(fd, 0, START);
+                    pos = 0;
+                }
+            }
+            elapsed = Now() - start;
+
+            printf("  %s %9.1f MB/s %9.2f us/read%s", mode == 0 ? "ReadFile" : "ReadView",
+                   reads * (double)size / (1024 * 1024) / elapsed, elapsed / reads * 1e6, errors ? " (errors)" : "");
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
+
+
+typedef struct appender
+{
+    int Fd;
+    long Count;
+    long Errors;
+}APPENDER;
+
+
+void *AppendRun(void *arg)
+{
+    APPENDER *a = (APPENDER *)arg;
+    char record[64];
+    long i = 0;
+
+    memset(record, 'a' + a->Fd % 26, sizeof(record));
+    for (i = 0; i < a->Count; i++)
+        if (WriteFile(a->Fd, record, sizeof(record)) != (int64_t)sizeof(record))
+            a->Errors++;
+
+    return NULL;
+}
+
+
+/*
+ * Function: BenchAppend
+ * ---------------------
+ * 1, 2, 4, ... 32 threads append 64-byte records to one file, each through
+ * its own APPEND descriptor and without the instance lock. The total number
+ * of records is the same for every thread count, and the file must end up
+ * exactly that long.
+ *
+ * Arguments: [Records]
+ */
+int BenchAppend(int argc, char *argv[])
+{
+    static char name[] = "log";
+    long records = argc > 0 ? atol(argv[0]) : 1000000, errors = 0;
+    std::vector<pthread_t> tids(32);
+    std::vector<APPENDER> apps(32);
+    int fd = 0, n = 0, i = 0;
+    double start = 0, elapsed = 0;
+
+    if (records <= 0 || StartInstance(NULL) != 0)
+        return 1;
+
+    fd = CreateFile(name, READ + WRITE);
+    if (fd < 0)
+        return 1;
+    for (i = 0; i < 32; i++)
+    {
+        apps[i].Fd = OpenFile(name, WRITE + APPEND);
+        if (apps[i].Fd < 0)
+        {
+            printf("ERROR: Unable to open %s for appending\n", name);
+            return 1;
+        }
+    }
+
+    printf("%ld records of 64 bytes per run\n", records);
+    for (n = 1; n <= 32; n *= 2)
+    {
+        truncate_File(name, 0);
+
+        start = Now();
+        for (i = 0; i < n; i++)
+        {
+            apps[i].Count = records / n + (i < records % n);
+            apps[i].Errors = 0;
+            pthread_create(&tids[i], NULL, AppendRun, &apps[i]);
+        }
+        errors = 0;
+        for (i = 0; i < n; i++)
+        {
+            pthread_join(tids[i], NULL);
+            errors += apps[i].Errors;
+        }
+        elapsed = Now() - start;
+
+        printf("writers %2d  %10.0f appends/s  size %s  errors %ld\n", n, records / elapsed,
+               UFDTArr[fd].ptrfiletable->ptrinode->FileActualSize == (uint64_t)records * 64 ? "ok" : "WRONG", errors);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Function: BenchReadahead
+ * ------------------------
+ * Sequential 64 KB ReadFile() scan of a file held in a backing file, with
+ * readahead on and off in turn for `Rounds` rounds. Before each scan the
+ * file's pages are written back, unmapped and dropped from the host page
+ * cache, so every scan reads from the host file system.
+ *
+ * Arguments: [Megabytes] [Rounds] [Backing_File]
+ */
+int BenchReadahead(int argc, char *argv[])
+{
+    long megabytes = argc > 0 ? atol(argv[0]) : 256, hits0 = 0, waste0 = 0, hits = 0, waste = 0;
+    int rounds = argc > 1 ? atoi(argv[1]) : 3;
+    const char *backing = argc > 2 ? argv[2] : "CVFSBench.backing";
+    std::vector<char> buf(64 * 1024);
+    uint64_t size = 0, done = 0;
+    PINODE inode = NULL;
+    int fd = 0, hostfd = 0, mode = 0, round = 0;
+    int64_t n = 0;
+    double start = 0, elapsed = 0;
+
+    if (megabytes <= 0 || rounds <= 0 || StartInstance(backing) != 0)
+        return 1;
+
+    size = (uint64_t)megabytes * 1024 * 1024;
+    fd = FillFile("scan", size, 's');
+    hostfd = open(backing, O_RDWR);
+    if (fd < 0 || hostfd == -1)
+    {
+        printf("ERROR: Unable to create scan\n");
+        return 1;
+    }
+    inode = UFDTArr[fd].ptrfiletable->ptrinode;
+
+    printf("Sequential scan of %ld MB in 64 KB reads from %s\n", megabytes, backing);
+    for (round = 0; round < rounds * 2; round++)
+    {
+        mode = round % 2 == 0;
+
+        // Start cold: nothing mapped, nothing in the page cache
+        msync(InodeData(inode), size, MS_SYNC);
+        madvise(InodeData(inode), size, MADV_DONTNEED);
+        posix_fadvise(hostfd, 0, 0, POSIX_FADV_DONTNEED);
+
+        UseReadahead = mode;
+        GetReadaheadStats(&hits0, &waste0);
+        LseekFile(fd, 0, START);
+        done = 0;
+
+        start = Now();
+        while ((n = ReadFile(fd, &buf[0], buf.size())) > 0)
+            done += n;
+        elapsed = Now() - start;
+
+        GetReadaheadStats(&hits, &waste);
+        printf("round %d  readahead %-3s  %8.1f MB/s  read %s  hits %ld MB  waste %ld KB\n", round / 2 + 1,
+               mode ? "on" : "off", done / (1024.0 * 1024) / elapsed, done == size ? "ok" : "SHORT",
+               (hits - hits0) >> 20, (waste - waste0) >> 10);
+    }
+
+    close(hostfd);
+    unlink(backing);
+    return 0;
+}
+
+
+/*
+ * Function: BenchTruncate
+ * -----------------------
+ * Latency of truncate_File() on fully written files of 1 MB to 1 GB:
+ * shrinking to half, to 4106 bytes (inside a block), extending back to
+ * the full size and shrinking to 0. Each size is refilled and measured
+ * `Rounds` times; the best time of each step is reported, with the data
+ * bytes the superblock reports free afterwards as a check.
+ *
+ * Arguments: [Rounds]
+ */
+int BenchTruncate(int argc, char *argv[])
+{
+    static const uint64_t sizes[] = { 1ULL << 20, 16ULL << 20, 256ULL << 20, 1ULL << 30 };
+    static char name[] = "trunc";
+    int rounds = argc > 0 ? atoi(argv[0]) : 3;
+    uint64_t targets[4];
+    double best[4], t = 0;
+    long freebytes = 0;
+    int fd = 0, s = 0, r = 0, step = 0;
+
+    if (rounds <= 0 || StartInstance(NULL) != 0)
+        return 1;
+
+    freebytes = SUPERBLOCKobj.FreeBytes;
+    printf("%-8s %12s %12s %12s %12s  freed\n", "size", "to half", "to 4106", "extend", "to 0");
+    for (s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+    {
+        targets[0] = sizes[s] / 2;
+        targets[1] = 4106;
+        targets[2] = sizes[s];
+        targets[3] = 0;
+        for (step = 0; step < 4; step++)
+            best[step] = 1e9;
+
+        for (r = 0; r < rounds; r++)
+        {
+            fd = FillFile(name, sizes[s], 't');
+            if (fd < 0)
+            {
+                printf("ERROR: Unable to create %s\n", name);
+                return 1;
+            }
+
+            for (step = 0; step < 4; step++)
+            {
+                t = Now();
+                if (truncate_File(name, targets[step]) != 0)
+                    printf("ERROR: truncate to %" PRIu64 " failed\n", targets[step]);
+                t = Now() - t;
+                if (t < best[step])
+                    best[step] = t;
+            }
+
+            rm_File(name);
+        }
+
+        printf("%5" PRIu64 " MB %9.1f us %9.1f us %9.1f us %9.1f us  %s\n", sizes[s] >> 20, best[0] * 1e6,
+               best[1] * 1e6, best[2] * 1e6, best[3] * 1e6, SUPERBLOCKobj.FreeBytes == freebytes ? "all" : "LEAK");
+    }
+
+    return 0;
+}
+
+
+/*
+ * Function: BenchLargeFile
+ * ------------------------
+ * Seeks and writes `Records` records of `Record_KB` at random block-aligned
+ * offsets of an 8 GB file, then seeks to them in a different order and
+ * reads them back, checking each. Only the written blocks take memory.
+ *
+ * Arguments: [Records] [Record_KB]
+ */
+int BenchLargeFile(int argc, char *argv[])
+{
+    static char name[] = "large";
+    long records = argc > 0 ? atol(argv[0]) : 512, i = 0, errors = 0;
+    int64_t record = (argc > 1 ? atol(argv[1]) : 1024) * 1024, slots = 0;
+    std::vector<int64_t> offsets;
+    std::vector<char> buf;
+    struct rusage ru;
+    uint64_t seed = 88172645463325252ULL;
+    int wfd = 0, rfd = 0;
+    double start = 0, elapsed = 0;
+
+    if (records <= 0 || record <= 0)
+        return 1;
+
+    DataAreaSize = (int64_t)MAXINODE * (8LL << 30);
+    if (StartInstance(NULL) != 0)
+        return 1;
+
+    // Distinct slots, so no record overwrites another
+    slots = MAXFILESIZE / record;
+    if (records > slots)
+        records = slots;
+    offsets.resize(records);
+    for (i = 0; i < records; i++)
+        offsets[i] = (slots / records) * i * record;
+    for (i = records - 1; i > 0; i--)
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        std::swap(offsets[i], offsets[seed % (i + 1)]);
+    }
+
+    buf.resize(record);
+    if (CreateFile(name, READ + WRITE) < 0 || (wfd = OpenFile(name, WRITE)) < 0 || (rfd = OpenFile(name, READ)) < 0)
+    {
+        printf("ERROR: Unable to create %s\n", name);
+        return 1;
+    }
+
+    printf("%ld records of %" PRId64 " KB in a %" PRId64 " MB file\n", records, record / 1024, MAXFILESIZE >> 20);
+
+    start = Now();
+    for (i = 0; i < records; i++)
+    {
+        memset(&buf[0], 'a' + i % 26, record);
+        memcpy(&buf[0], &offsets[i], sizeof(int64_t));
+        if (LseekFile(wfd, offsets[i], START) != 0 || WriteFile(wfd, &buf[0], record) != record)
+            errors++;
+    }
+    elapsed = Now() - start;
+    printf("seek + write %8.1f MB/s  %8.2f us/record  errors %ld\n", records * (double)record / (1 << 20) / elapsed,
+           elapsed / records * 1e6, errors);
+
+    // Read back in reverse order of writing, so every read seeks
+    errors = 0;
+    start = Now();
+    for (i = records - 1; i >= 0; i--)
+    {
+        if (LseekFile(rfd, offsets[i], START) != 0 || ReadFile(rfd, &buf[0], record) != record ||
+            memcmp(&buf[0], &offsets[i], sizeof(int64_t)) != 0 || buf[record - 1] != 'a' + i % 26)
+            errors++;
+    }
+    elapsed = Now() - start;
+    printf("seek + read  %8.1f MB/s  %8.2f us/record  errors %ld\n", records * (double)record / (1 << 20) / elapsed,
+           elapsed / records * 1e6, errors);
+
+    getrusage(RUSAGE_SELF, &ru);
+    printf("file size %" PRIu64 " MB, %" PRId64 " MB allocated, peak RSS %ld MB\n",
+           UFDTArr[rfd].ptrfiletable->ptrinode->FileActualSize >> 20,
+           (int64_t)UFDTArr[rfd].ptrfiletable->ptrinode->AllocatedBlocks * BLOCKSIZE >> 20, ru.ru_maxrss / 1024);
+
+    DataAreaSize = DATAAREASIZE;
+    return 0;
+}
+
+
+/*
+ * Function: AnonHugeMB
+ * --------------------
+ * @return Megabytes of this process's memory in transparent huge pages.
+ */
+long AnonHugeMB()
+{
+    char line[256];
+    long kb = 0, total = 0;
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+
+    if (f == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), f) != NULL)
+        if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+            total += kb;
+    fclose(f);
+
+    return total / 1024;
+}
+
+
+/*
+ * Function: BenchHugePages
+ * ------------------------
+ * Random reads of `Read_Bytes` from a `Megabytes` file whose data lives in
+ * a private arena of 4 KB pages, then in one with UseHugePages set. Small
+ * reads spread over a large file make the page size, i.e. the TLB reach,
+ * the main cost.
+ *
+ * Arguments: [Megabytes] [Reads] [Read_Bytes]
+ */
+int BenchHugePages(int argc, char *argv[])
+{
+    static const char *pages[] = { "4 KB pages", "transparent huge pages", "explicit huge pages" };
+    static char name[] = "pages";
+    long megabytes = argc > 0 ? atol(argv[0]) : 1024, reads = argc > 1 ? atol(argv[1]) : 4000000, i = 0;
+    int64_t size = argc > 2 ? atol(argv[2]) : 64, blocks = 0;
+    char buf[BENCHIO];
+    uint64_t seed = 88172645463325252ULL;
+    long errors = 0;
+    int fd = 0, mode = 0;
+    double start = 0, elapsed = 0;
+
+    if (megabytes <= 0 || reads <= 0 || size <= 0 || size > BENCHIO)
+        return 1;
+
+    blocks = (int64_t)megabytes * 1024 * 1024 / BLOCKSIZE;
+    printf("%ld random reads of %" PRId64 " bytes over %ld MB\n", reads, size, megabytes);
+    for (mode = 0; mode < 2; mode++)
+    {
+        UseHugePages = mode;
+        CurrentVFS = new VFSINSTANCE();
+        if (StartInstance(NULL) != 0)
+            return 1;
+        fd = FillFile(name, (uint64_t)megabytes * 1024 * 1024, 'h');
+        if (fd < 0)
+        {
+            printf("ERROR: Unable to create %s\n", name);
+            return 1;
+        }
+        fd = OpenFile(name, READ);
+
+        errors = 0;
+        start = Now();
+        for (i = 0; i < reads; i++)
+        {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            if (LseekFile(fd, (int64_t)(seed % blocks) * BLOCKSIZE + (int64_t)(seed >> 52) % (BLOCKSIZE - size + 1),
+                          START) != 0 || ReadFile(fd, buf, size) != size)
+                errors++;
+        }
+        elapsed = Now() - start;
+
+        printf("%-24s %10.0f reads/s  %7.3f us/read  %5ld MB in huge pages  errors %ld\n",
+               pages[CurrentVFS->ArenaPages], reads / elapsed, elapsed / reads * 1e6, AnonHugeMB(), errors);
+        rm_File(name);
+    }
+
+    UseHugePages = 0;
+    return 0;
+}
+
+
+/*
+ * Function: BenchGrep
+ * -------------------
+ * GrepFiles() over `Files` files of `Megabytes_Per_File` of random
+ * lowercase text, with the pattern planted once per megabyte, on 1, 2, 4,
+ * ... `Max_Threads` threads. A single-threaded memcpy of 256 MB is timed
+ * first as a reference for the memory bandwidth.
+ *
+ * Arguments: [Files] [Megabytes_Per_File] [Max_Threads]
+ */
+int BenchGrep(int argc, char *argv[])
+{
+    static const char pattern[] = "needle-in-cvfs";
+    int files = argc > 0 ? atoi(argv[0]) : 16;
+    long megabytes = argc > 1 ? atol(argv[1]) : 128;
+    int max = argc > 2 ? atoi(argv[2]) : 16;
+    std::vector<char> chunk(1024 * 1024), src, dst;
+    std::vector<GREPMATCH> matches;
+    uint64_t seed = 88172645463325252ULL, count = 0;
+    char name[32];
+    int fd = 0, f = 0, n = 0, found = 0;
+    long m = 0;
+    size_t i = 0;
+    double start = 0, elapsed = 0, total = 0;
+
+    if (files <= 0 || files > MAXINODE || megabytes <= 0 || max <= 0 || max > GREPMAXTHREADS ||
+        StartInstance(NULL) != 0)
+        return 1;
+
+    for (f = 0; f < files; f++)
+    {
+        snprintf(name, sizeof(name), "corpus%d", f);
+        fd = CreateFile(name, READ + WRITE);
+        if (fd < 0)
+            return 1;
+        for (m = 0; m < megabytes; m++)
+        {
+            for (i = 0; i < chunk.size(); i++)
+            {
+                seed ^= seed << 13;
+                seed ^= seed >> 7;
+                seed ^= seed << 17;
+                chunk[i] = 'a' + seed % 26;
+            }
+            memcpy(&chunk[777], pattern, sizeof(pattern) - 1);
+            if (WriteFile(fd, &chunk[0], chunk.size()) != (int64_t)chunk.size())
+                return 1;
+        }
+    }
+    total = (double)files * megabytes * 1024 * 1024;
+
+    src.assign(256 * 1024 * 1024, 's');
+    dst.assign(src.size(), 'd');
+    start = Now();
+    memcpy(&dst[0], &src[0], src.size());
+    elapsed = Now() - start;
+    printf("%d files of %ld MB, memcpy reference %.2f GB/s, %ld online cores\n", files, megabytes,
+           src.size() / elapsed / 1e9, sysconf(_SC_NPROCESSORS_ONLN));
+    src.clear();
+    dst.clear();
+
+    matches.resize(files);
+    for (n = 1; n <= max; n *= 2)
+    {
+        LockVFS();
+        start = Now();
+        found = GrepFiles(pattern, n, &matches[0], files);
+        elapsed = Now() - start;
+        UnlockVFS();
+
+        count = 0;
+        for (f = 0; f < found; f++)
+            count += matches[f].Count;
+        printf("threads %2d  %7.2f GB/s  %4d files  %8" PRIu64 " matches%s\n", n, total / elapsed / 1e9, found, count,
+               count == (uint64_t)files * megabytes ? "" : "  (WRONG)");
+    }
+
+    return 0;
+}
+
+
+/*
+ * Function: EngineRecords
+ * -----------------------
+ * Workload of BenchEngine for one caller: appends 64-byte records to a file
+ * of its own, reads them back behind the writer, and asks for the read
+ * offset and the file's metadata, in turn. The file is truncated and
+ * started over when it is full.
+ *
+ * @return Number of operations that failed.
+ */
+template<class VFS>
+long EngineRecords(VFS *store, int id, long ops)
+{
+    FILESTAT st;
+    char record[64], name[32];
+    long i = 0, errors = 0;
+    int rfd = 0, wfd = 0;
+
+    snprintf(name, sizeof(name), "engine%d", id);
+    memset(record, 'a' + id % 26, sizeof(record));
+    rfd = store->CreateFile(name, READ + WRITE);
+    wfd = store->OpenFile(name, WRITE);
+    if (rfd < 0 || wfd < 0)
+        return ops;
+
+    for (i = 0; i < ops; i++)
+    {
+        switch (i % 4)
+        {
+            case 0:
+                if (store->WriteFile(wfd, record, sizeof(record)) != (int64_t)sizeof(record))
+                {
+                    errors += store->TruncateFile(name, 0) != 0;
+                    errors += store->LseekFile(wfd, 0, START) != 0;
+                    errors += store->LseekFile(rfd, 0, START) != 0;
+                    errors += store->WriteFile(wfd, record, sizeof(record)) != (int64_t)sizeof(record);
+                }
+                break;
+            case 1:
+                errors += store->ReadFile(rfd, record, sizeof(record)) != (int64_t)sizeof(record);
+                break;
+            case 2:
+                errors += store->LseekFile(rfd, 0, CURRENT) != 0;
+                break;
+            default:
+                errors += store->StatFile(name, &st) != 0;
+                break;
+        }
+    }
+
+    store->CloseFile(wfd);
+    errors += store->RemoveFile(name) != 0;
+    return errors;
+}
+
+
+/*
+ * Structure: engineworker
+ * -----------------------
+ * Arguments and result of one thread of BenchEngine's server runs.
+ */
+typedef struct engineworker
+{
+    BasicVfs<ServerConfig> *Store;
+    int Id;
+    long Ops;
+    long Errors;
+}ENGINEWORKER, *PENGINEWORKER;
+
+
+void *EngineThread(void *arg)
+{
+    PENGINEWORKER w = (PENGINEWORKER)arg;
+
+    w->Errors = EngineRecords(w->Store, w->Id, w->Ops);
+    return NULL;
+}
+
+
+/*
+ * Function: BenchEngine
+ * ---------------------
+ * The same record workload on BasicVfs<EmbeddedConfig> (no lock, small
+ * data area) and BasicVfs<ServerConfig> (instance lock, 64 GB data area in
+ * huge pages) on one thread, then on the server profile from `Threads`
+ * threads at once, each with a file of its own.
+ *
+ * Arguments: [Ops] [Threads]
+ */
+int BenchEngine(int argc, char *argv[])
+{
+    long ops = argc > 0 ? atol(argv[0]) : 10000000;
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    BasicVfs<EmbeddedConfig> *embedded = NULL;
+    BasicVfs<ServerConfig> *server = NULL;
+    std::vector<ENGINEWORKER> workers;
+    std::vector<pthread_t> tids;
+    double start = 0, elapsed = 0;
+    long errors = 0;
+    int i = 0;
+
+    if (ops <= 0 || threads <= 0 || threads > 25)
+        return 1;
+
+    embedded = new BasicVfs<EmbeddedConfig>();
+    start = Now();
+    errors = EngineRecords(embedded, 0, ops);
+    elapsed = Now() - start;
+    printf("embedded  1 thread   %12.0f ops/s  errors %ld\n", ops / elapsed, errors);
+
+    server = new BasicVfs<ServerConfig>();
+    start = Now();
+    errors = EngineRecords(server, 0, ops);
+    elapsed = Now() - start;
+    printf("server    1 thread   %12.0f ops/s  errors %ld\n", ops / elapsed, errors);
+
+    workers.resize(threads);
+    tids.resize(threads);
+    start = Now();
+    for (i = 0; i < threads; i++)
+    {
+        workers[i].Store = server;
+        workers[i].Id = i;
+        workers[i].Ops = ops;
+        workers[i].Errors = 0;
+        pthread_create(&tids[i], NULL, EngineThread, &workers[i]);
+    }
+    errors = 0;
+    for (i = 0; i < threads; i++)
+    {
+        pthread_join(tids[i], NULL);
+        errors += workers[i].Errors;
+    }
+    elapsed = Now() - start;
+    printf("server   %2d threads  %12.0f ops/s  errors %ld\n", threads, ops * threads / elapsed, errors);
+
+    return 0;
+}
+
+
+/*
+ * Function: ResidentMB
+ * --------------------
+ * @return Megabytes of this process's resident set.
+ */
+long ResidentMB()
+{
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+
+    if (f == NULL)
+        return 0;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(f);
+
+    return resident * sysconf(_SC_PAGESIZE) >> 20;
+}
+
+
+/*
+ * Function: BenchSparse
+ * ---------------------
+ * A host file of `Megabytes` whose data is `Percent` % of it, in 64 KB
+ * runs spread evenly over holes, is imported with ImportDirectory() and
+ * exported back with ExportDirectory() on one thread. Each line gives the
+ * time, the blocks the VFS allocated, the growth of the resident set and
+ * the host space the exported copy takes. The same bytes written through
+ * WriteFile(), zeros included, are the dense reference.
+ *
+ * Arguments: [Megabytes] [Percent] [Host_Dir]
+ */
+int BenchSparse(int argc, char *argv[])
+{
+    static char name[] = "sparse", dense[] = "dense";
+    long megabytes = argc > 0 ? atol(argv[0]) : 1024;
+    double percent = argc > 1 ? atof(argv[1]) : 1;
+    const char *dir = argc > 2 ? argv[2] : "/tmp/CVFSBench.sparse";
+    const uint64_t run = 64 * 1024;
+    std::vector<char> chunk(1024 * 1024);
+    char in[PATH_MAX / 2], out[PATH_MAX / 2], path[PATH_MAX];
+    uint64_t size = 0, runs = 0, gap = 0, r = 0, done = 0;
+    TRANSFERSTATS stats;
+    struct stat st;
+    double start = 0, import = 0, exported = 0;
+    long rss = 0;
+    int host = -1, fd = 0;
+
+    if (megabytes <= 0 || percent <= 0 || percent > 100)
+        return 1;
+    size = (uint64_t)megabytes << 20;
+    runs = (uint64_t)(size * percent / 100) / run;
+    if (runs == 0)
+        runs = 1;
+    gap = size / runs;
+
+    snprintf(in, sizeof(in), "%s/in", dir);
+    snprintf(out, sizeof(out), "%s/out", dir);
+    mkdir(dir, 0700);
+    mkdir(in, 0700);
+    mkdir(out, 0700);
+    snprintf(path, sizeof(path), "%s/%s", in, name);
+    host = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (host == -1 || ftruncate(host, (off_t)size) != 0)
+    {
+        printf("ERROR: Unable to create %s\n", path);
+        return 1;
+    }
+    memset(&chunk[0], 'd', run);
+    for (r = 0; r < runs; r++)
+        if (pwrite(host, &chunk[0], run, (off_t)(r * gap)) != (ssize_t)run)
+            return 1;
+
+    if (StartInstance(NULL) != 0)
+        return 1;
+    if ((uint64_t)MAXFILESIZE < size)
+    {
+        printf("ERROR: %ld MB is larger than a file can be\n", megabytes);
+        return 1;
+    }
+    printf("%ld MB file, %" PRIu64 " runs of 64 KB (%.1f%% data)\n", megabytes, runs, percent);
+
+    LockVFS();
+    rss = ResidentMB();
+    start = Now();
+    if (ImportDirectory(in, 1, &stats) != 0 || stats.Files != 1)
+        return 1;
+    import = Now() - start;
+    rss = ResidentMB() - rss;
+
+    snprintf(path, sizeof(path), "%s/%s", out, name);
+    start = Now();
+    if (ExportDirectory(out, 1, &stats) != 0 || stats.Files != 1 || stat(path, &st) != 0)
+        return 1;
+    exported = Now() - start;
+    printf("sparse  import %8.3f s  export %8.3f s  %6" PRId64 " MB allocated  +%5ld MB RSS  %6" PRId64 " MB on host\n",
+           import, exported, (int64_t)Get_Inode(name)->AllocatedBlocks * BLOCKSIZE >> 20, rss,
+           (int64_t)st.st_blocks * 512 >> 20);
+
+    fd = OpenFile(name, READ);
+    rm_File(name);
+    ReclaimRetired();
+    unlink(path);
+
+    // The same bytes written in full, as a copy without hole tracking makes them
+    rss = ResidentMB();
+    start = Now();
+    fd = CreateFile(dense, READ + WRITE);
+    for (done = 0; fd >= 0 && done < size; done += chunk.size())
+    {
+        if (pread(host, &chunk[0], chunk.size(), (off_t)done) != (ssize_t)chunk.size() ||
+            WriteFile(fd, &chunk[0], chunk.size()) != (int64_t)chunk.size())
+            return 1;
+    }
+    import = Now() - start;
+    rss = ResidentMB() - rss;
+
+    snprintf(path, sizeof(path), "%s/%s", out, dense);
+    start = Now();
+    if (ExportDirectory(out, 1, &stats) != 0 || stats.Files != 1 || stat(path, &st) != 0)
+        return 1;
+    exported = Now() - start;
+    printf("dense   write  %8.3f s  export %8.3f s  %6" PRId64 " MB allocated  +%5ld MB RSS  %6" PRId64 " MB on host\n",
+           import, exported, (int64_t)Get_Inode(dense)->AllocatedBlocks * BLOCKSIZE >> 20, rss,
+           (int64_t)st.st_blocks * 512 >> 20);
+    UnlockVFS();
+
+    close(host);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%s", in, name);
+    unlink(path);
+    rmdir(in);
+    rmdir(out);
+    rmdir(dir);
+
+    return 0;
+}
+
+
+/*
+ * Function: BenchWriteBuffer
+ * --------------------------
+ * Writes `Megabytes` as `Record`-byte writes (16 by default) to a new file
+ * through a descriptor without a write-behind buffer (SetWriteBuffer(fd, 0))
+ * and through descriptors with 4 KB, 64 KB and 1 MB buffers, closing the
+ * file inside the timed part so the last flush counts. Each line gives the
+ * time per write and the throughput; the file size is checked after close.
+ *
+ * Arguments: [Megabytes] [Record]
+ */
+int BenchWriteBuffer(int argc, char *argv[])
+{
+    static const uint64_t buffers[] = { 0, 4096, 64 * 1024, 1024 * 1024 };
+    static char name[] = "wbuf";
+    uint64_t megabytes = argc > 0 ? strtoull(argv[0], NULL, 10) : 64;
+    uint64_t record = argc > 1 ? strtoull(argv[1], NULL, 10) : 16;
+    uint64_t writes = 0, w = 0;
+    std::vector<char> data;
+    double t = 0;
+    int fd = 0, b = 0;
+
+    if (megabytes == 0 || record == 0 || StartInstance(NULL) != 0)
+        return 1;
+    writes = (megabytes << 20) / record;
+    data.assign(record, 'w');
+
+    printf("%" PRIu64 " writes of %" PRIu64 " bytes\n", writes, record);
+    printf("%-10s %12s %12s\n", "buffer", "ns/write", "MB/s");
+    for (b = 0; b < (int)(sizeof(buffers) / sizeof(buffers[0])); b++)
+    {
+        fd = CreateFile(name, READ + WRITE);
+        if (fd < 0 || SetWriteBuffer(fd, buffers[b]) != 0)
+        {
+            printf("ERROR: Unable to create %s\n", name);
+            return 1;
+        }
+
+        t = Now();
+        for (w = 0; w < writes; w++)
+        {
+            if (WriteFile(fd, &data[0], record) != (int64_t)record)
+            {
+                printf("ERROR: Write %" PRIu64 " failed\n", w);
+                return 1;
+            }
+        }
+        CloseFileByName(fd);
+        t = Now() - t;
+
+        if (Get_Inode(name)->FileActualSize != writes * record)
+            printf("ERROR: File holds %" PRIu64 " bytes\n", Get_Inode(name)->FileActualSize);
+        printf("%7" PRIu64 " KB %12.1f %12.1f\n", buffers[b] >> 10, t * 1e9 / writes,
+               (double)(writes * record) / t / (1 << 20));
+
+        fd = OpenFile(name, READ);
+        rm_File(name);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Function: BenchNames
+ * --------------------
+ * Creates `Files` empty files (all MAXINODE by default) in name order,
+ * then looks up `Lookups` names at random with Get_Inode(), half of them
+ * existing and half not, lists pages of 100 files after random names, and
+ * replaces 1000 random files with files of new random names, each of which
+ * shifts the sorted name index. Memory per file is given as the inode and
+ * index entry plus the name arena used, and as the growth of the resident
+ * set over the empty instance. The default build has only 50 inodes;
+ * rebuild with more to see the index at scale:
+ *
+ *     g++ -std=c++20 -O2 -DMAXINODE=1048576 CVFSBench.cpp -o CVFSBench -pthread
+ *
+ * Arguments: [Files] [Lookups]
+ */
+int BenchNames(int argc, char *argv[])
+{
+    long files = argc > 0 ? atol(argv[0]) : MAXINODE;
+    long lookups = argc > 1 ? atol(argv[1]) : 1000000;
+    PINODE *found = NULL;
+    char name[32];
+    double t = 0;
+    long rss = 0, i = 0, hits = 0, n = 0;
+    uint64_t seed = 42;
+    int fd = 0;
+
+    if (files <= 0 || files > MAXINODE || lookups <= 0)
+        return 1;
+    rss = ResidentMB();
+    if (StartInstance(NULL) != 0)
+        return 1;
+    printf("Empty instance of %d inodes: %ld MB resident\n", MAXINODE, ResidentMB() - rss);
+    found = (PINODE *)malloc(100 * sizeof(PINODE));
+    if (found == NULL)
+        return 1;
+
+    // Even numbers exist, odd ones do not
+    rss = ResidentMB();
+    t = Now();
+    for (i = 0; i < files; i++)
+    {
+        snprintf(name, sizeof(name), "file%08ld", i * 2);
+        fd = CreateFile(name, READ + WRITE);
+        if (fd < 0)
+        {
+            printf("ERROR: Unable to create %s (%d)\n", name, fd);
+            return 1;
+        }
+        CloseFileByName(fd);
+    }
+    t = Now() - t;
+    rss = ResidentMB() - rss;
+    printf("%ld files: create %.2f us/file, %zu + %zu bytes per inode and index entry, "
+           "%.1f bytes of names per file, +%ld MB resident (%.0f bytes per file)\n",
+           files, t * 1e6 / files, sizeof(INODE), sizeof(NAMEENTRY),
+           (double)CurrentVFS->Names->ArenaUsed / files, rss, (double)(rss << 20) / files);
+
+    t = Now();
+    for (i = 0; i < lookups; i++)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        snprintf(name, sizeof(name), "file%08ld", (long)((seed >> 33) % (2 * files)));
+        if (Get_Inode(name) != NULL)
+            hits++;
+    }
+    t = Now() - t;
+    printf("Get_Inode: %.0f ns per lookup (%ld of %ld found)\n", t * 1e9 / lookups, hits, lookups);
+
+    t = Now();
+    for (i = 0; i < 1000; i++)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        snprintf(name, sizeof(name), "file%08ld", (long)((seed >> 33) % (2 * files)));
+        if (ListFiles("file*", name, 100, found) < 0)
+            return 1;
+    }
+    t = Now() - t;
+    printf("ListFiles: %.1f us per page of 100 after a name\n", t * 1e6 / 1000);
+
+    // Each round removes a file and creates one at a random place in the index
+    t = Now();
+    for (i = 0; i < 1000; i++)
+    {
+        do
+        {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            n = (long)((seed >> 33) % (2 * files));
+            snprintf(name, sizeof(name), "file%08ld", n);
+        } while (Get_Inode(name) == NULL);
+        OpenFile(name, READ);
+        rm_File(name);
+
+        snprintf(name, sizeof(name), "file%08ld", n ^ 1);
+        fd = CreateFile(name, READ + WRITE);
+        if (fd < 0)
+        {
+            printf("ERROR: Unable to create %s (%d)\n", name, fd);
+            return 1;
+        }
+        CloseFileByName(fd);
+    }
+    t = Now() - t;
+    printf("rm + create at random names: %.2f us per pair\n", t * 1e6 / 1000);
+
+    free(found);
+    return 0;
+}
+
+
+typedef struct churner
+{
+    int Fd;
+    uint64_t Size;
+    int NoLock;
+    std::atomic<int> *Stop;
+    long Ops;
+    long Errors;
+}CHURNER;
+
+
+void *ChurnRead(void *arg)
+{
+    CHURNER *c = (CHURNER *)arg;
+    std::vector<char> buf(c->Size);
+    int64_t ret = 0;
+
+    while (c->Stop->load(std::memory_order_relaxed) == 0)
+    {
+        if (c->NoLock)
+            ret = ReadFileNoLock(c->Fd, &buf[0], c->Size);
+        else
+        {
+            LockVFS();
+            ret = ReadFile(c->Fd, &buf[0], c->Size);
+            UnlockVFS();
+        }
+
+        if (ret > 0)
+            c->Ops++;
+        else
+        {
+            LockVFS();
+            if (LseekFile(c->Fd, 0, START) != 0)
+                c->Errors++;
+            UnlockVFS();
+        }
+    }
+
+    return NULL;
+}
+
+
+void *ChurnFiles(void *arg)
+{
+    static char name[] = "churn";
+    CHURNER *c = (CHURNER *)arg;
+    char block[4096];
+    int fd = 0;
+
+    memset(block, 'c', sizeof(block));
+    while (c->Stop->load(std::memory_order_relaxed) == 0)
+    {
+        LockVFS();
+        fd = CreateFile(name, READ + WRITE);
+        if (fd < 0 || WriteFile(fd, block, sizeof(block)) != (int64_t)sizeof(block) || rm_File(name) != 0)
+            c->Errors++;
+        else
+            c->Ops++;
+        UnlockVFS();
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Function: BenchChurn
+ * --------------------
+ * `Readers` threads each read `Read_Size` bytes at a time from a 1 MB file
+ * of their own while one more thread creates a file, writes 4 KB to it and
+ * removes it again, in a loop under the instance lock. The reads take the
+ * instance lock (ReadFile) in one run and run inside an epoch without it
+ * (ReadFileNoLock) in the other; each run lasts `Seconds` and reports the
+ * reads and the create/write/rm rounds per second.
+ *
+ * Arguments: [Readers] [Read_Size] [Seconds]
+ */
+int BenchChurn(int argc, char *argv[])
+{
+    int readers = argc > 0 ? atoi(argv[0]) : 4;
+    uint64_t size = argc > 1 ? strtoull(argv[1], NULL, 10) : 4096;
+    double seconds = argc > 2 ? atof(argv[2]) : 2;
+    std::vector<pthread_t> tids(readers + 1);
+    std::vector<CHURNER> ch(readers + 1);
+    std::atomic<int> stop(0);
+    char name[32];
+    long reads = 0, errors = 0;
+    int i = 0, nolock = 0;
+
+    if (readers <= 0 || readers > 40 || size == 0 || size > 1024 * 1024 || seconds <= 0 || StartInstance(NULL) != 0)
+        return 1;
+
+    for (i = 0; i < readers; i++)
+    {
+        snprintf(name, sizeof(name), "data%d", i);
+        if (FillFile(name, 1024 * 1024, 'r') < 0 || (ch[i].Fd = OpenFile(name, READ)) < 0)
+        {
+            printf("ERROR: Unable to create %s\n", name);
+            return 1;
+        }
+        ch[i].Size = size;
+    }
+
+    printf("%d readers of %" PRIu64 "-byte reads, 1 thread doing create + 4 KB write + rm\n", readers, size);
+    for (nolock = 0; nolock <= 1; nolock++)
+    {
+        stop.store(0);
+        for (i = 0; i <= readers; i++)
+        {
+            ch[i].NoLock = nolock;
+            ch[i].Stop = &stop;
+            ch[i].Ops = 0;
+            ch[i].Errors = 0;
+            pthread_create(&tids[i], NULL, i < readers ? ChurnRead : ChurnFiles, &ch[i]);
+        }
+        usleep((useconds_t)(seconds * 1e6));
+        stop.store(1);
+
+        reads = 0;
+        errors = 0;
+        for (i = 0; i <= readers; i++)
+        {
+            pthread_join(tids[i], NULL);
+            if (i < readers)
+                reads += ch[i].Ops;
+            errors += ch[i].Errors;
+        }
+
+        printf("%-8s %10.2f M reads/s %10.1f K churn/s  errors %ld\n", nolock ? "no-lock" : "locked",
+               reads / seconds / 1e6, ch[readers].Ops / seconds / 1e3, errors);
+    }
+
+    return 0;
+}
+
+
+typedef struct txworker
+{
+    char Name[32];
+    std::atomic<int> *Stop;
+    long Commits;
+    long Conflicts;
+}TXWORKER;
+
+
+void *TxIncrement(void *arg)
+{
+    TXWORKER *w = (TXWORKER *)arg;
+    TRANSACTION *tx = new TRANSACTION;
+    uint64_t counter = 0;
+    int ret = 0;
+
+    while (w->Stop->load(std::memory_order_relaxed) == 0)
+    {
+        TxBegin(tx);
+        ret = (int)TxRead(tx, w->Name, 0, (char *)&counter, sizeof(counter));
+        if (ret == (int)sizeof(counter))
+        {
+            counter++;
+            TxWrite(tx, w->Name, 0, (char *)&counter, sizeof(counter));
+            sched_yield();  // Other threads get to run between the read and the commit
+            ret = TxCommit(tx);
+        }
+        else
+            TxAbort(tx);
+
+        if (ret == 0)
+            w->Commits++;
+        else
+            w->Conflicts++;  // -5 from the read or -2 from the commit; either way it is retried
+    }
+
+    delete tx;
+    return NULL;
+}
+
+
+/*
+ * Function: BenchTx
+ * -----------------
+ * `Threads` threads each run read-increment-write transactions on an
+ * 8-byte counter for `Seconds`, retrying those that conflict. In the low
+ * contention run every thread has a counter of its own; in the high
+ * contention run they all share one. Each thread yields between its read
+ * and its commit, so the others run in between even on one CPU. Reports the commits per second, the
+ * conflicts per commit, and checks that the counters add up to the commits.
+ *
+ * Arguments: [Threads] [Seconds]
+ */
+int BenchTx(int argc, char *argv[])
+{
+    int threads = argc > 0 ? atoi(argv[0]) : 4;
+    double seconds = argc > 1 ? atof(argv[1]) : 2;
+    std::vector<pthread_t> tids(threads > 0 ? threads : 0);
+    std::vector<TXWORKER> w(threads > 0 ? threads : 0);
+    std::atomic<int> stop(0);
+    uint64_t zero = 0, counter = 0, total = 0;
+    long commits = 0, conflicts = 0;
+    int i = 0, shared = 0, fd = 0;
+
+    if (threads <= 0 || threads > 40 || seconds <= 0 || StartInstance(NULL) != 0)
+        return 1;
+
+    printf("%d threads of read-increment-write transactions on an 8-byte counter\n", threads);
+    for (shared = 0; shared <= 1; shared++)
+    {
+        stop.store(0);
+        for (i = 0; i < threads; i++)
+        {
+            snprintf(w[i].Name, sizeof(w[i].Name), "counter%d.%d", shared, shared ? 0 : i);
+            if (Get_Inode(w[i].Name) == NULL)
+            {
+                fd = CreateFile(w[i].Name, READ + WRITE);
+                if (fd < 0 || WriteFile(fd, (char *)&zero, sizeof(zero)) != (int64_t)sizeof(zero))
+                {
+                    printf("ERROR: Unable to create %s\n", w[i].Name);
+                    return 1;
+                }
+                CloseFileByName(fd);
+            }
+            w[i].Stop = &stop;
+            w[i].Commits = 0;
+            w[i].Conflicts = 0;
+        }
+
+        for (i = 0; i < threads; i++)
+            pthread_create(&tids[i], NULL, TxIncrement, &w[i]);
+        usleep((useconds_t)(seconds * 1e6));
+        stop.store(1);
+
+        commits = 0;
+        conflicts = 0;
+        total = 0;
+        for (i = 0; i < threads; i++)
+        {
+            pthread_join(tids[i], NULL);
+            commits += w[i].Commits;
+            conflicts += w[i].Conflicts;
+            if (!shared || i == 0)
+            {
+                memcpy(&counter, InodeData(Get_Inode(w[i].Name)), sizeof(counter));
+                total += counter;
+            }
+        }
+        if (total != (uint64_t)commits)
+        {
+            printf("ERROR: %ld commits but the counters add up to %" PRIu64 "\n", commits, total);
+            return 1;
+        }
+
+        printf("%-6s contention %10.1f K commits/s %8.3f conflicts per commit\n", shared ? "high" : "low",
+               commits / seconds / 1e3, commits > 0 ? (double)conflicts / commits : 0.0);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Structure: benchtask
+ * --------------------
+ * Fire-and-forget coroutine type for the benchmark clients: it starts
+ * running when called and frees its frame when it finishes.
+ */
+struct BenchTask
+{
+    struct promise_type
+    {
+        BenchTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+
+/*
+ * Structure: coroutinerun
+ * -----------------------
+ * Counters shared by the coroutine clients of one BenchCoroutines run.
+ */
+typedef struct coroutinerun
+{
+    std::atomic<long> Errors;
+    std::atomic<long> Resumed;      // reads that resumed on a ring worker
+    std::atomic<long> Finished;     // clients that have returned
+}COROUTINERUN, *PCOROUTINERUN;
+
+
+BenchTask CoroutineClient(int fd, int reads, PCOROUTINERUN run)
+{
+    char buf[BENCHIO];
+    pthread_t self;
+    int i = 0;
+
+    for (i = 0; i < reads; i++)
+    {
+        self = pthread_self();
+        if (co_await vfs.read(fd, buf, BENCHIO) != BENCHIO)
+            run->Errors++;
+        if (!pthread_equal(self, pthread_self()))
+            run->Resumed++;
+    }
+
+    run->Finished++;
+}
+
+
+typedef struct coroutinedriver
+{
+    int First, Count, Reads;
+    int *Fds;
+    PCOROUTINERUN Run;
+}COROUTINEDRIVER;
+
+
+void *StartClients(void *arg)
+{
+    COROUTINEDRIVER *d = (COROUTINEDRIVER *)arg;
+    int i = 0;
+
+    for (i = d->First; i < d->First + d->Count; i++)
+        CoroutineClient(d->Fds[i % BENCHFILES], d->Reads, d->Run);
+
+    return NULL;
+}
+
+
+void *BlockingClients(void *arg)
+{
+    COROUTINEDRIVER *d = (COROUTINEDRIVER *)arg;
+    char buf[BENCHIO];
+    long i = 0;
+
+    for (i = 0; i < (long)d->Count * d->Reads; i++)
+        if (ReadFile(d->Fds[(d->First + i) % BENCHFILES], buf, BENCHIO) != BENCHIO)
+            d->Run->Errors++;
+
+    return NULL;
+}
+
+
+/*
+ * Function: BenchCoroutines
+ * -------------------------
+ * `Clients` coroutines (10000 by default) each co_await `Reads` 4 KB
+ * reads. The clients are started from `Threads` driver threads so the
+ * VFS lock is contended and some reads are suspended and finished by the
+ * ring workers. The same reads are then done with blocking ReadFile()
+ * calls on the driver threads for comparison.
+ *
+ * Arguments: [Clients] [Reads] [Threads]
+ */
+int BenchCoroutines(int argc, char *argv[])
+{
+    int clients = argc > 0 ? atoi(argv[0]) : 10000;
+    int reads = argc > 1 ? atoi(argv[1]) : 16;
+    int threads = argc > 2 ? atoi(argv[2]) : 4;
+    std::vector<pthread_t> tids;
+    std::vector<COROUTINEDRIVER> drivers;
+    COROUTINERUN run;
+    uint64_t filesize = 0;
+    char name[32];
+    int fds[BENCHFILES], i = 0, mode = 0;
+    long total = 0;
+    double start = 0, elapsed = 0;
+
+    if (clients <= 0 || reads <= 0 || threads <= 0 || StartInstance(NULL) != 0)
+        return 1;
+
+    total = (long)clients * reads;
+    filesize = ((uint64_t)total / BENCHFILES + 1) * BENCHIO;
+    for (i = 0; i < BENCHFILES; i++)
+    {
+        snprintf(name, sizeof(name), "coro%d", i);
+        fds[i] = FillFile(name, filesize, 'a' + i);
+        if (fds[i] < 0)
+        {
+            printf("ERROR: Unable to create %s\n", name);
+            return 1;
+        }
+    }
+
+    if (InitialiseRing(RINGWORKERS) != 0)
+    {
+        printf("ERROR: Unable to start the ring\n");
+        return 1;
+    }
+
+    printf("%d clients x %d reads of %d bytes, %d driver threads, %d ring workers\n", clients, reads, BENCHIO,
+           threads, RINGWORKERS);
+
+    tids.resize(threads);
+    drivers.resize(threads);
+    for (mode = 0; mode < 2; mode++)
+    {
+        for (i = 0; i < BENCHFILES; i++)
+            LseekFile(fds[i], 0, START);
+        run.Errors = run.Resumed = run.Finished = 0;
+
+        start = Now();
+        for (i = 0; i < threads; i++)
+        {
+            drivers[i].First = (int)((long)clients * i / threads);
+            drivers[i].Count = (int)((long)clients * (i + 1) / threads) - drivers[i].First;
+            drivers[i].Reads = reads;
+            drivers[i].Fds = fds;
+            drivers[i].Run = &run;
+            pthread_create(&tids[i], NULL, mode == 0 ? StartClients : BlockingClients, &drivers[i]);
+        }
+        for (i = 0; i < threads; i++)
+            pthread_join(tids[i], NULL);
+
+        // Suspended clients finish on the ring workers
+        while (mode == 0 && run.Finished.load() < clients)
+            sched_yield();
+        elapsed = Now() - start;
+
+        if (mode == 0)
+            printf("coroutines %10.0f reads/s  %7.2f us/read  resumed on ring %ld  errors %ld\n", total / elapsed,
+                   elapsed / total * 1e6, run.Resumed.load(), run.Errors.load());
+        else
+            printf("blocking   %10.0f reads/s  %7.2f us/read  errors %ld\n", total / elapsed,
+                   elapsed / total * 1e6, run.Errors.load());
+    }
+
+    ShutdownRing();
+    return 0;
+}
+
+
+/*
+ * Function: ShardClientRun
+ * ------------------------
+ * One client of BenchShards: creates its own file with one block of data
+ * and reads it back `*(long *)arg` times through ShardCall().
+ */
+void *ShardClientRun(void *arg)
+{
+    long ops = *(long *)arg, i = 0;
+    char name[32], buf[BENCHIO];
+    VFSREQUEST req;
+    int fd = 0;
+
+    snprintf(name, sizeof(name), "shard%lx", (unsigned long)pthread_self());
+    memset(&req, 0, sizeof(req));
+    req.opcode = OP_CREATE;
+    req.name = name;
+    req.size = READ + WRITE;
+    fd = (int)ShardCall(&req);
+    if (fd < 0)
+        return (void *)1;
+
+    memset(buf, 's', sizeof(buf));
+    memset(&req, 0, sizeof(req));
+    req.opcode = OP_WRITE;
+    req.fd = fd;
+    req.buffer = buf;
+    req.size = BENCHIO;
+    ShardCall(&req);
+
+    for (i = 0; i < ops; i++)
+    {
+        memset(&req, 0, sizeof(req));
+        req.opcode = OP_LSEEK;
+        req.fd = fd;
+        req.from = START;
+        ShardCall(&req);
+
+        req.opcode = OP_READ;
+        req.buffer = buf;
+        req.size = BENCHIO;
+        if (ShardCall(&req) != BENCHIO)
+            return (void *)1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.opcode = OP_CLOSE;
+    req.fd = fd;
+    ShardCall(&req);
+    req.opcode = OP_RM;
+    req.name = name;
+    ShardCall(&req);
+
+    return NULL;
+}
+
+
+/*
+ * Function: BenchShards
+ * ---------------------
+ * Sharded mode with 1, 2, 4, ... `Max_Shards` shards and one client thread
+ * per shard, each doing `Ops` seek + 4 KB read pairs on its own file. Every
+ * run starts fresh client threads, so client slots are recycled. After each
+ * run the process CPU time of 200 ms with idle shards is reported.
+ *
+ * Arguments: [Ops] [Max_Shards]
+ */
+int BenchShards(int argc, char *argv[])
+{
+    long ops = argc > 0 ? atol(argv[0]) : 20000;
+    int max = argc > 1 ? atoi(argv[1]) : 64;
+    std::vector<pthread_t> tids(MAXSHARDS);
+    struct timespec cpu0, cpu1;
+    void *failed = NULL;
+    long errors = 0;
+    int n = 0, i = 0;
+    double start = 0, elapsed = 0, idle = 0;
+
+    if (ops <= 0 || max <= 0 || max > MAXSHARDS)
+        return 1;
+
+    printf("%ld seek + read pairs per client, %ld online cores\n", ops, sysconf(_SC_NPROCESSORS_ONLN));
+    for (n = 1; n <= max; n *= 2)
+    {
+        if (InitialiseShards(n) != 0)
+        {
+            printf("ERROR: Unable to start %d shards\n", n);
+            return 1;
+        }
+
+        errors = 0;
+        start = Now();
+        for (i = 0; i < n; i++)
+            pthread_create(&tids[i], NULL, ShardClientRun, &ops);
+        for (i = 0; i < n; i++)
+        {
+            pthread_join(tids[i], &failed);
+            errors += failed != NULL;
+        }
+        elapsed = Now() - start;
+
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu0);
+        usleep(200000);
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu1);
+        idle = (cpu1.tv_sec - cpu0.tv_sec) + (cpu1.tv_nsec - cpu0.tv_nsec) / 1e9;
+
+        printf("shards %2d  %10.0f reads/s  idle CPU %5.1f ms / 200 ms  errors %ld\n", n, n * ops / elapsed,
+               idle * 1e3, errors);
+        ShutdownShards();
+    }
+
+    return 0;
+}
+
+
+/*
+ * Structure: benchmark
+ * --------------------
+ * One entry of the benchmark table: name, arguments and the function
+ * that runs it with the arguments after the name.
+ */
+typedef struct benchmark
+{
+    const char *Name;
+    const char *Usage;
+    int (*Run)(int argc, char *argv[]);
+}BENCHMARK;
+
+
+BENCHMARK Benchmarks[] =
+{
+    { "ring", "[Reads] [Backing_File]", BenchRing },
+    { "coroutines", "[Clients] [Reads] [Threads]", BenchCoroutines },
+    { "view", "[Megabytes_Per_Size]", BenchView },
+    { "shards", "[Ops] [Max_Shards]", BenchShards },
+    { "append", "[Records]", BenchAppend },
+    { "readahead", "[Megabytes] [Rounds] [Backing_File]", BenchReadahead },
+    { "truncate", "[Rounds]", BenchTruncate },
+    { "largefile", "[Records] [Record_KB]", BenchLargeFile },
+    { "hugepages", "[Megabytes] [Reads] [Read_Bytes]", BenchHugePages },
+    { "grep", "[Files] [Megabytes_Per_File] [Max_Threads]", BenchGrep },
+    { "engine", "[Ops] [Threads]", BenchEngine },
+    { "sparse", "[Megabytes] [Percent] [Host_Dir]", BenchSparse },
+    { "wbuf", "[Megabytes] [Record]", BenchWriteBuffer },
+    { "names", "[Files] [Lookups]", BenchNames },
+    { "churn", "[Readers] [Read_Size] [Seconds]", BenchChurn },
+    { "tx", "[Threads] [Seconds]", BenchTx },
+};
+
+
+int main(int argc, char *argv[])
+{
+    int i = 0, count = sizeof(Benchmarks) / sizeof(Benchmarks[0]);
+
+    if (argc > 1)
+    {
+        for (i = 0; i < count; i++)
+            if (strcmp(argv[1], Benchmarks[i].Name) == 0)
+                return Benchmarks[i].Run(argc - 2, argv + 2);
+        printf("ERROR: No benchmark named %s\n", argv[1]);
+    }
+
+    printf("Usage : %s Benchmark [arguments]\n", argv[0]);
+    for (i = 0; i < count; i++)
+        printf("  %-10s %s\n", Benchmarks[i].Name, Benchmarks[i].Usage);
+
+    return 1;
+}
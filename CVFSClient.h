@@ -0,0 +1,365 @@
+/*
+    Project Name: Unix based Customized Virtual File System
+
+    Description:
+    Wire protocol and client library for the CVFS server mode
+    (CVFS --server /path/to/socket).
+
+    Every request and response is one frame that starts with a fixed
+    little-endian header; the header's Length field covers the whole frame.
+    Clients may send any number of requests before reading responses
+    (pipelining); the server answers each connection's requests in order.
+
+      request  : CVFSREQHDR  + payload (file name, data for WRITE, or the
+                 offset for PREAD)
+      response : CVFSRESPHDR + payload (data for READ and PREAD, CVFSSTAT for STAT)
+*/
+
+#ifndef CVFSCLIENT_H
+#define CVFSCLIENT_H
+
+#include<stdint.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<errno.h>
+#include<sys/socket.h>
+#include<sys/un.h>
+
+
+/*
+ * Operation codes. Up to RM they match the OP_* codes of the VFS ring.
+ * PREAD seeks a descriptor to the int64_t offset in its payload and reads
+ * from there as one request, so requests of other connections sharing the
+ * descriptor cannot come between the seek and the read.
+ */
+#define CVFSP_CREATE 1
+#define CVFSP_OPEN 2
+#define CVFSP_READ 3
+#define CVFSP_WRITE 4
+#define CVFSP_LSEEK 5
+#define CVFSP_CLOSE 6
+#define CVFSP_STAT 7
+#define CVFSP_RM 8
+#define CVFSP_PREAD 9
+
+#define CVFSP_MAXFRAME (1 << 20)
+#define CVFSP_BADREQUEST -100
+
+
+/*
+ * Structure: cvfsreqhdr
+ * ---------------------
+ * Request header.
+ *
+ * Fields:
+ *  - Length : Size of the frame including this header.
+ *  - Id     : Chosen by the client, echoed in the response.
+ *  - Opcode : One of the CVFSP_* codes.
+ *  - Fd     : File descriptor for READ, PREAD, WRITE, LSEEK and CLOSE.
+ *  - From   : Whence for LSEEK.
+ *  - Arg    : Permission (CREATE), mode (OPEN), byte count (READ, PREAD) or offset (LSEEK).
+ */
+typedef struct cvfsreqhdr
+{
+    uint32_t Length;
+    uint32_t Id;
+    int32_t Opcode;
+    int32_t Fd;
+    int32_t From;
+    int64_t Arg;
+}CVFSREQHDR;
+
+
+/*
+ * Structure: cvfsresphdr
+ * ----------------------
+ * Response header. Result is the value returned by the VFS function.
+ */
+typedef struct cvfsresphdr
+{
+    uint32_t Length;
+    uint32_t Id;
+    int64_t Result;
+}CVFSRESPHDR;
+
+
+/*
+ * Structure: cvfsstat
+ * -------------------
+ * Payload of a successful STAT response.
+ */
+typedef struct cvfsstat
+{
+    int32_t InodeNumber;
+    int32_t LinkCount;
+    uint64_t FileSize;
+    uint64_t FileActualSize;
+    int32_t ReferenceCount;
+    int32_t Permission;
+}CVFSSTAT;
+
+
+/*
+ * Structure: cvfsclient
+ * ---------------------
+ * One connection. Requests are collected in SendBuf until CvfsFlush();
+ * RecvBuf holds bytes of responses that have not been consumed yet.
+ */
+typedef struct cvfsclient
+{
+    int Sock;
+    uint32_t NextId;
+    char *SendBuf;
+    size_t SendLen;
+    size_t SendCap;
+    char *RecvBuf;
+    size_t RecvLen;
+    size_t RecvCap;
+}CVFSCLIENT, *PCVFSCLIENT;
+
+
+/*
+ * Function: CvfsConnect
+ * ---------------------
+ * @return 0 on success, -1 if the server socket cannot be reached.
+ */
+static inline int CvfsConnect(PCVFSCLIENT c, const char *path)
+{
+    struct sockaddr_un addr;
+
+    memset(c, 0, sizeof(*c));
+    c->Sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (c->Sock == -1)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if (connect(c->Sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        close(c->Sock);
+        c->Sock = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/*
+ * Function: CvfsDisconnect
+ * ------------------------
+ * Closes the connection; the server closes every descriptor it opened.
+ */
+static inline void CvfsDisconnect(PCVFSCLIENT c)
+{
+    if (c->Sock != -1)
+        close(c->Sock);
+    free(c->SendBuf);
+    free(c->RecvBuf);
+    memset(c, 0, sizeof(*c));
+    c->Sock = -1;
+}
+
+
+/*
+ * Function: CvfsReserve
+ * ---------------------
+ * Grows a connection buffer to hold at least `need` bytes.
+ */
+static inline int CvfsReserve(char **buf, size_t *cap, size_t need)
+{
+    char *p = NULL;
+    size_t n = *cap ? *cap : 4096;
+
+    if (need <= *cap)
+        return 0;
+    while (n < need)
+        n *= 2;
+
+    p = (char *)realloc(*buf, n);
+    if (p == NULL)
+        return -1;
+
+    *buf = p;
+    *cap = n;
+    return 0;
+}
+
+
+/*
+ * Function: CvfsQueue
+ * -------------------
+ * Appends one request to the send buffer without sending it.
+ *
+ * @return The request id, or 0 on allocation failure.
+ */
+static inline uint32_t CvfsQueue(PCVFSCLIENT c, int opcode, int fd, int64_t arg, int from,
+                                 const void *payload, size_t len)
+{
+    CVFSREQHDR hdr;
+
+    if (CvfsReserve(&c->SendBuf, &c->SendCap, c->SendLen + sizeof(hdr) + len) != 0)
+        return 0;
+
+    hdr.Length = (uint32_t)(sizeof(hdr) + len);
+    hdr.Id = ++c->NextId;
+    hdr.Opcode = opcode;
+    hdr.Fd = fd;
+    hdr.Arg = arg;
+    hdr.From = from;
+
+    memcpy(c->SendBuf + c->SendLen, &hdr, sizeof(hdr));
+    if (len > 0)
+        memcpy(c->SendBuf + c->SendLen + sizeof(hdr), payload, len);
+    c->SendLen += sizeof(hdr) + len;
+
+    return hdr.Id;
+}
+
+
+/*
+ * Function: CvfsFlush
+ * -------------------
+ * Sends every queued request in as few system calls as possible.
+ *
+ * @return 0 on success, -1 if the connection failed.
+ */
+static inline int CvfsFlush(PCVFSCLIENT c)
+{
+    size_t done = 0;
+    ssize_t n = 0;
+
+    while (done < c->SendLen)
+    {
+        n = send(c->Sock, c->SendBuf + done, c->SendLen - done, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        done += (size_t)n;
+    }
+
+    c->SendLen = 0;
+    return 0;
+}
+
+
+/*
+ * Function: CvfsReceive
+ * ---------------------
+ * Waits for the next response. Up to `cap` bytes of its payload are copied
+ * to `data` (which may be NULL when no payload is expected).
+ *
+ * @return 0 on success, -1 if the connection failed.
+ */
+static inline int CvfsReceive(PCVFSCLIENT c, CVFSRESPHDR *resp, void *data, size_t cap)
+{
+    ssize_t n = 0;
+    size_t payload = 0;
+
+    while (1)
+    {
+        if (c->RecvLen >= sizeof(CVFSRESPHDR))
+        {
+            memcpy(resp, c->RecvBuf, sizeof(CVFSRESPHDR));
+            if (resp->Length < sizeof(CVFSRESPHDR))
+                return -1;
+            if (c->RecvLen >= resp->Length)
+                break;
+        }
+
+        if (CvfsReserve(&c->RecvBuf, &c->RecvCap, c->RecvLen + 65536) != 0)
+            return -1;
+        n = recv(c->Sock, c->RecvBuf + c->RecvLen, c->RecvCap - c->RecvLen, 0);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        c->RecvLen += (size_t)n;
+    }
+
+    payload = resp->Length - sizeof(CVFSRESPHDR);
+    if (data != NULL && payload > 0)
+        memcpy(data, c->RecvBuf + sizeof(CVFSRESPHDR), payload < cap ? payload : cap);
+
+    c->RecvLen -= resp->Length;
+    memmove(c->RecvBuf, c->RecvBuf + resp->Length, c->RecvLen);
+
+    return 0;
+}
+
+
+/*
+ * Function: CvfsCall
+ * ------------------
+ * Sends one request and waits for its response.
+ *
+ * @return The VFS result, or CVFSP_BADREQUEST if the connection failed.
+ */
+static inline int64_t CvfsCall(PCVFSCLIENT c, int opcode, int fd, int64_t arg, int from,
+                           const void *payload, size_t len, void *data, size_t cap)
+{
+    CVFSRESPHDR resp;
+
+    if (CvfsQueue(c, opcode, fd, arg, from, payload, len) == 0)
+        return CVFSP_BADREQUEST;
+    if (CvfsFlush(c) != 0 || CvfsReceive(c, &resp, data, cap) != 0)
+        return CVFSP_BADREQUEST;
+
+    return resp.Result;
+}
+
+
+/*
+ * Blocking helpers with the same arguments and return values as the
+ * corresponding VFS functions.
+ */
+static inline int CvfsCreate(PCVFSCLIENT c, const char *name, int permission)
+{
+    return (int)CvfsCall(c, CVFSP_CREATE, 0, permission, 0, name, strlen(name), NULL, 0);
+}
+
+static inline int CvfsOpen(PCVFSCLIENT c, const char *name, int mode)
+{
+    return (int)CvfsCall(c, CVFSP_OPEN, 0, mode, 0, name, strlen(name), NULL, 0);
+}
+
+static inline int64_t CvfsRead(PCVFSCLIENT c, int fd, void *buf, size_t size)
+{
+    return CvfsCall(c, CVFSP_READ, fd, (int64_t)size, 0, NULL, 0, buf, size);
+}
+
+static inline int64_t CvfsPread(PCVFSCLIENT c, int fd, void *buf, size_t size, int64_t offset)
+{
+    return CvfsCall(c, CVFSP_PREAD, fd, (int64_t)size, 0, &offset, sizeof(offset), buf, size);
+}
+
+static inline int64_t CvfsWrite(PCVFSCLIENT c, int fd, const void *buf, size_t size)
+{
+    return CvfsCall(c, CVFSP_WRITE, fd, 0, 0, buf, size, NULL, 0);
+}
+
+static inline int CvfsLseek(PCVFSCLIENT c, int fd, int64_t offset, int from)
+{
+    return (int)CvfsCall(c, CVFSP_LSEEK, fd, offset, from, NULL, 0, NULL, 0);
+}
+
+static inline int CvfsStat(PCVFSCLIENT c, const char *name, CVFSSTAT *st)
+{
+    return (int)CvfsCall(c, CVFSP_STAT, 0, 0, 0, name, strlen(name), st, sizeof(*st));
+}
+
+static inline int CvfsClose(PCVFSCLIENT c, int fd)
+{
+    return (int)CvfsCall(c, CVFSP_CLOSE, fd, 0, 0, NULL, 0, NULL, 0);
+}
+
+static inline int CvfsRm(PCVFSCLIENT c, const char *name)
+{
+    return (int)CvfsCall(c, CVFSP_RM, 0, 0, 0, name, strlen(name), NULL, 0);
+}
+
+#endif
@@ -0,0 +1,375 @@
+/*
+    Project Name: Unix based Customized Virtual File System
+
+    Description:
+    Load generator for the CVFS server mode. Opens 1, 16 and 256
+    connections (or the counts given on the command line) to a running
+    `CVFS --server` and drives a mix of stat, lseek, read and write
+    requests with a fixed pipeline depth per connection, then reports
+    operations per second and latency percentiles.
+
+    With --zipf the mix becomes random-offset reads (PREAD) and appends over
+    `Files` files of `SizeKB` each, with the file picked from a Zipfian
+    distribution.
+    Run it against a tiered server (CVFS --spill File Budget_MB --server ...)
+    with a budget below the total size to measure hot/cold behaviour.
+
+    Build : g++ -std=c++20 -O2 CVFSLoadGen.cpp -o CVFSLoadGen -pthread
+    Usage : CVFSLoadGen [--zipf Files SizeKB] /path/to/socket [seconds] [depth] [connections...]
+*/
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<math.h>
+#include<pthread.h>
+#include<vector>
+#include<algorithm>
+
+#include "CVFSClient.h"
+
+#define LOADFILES 8
+#define LOADMAXFILES 40
+#define RECORDSIZE 64
+#define ZIPFTHETA 0.99
+#define FILLCHUNK (64 * 1024)
+
+
+/*
+ * Structure: loadworker
+ * ---------------------
+ * Per-connection state and results of one load generator thread.
+ */
+typedef struct loadworker
+{
+    const char *Path;
+    int Fds[LOADMAXFILES];
+    int Files;
+    const double *Cdf;
+    uint64_t FileSize;
+    unsigned Seed;
+    int Depth;
+    double Seconds;
+    long Ops;
+    long Errors;
+    std::vector<double> Latencies;
+}LOADWORKER, *PLOADWORKER;
+
+
+double Now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+ * Function: ZipfPick
+ * ------------------
+ * @return A file index drawn from the worker's Zipfian distribution.
+ */
+int ZipfPick(PLOADWORKER w)
+{
+    double u = rand_r(&w->Seed) / ((double)RAND_MAX + 1);
+    int lo = 0, hi = w->Files - 1, mid = 0;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (w->Cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+
+/*
+ * Function: QueueZipfOperation
+ * ----------------------------
+ * Queues the i-th operation of the Zipfian mix on a Zipf-chosen file: a
+ * read of a random record, or an append for every fourth operation. All
+ * connections share the descriptors of the setup connection, so reads are
+ * positioned (PREAD) rather than a seek and a read that another
+ * connection's seek could come between.
+ */
+void QueueZipfOperation(PCVFSCLIENT c, PLOADWORKER w, long i)
+{
+    static const char record[RECORDSIZE] = "cvfs-loadgen-record";
+    uint64_t records = w->FileSize / RECORDSIZE;
+    int64_t offset = 0;
+    int fd = w->Fds[ZipfPick(w)];
+
+    if (i % 4 == 3)
+    {
+        CvfsQueue(c, CVFSP_WRITE, fd, 0, 0, record, RECORDSIZE);
+        return;
+    }
+
+    offset = (int64_t)(rand_r(&w->Seed) % records) * RECORDSIZE;
+    CvfsQueue(c, CVFSP_PREAD, fd, RECORDSIZE, 0, &offset, sizeof(offset));
+}
+
+
+/*
+ * Function: QueueOperation
+ * ------------------------
+ * Queues the i-th operation of the mix on a connection.
+ */
+void QueueOperation(PCVFSCLIENT c, PLOADWORKER w, long i)
+{
+    static const char record[RECORDSIZE] = "cvfs-loadgen-record";
+    char name[32];
+    int fd = w->Fds[i % LOADFILES];
+
+    if (w->Cdf != NULL)
+    {
+        QueueZipfOperation(c, w, i);
+        return;
+    }
+
+    switch (i % 4)
+    {
+        case 0:
+            snprintf(name, sizeof(name), "load%ld", i % LOADFILES);
+            CvfsQueue(c, CVFSP_STAT, 0, 0, 0, name, strlen(name));
+            break;
+        case 1:
+            CvfsQueue(c, CVFSP_LSEEK, fd, 0, 0, NULL, 0);
+            break;
+        case 2:
+            CvfsQueue(c, CVFSP_READ, fd, RECORDSIZE, 0, NULL, 0);
+            break;
+        default:
+            CvfsQueue(c, CVFSP_WRITE, fd, 0, 0, record, RECORDSIZE);
+            break;
+    }
+}
+
+
+/*
+ * Function: LoadThread
+ * --------------------
+ * Keeps `Depth` requests in flight on one connection until time is up.
+ */
+void *LoadThread(void *arg)
+{
+    PLOADWORKER w = (PLOADWORKER)arg;
+    CVFSCLIENT c;
+    CVFSRESPHDR resp;
+    std::vector<double> sent;
+    char data[RECORDSIZE];
+    double end = 0, t = 0;
+    long next = 0, done = 0;
+
+    if (CvfsConnect(&c, w->Path) != 0)
+    {
+        w->Errors++;
+        return NULL;
+    }
+
+    end = Now() + w->Seconds;
+    while (next < w->Depth)
+    {
+        sent.push_back(Now());
+        QueueOperation(&c, w, next++);
+    }
+    CvfsFlush(&c);
+
+    while (done < next)
+    {
+        if (CvfsReceive(&c, &resp, data, sizeof(data)) != 0)
+        {
+            w->Errors++;
+            break;
+        }
+        t = Now();
+        w->Latencies.push_back(t - sent[resp.Id - 1]);
+        // End of file (-3 on read) and a full file (-2 on write) are expected
+        if (resp.Result == -1 || resp.Result == CVFSP_BADREQUEST)
+            w->Errors++;
+        done++;
+
+        if (t < end)
+        {
+            sent.push_back(t);
+            QueueOperation(&c, w, next++);
+            CvfsFlush(&c);
+        }
+    }
+
+    w->Ops = done;
+    CvfsDisconnect(&c);
+    return NULL;
+}
+
+
+/*
+ * Function: RunLoad
+ * -----------------
+ * Runs one measurement with `conns` connections and prints a report line.
+ */
+void RunLoad(const char *path, int *fds, int files, const double *cdf, uint64_t filesize,
+             int conns, int depth, double seconds)
+{
+    std::vector<LOADWORKER> workers(conns);
+    std::vector<pthread_t> threads(conns);
+    std::vector<double> all;
+    long ops = 0, errors = 0;
+    double start = 0, elapsed = 0;
+    int i = 0;
+
+    start = Now();
+    for (i = 0; i < conns; i++)
+    {
+        workers[i].Path = path;
+        memcpy(workers[i].Fds, fds, sizeof(workers[i].Fds));
+        workers[i].Files = files;
+        workers[i].Cdf = cdf;
+        workers[i].FileSize = filesize;
+        workers[i].Seed = (unsigned)(i + 1);
+        workers[i].Depth = depth;
+        workers[i].Seconds = seconds;
+        workers[i].Ops = 0;
+        workers[i].Errors = 0;
+        pthread_create(&threads[i], NULL, LoadThread, &workers[i]);
+    }
+    for (i = 0; i < conns; i++)
+    {
+        pthread_join(threads[i], NULL);
+        ops += workers[i].Ops;
+        errors += workers[i].Errors;
+        all.insert(all.end(), workers[i].Latencies.begin(), workers[i].Latencies.end());
+    }
+    elapsed = Now() - start;
+
+    std::sort(all.begin(), all.end());
+    if (all.empty())
+        all.push_back(0);
+
+    printf("%5d conns  %10.0f ops/s  p50 %8.1f us  p99 %8.1f us  p99.9 %8.1f us  errors %ld\n",
+           conns, ops / elapsed,
+           all[all.size() * 50 / 100] * 1e6,
+           all[all.size() * 99 / 100] * 1e6,
+           all[all.size() * 999 / 1000] * 1e6,
+           errors);
+}
+
+
+/*
+ * Function: ZipfTable
+ * -------------------
+ * Fills `cdf` with the cumulative Zipfian probabilities of `n` items.
+ */
+void ZipfTable(double *cdf, int n)
+{
+    double sum = 0;
+    int i = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        sum += 1.0 / pow(i + 1, ZIPFTHETA);
+        cdf[i] = sum;
+    }
+    for (i = 0; i < n; i++)
+        cdf[i] /= sum;
+}
+
+
+int main(int argc, char *argv[])
+{
+    static const int defaults[] = { 1, 16, 256 };
+    static char fill[FILLCHUNK];
+    CVFSCLIENT setup;
+    char name[32];
+    double seconds = 5, cdf[LOADMAXFILES], *zipf = NULL;
+    uint64_t filesize = 0, done = 0;
+    int64_t ret = 0;
+    int depth = 16, fds[LOADMAXFILES], files = LOADFILES, i = 0;
+
+    if (argc > 3 && strcmp(argv[1], "--zipf") == 0)
+    {
+        files = atoi(argv[2]);
+        filesize = strtoull(argv[3], NULL, 10) * 1024;
+        if (files < 1 || files > LOADMAXFILES || filesize < RECORDSIZE)
+        {
+            printf("ERROR: Invalid parameters\n");
+            return 1;
+        }
+        ZipfTable(cdf, files);
+        zipf = cdf;
+        argc -= 3;
+        argv += 3;
+    }
+
+    if (argc < 2)
+    {
+        printf("Usage : %s [--zipf Files SizeKB] /path/to/socket [seconds] [depth] [connections...]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 2)
+        seconds = atof(argv[2]);
+    if (argc > 3)
+        depth = atoi(argv[3]);
+    if (seconds <= 0 || depth <= 0)
+    {
+        printf("ERROR: Invalid parameters\n");
+        return 1;
+    }
+
+    // The setup connection owns the test files for the whole run
+    if (CvfsConnect(&setup, argv[1]) != 0)
+    {
+        printf("ERROR: Unable to connect to %s\n", argv[1]);
+        return 1;
+    }
+    for (i = 0; i < files; i++)
+    {
+        snprintf(name, sizeof(name), "load%d", i);
+        fds[i] = CvfsCreate(&setup, name, 3);
+        if (fds[i] < 0)
+        {
+            printf("ERROR: Unable to create %s (%d)\n", name, fds[i]);
+            return 1;
+        }
+
+        memset(fill, 'a' + i % 26, sizeof(fill));
+        for (done = 0; done < filesize; done += (uint64_t)ret)
+        {
+            ret = CvfsWrite(&setup, fds[i], fill, filesize - done < FILLCHUNK ? filesize - done : FILLCHUNK);
+            if (ret <= 0)
+            {
+                printf("ERROR: Unable to fill %s (%lld)\n", name, (long long)ret);
+                return 1;
+            }
+        }
+    }
+
+    if (zipf != NULL)
+        printf("Zipfian mix over %d files of %llu KB\n", files, (unsigned long long)(filesize / 1024));
+    printf("Pipeline depth %d, %.1f s per run\n", depth, seconds);
+    if (argc > 4)
+    {
+        for (i = 4; i < argc; i++)
+            RunLoad(argv[1], fds, files, zipf, filesize, atoi(argv[i]), depth, seconds);
+    }
+    else
+    {
+        for (i = 0; i < 3; i++)
+            RunLoad(argv[1], fds, files, zipf, filesize, defaults[i], depth, seconds);
+    }
+
+    for (i = 0; i < files; i++)
+    {
+        snprintf(name, sizeof(name), "load%d", i);
+        CvfsRm(&setup, name);
+    }
+    CvfsDisconnect(&setup);
+
+    return 0;
+}
@@ -0,0 +1,1186 @@
+/*
+    Project Name: Unix based Customized Virtual File System
+
+    Description:
+    Tests of the file system in CVFS.cpp. The file is compiled in with
+    CVFS_NO_MAIN, so the tests drive the same code the shell and the
+    server run. Every test works on a fresh instance and prints PASS or
+    FAIL with the first check that did not hold.
+
+    Build : g++ -std=c++20 -O2 CVFSTest.cpp -o CVFSTest -pthread
+    Usage : CVFSTest [Test...]      (runs every test when none is named)
+*/
+
+#define CVFS_NO_MAIN
+#include "CVFS.cpp"
+
+#include<vector>
+
+// Fails the running test with the text of the check
+#define CHECK(cond) \
+    do { if (!(cond)) { printf("FAIL %s: %s (line %d)\n", CurrentTest, #cond, __LINE__); return 1; } } while (0)
+
+const char *CurrentTest = "";
+
+
+/*
+ * Function: FreshInstance
+ * -----------------------
+ * Points the calling thread at a new, empty instance sized from
+ * DataAreaSize. Earlier instances are left as they are.
+ */
+void FreshInstance()
+{
+    CurrentVFS = new VFSINSTANCE();
+    InitialiseSuperBlock();
+    CreateDILB();
+}
+
+
+/*
+ * Function: TestLargeFile
+ * -----------------------
+ * Writes 1 MB records at offsets on both sides of 2 GB and 4 GB and at the
+ * very end of a 6 GB file, seeks to each and reads it back, and checks
+ * that the gaps read as zeros, that only the written blocks take memory
+ * and that out-of-range seeks fail.
+ */
+int TestLargeFile()
+{
+    static char name[] = "big";
+    const int64_t record = 1024 * 1024;
+    int64_t offsets[5];
+    std::vector<char> data(record), back(record);
+    PINODE inode = NULL;
+    int wfd = 0, rfd = 0, i = 0;
+
+    DataAreaSize = (int64_t)MAXINODE * (6LL << 30);
+    FreshInstance();
+    DataAreaSize = DATAAREASIZE;
+    CHECK(MAXFILESIZE == (6LL << 30));
+
+    offsets[0] = 0;
+    offsets[1] = (2LL << 30) - 100;
+    offsets[2] = (4LL << 30) - 10;
+    offsets[3] = 5LL << 30;
+    offsets[4] = MAXFILESIZE - record;
+
+    CHECK(CreateFile(name, READ + WRITE) >= 0);
+    wfd = OpenFile(name, WRITE);
+    rfd = OpenFile(name, READ);
+    CHECK(wfd >= 0 && rfd >= 0);
+    inode = UFDTArr[wfd].ptrfiletable->ptrinode;
+
+    for (i = 0; i < 5; i++)
+    {
+        memset(&data[0], 'A' + i, record);
+        memcpy(&data[0], &offsets[i], sizeof(int64_t));
+        CHECK(LseekFile(wfd, offsets[i], START) == 0);
+        CHECK(WriteFile(wfd, &data[0], record) == record);
+    }
+    CHECK(inode->FileActualSize == (uint64_t)MAXFILESIZE);
+    CHECK(WriteFile(wfd, &data[0], 1) == -2);
+
+    // Only the blocks the records touch are allocated
+    CHECK(inode->AllocatedBlocks == 256 + 257 + 257 + 256 + 256);
+
+    for (i = 4; i >= 0; i--)
+    {
+        memset(&data[0], 'A' + i, record);
+        memcpy(&data[0], &offsets[i], sizeof(int64_t));
+        CHECK(LseekFile(rfd, offsets[i], START) == 0);
+        CHECK(ReadFile(rfd, &back[0], record) == record);
+        CHECK(memcmp(&data[0], &back[0], record) == 0);
+    }
+
+    // The gap between 4 GB and 5 GB is a hole
+    CHECK(LseekFile(rfd, 3LL << 30, START) == 0);
+    CHECK(LseekFile(rfd, (1LL << 30) + (2LL << 20), CURRENT) == 0);
+    CHECK(ReadFile(rfd, &back[0], 4096) == 4096);
+    for (i = 0; i < 4096; i++)
+        CHECK(back[i] == 0);
+
+    // Seeks that would overflow or leave the file fail and keep the offset
+    CHECK(LseekFile(rfd, -(5LL << 30), END) == 0);
+    CHECK(UFDTArr[rfd].ptrfiletable->readoffset == MAXFILESIZE - (5LL << 30));
+    CHECK(LseekFile(rfd, INT64_MAX, CURRENT) == -1);
+    CHECK(LseekFile(rfd, INT64_MIN, CURRENT) == -1);
+    CHECK(LseekFile(rfd, 1, END) == -1);
+    CHECK(LseekFile(wfd, 1, END) == -1);
+    CHECK(UFDTArr[rfd].ptrfiletable->readoffset == MAXFILESIZE - (5LL << 30));
+
+    return 0;
+}
+
+
+
+/*
+ * Function: TestLseekDelta
+ * ------------------------
+ * Grows a file by seeking a write descriptor past its end, ships the change
+ * to a second instance with ExportDelta() and ApplyDelta(), and checks that
+ * the copy has the new size and the same data, hole included.
+ */
+int TestLseekDelta()
+{
+    static char name[] = "grown";
+    const char *path = "/tmp/CVFSTest.delta";
+    PVFSINSTANCE source = NULL, replica = NULL;
+    DELTASTATS stats;
+    char data[4096], back[8192];
+    uint64_t gen = 0;
+    int fd = 0, i = 0;
+
+    FreshInstance();
+    source = CurrentVFS;
+    FreshInstance();
+    replica = CurrentVFS;
+
+    CurrentVFS = source;
+    memset(data, 'g', sizeof(data));
+    fd = CreateFile(name, READ + WRITE);
+    CHECK(fd >= 0);
+    CHECK(WriteFile(fd, data, sizeof(data)) == (int64_t)sizeof(data));
+    CHECK(ExportDelta(path, 0, &stats) == 0);
+    gen = stats.To;
+    CurrentVFS = replica;
+    CHECK(ApplyDelta(path, &stats) == 0);
+
+    // Only the size changes: no block is written
+    CurrentVFS = source;
+    fd = OpenFile(name, WRITE);
+    CHECK(fd >= 0);
+    CHECK(LseekFile(fd, 8192, START) == 0);
+    CHECK(Get_Inode(name)->FileActualSize == 8192);
+    CHECK(ExportDelta(path, gen, &stats) == 0);
+    CHECK(stats.To > gen && stats.Files == 1);
+    CurrentVFS = replica;
+    CHECK(ApplyDelta(path, &stats) == 0);
+
+    CHECK(Get_Inode(name)->FileActualSize == 8192);
+    fd = OpenFile(name, READ);
+    CHECK(fd >= 0);
+    CHECK(ReadFile(fd, back, sizeof(back)) == (int64_t)sizeof(back));
+    for (i = 0; i < 8192; i++)
+        CHECK(back[i] == (i < 4096 ? 'g' : 0));
+
+    unlink(path);
+    return 0;
+}
+
+
+/*
+ * Structure: viewclient
+ * ---------------------
+ * Arguments of one thread of TestViewLeases.
+ */
+typedef struct viewclient
+{
+    PVFSINSTANCE Instance;
+    int Fd;
+    long Rounds;
+    long Errors;
+}VIEWCLIENT, *PVIEWCLIENT;
+
+
+void *ViewClient(void *arg)
+{
+    PVIEWCLIENT c = (PVIEWCLIENT)arg;
+    VIEWLEASE view;
+    long i = 0;
+
+    CurrentVFS = c->Instance;
+    for (i = 0; i < c->Rounds; i++)
+    {
+        LockVFS();
+        if (LseekFile(c->Fd, 0, START) != 0 || ReadView(c->Fd, 64, &view) != 64)
+            c->Errors++;
+        UnlockVFS();
+        ReleaseView(&view);  // Without the lock, while the other thread takes leases
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Function: TestViewLeases
+ * ------------------------
+ * Two threads take read views of one file under the lock and release them
+ * without it. Afterwards no lease may be left, and the file can be removed.
+ */
+int TestViewLeases()
+{
+    static char name[] = "viewed";
+    char data[64];
+    VIEWCLIENT clients[2];
+    pthread_t tids[2];
+    int i = 0;
+
+    FreshInstance();
+    memset(data, 'v', sizeof(data));
+    CHECK(CreateFile(name, READ + WRITE) >= 0);
+    CHECK(WriteFile(GetFDFromName(name), data, sizeof(data)) == (int64_t)sizeof(data));
+
+    for (i = 0; i < 2; i++)
+    {
+        clients[i].Instance = CurrentVFS;
+        clients[i].Fd = OpenFile(name, READ);
+        clients[i].Rounds = 200000;
+        clients[i].Errors = 0;
+        CHECK(clients[i].Fd >= 0);
+    }
+    for (i = 0; i < 2; i++)
+        pthread_create(&tids[i], NULL, ViewClient, &clients[i]);
+    for (i = 0; i < 2; i++)
+        pthread_join(tids[i], NULL);
+
+    CHECK(clients[0].Errors == 0 && clients[1].Errors == 0);
+    CHECK(Get_Inode(name)->LeaseCount == 0);
+    CHECK(rm_File(name) == 0);
+
+    return 0;
+}
+
+
+/*
+ * Function: TestMappings
+ * ----------------------
+ * Maps a file of one instance and checks that the mapping is unknown to a
+ * second instance, whose own mapping of a file is unknown to the first,
+ * and that each instance publishes and releases only its own mappings.
+ */
+int TestMappings()
+{
+    static char name[] = "mapped";
+    PVFSINSTANCE first = NULL, second = NULL;
+    char *a = NULL, *b = NULL;
+    int fd = 0;
+
+    FreshInstance();
+    first = CurrentVFS;
+    fd = CreateFile(name, READ + WRITE);
+    CHECK(fd >= 0);
+    a = MapFile(fd, 0, 4096, READ + WRITE);
+    CHECK(a != NULL);
+
+    FreshInstance();
+    second = CurrentVFS;
+    fd = CreateFile(name, READ + WRITE);
+    CHECK(fd >= 0);
+    b = MapFile(fd, 0, 4096, READ + WRITE);
+    CHECK(b != NULL);
+
+    memcpy(b, "second", 6);
+    CHECK(MsyncFile(a, 6) == -1);
+    CHECK(UnmapFile(a) == -1);
+    CHECK(MsyncFile(b, 6) == 0);
+    CHECK(Get_Inode(name)->FileActualSize == 6);
+
+    CurrentVFS = first;
+    memcpy(a, "first", 5);
+    CHECK(MsyncFile(b, 6) == -1);
+    CHECK(UnmapFile(b) == -1);
+    CHECK(MsyncFile(a, 5) == 0);
+    CHECK(Get_Inode(name)->FileActualSize == 5);
+    CHECK(UnmapFile(a) == 0);
+    CHECK(Get_Inode(name)->LeaseCount == 0);
+
+    CurrentVFS = second;
+    CHECK(Get_Inode(name)->LeaseCount == 1);
+    CHECK(UnmapFile(b) == 0);
+    CHECK(Get_Inode(name)->LeaseCount == 0);
+
+    return 0;
+}
+
+
+/*
+ * Function: ProfileRoundTrip
+ * --------------------------
+ * Creates, writes, reads back, stats, truncates and removes one file of
+ * `store`, and checks that the calling thread's own instance is untouched.
+ *
+ * @return 0 if every step gave the expected result, 1 otherwise.
+ */
+template<class VFS>
+int ProfileRoundTrip(VFS *store, char *name)
+{
+    PVFSINSTANCE own = CurrentVFS;
+    FILESTAT st;
+    char data[1000], back[1000];
+    int rfd = 0, wfd = 0, i = 0;
+
+    for (i = 0; i < (int)sizeof(data); i++)
+        data[i] = (char)(i * 7);
+
+    rfd = store->CreateFile(name, READ + WRITE);
+    wfd = store->OpenFile(name, WRITE);
+    CHECK(rfd >= 0 && wfd >= 0);
+    CHECK(CurrentVFS == own);
+    CHECK(Get_Inode(name) == NULL);
+
+    CHECK(store->WriteFile(wfd, data, sizeof(data)) == (int64_t)sizeof(data));
+    CHECK(store->LseekFile(rfd, 10, START) == 0);
+    CHECK(store->ReadFile(rfd, back, sizeof(back)) == (int64_t)sizeof(back) - 10);
+    CHECK(memcmp(back, data + 10, sizeof(back) - 10) == 0);
+
+    CHECK(store->StatFile(name, &st) == 0);
+    CHECK(st.FileActualSize == sizeof(data) && st.FileSize == VFS::MaxFileSize);
+    CHECK(store->TruncateFile(name, 100) == 0);
+    CHECK(store->StatFile(name, &st) == 0 && st.FileActualSize == 100);
+
+    // Writes stop at the profile's file size
+    CHECK(store->LseekFile(wfd, VFS::MaxFileSize, START) == 0);
+    CHECK(store->WriteFile(wfd, data, 1) == -2);
+
+    store->CloseFile(wfd);
+    CHECK(store->RemoveFile(name) == 0);
+    CHECK(store->StatFile(name, &st) == -2);
+
+    return 0;
+}
+
+
+/*
+ * Function: TestEmbeddedProfile
+ * -----------------------------
+ * Runs the round trip on two BasicVfs<EmbeddedConfig> objects and checks
+ * that they do not see each other's files.
+ */
+int TestEmbeddedProfile()
+{
+    static char name[] = "embedded";
+    BasicVfs<EmbeddedConfig> *first = new BasicVfs<EmbeddedConfig>();
+    BasicVfs<EmbeddedConfig> *second = new BasicVfs<EmbeddedConfig>();
+    FILESTAT st;
+
+    static_assert(!BasicVfs<EmbeddedConfig>::Concurrent, "the embedded profile takes no lock");
+    FreshInstance();
+    CHECK(BasicVfs<EmbeddedConfig>::MaxFileSize == SpanOf(EmbeddedConfig::DataSize));
+
+    CHECK(ProfileRoundTrip(first, name) == 0);
+    CHECK(first->CreateFile(name, READ) >= 0);
+    CHECK(second->StatFile(name, &st) == -2);
+    CHECK(ProfileRoundTrip(second, name) == 0);
+    CHECK(first->StatFile(name, &st) == 0);
+
+    return 0;
+}
+
+
+/*
+ * Structure: profileclient
+ * ------------------------
+ * Arguments of one thread of TestServerProfile.
+ */
+typedef struct profileclient
+{
+    BasicVfs<ServerConfig> *Store;
+    PVFSINSTANCE Own;
+    char Name[32];
+    int Rounds;
+    int Failed;
+}PROFILECLIENT, *PPROFILECLIENT;
+
+
+void *ProfileClient(void *arg)
+{
+    PPROFILECLIENT c = (PPROFILECLIENT)arg;
+    int i = 0;
+
+    CurrentVFS = c->Own;
+    for (i = 0; i < c->Rounds; i++)
+        c->Failed += ProfileRoundTrip(c->Store, c->Name);
+
+    return NULL;
+}
+
+
+/*
+ * Function: TestServerProfile
+ * ---------------------------
+ * Runs the round trip on one BasicVfs<ServerConfig> from four threads at
+ * once, each on a file of its own.
+ */
+int TestServerProfile()
+{
+    BasicVfs<ServerConfig> *store = new BasicVfs<ServerConfig>();
+    PROFILECLIENT clients[4];
+    pthread_t tids[4];
+    int i = 0;
+
+    static_assert(BasicVfs<ServerConfig>::Concurrent, "the server profile takes the instance lock");
+    FreshInstance();
+
+    for (i = 0; i < 4; i++)
+    {
+        clients[i].Store = store;
+        clients[i].Own = CurrentVFS;
+        snprintf(clients[i].Name, sizeof(clients[i].Name), "server%d", i);
+        clients[i].Rounds = 500;
+        clients[i].Failed = 0;
+        pthread_create(&tids[i], NULL, ProfileClient, &clients[i]);
+    }
+    for (i = 0; i < 4; i++)
+    {
+        pthread_join(tids[i], NULL);
+        CHECK(clients[i].Failed == 0);
+    }
+
+    return 0;
+}
+
+/*
+ * Function: SeekTo
+ * ----------------
+ * LseekFile() on a descriptor opened for reading.
+ *
+ * @return The read offset it moved to, or -1 if the seek failed.
+ */
+int64_t SeekTo(int fd, int64_t offset, int from)
+{
+    if (LseekFile(fd, offset, from) != 0)
+        return -1;
+    return UFDTArr[fd].ptrfiletable->readoffset;
+}
+
+
+/*
+ * Function: SameContents
+ * ----------------------
+ * @return 1 if the file open for reading on `fd` holds exactly `size`
+ *         bytes equal to `expect`, 0 otherwise.
+ */
+int SameContents(int fd, const char *expect, int64_t size)
+{
+    std::vector<char> back(size + 1);
+
+    if (LseekFile(fd, 0, START) != 0 || ReadFile(fd, &back[0], size + 1) != size)
+        return 0;
+    return memcmp(&back[0], expect, size) == 0;
+}
+
+
+/*
+ * Function: TestSparse
+ * --------------------
+ * Builds a file of data, a two-block hole, then data ending part way into
+ * its last block, and checks where SEEK_DATA and SEEK_HOLE land, then
+ * punches a range inside one block, a whole block, the tail of the last
+ * block and a range reaching the end of file, checking after each the
+ * contents, the size and the blocks still allocated.
+ */
+int TestSparse()
+{
+    static char name[] = "sparse";
+    const int64_t size = 4 * BLOCKSIZE + 1000;
+    std::vector<char> expect(size, 0);
+    PINODE inode = NULL;
+    int wfd = 0, rfd = 0;
+
+    FreshInstance();
+    memset(&expect[0], 'a', BLOCKSIZE);
+    memset(&expect[3 * BLOCKSIZE], 'b', BLOCKSIZE + 1000);
+
+    CHECK(CreateFile(name, READ + WRITE) >= 0);
+    wfd = OpenFile(name, WRITE);
+    rfd = OpenFile(name, READ);
+    CHECK(wfd >= 0 && rfd >= 0);
+    inode = Get_Inode(name);
+    CHECK(WriteFile(wfd, &expect[0], BLOCKSIZE) == BLOCKSIZE);
+    CHECK(LseekFile(wfd, 3 * BLOCKSIZE, START) == 0);
+    CHECK(WriteFile(wfd, &expect[3 * BLOCKSIZE], BLOCKSIZE + 1000) == BLOCKSIZE + 1000);
+    CHECK(inode->FileActualSize == (uint64_t)size);
+    CHECK(inode->AllocatedBlocks == 3);
+    CHECK(SameContents(rfd, &expect[0], size));
+
+    // Data in blocks 0, 3 and 4; the end of file counts as a hole
+    CHECK(SeekTo(rfd, 0, DATA) == 0);
+    CHECK(SeekTo(rfd, 100, DATA) == 100);
+    CHECK(SeekTo(rfd, BLOCKSIZE, DATA) == 3 * BLOCKSIZE);
+    CHECK(SeekTo(rfd, 2 * BLOCKSIZE + 5, DATA) == 3 * BLOCKSIZE);
+    CHECK(SeekTo(rfd, size - 1, DATA) == size - 1);
+    CHECK(SeekTo(rfd, 0, HOLE) == BLOCKSIZE);
+    CHECK(SeekTo(rfd, BLOCKSIZE + 7, HOLE) == BLOCKSIZE + 7);
+    CHECK(SeekTo(rfd, 3 * BLOCKSIZE, HOLE) == size);
+    CHECK(SeekTo(rfd, size, DATA) == -1);
+    CHECK(SeekTo(rfd, size, HOLE) == -1);
+    CHECK(SeekTo(rfd, -1, HOLE) == -1);
+
+    // Invalid calls change nothing
+    CHECK(PunchHole(rfd, 0, 1) == -1);
+    CHECK(PunchHole(wfd, size + 1, 1) == -3);
+    CHECK(PunchHole(wfd, -1, 1) == -3);
+    CHECK(PunchHole(wfd, 0, 0) == -3);
+    CHECK(PunchHole(wfd, size, 10) == 0);
+    CHECK(SameContents(rfd, &expect[0], size));
+
+    // Inside one block: zeroed, the block stays
+    CHECK(PunchHole(wfd, 100, 200) == 0);
+    memset(&expect[100], 0, 200);
+    CHECK(inode->AllocatedBlocks == 3);
+    CHECK(SameContents(rfd, &expect[0], size));
+    CHECK(SeekTo(rfd, 0, HOLE) == BLOCKSIZE);
+
+    // Across a block boundary: the head is zeroed, the whole block freed
+    CHECK(PunchHole(wfd, 3 * BLOCKSIZE - 10, BLOCKSIZE + 10) == 0);
+    memset(&expect[3 * BLOCKSIZE], 0, BLOCKSIZE);
+    CHECK(inode->AllocatedBlocks == 2);
+    CHECK(SameContents(rfd, &expect[0], size));
+    CHECK(SeekTo(rfd, BLOCKSIZE, DATA) == 4 * BLOCKSIZE);
+    CHECK(SeekTo(rfd, 3 * BLOCKSIZE, HOLE) == 3 * BLOCKSIZE);
+
+    // From inside the last block to the end of file: zeroed, the block stays
+    CHECK(PunchHole(wfd, 4 * BLOCKSIZE + 500, 1 << 20) == 0);
+    memset(&expect[4 * BLOCKSIZE + 500], 0, 500);
+    CHECK(inode->AllocatedBlocks == 2);
+    CHECK(inode->FileActualSize == (uint64_t)size);
+    CHECK(SameContents(rfd, &expect[0], size));
+
+    // The whole last block up to the end of file: freed, the size kept
+    CHECK(PunchHole(wfd, 4 * BLOCKSIZE, 1000) == 0);
+    memset(&expect[4 * BLOCKSIZE], 0, 1000);
+    CHECK(inode->AllocatedBlocks == 1);
+    CHECK(inode->FileActualSize == (uint64_t)size);
+    CHECK(SameContents(rfd, &expect[0], size));
+    CHECK(SeekTo(rfd, BLOCKSIZE, DATA) == -1);
+    CHECK(SeekTo(rfd, 5, HOLE) == BLOCKSIZE);
+
+    // Writing into a hole allocates the block again
+    CHECK(LseekFile(wfd, 2 * BLOCKSIZE + 1, START) == 0);
+    CHECK(WriteFile(wfd, (char *)"c", 1) == 1);
+    expect[2 * BLOCKSIZE + 1] = 'c';
+    CHECK(inode->AllocatedBlocks == 2);
+    CHECK(SameContents(rfd, &expect[0], size));
+    CHECK(SeekTo(rfd, BLOCKSIZE, DATA) == 2 * BLOCKSIZE);
+
+    return 0;
+}
+
+
+/*
+ * Function: TestWriteBuffer
+ * -------------------------
+ * Writes 16-byte records through a descriptor with a write-behind buffer
+ * and checks that they stay in the buffer until a read on the same
+ * descriptor, an lseek, a buffer change or close flushes them, and that
+ * the file then holds exactly what was written. A write larger than the
+ * buffer goes straight to the file after the buffered data.
+ */
+int TestWriteBuffer()
+{
+    static char name[] = "wbuf";
+    std::vector<char> expect, back(4096);
+    char record[16];
+    PINODE inode = NULL;
+    int fd = 0, rfd = 0, i = 0;
+
+    FreshInstance();
+    fd = CreateFile(name, READ + WRITE);
+    rfd = OpenFile(name, READ);
+    CHECK(fd >= 0 && rfd >= 0);
+    inode = Get_Inode(name);
+
+    CHECK(SetWriteBuffer(rfd, 4096) == -1);
+    CHECK(SetWriteBuffer(fd, WBUFMAX + 1) == -2);
+    CHECK(SetWriteBuffer(fd, 4096) == 0);
+
+    // A read on the writing descriptor sees its buffered writes
+    for (i = 0; i < 100; i++)
+    {
+        memset(record, 'A' + i % 26, sizeof(record));
+        CHECK(WriteFile(fd, record, sizeof(record)) == (int64_t)sizeof(record));
+        expect.insert(expect.end(), record, record + sizeof(record));
+    }
+    CHECK(inode->FileActualSize == 0);
+    CHECK(UFDTArr[fd].ptrfiletable->WBufLen == 1600);
+    CHECK(ReadFile(fd, &back[0], 1600) == 1600);
+    CHECK(memcmp(&back[0], &expect[0], 1600) == 0);
+    CHECK(UFDTArr[fd].ptrfiletable->WBufLen == 0);
+    CHECK(SameContents(rfd, &expect[0], expect.size()));
+
+    // lseek flushes
+    memset(record, 'l', sizeof(record));
+    CHECK(WriteFile(fd, record, sizeof(record)) == (int64_t)sizeof(record));
+    expect.insert(expect.end(), record, record + sizeof(record));
+    CHECK(inode->FileActualSize == 1600);
+    CHECK(LseekFile(fd, 0, START) == 0);
+    CHECK(inode->FileActualSize == 1616);
+    CHECK(SameContents(rfd, &expect[0], expect.size()));
+
+    // A write that does not fit goes through after the buffered data
+    memset(record, 'f', sizeof(record));
+    CHECK(WriteFile(fd, record, sizeof(record)) == (int64_t)sizeof(record));
+    expect.insert(expect.end(), record, record + sizeof(record));
+    memset(&back[0], 'L', 4096);
+    CHECK(WriteFile(fd, &back[0], 4096) == 4096);
+    expect.insert(expect.end(), back.begin(), back.end());
+    CHECK(inode->FileActualSize == 1632 + 4096);
+    CHECK(SameContents(rfd, &expect[0], expect.size()));
+
+    // Turning the buffer off flushes
+    memset(record, 'o', sizeof(record));
+    CHECK(WriteFile(fd, record, sizeof(record)) == (int64_t)sizeof(record));
+    expect.insert(expect.end(), record, record + sizeof(record));
+    CHECK(SetWriteBuffer(fd, 0) == 0);
+    CHECK(SameContents(rfd, &expect[0], expect.size()));
+    CHECK(WriteFile(fd, record, sizeof(record)) == (int64_t)sizeof(record));
+    expect.insert(expect.end(), record, record + sizeof(record));
+    CHECK(SameContents(rfd, &expect[0], expect.size()));
+
+    // close flushes
+    CHECK(SetWriteBuffer(fd, 256) == 0);
+    memset(record, 'c', sizeof(record));
+    for (i = 0; i < 10; i++)
+    {
+        CHECK(WriteFile(fd, record, sizeof(record)) == (int64_t)sizeof(record));
+        expect.insert(expect.end(), record, record + sizeof(record));
+    }
+    CHECK(inode->FileActualSize == expect.size() - 160);
+    CloseFileByName(fd);
+    CHECK(inode->FileActualSize == expect.size());
+    CHECK(SameContents(rfd, &expect[0], expect.size()));
+
+    return 0;
+}
+
+
+/*
+ * Structure: epochclient
+ * ----------------------
+ * Arguments of one reader thread of TestEpochReads.
+ *
+ * Fields:
+ *  - Instance : Instance to read from.
+ *  - Fd       : Descriptor to read, -1 between files.
+ *  - Stage    : Steps of the paused read (see PausedReader).
+ *  - Result   : What the paused read returned.
+ *  - Stop     : Set when the readers are to finish.
+ *  - Reads    : Reads that returned data.
+ *  - Errors   : Reads whose data was not the file's.
+ */
+typedef struct epochclient
+{
+    PVFSINSTANCE Instance;
+    std::atomic<int> Fd;
+    std::atomic<int> Stage;
+    int64_t Result;
+    std::atomic<int> Stop;
+    long Reads;
+    long Errors;
+}EPOCHCLIENT, *PEPOCHCLIENT;
+
+
+/*
+ * Function: PausedReader
+ * ----------------------
+ * Does what ReadFileNoLock() does, but stops inside the epoch after
+ * loading the file table until the main thread sets Stage to 2, so the
+ * file can be closed or removed while the read is in flight. The file
+ * data, all 'e', must still be there when it goes on; the read itself
+ * fails if the file was removed meanwhile.
+ */
+void *PausedReader(void *arg)
+{
+    PEPOCHCLIENT c = (PEPOCHCLIENT)arg;
+    PFILETABLE ft = NULL;
+    char back[4096];
+    int i = 0;
+
+    CurrentVFS = c->Instance;
+    if (EpochEnter() != 0)
+    {
+        c->Errors++;
+        c->Stage.store(1);
+        return NULL;
+    }
+    ft = __atomic_load_n(&UFDTArr[c->Fd.load()].ptrfiletable, __ATOMIC_SEQ_CST);
+    c->Stage.store(1);
+    while (c->Stage.load() != 2)
+        sched_yield();
+
+    if (ft == NULL)
+        c->Errors++;
+    else
+    {
+        for (i = 0; i < (int)sizeof(back); i++)
+            if (InodeData(ft->ptrinode)[i] != 'e')
+                break;
+        if (i < (int)sizeof(back))
+            c->Errors++;
+
+        c->Result = ReadOpenFile(ft, back, sizeof(back));
+        if (c->Result > 0 && memcmp(back, InodeData(ft->ptrinode), c->Result) != 0)
+            c->Errors++;
+    }
+    EpochExit();
+
+    return NULL;
+}
+
+
+/*
+ * Function: ChurnReader
+ * ---------------------
+ * Reads 4 KB at a time with ReadFileNoLock() from whatever file the main
+ * thread publishes, until told to stop. Every file is filled with one
+ * byte of its own, so data that is not all one non-zero byte was read
+ * from a file freed or reused under the read.
+ */
+void *ChurnReader(void *arg)
+{
+    PEPOCHCLIENT c = (PEPOCHCLIENT)arg;
+    char back[4096];
+    int64_t ret = 0, i = 0;
+    int fd = 0;
+
+    CurrentVFS = c->Instance;
+    while (c->Stop.load() == 0)
+    {
+        fd = c->Fd.load();
+        if (fd < 0)
+            continue;
+        ret = ReadFileNoLock(fd, back, sizeof(back));
+        if (ret <= 0)
+            continue;
+
+        c->Reads++;
+        for (i = 0; i < ret; i++)
+            if (back[i] == 0 || back[i] != back[0])
+                break;
+        if (i < ret)
+            c->Errors++;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Function: TestEpochReads
+ * ------------------------
+ * A reader stopped inside its epoch keeps a file that rm_File() removes,
+ * and then one that CloseFileByName() closes, alive: the file table and
+ * data stay valid (the read of the removed file fails with -4, the read of
+ * the closed one returns the data), the inode stays out of AllocateInode()'s
+ * reach and out of FreeInodes, and both are reclaimed once the reader leaves. Then
+ * two threads read with ReadFileNoLock() while the main thread creates,
+ * closes and removes files of different contents under them.
+ */
+int TestEpochReads()
+{
+    static char name[] = "epoch", other[] = "other";
+    char data[8192];
+    EPOCHCLIENT c, readers[2];
+    pthread_t tid, tids[2];
+    PINODE inode = NULL;
+    int fd = 0, rfd = 0, freeinodes = 0, round = 0, i = 0, removing = 0;
+
+    FreshInstance();
+    memset(data, 'e', sizeof(data));
+
+    for (removing = 1; removing >= 0; removing--)
+    {
+        fd = CreateFile(name, READ + WRITE);
+        CHECK(fd >= 0);
+        CHECK(WriteFile(fd, data, sizeof(data)) == (int64_t)sizeof(data));
+        rfd = OpenFile(name, READ);
+        CHECK(rfd >= 0);
+        inode = Get_Inode(name);
+        freeinodes = SUPERBLOCKobj.FreeInodes;
+
+        c.Instance = CurrentVFS;
+        c.Fd.store(rfd);
+        c.Stage.store(0);
+        c.Result = 0;
+        c.Errors = 0;
+        pthread_create(&tid, NULL, PausedReader, &c);
+        while (c.Stage.load() != 1)
+            sched_yield();
+
+        LockVFS();
+        if (removing)
+        {
+            CHECK(rm_File(name) == 0);
+            CHECK(Get_Inode(name) == NULL);
+            CHECK(SUPERBLOCKobj.FreeInodes == freeinodes);
+            CHECK(Leased(inode));
+            CHECK(CreateFile(other, READ + WRITE) >= 0);
+            CHECK(Get_Inode(other) != inode);
+            CHECK(rm_File(other) == 0);
+        }
+        else
+            CloseFileByName(rfd);
+        CHECK(UFDTArr[rfd].ptrfiletable == NULL);
+        CHECK(CurrentVFS->Retired != NULL);
+        ReclaimRetired();
+        CHECK(CurrentVFS->Retired != NULL);
+        UnlockVFS();
+
+        c.Stage.store(2);
+        pthread_join(tid, NULL);
+        CHECK(c.Errors == 0);
+        CHECK(c.Result == (removing ? -4 : 4096));
+
+        LockVFS();
+        ReclaimRetired();
+        CHECK(CurrentVFS->Retired == NULL);
+        if (removing)
+        {
+            CHECK(!Leased(inode));
+            CHECK(SUPERBLOCKobj.FreeInodes == freeinodes + 1);
+        }
+        else
+            CHECK(rm_File(name) == 0);
+        UnlockVFS();
+    }
+    CHECK(SUPERBLOCKobj.FreeInodes == MAXINODE);
+
+    for (i = 0; i < 2; i++)
+    {
+        readers[i].Instance = CurrentVFS;
+        readers[i].Fd.store(-1);
+        readers[i].Stop.store(0);
+        readers[i].Reads = 0;
+        readers[i].Errors = 0;
+        pthread_create(&tids[i], NULL, ChurnReader, &readers[i]);
+    }
+
+    // Even rounds removing the file under the readers, odd ones close their descriptor first
+    for (round = 0; round < 1000; round++)
+    {
+        LockVFS();
+        memset(data, 'a' + round % 26, sizeof(data));
+        fd = CreateFile(name, READ + WRITE);
+        for (i = 0; fd >= 0 && i < 32; i++)
+            WriteFile(fd, data, sizeof(data));
+        rfd = OpenFile(name, READ);
+        readers[0].Fd.store(rfd);
+        readers[1].Fd.store(rfd);
+        UnlockVFS();
+        CHECK(fd >= 0 && rfd >= 0);
+        usleep(50);
+
+        LockVFS();
+        if (round % 2)
+        {
+            CloseFileByName(rfd);
+            UnlockVFS();
+            usleep(50);
+            LockVFS();
+        }
+        readers[0].Fd.store(-1);
+        readers[1].Fd.store(-1);
+        CHECK(rm_File(name) == 0);
+        UnlockVFS();
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        readers[i].Stop.store(1);
+        pthread_join(tids[i], NULL);
+        CHECK(readers[i].Errors == 0);
+    }
+    CHECK(readers[0].Reads + readers[1].Reads > 0);
+
+    LockVFS();
+    ReclaimRetired();
+    CHECK(CurrentVFS->Retired == NULL);
+    CHECK(SUPERBLOCKobj.FreeInodes == MAXINODE);
+    UnlockVFS();
+
+    return 0;
+}
+
+
+/*
+ * Structure: txclient
+ * -------------------
+ * Arguments of the reader thread of TestTransactions.
+ *
+ * Fields:
+ *  - Instance  : Instance to read from.
+ *  - Stop      : Set when the reader is to finish.
+ *  - Snapshots : Transactions that read both files.
+ *  - Retries   : Transactions whose reads met a commit and returned -5.
+ *  - Errors    : Snapshots in which the two files differed.
+ */
+typedef struct txclient
+{
+    PVFSINSTANCE Instance;
+    std::atomic<int> Stop;
+    long Snapshots;
+    long Retries;
+    long Errors;
+}TXCLIENT, *PTXCLIENT;
+
+
+/*
+ * Function: TxReader
+ * ------------------
+ * Reads the files "left" and "right", which every commit of the test
+ * changes together, in one transaction after another without the lock.
+ */
+void *TxReader(void *arg)
+{
+    static char left[] = "left", right[] = "right";
+    PTXCLIENT c = (PTXCLIENT)arg;
+    TRANSACTION *tx = new TRANSACTION;
+    char a[4096], b[4096];
+    int64_t ra = 0, rb = 0;
+    int i = 0;
+
+    CurrentVFS = c->Instance;
+    while (c->Stop.load() == 0)
+    {
+        TxBegin(tx);
+        ra = TxRead(tx, left, 0, a, sizeof(a));
+        rb = ra == (int64_t)sizeof(a) ? TxRead(tx, right, 0, b, sizeof(b)) : ra;
+        TxAbort(tx);
+
+        if (ra == -5 || rb == -5)
+        {
+            c->Retries++;
+            continue;
+        }
+        if (ra != (int64_t)sizeof(a) || rb != (int64_t)sizeof(b))
+        {
+            c->Errors++;
+            continue;
+        }
+
+        for (i = 0; i < (int)sizeof(a); i++)
+            if (a[i] != a[0] || b[i] != a[0])
+                break;
+        if (i < (int)sizeof(a))
+            c->Errors++;
+        c->Snapshots++;
+    }
+
+    delete tx;
+    return NULL;
+}
+
+
+/*
+ * Function: SameByte
+ * ------------------
+ * @return 1 if the first `size` bytes of a file are all `c`, 0 otherwise.
+ */
+int SameByte(char *name, char c, uint64_t size)
+{
+    PINODE inode = Get_Inode(name);
+    uint64_t i = 0;
+
+    if (inode == NULL || inode->FileActualSize != size)
+        return 0;
+    for (i = 0; i < size; i++)
+        if (InodeData(inode)[i] != c)
+            return 0;
+    return 1;
+}
+
+
+/*
+ * Function: TestTransactions
+ * --------------------------
+ * Checks that an aborted transaction changes nothing, that the second of
+ * two transactions over the same file fails with -2 and so does one whose
+ * file changed outside it, that a commit failing its checks (no free
+ * inode, a leased file) applies none of its operations, and that a commit
+ * on a tiered instance keeps every file it writes in RAM until all of
+ * them are written. A reader thread meanwhile takes snapshots of two
+ * files that every commit changes together and must never see them differ.
+ */
+int TestTransactions()
+{
+    static char left[] = "left", right[] = "right", extra[] = "extra", new0[] = "new0", spill[] = "/tmp/CVFSTest.spill";
+    TRANSACTION *tx = new TRANSACTION, *other = new TRANSACTION;
+    char data[65536], name[32];
+    TXCLIENT c;
+    VIEWLEASE view;
+    pthread_t tid;
+    long promotions = 0;
+    int fd = 0, i = 0;
+
+    FreshInstance();
+    memset(data, 'o', sizeof(data));
+    for (i = 0; i < 2; i++)
+    {
+        fd = CreateFile(i ? right : left, READ + WRITE);
+        CHECK(fd >= 0);
+        CHECK(WriteFile(fd, data, 4096) == 4096);
+    }
+
+    // Abort
+    TxBegin(tx);
+    memset(data, 'x', sizeof(data));
+    CHECK(TxWrite(tx, left, 0, data, 4096) == 4096);
+    CHECK(TxCreate(tx, extra, READ + WRITE) == 0);
+    CHECK(TxRm(tx, right) == 0);
+    CHECK(TxRead(tx, left, 0, name, 1) == 1 && name[0] == 'x');
+    TxAbort(tx);
+    CHECK(tx->FileCount == 0 && tx->Ops == NULL);
+    CHECK(SameByte(left, 'o', 4096) && SameByte(right, 'o', 4096));
+    CHECK(Get_Inode(extra) == NULL);
+
+    // Two transactions over one file: the first to commit wins
+    TxBegin(tx);
+    TxBegin(other);
+    memset(data, '1', sizeof(data));
+    CHECK(TxWrite(tx, left, 0, data, 4096) == 4096);
+    memset(data, '2', sizeof(data));
+    CHECK(TxWrite(other, left, 0, data, 4096) == 4096);
+    CHECK(TxWrite(other, right, 0, data, 4096) == 4096);
+    CHECK(TxCommit(tx) == 0);
+    CHECK(TxCommit(other) == -2);
+    CHECK(SameByte(left, '1', 4096) && SameByte(right, 'o', 4096));
+
+    // A change outside any transaction conflicts too, a create as well as a write
+    TxBegin(tx);
+    CHECK(TxRead(tx, right, 0, name, 1) == 1);
+    CHECK(TxCreate(tx, extra, READ + WRITE) == 0);
+    CHECK(TxWrite(tx, left, 0, data, 4096) == 4096);
+    fd = OpenFile(right, WRITE);
+    CHECK(WriteFile(fd, data, 1) == 1);
+    CHECK(TxCommit(tx) == -2);
+    CHECK(SameByte(left, '1', 4096) && Get_Inode(extra) == NULL);
+    CloseFileByName(fd);
+    memset(data, 'o', sizeof(data));
+    fd = OpenFile(right, WRITE);
+    CHECK(WriteFile(fd, data, 1) == 1);
+    CloseFileByName(fd);
+
+    TxBegin(tx);
+    CHECK(TxCreate(tx, extra, READ + WRITE) == 0);
+    CHECK(CreateFile(extra, READ + WRITE) >= 0);
+    CHECK(TxCommit(tx) == -2);
+    CHECK(Get_Inode(extra)->FileActualSize == 0);
+    CHECK(OpenFile(extra, READ) >= 0 && rm_File(extra) == 0);
+
+    // A commit that fails its checks applies nothing, not even the operations before
+    TxBegin(tx);
+    memset(data, 'p', sizeof(data));
+    CHECK(TxWrite(tx, left, 0, data, 8192) == 8192);
+    for (i = 0; i < SUPERBLOCKobj.FreeInodes + 1; i++)
+    {
+        snprintf(name, sizeof(name), "new%d", i);
+        CHECK(TxCreate(tx, name, READ + WRITE) == 0);
+    }
+    CHECK(TxCommit(tx) == -4);
+    CHECK(SameByte(left, '1', 4096) && Get_Inode(new0) == NULL);
+
+    TxBegin(tx);
+    CHECK(TxWrite(tx, left, 0, data, 8192) == 8192);
+    CHECK(TxTruncate(tx, right, 0) == 0);
+    fd = OpenFile(right, READ);
+    CHECK(ReadView(fd, 16, &view) == 16);
+    CHECK(TxCommit(tx) == -3);
+    ReleaseView(&view);
+    CloseFileByName(fd);
+    CHECK(SameByte(left, '1', 4096) && SameByte(right, 'o', 4096));
+
+    // Snapshots of both files while commits change them together
+    TxBegin(tx);
+    CHECK(TxWrite(tx, right, 0, data, 4096) == 4096);
+    CHECK(TxWrite(tx, left, 0, data, 4096) == 4096);
+    CHECK(TxCommit(tx) == 0);
+    c.Instance = CurrentVFS;
+    c.Stop.store(0);
+    c.Snapshots = 0;
+    c.Retries = 0;
+    c.Errors = 0;
+    pthread_create(&tid, NULL, TxReader, &c);
+    for (i = 0; i < 2000; i++)
+    {
+        memset(data, 'A' + i % 26, 4096);
+        TxBegin(tx);
+        CHECK(TxWrite(tx, left, 0, data, 4096) == 4096);
+        CHECK(TxWrite(tx, right, 0, data, 4096) == 4096);
+        CHECK(TxCommit(tx) == 0);
+        if (i % 64 == 0)
+            sched_yield();
+    }
+    c.Stop.store(1);
+    pthread_join(tid, NULL);
+    CHECK(c.Errors == 0);
+    CHECK(c.Snapshots > 0);
+    CHECK(SameByte(left, 'A' + 1999 % 26, 4096) && SameByte(right, 'A' + 1999 % 26, 4096));
+
+    // Tiered: growing one file must not push out another the same commit writes next
+    CHECK(EnableTiering(spill, 64 * 1024) == 0);
+    CHECK(EnsureResident(Get_Inode(left)) == 0 && EnsureResident(Get_Inode(right)) == 0);
+    promotions = CurrentVFS->Tier->Promotions;
+    memset(data, 'g', sizeof(data));
+    TxBegin(tx);
+    CHECK(TxWrite(tx, left, 0, data, 65536) == 65536);
+    CHECK(TxWrite(tx, right, 0, data, 4096) == 4096);
+    CHECK(TxCommit(tx) == 0);
+    CHECK(CurrentVFS->Tier->Promotions == promotions);
+    CHECK(EnsureResident(Get_Inode(left)) == 0 && SameByte(left, 'g', 65536));
+    CHECK(EnsureResident(Get_Inode(right)) == 0 && SameByte(right, 'g', 4096));
+    unlink(spill);
+
+    delete tx;
+    delete other;
+    return 0;
+}
+
+
+/*
+ * Structure: test
+ * ---------------
+ * One entry of the test table: name and the function that runs it.
+ */
+typedef struct test
+{
+    const char *Name;
+    int (*Run)();
+}TEST;
+
+
+TEST Tests[] =
+{
+    { "largefile", TestLargeFile },
+    { "lseekdelta", TestLseekDelta },
+    { "viewleases", TestViewLeases },
+    { "mappings", TestMappings },
+    { "embedded", TestEmbeddedProfile },
+    { "server", TestServerProfile },
+    { "sparse", TestSparse },
+    { "wbuf", TestWriteBuffer },
+    { "epochreads", TestEpochReads },
+    { "tx", TestTransactions },
+};
+
+
+int main(int argc, char *argv[])
+{
+    int i = 0, j = 0, count = sizeof(Tests) / sizeof(Tests[0]), failed = 0, run = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        for (j = 1; j < argc; j++)
+            if (strcmp(argv[j], Tests[i].Name) == 0)
+                break;
+        if (argc > 1 && j == argc)
+            continue;
+
+        CurrentTest = Tests[i].Name;
+        run++;
+        if (Tests[i].Run() != 0)
+            failed++;
+        else
+            printf("PASS %s\n", Tests[i].Name);
+    }
+
+    if (run == 0)
+    {
+        printf("ERROR: No such test\n");
+        return 1;
+    }
+
+    printf("%d of %d tests passed\n", run - failed, run);
+    return failed != 0;
+}